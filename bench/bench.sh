@@ -0,0 +1,209 @@
+#!/usr/bin/env bash
+#
+# Runs the benchmarks in bench/ and writes the results to bin/bench/results.json. With --save, the
+# results also become the baseline (bench/baseline.json); otherwise they are compared against it and
+# the script fails if any benchmark got slower by more than BENCH_THRESHOLD percent.
+#
+# Environment: BENCH_RUNS (runs per benchmark, default 5), BENCH_THRESHOLD (default 10),
+# BENCH_ASSEMBLE (extra quarki flags, e.g. -F), BENCH_FLAGS (extra quarkc flags, e.g. --jit).
+
+runs=${BENCH_RUNS:-5}
+threshold=${BENCH_THRESHOLD:-10}
+output=bin/bench
+results=$output/results.json
+baseline=bench/baseline.json
+
+mkdir -p "$output"
+entries=()
+
+# Keep the compile cache of the benchmarks out of the user's.
+export QUARK_CACHE_DIR=$output/cache
+
+now() {
+  date +%s%N
+}
+
+# Prints the median wall time in nanoseconds of running "$@" $runs times, or fails if any run fails.
+median() {
+  local times=() start
+  for ((run = 0; run < runs; ++run)); do
+    start=$(now)
+    "$@" >/dev/null 2>&1 || return 1
+    times+=($(($(now) - start)))
+  done
+
+  printf "%s\n" "${times[@]}" | sort -n | awk '{ values[NR] = $1 } END { print values[int((NR + 1) / 2)] }'
+}
+
+# Records one result: name, what the units are, the number of units, and the median time. Byte counts are also
+# printed as GB/s.
+record() {
+  local perUnit
+  perUnit=$(awk -v ns="$4" -v units="$3" 'BEGIN { printf "%.3f", ns / units }')
+
+  printf "\033[1;32mOK\033[0m %-20s %12s %s, median %8.3f ms, %s ns/%s%s\n" "$1" "$3" "$2" \
+    "$(awk -v ns="$4" 'BEGIN { print ns / 1e6 }')" "$perUnit" "${2%s}" \
+    "$([[ $2 == bytes ]] && awk -v ns="$4" -v units="$3" 'BEGIN { printf ", %.2f GB/s", units / ns }')"
+  entries+=("$(printf '{"name": "%s", "unit": "%s", "units": %s, "runs": %s, "median_ns": %s, "ns_per_unit": %s}' \
+    "$1" "${2%s}" "$3" "$runs" "$4" "$perUnit")")
+}
+
+fail() {
+  echo -e "\033[1;31mFAILED\033[0m $1"
+  exit 1
+}
+
+for source in bench/*.qas; do
+  name=$(basename "$source" .qas)
+  cp "$source" "$output/$name.qas"
+  ./bin/quarki $BENCH_ASSEMBLE -f "$output/$name.qas" >/dev/null || fail "$source (assembling)"
+
+  # The instruction count does not depend on the engine, so take it from a profiled run.
+  ./bin/quarkc --profile-json "$output/$name.profile.json" -f "$output/$name.qce" >/dev/null 2>&1 ||
+    fail "$source (profiling)"
+  instructions=$(sed -n 's/^  "instructions": \([0-9]*\),$/\1/p' "$output/$name.profile.json")
+
+  time=$(median ./bin/quarkc $BENCH_FLAGS -f "$output/$name.qce") || fail "$source"
+  record "$name" instructions "$instructions" "$time"
+done
+
+# Assembler throughput and load time on a generated program of about a million instructions. The
+# program stops at its first instruction, so running it measures reading, verifying and preparing it.
+blocks=150000
+awk -v blocks=$blocks 'BEGIN {
+  print "stop -- Everything below is only loaded"
+  for (i = 0; i < blocks; ++i) {
+    printf "block%d:\n\tput %d -- Block %d\n\tput 2.5\n\tdup 1\n\tswap 2\n\tfplus\n\trelease\n\tjif block%d\n", \
+      i, i, i, i / 2
+  }
+}' >"$output/large.qas"
+lines=$(wc -l <"$output/large.qas")
+
+time=$(median ./bin/quarki --no-cache $BENCH_ASSEMBLE -f "$output/large.qas") || fail "assembling $output/large.qas"
+record assemble lines "$lines" "$time"
+
+# The same program again, now found in the compile cache: hashing the source and linking the entry.
+./bin/quarki $BENCH_ASSEMBLE -f "$output/large.qas" >/dev/null || fail "caching $output/large.qas"
+time=$(median ./bin/quarki $BENCH_ASSEMBLE -f "$output/large.qas") || fail "assembling $output/large.qas (cached)"
+record assemble-cached lines "$lines" "$time"
+
+time=$(median ./bin/quarkc $BENCH_FLAGS -f "$output/large.qce") || fail "loading $output/large.qce"
+record load instructions $((blocks * 7 + 1)) "$time"
+
+# Vector instruction throughput on three arrays of 64K elements, with the best instruction set and without SIMD. The
+# bytes counted are the ones each instruction reads and writes.
+elements=65536
+iterations=500
+for vector in "vfplus 4 24" "vffma 4 32" "vfdot 3 16" "vfsum 2 8" "viplus 4 24" "vimax 2 8"; do
+  read -r op operands bytes <<<"$vector"
+  awk -v op="$op" -v operands="$operands" -v elements=$elements -v iterations=$iterations 'BEGIN {
+    for (i = 0; i < 3; ++i) printf "put %d\nnative 0\ndup 0\nput 0\nput %d\nmemset\n", elements * 8, elements * 8
+    printf "put %d\nloop:\n", iterations
+    if (operands == 4) printf "\tdup 1\n\tdup 4\n\tdup 4\n"
+    else if (operands == 3) printf "\tdup 3\n\tdup 3\n"
+    else printf "\tdup 3\n"
+    printf "\tput %d\n\t%s\n", elements, op
+    if (operands < 4) printf "\trelease\n"
+    print "\timinusi 1\n\tjifdup loop\nstop"
+  }' >"$output/vector-$op.qas"
+  ./bin/quarki $BENCH_ASSEMBLE -f "$output/vector-$op.qas" >/dev/null || fail "assembling $output/vector-$op.qas"
+
+  for simd in "" scalar; do
+    name=vector-$op${simd:+-$simd}
+    time=$(median ./bin/quarkc $BENCH_FLAGS ${simd:+--simd $simd} -f "$output/vector-$op.qce") || fail "$name"
+    record "$name" bytes $((elements * bytes * iterations)) "$time"
+  done
+done
+
+# Fibers: spawning and joining fibers in bulk, two fibers yielding to each other on one worker, and eight fibers
+# counting down in parallel on 1, 2, 4, ... workers up to one per processor.
+fibers=10000
+awk -v fibers=$fibers 'BEGIN {
+  printf "put %d\nspawn:\n\tdup 0\n\tspawn work\n\tswap 1\n\timinusi 1\n\tjifdup spawn\n\trelease\n", fibers
+  printf "put %d\njoin:\n\tswap 1\n\tjoin\n\trelease\n\timinusi 1\n\tjifdup join\n\tstop\nwork:\n\tstop\n", fibers
+}' >"$output/fiber-spawn.qas"
+
+switches=1000000
+awk -v switches=$switches 'BEGIN {
+  printf "put %d\nspawn ping\nput %d\n", switches / 2, switches / 2
+  print "pong:\n\tyield\n\timinusi 1\n\tjifdup pong\n\trelease\n\tjoin\n\tstop"
+  print "ping:\n\tyield\n\timinusi 1\n\tjifdup ping\n\tstop"
+}' >"$output/fiber-switch.qas"
+
+iterations=20000000
+awk -v iterations=$iterations 'BEGIN {
+  for (i = 0; i < 8; ++i) printf "put %d\nspawn count\n", iterations
+  for (i = 0; i < 8; ++i) print "join\nrelease"
+  print "stop\ncount:\n\timinusi 1\n\tjifdup count\n\tstop"
+}' >"$output/fiber-scale.qas"
+
+for name in fiber-spawn fiber-switch fiber-scale; do
+  ./bin/quarki $BENCH_ASSEMBLE -f "$output/$name.qas" >/dev/null || fail "assembling $output/$name.qas"
+done
+
+time=$(median ./bin/quarkc $BENCH_FLAGS -w 1 -f "$output/fiber-spawn.qce") || fail fiber-spawn
+record fiber-spawn fibers $fibers "$time"
+
+time=$(median ./bin/quarkc $BENCH_FLAGS -w 1 -f "$output/fiber-switch.qce") || fail fiber-switch
+record fiber-switch yields $switches "$time"
+
+instructions=$(./bin/quarkc --stats -f "$output/fiber-scale.qce" 2>&1 >/dev/null |
+  sed -n 's/.*Executed \([0-9]*\) instructions.*/\1/p')
+processors=$(getconf _NPROCESSORS_ONLN 2>/dev/null || echo 1)
+for ((workers = 1; ; workers *= 2)); do
+  ((workers > processors)) && workers=$processors
+  time=$(median ./bin/quarkc $BENCH_FLAGS -w $workers -f "$output/fiber-scale.qce") || fail "fiber-scale-$workers"
+  record "fiber-scale-$workers" instructions "$instructions" "$time"
+  ((workers >= processors)) && break
+done
+
+{
+  echo "{"
+  echo "  \"runs\": $runs,"
+  echo "  \"flags\": \"$(echo $BENCH_ASSEMBLE $BENCH_FLAGS)\","
+  echo "  \"benchmarks\": ["
+  for ((i = 0; i < ${#entries[@]}; ++i)); do
+    echo -n "    ${entries[i]}"
+    ((i + 1 < ${#entries[@]})) && echo "," || echo
+  done
+  echo "  ]"
+  echo "}"
+} >"$results"
+
+if [[ $1 == "--save" ]]; then
+  cp "$results" "$baseline"
+  echo -e "\033[1;34mSaved the baseline to $baseline.\033[0m"
+  exit 0
+fi
+
+if [[ ! -f $baseline ]]; then
+  echo -e "\033[1;34mNo baseline to compare against; run \"make bench-baseline\" to save these results as one.\033[0m"
+  exit 0
+fi
+
+# Each benchmark is one line of the JSON files, so awk can match them up by name.
+awk -v threshold="$threshold" '
+  function field(line, key,    value) {
+    value = line
+    sub(".*\"" key "\": \"?", "", value)
+    sub("[\",}].*", "", value)
+    return value
+  }
+  FNR == NR && /"name"/ {
+    base[field($0, "name")] = field($0, "median_ns")
+    units[field($0, "name")] = field($0, "units")
+    next
+  }
+  /"name"/ {
+    name = field($0, "name")
+    if (!(name in base)) { printf "\033[1;34mNEW\033[0m %s\n", name; next }
+    if (units[name] != field($0, "units")) { printf "\033[1;34mCHANGED\033[0m %s (different workload)\n", name; next }
+
+    change = 100 * (field($0, "median_ns") - base[name]) / base[name]
+    if (change > threshold) { printf "\033[1;31mREGRESSION\033[0m %s: %+.1f%%\n", name, change; ++regressions }
+    else printf "\033[1;32mOK\033[0m %s: %+.1f%%\n", name, change
+  }
+  END {
+    if (regressions > 0) { printf "%d benchmarks regressed by more than %s%%.\n", regressions, threshold; exit 1 }
+  }
+' "$baseline" "$results"
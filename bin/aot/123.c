@@ -0,0 +1,74 @@
+// Translated by quarkt from "examples/123.qce".
+// Build with: cc -O2 -I<quarklang-vm>/src/include <file>.c -o <program> -lm -pthread
+
+#include "compiler.h"
+#include "native.h"
+
+#define QUARK_RAISE(address, error) do { vm->instructionPointer = (address); return (error); } while (0)
+
+static const Instruction quarkProgram[6] = {
+        {1, {0}}, {1, {0}}, {33, {0}}, {5, {0}}, {19, {0}}, {32, {0}}
+};
+
+static Exception quarkRun(QuarkVM *vm)
+{
+    Word *const stack = vm->stack, *sp = stack;
+    Word s0 = {0};
+    Word s1 = {0};
+    Exception exception;
+    (void) sp;
+
+    // 0: put
+    s0.asI64 = INT64_C(1);
+    // 1: put
+    s1.asI64 = INT64_C(2);
+    // 2: iplusi
+    s1.asI64 += INT64_C(3);
+    // 3: iplus
+    s0.asI64 += s1.asI64;
+    // 4: native
+    stack[0] = s0;
+    vm->stackSize = 1;
+    exception = vmPrintI64(vm);
+    if (exception != EX_OK) QUARK_RAISE(4, exception);
+    // 5: stop
+    vm->stackSize = 0;
+    vm->halt = 1;
+    vm->instructionPointer = 5;
+    return EX_OK;
+    vm->stackSize = sp - stack;
+    QUARK_RAISE(6, EX_ILLEGAL_INSTRUCTION_ACCESS);
+}
+
+int main(void)
+{
+    static QuarkVM quarkVm = {0};
+    QuarkVM *vm = &quarkVm;
+
+    vmInit(vm);
+    vm->program = (Instruction *) quarkProgram;
+    vm->programSize = 6;
+    vm->programBorrowed = 1;
+    vmPushNatives(vm);
+
+    VM_GUARD_STACK(vm, guard);
+    if (VM_STACK_OVERFLOWED(guard))
+    {
+        VM_RELEASE_STACK(guard);
+
+        vm->stackSize = VM_STACK_CAPACITY;
+        vm->instructionPointer = -1;
+        vmReportException(vm, EX_STACK_OVERFLOW);
+        vmDestroy(vm);
+
+        return EXIT_FAILURE;
+    }
+
+    const Exception exception = quarkRun(vm);
+    VM_RELEASE_STACK(guard);
+
+    if (exception != EX_OK) vmReportException(vm, exception);
+    vmDestroy(vm);
+
+    return exception == EX_OK ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,88 @@
+// Translated by quarkt from "bin/aot/bench-dispatch.qce".
+// Build with: cc -O2 -I<quarklang-vm>/src/include <file>.c -o <program> -lm -pthread
+
+#include "compiler.h"
+#include "native.h"
+
+#define QUARK_RAISE(address, error) do { vm->instructionPointer = (address); return (error); } while (0)
+
+static const Instruction quarkProgram[20] = {
+        {1, {0}}, {0, {0}}, {0, {0}}, {0, {0}}, {0, {0}}, {0, {0}}, {0, {0}}, {0, {0}}, 
+        {0, {0}}, {0, {0}}, {0, {0}}, {0, {0}}, {0, {0}}, {0, {0}}, {0, {0}}, {0, {0}}, 
+        {0, {0}}, {34, {0}}, {38, {0}}, {32, {0}}
+};
+
+static Exception quarkRun(QuarkVM *vm)
+{
+    Word *const stack = vm->stack, *sp = stack;
+    Word s0 = {0};
+    (void) sp;
+
+    // 0: put
+    s0.asI64 = INT64_C(2000000);
+L1:
+    // 1: kaput
+    // 2: kaput
+    // 3: kaput
+    // 4: kaput
+    // 5: kaput
+    // 6: kaput
+    // 7: kaput
+    // 8: kaput
+    // 9: kaput
+    // 10: kaput
+    // 11: kaput
+    // 12: kaput
+    // 13: kaput
+    // 14: kaput
+    // 15: kaput
+    // 16: kaput
+    // 17: iminusi
+    s0.asI64 -= INT64_C(1);
+    // 18: jifdup
+    {
+        const int condition = s0.asI64 != 0;
+        if (condition) goto L1;
+    }
+    // 19: stop
+    stack[0] = s0;
+    vm->stackSize = 1;
+    vm->halt = 1;
+    vm->instructionPointer = 19;
+    return EX_OK;
+    vm->stackSize = sp - stack;
+    QUARK_RAISE(20, EX_ILLEGAL_INSTRUCTION_ACCESS);
+}
+
+int main(void)
+{
+    static QuarkVM quarkVm = {0};
+    QuarkVM *vm = &quarkVm;
+
+    vmInit(vm);
+    vm->program = (Instruction *) quarkProgram;
+    vm->programSize = 20;
+    vm->programBorrowed = 1;
+    vmPushNatives(vm);
+
+    VM_GUARD_STACK(vm, guard);
+    if (VM_STACK_OVERFLOWED(guard))
+    {
+        VM_RELEASE_STACK(guard);
+
+        vm->stackSize = VM_STACK_CAPACITY;
+        vm->instructionPointer = -1;
+        vmReportException(vm, EX_STACK_OVERFLOW);
+        vmDestroy(vm);
+
+        return EXIT_FAILURE;
+    }
+
+    const Exception exception = quarkRun(vm);
+    VM_RELEASE_STACK(guard);
+
+    if (exception != EX_OK) vmReportException(vm, exception);
+    vmDestroy(vm);
+
+    return exception == EX_OK ? EXIT_SUCCESS : EXIT_FAILURE;
+}
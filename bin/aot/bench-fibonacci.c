@@ -0,0 +1,141 @@
+// Translated by quarkt from "bin/aot/bench-fibonacci.qce".
+// Build with: cc -O2 -I<quarklang-vm>/src/include <file>.c -o <program> -lm -pthread
+
+#include "compiler.h"
+#include "native.h"
+
+#define QUARK_RAISE(address, error) do { vm->instructionPointer = (address); return (error); } while (0)
+
+static const Instruction quarkProgram[24] = {
+        {1, {0}}, {1, {0}}, {1, {0}}, {1, {0}}, {3, {0}}, {2, {0}}, {5, {0}}, {3, {0}}, 
+        {3, {0}}, {34, {0}}, {2, {0}}, {1, {0}}, {41, {0}}, {4, {0}}, {4, {0}}, {3, {0}}, 
+        {34, {0}}, {38, {0}}, {4, {0}}, {19, {0}}, {32, {0}}, {3, {0}}, {4, {0}}, {15, {0}}
+};
+
+static Exception quarkRun(QuarkVM *vm)
+{
+    Word *const stack = vm->stack, *sp = stack;
+    Word s0 = {0};
+    Word s1 = {0};
+    Word s2 = {0};
+    Word s3 = {0};
+    Word s4 = {0};
+    Word s5 = {0};
+    Exception exception;
+    (void) sp;
+
+    // 0: put
+    s0.asI64 = INT64_C(40000);
+L1:
+    // 1: put
+    s1.asI64 = INT64_C(0);
+    // 2: put
+    s2.asI64 = INT64_C(1);
+    // 3: put
+    s3.asI64 = INT64_C(90);
+L4:
+    // 4: swap
+    {
+        const Word temp = s3;
+        s3 = s1;
+        s1 = temp;
+    }
+    // 5: dup
+    s4 = s2;
+    // 6: iplus
+    s3.asI64 += s4.asI64;
+    // 7: swap
+    {
+        const Word temp = s3;
+        s3 = s2;
+        s2 = temp;
+    }
+    // 8: swap
+    {
+        const Word temp = s3;
+        s3 = s1;
+        s1 = temp;
+    }
+    // 9: iminusi
+    s3.asI64 -= INT64_C(1);
+    // 10: dup
+    s4 = s3;
+    // 11: put
+    s5.asI64 = INT64_C(0);
+    // 12: jine
+    {
+        const int condition = s5.asI64 != s4.asI64;
+        if (condition) goto L4;
+    }
+    // 13: release
+    // 14: release
+    // 15: swap
+    {
+        const Word temp = s1;
+        s1 = s0;
+        s0 = temp;
+    }
+    // 16: iminusi
+    s1.asI64 -= INT64_C(1);
+    // 17: jifdup
+    {
+        const int condition = s1.asI64 != 0;
+        if (condition) goto L21;
+    }
+    // 18: release
+    // 19: native
+    stack[0] = s0;
+    vm->stackSize = 1;
+    exception = vmPrintI64(vm);
+    if (exception != EX_OK) QUARK_RAISE(19, exception);
+    // 20: stop
+    vm->stackSize = 0;
+    vm->halt = 1;
+    vm->instructionPointer = 20;
+    return EX_OK;
+L21:
+    // 21: swap
+    {
+        const Word temp = s1;
+        s1 = s0;
+        s0 = temp;
+    }
+    // 22: release
+    // 23: jmp
+    goto L1;
+    vm->stackSize = sp - stack;
+    QUARK_RAISE(24, EX_ILLEGAL_INSTRUCTION_ACCESS);
+}
+
+int main(void)
+{
+    static QuarkVM quarkVm = {0};
+    QuarkVM *vm = &quarkVm;
+
+    vmInit(vm);
+    vm->program = (Instruction *) quarkProgram;
+    vm->programSize = 24;
+    vm->programBorrowed = 1;
+    vmPushNatives(vm);
+
+    VM_GUARD_STACK(vm, guard);
+    if (VM_STACK_OVERFLOWED(guard))
+    {
+        VM_RELEASE_STACK(guard);
+
+        vm->stackSize = VM_STACK_CAPACITY;
+        vm->instructionPointer = -1;
+        vmReportException(vm, EX_STACK_OVERFLOW);
+        vmDestroy(vm);
+
+        return EXIT_FAILURE;
+    }
+
+    const Exception exception = quarkRun(vm);
+    VM_RELEASE_STACK(guard);
+
+    if (exception != EX_OK) vmReportException(vm, exception);
+    vmDestroy(vm);
+
+    return exception == EX_OK ? EXIT_SUCCESS : EXIT_FAILURE;
+}
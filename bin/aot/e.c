@@ -0,0 +1,149 @@
+// Translated by quarkt from "examples/e.qce".
+// Build with: cc -O2 -I<quarklang-vm>/src/include <file>.c -o <program> -lm -pthread
+
+#include "compiler.h"
+#include "native.h"
+
+#define QUARK_RAISE(address, error) do { vm->instructionPointer = (address); return (error); } while (0)
+
+static const Instruction quarkProgram[23] = {
+        {1, {0}}, {1, {0}}, {1, {0}}, {1, {0}}, {2, {0}}, {13, {0}}, {10, {0}}, {3, {0}}, 
+        {35, {0}}, {2, {0}}, {3, {0}}, {12, {0}}, {3, {0}}, {3, {0}}, {2, {0}}, {1, {0}}, 
+        {49, {0}}, {3, {0}}, {4, {0}}, {3, {0}}, {4, {0}}, {19, {0}}, {32, {0}}
+};
+
+static Exception quarkRun(QuarkVM *vm)
+{
+    Word *const stack = vm->stack, *sp = stack;
+    Word s0 = {0};
+    Word s1 = {0};
+    Word s2 = {0};
+    Word s3 = {0};
+    Word s4 = {0};
+    Exception exception;
+    (void) sp;
+
+    // 0: put
+    s0.asI64 = INT64_C(4607182418800017408);
+    // 1: put
+    s1.asI64 = INT64_C(4607182418800017408);
+    // 2: put
+    s2.asI64 = INT64_C(4607182418800017408);
+L3:
+    // 3: put
+    s3.asI64 = INT64_C(4607182418800017408);
+    // 4: dup
+    s4 = s1;
+    // 5: fdiv
+    if (s4.asF64 == 0)
+    {
+        stack[0] = s0;
+        stack[1] = s1;
+        stack[2] = s2;
+        stack[3] = s3;
+        stack[4] = s4;
+        vm->stackSize = 5;
+        QUARK_RAISE(5, EX_DIVIDE_BY_ZERO);
+    }
+    s3.asF64 /= s4.asF64;
+    // 6: fplus
+    s2.asF64 += s3.asF64;
+    // 7: swap
+    {
+        const Word temp = s2;
+        s2 = s0;
+        s0 = temp;
+    }
+    // 8: fplusi
+    s2.asF64 += 0x1p+0;
+    // 9: dup
+    s3 = s2;
+    // 10: swap
+    {
+        const Word temp = s3;
+        s3 = s1;
+        s1 = temp;
+    }
+    // 11: fmul
+    s2.asF64 *= s3.asF64;
+    // 12: swap
+    {
+        const Word temp = s2;
+        s2 = s1;
+        s1 = temp;
+    }
+    // 13: swap
+    {
+        const Word temp = s2;
+        s2 = s0;
+        s0 = temp;
+    }
+    // 14: dup
+    s3 = s0;
+    // 15: put
+    s4.asI64 = INT64_C(4636737291354636288);
+    // 16: jfge
+    {
+        const int condition = s4.asF64 >= s3.asF64;
+        if (condition) goto L3;
+    }
+    // 17: swap
+    {
+        const Word temp = s2;
+        s2 = s1;
+        s1 = temp;
+    }
+    // 18: release
+    // 19: swap
+    {
+        const Word temp = s1;
+        s1 = s0;
+        s0 = temp;
+    }
+    // 20: release
+    // 21: native
+    stack[0] = s0;
+    vm->stackSize = 1;
+    exception = vmPrintF64(vm);
+    if (exception != EX_OK) QUARK_RAISE(21, exception);
+    // 22: stop
+    vm->stackSize = 0;
+    vm->halt = 1;
+    vm->instructionPointer = 22;
+    return EX_OK;
+    vm->stackSize = sp - stack;
+    QUARK_RAISE(23, EX_ILLEGAL_INSTRUCTION_ACCESS);
+}
+
+int main(void)
+{
+    static QuarkVM quarkVm = {0};
+    QuarkVM *vm = &quarkVm;
+
+    vmInit(vm);
+    vm->program = (Instruction *) quarkProgram;
+    vm->programSize = 23;
+    vm->programBorrowed = 1;
+    vmPushNatives(vm);
+
+    VM_GUARD_STACK(vm, guard);
+    if (VM_STACK_OVERFLOWED(guard))
+    {
+        VM_RELEASE_STACK(guard);
+
+        vm->stackSize = VM_STACK_CAPACITY;
+        vm->instructionPointer = -1;
+        vmReportException(vm, EX_STACK_OVERFLOW);
+        vmDestroy(vm);
+
+        return EXIT_FAILURE;
+    }
+
+    const Exception exception = quarkRun(vm);
+    VM_RELEASE_STACK(guard);
+
+    if (exception != EX_OK) vmReportException(vm, exception);
+    vmDestroy(vm);
+
+    return exception == EX_OK ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,118 @@
+// Translated by quarkt from "examples/fibonacci.qce".
+// Build with: cc -O2 -I<quarklang-vm>/src/include <file>.c -o <program> -lm -pthread
+
+#include "compiler.h"
+#include "native.h"
+
+#define QUARK_RAISE(address, error) do { vm->instructionPointer = (address); return (error); } while (0)
+
+static const Instruction quarkProgram[15] = {
+        {1, {0}}, {1, {0}}, {1, {0}}, {3, {0}}, {2, {0}}, {19, {0}}, {2, {0}}, {5, {0}}, 
+        {3, {0}}, {3, {0}}, {34, {0}}, {2, {0}}, {1, {0}}, {41, {0}}, {32, {0}}
+};
+
+static Exception quarkRun(QuarkVM *vm)
+{
+    Word *const stack = vm->stack, *sp = stack;
+    Word s0 = {0};
+    Word s1 = {0};
+    Word s2 = {0};
+    Word s3 = {0};
+    Word s4 = {0};
+    Exception exception;
+    (void) sp;
+
+    // 0: put
+    s0.asI64 = INT64_C(0);
+    // 1: put
+    s1.asI64 = INT64_C(1);
+    // 2: put
+    s2.asI64 = INT64_C(10);
+L3:
+    // 3: swap
+    {
+        const Word temp = s2;
+        s2 = s0;
+        s0 = temp;
+    }
+    // 4: dup
+    s3 = s2;
+    // 5: native
+    stack[0] = s0;
+    stack[1] = s1;
+    stack[2] = s2;
+    stack[3] = s3;
+    vm->stackSize = 4;
+    exception = vmPrintI64(vm);
+    if (exception != EX_OK) QUARK_RAISE(5, exception);
+    // 6: dup
+    s3 = s1;
+    // 7: iplus
+    s2.asI64 += s3.asI64;
+    // 8: swap
+    {
+        const Word temp = s2;
+        s2 = s1;
+        s1 = temp;
+    }
+    // 9: swap
+    {
+        const Word temp = s2;
+        s2 = s0;
+        s0 = temp;
+    }
+    // 10: iminusi
+    s2.asI64 -= INT64_C(1);
+    // 11: dup
+    s3 = s2;
+    // 12: put
+    s4.asI64 = INT64_C(0);
+    // 13: jine
+    {
+        const int condition = s4.asI64 != s3.asI64;
+        if (condition) goto L3;
+    }
+    // 14: stop
+    stack[0] = s0;
+    stack[1] = s1;
+    stack[2] = s2;
+    vm->stackSize = 3;
+    vm->halt = 1;
+    vm->instructionPointer = 14;
+    return EX_OK;
+    vm->stackSize = sp - stack;
+    QUARK_RAISE(15, EX_ILLEGAL_INSTRUCTION_ACCESS);
+}
+
+int main(void)
+{
+    static QuarkVM quarkVm = {0};
+    QuarkVM *vm = &quarkVm;
+
+    vmInit(vm);
+    vm->program = (Instruction *) quarkProgram;
+    vm->programSize = 15;
+    vm->programBorrowed = 1;
+    vmPushNatives(vm);
+
+    VM_GUARD_STACK(vm, guard);
+    if (VM_STACK_OVERFLOWED(guard))
+    {
+        VM_RELEASE_STACK(guard);
+
+        vm->stackSize = VM_STACK_CAPACITY;
+        vm->instructionPointer = -1;
+        vmReportException(vm, EX_STACK_OVERFLOW);
+        vmDestroy(vm);
+
+        return EXIT_FAILURE;
+    }
+
+    const Exception exception = quarkRun(vm);
+    VM_RELEASE_STACK(guard);
+
+    if (exception != EX_OK) vmReportException(vm, exception);
+    vmDestroy(vm);
+
+    return exception == EX_OK ? EXIT_SUCCESS : EXIT_FAILURE;
+}
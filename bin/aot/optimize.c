@@ -0,0 +1,172 @@
+// Translated by quarkt from "examples/optimize.qce".
+// Build with: cc -O2 -I<quarklang-vm>/src/include <file>.c -o <program> -lm -pthread
+
+#include "compiler.h"
+#include "native.h"
+
+#define QUARK_RAISE(address, error) do { vm->instructionPointer = (address); return (error); } while (0)
+
+static const Instruction quarkProgram[38] = {
+        {1, {0}}, {1, {0}}, {7, {0}}, {19, {0}}, {1, {0}}, {37, {0}}, {35, {0}}, {19, {0}}, 
+        {1, {0}}, {1, {0}}, {23, {0}}, {19, {0}}, {0, {0}}, {1, {0}}, {4, {0}}, {1, {0}}, 
+        {16, {0}}, {1, {0}}, {19, {0}}, {1, {0}}, {34, {0}}, {38, {0}}, {16, {0}}, {15, {0}}, 
+        {1, {0}}, {1, {0}}, {8, {0}}, {19, {0}}, {32, {0}}, {15, {0}}, {1, {0}}, {19, {0}}, 
+        {15, {0}}, {1, {0}}, {19, {0}}, {1, {0}}, {19, {0}}, {32, {0}}
+};
+
+static Exception quarkRun(QuarkVM *vm)
+{
+    Word *const stack = vm->stack, *sp = stack;
+    Word s0 = {0};
+    Word s1 = {0};
+    Exception exception;
+    (void) sp;
+
+    // 0: put
+    s0.asI64 = INT64_C(6);
+    // 1: put
+    s1.asI64 = INT64_C(7);
+    // 2: imul
+    s0.asI64 *= s1.asI64;
+    // 3: native
+    stack[0] = s0;
+    vm->stackSize = 1;
+    exception = vmPrintI64(vm);
+    if (exception != EX_OK) QUARK_RAISE(3, exception);
+    // 4: put
+    s0.asI64 = INT64_C(4612811918334230528);
+    // 5: fmuli
+    s0.asF64 *= 0x1p+2;
+    // 6: fplusi
+    s0.asF64 += 0x1p+0;
+    // 7: native
+    stack[0] = s0;
+    vm->stackSize = 1;
+    exception = vmPrintF64(vm);
+    if (exception != EX_OK) QUARK_RAISE(7, exception);
+    // 8: put
+    s0.asI64 = INT64_C(3);
+    // 9: put
+    s1.asI64 = INT64_C(5);
+    // 10: ilt
+    s0.asI64 = s1.asI64 < s0.asI64;
+    // 11: native
+    stack[0] = s0;
+    vm->stackSize = 1;
+    exception = vmPrintI64(vm);
+    if (exception != EX_OK) QUARK_RAISE(11, exception);
+    // 12: kaput
+    // 13: put
+    s0.asI64 = INT64_C(8);
+    // 14: release
+    // 15: put
+    s0.asI64 = INT64_C(1);
+    // 16: jif
+    {
+        const int condition = s0.asI64 != 0;
+        if (condition) goto L19;
+    }
+    // 17: put
+    s0.asI64 = INT64_C(0);
+    // 18: native
+    stack[0] = s0;
+    vm->stackSize = 1;
+    exception = vmPrintI64(vm);
+    if (exception != EX_OK) QUARK_RAISE(18, exception);
+L19:
+    // 19: put
+    s0.asI64 = INT64_C(3);
+L20:
+    // 20: iminusi
+    s0.asI64 -= INT64_C(1);
+    // 21: jifdup
+    {
+        const int condition = s0.asI64 != 0;
+        if (condition) goto L20;
+    }
+    // 22: jif
+    {
+        const int condition = s0.asI64 != 0;
+        if (condition) goto L24;
+    }
+    // 23: jmp
+    goto L29;
+L24:
+    // 24: put
+    s0.asI64 = INT64_C(1);
+    // 25: put
+    s1.asI64 = INT64_C(0);
+    // 26: idiv
+    if (s1.asI64 == 0)
+    {
+        stack[0] = s0;
+        stack[1] = s1;
+        vm->stackSize = 2;
+        QUARK_RAISE(26, EX_DIVIDE_BY_ZERO);
+    }
+    s0.asI64 /= s1.asI64;
+    // 27: native
+    stack[0] = s0;
+    vm->stackSize = 1;
+    exception = vmPrintI64(vm);
+    if (exception != EX_OK) QUARK_RAISE(27, exception);
+    // 28: stop
+    vm->stackSize = 0;
+    vm->halt = 1;
+    vm->instructionPointer = 28;
+    return EX_OK;
+L29:
+    // 29: jmp
+    goto L32;
+L32:
+    // 32: jmp
+    goto L35;
+L35:
+    // 35: put
+    s0.asI64 = INT64_C(100);
+    // 36: native
+    stack[0] = s0;
+    vm->stackSize = 1;
+    exception = vmPrintI64(vm);
+    if (exception != EX_OK) QUARK_RAISE(36, exception);
+    // 37: stop
+    vm->stackSize = 0;
+    vm->halt = 1;
+    vm->instructionPointer = 37;
+    return EX_OK;
+    vm->stackSize = sp - stack;
+    QUARK_RAISE(38, EX_ILLEGAL_INSTRUCTION_ACCESS);
+}
+
+int main(void)
+{
+    static QuarkVM quarkVm = {0};
+    QuarkVM *vm = &quarkVm;
+
+    vmInit(vm);
+    vm->program = (Instruction *) quarkProgram;
+    vm->programSize = 38;
+    vm->programBorrowed = 1;
+    vmPushNatives(vm);
+
+    VM_GUARD_STACK(vm, guard);
+    if (VM_STACK_OVERFLOWED(guard))
+    {
+        VM_RELEASE_STACK(guard);
+
+        vm->stackSize = VM_STACK_CAPACITY;
+        vm->instructionPointer = -1;
+        vmReportException(vm, EX_STACK_OVERFLOW);
+        vmDestroy(vm);
+
+        return EXIT_FAILURE;
+    }
+
+    const Exception exception = quarkRun(vm);
+    VM_RELEASE_STACK(guard);
+
+    if (exception != EX_OK) vmReportException(vm, exception);
+    vmDestroy(vm);
+
+    return exception == EX_OK ? EXIT_SUCCESS : EXIT_FAILURE;
+}
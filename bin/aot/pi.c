@@ -0,0 +1,151 @@
+// Translated by quarkt from "examples/pi.qce".
+// Build with: cc -O2 -I<quarklang-vm>/src/include <file>.c -o <program> -lm -pthread
+
+#include "compiler.h"
+#include "native.h"
+
+#define QUARK_RAISE(address, error) do { vm->instructionPointer = (address); return (error); } while (0)
+
+static const Instruction quarkProgram[23] = {
+        {1, {0}}, {1, {0}}, {1, {0}}, {3, {0}}, {1, {0}}, {2, {0}}, {35, {0}}, {3, {0}}, 
+        {13, {0}}, {11, {0}}, {1, {0}}, {2, {0}}, {35, {0}}, {3, {0}}, {13, {0}}, {10, {0}}, 
+        {3, {0}}, {34, {0}}, {38, {0}}, {4, {0}}, {4, {0}}, {19, {0}}, {32, {0}}
+};
+
+static Exception quarkRun(QuarkVM *vm)
+{
+    Word *const stack = vm->stack, *sp = stack;
+    Word s0 = {0};
+    Word s1 = {0};
+    Word s2 = {0};
+    Word s3 = {0};
+    Word s4 = {0};
+    Exception exception;
+    (void) sp;
+
+    // 0: put
+    s0.asI64 = INT64_C(4616189618054758400);
+    // 1: put
+    s1.asI64 = INT64_C(4612164328630132340);
+    // 2: put
+    s2.asI64 = INT64_C(1);
+L3:
+    // 3: swap
+    {
+        const Word temp = s2;
+        s2 = s0;
+        s0 = temp;
+    }
+    // 4: put
+    s3.asI64 = INT64_C(4616189618054758400);
+    // 5: dup
+    s4 = s1;
+    // 6: fplusi
+    s4.asF64 += 0x1p+1;
+    // 7: swap
+    {
+        const Word temp = s4;
+        s4 = s1;
+        s1 = temp;
+    }
+    // 8: fdiv
+    if (s4.asF64 == 0)
+    {
+        stack[0] = s0;
+        stack[1] = s1;
+        stack[2] = s2;
+        stack[3] = s3;
+        stack[4] = s4;
+        vm->stackSize = 5;
+        QUARK_RAISE(8, EX_DIVIDE_BY_ZERO);
+    }
+    s3.asF64 /= s4.asF64;
+    // 9: fminus
+    s2.asF64 -= s3.asF64;
+    // 10: put
+    s3.asI64 = INT64_C(4616189618054758400);
+    // 11: dup
+    s4 = s1;
+    // 12: fplusi
+    s4.asF64 += 0x1p+1;
+    // 13: swap
+    {
+        const Word temp = s4;
+        s4 = s1;
+        s1 = temp;
+    }
+    // 14: fdiv
+    if (s4.asF64 == 0)
+    {
+        stack[0] = s0;
+        stack[1] = s1;
+        stack[2] = s2;
+        stack[3] = s3;
+        stack[4] = s4;
+        vm->stackSize = 5;
+        QUARK_RAISE(14, EX_DIVIDE_BY_ZERO);
+    }
+    s3.asF64 /= s4.asF64;
+    // 15: fplus
+    s2.asF64 += s3.asF64;
+    // 16: swap
+    {
+        const Word temp = s2;
+        s2 = s0;
+        s0 = temp;
+    }
+    // 17: iminusi
+    s2.asI64 -= INT64_C(1);
+    // 18: jifdup
+    {
+        const int condition = s2.asI64 != 0;
+        if (condition) goto L3;
+    }
+    // 19: release
+    // 20: release
+    // 21: native
+    stack[0] = s0;
+    vm->stackSize = 1;
+    exception = vmPrintF64(vm);
+    if (exception != EX_OK) QUARK_RAISE(21, exception);
+    // 22: stop
+    vm->stackSize = 0;
+    vm->halt = 1;
+    vm->instructionPointer = 22;
+    return EX_OK;
+    vm->stackSize = sp - stack;
+    QUARK_RAISE(23, EX_ILLEGAL_INSTRUCTION_ACCESS);
+}
+
+int main(void)
+{
+    static QuarkVM quarkVm = {0};
+    QuarkVM *vm = &quarkVm;
+
+    vmInit(vm);
+    vm->program = (Instruction *) quarkProgram;
+    vm->programSize = 23;
+    vm->programBorrowed = 1;
+    vmPushNatives(vm);
+
+    VM_GUARD_STACK(vm, guard);
+    if (VM_STACK_OVERFLOWED(guard))
+    {
+        VM_RELEASE_STACK(guard);
+
+        vm->stackSize = VM_STACK_CAPACITY;
+        vm->instructionPointer = -1;
+        vmReportException(vm, EX_STACK_OVERFLOW);
+        vmDestroy(vm);
+
+        return EXIT_FAILURE;
+    }
+
+    const Exception exception = quarkRun(vm);
+    VM_RELEASE_STACK(guard);
+
+    if (exception != EX_OK) vmReportException(vm, exception);
+    vmDestroy(vm);
+
+    return exception == EX_OK ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,154 @@
+// Translated by quarkt from "bin/tests/return-computed.qce".
+// Build with: cc -O2 -I<quarklang-vm>/src/include <file>.c -o <program> -lm -pthread
+
+#include "compiler.h"
+#include "native.h"
+
+#define QUARK_RAISE(address, error) do { vm->instructionPointer = (address); return (error); } while (0)
+
+static const Instruction quarkProgram[9] = {
+        {18, {0}}, {1, {0}}, {19, {0}}, {1, {0}}, {19, {0}}, {32, {0}}, {4, {0}}, {1, {0}}, 
+        {17, {0}}
+};
+
+static Exception quarkRun(QuarkVM *vm)
+{
+    Word *const stack = vm->stack, *sp = stack;
+    Exception exception;
+    int64_t target;
+    (void) sp;
+
+L0:
+    // 0: invoke
+    if (!VM_STACK_GUARD && sp - stack >= VM_STACK_CAPACITY)
+    {
+        vm->stackSize = sp - stack;
+        QUARK_RAISE(0, EX_STACK_OVERFLOW);
+    }
+    (sp++)->asI64 = 1;
+    goto L6;
+L1:
+    // 1: put
+    if (!VM_STACK_GUARD && sp - stack >= VM_STACK_CAPACITY)
+    {
+        vm->stackSize = sp - stack;
+        QUARK_RAISE(1, EX_STACK_OVERFLOW);
+    }
+    sp[0].asI64 = INT64_C(1);
+    ++sp;
+L2:
+    // 2: native
+    vm->stackSize = sp - stack;
+    exception = vmPrintI64(vm);
+    if (exception != EX_OK) QUARK_RAISE(2, exception);
+    sp = stack + vm->stackSize;
+L3:
+    // 3: put
+    if (!VM_STACK_GUARD && sp - stack >= VM_STACK_CAPACITY)
+    {
+        vm->stackSize = sp - stack;
+        QUARK_RAISE(3, EX_STACK_OVERFLOW);
+    }
+    sp[0].asI64 = INT64_C(2);
+    ++sp;
+L4:
+    // 4: native
+    vm->stackSize = sp - stack;
+    exception = vmPrintI64(vm);
+    if (exception != EX_OK) QUARK_RAISE(4, exception);
+    sp = stack + vm->stackSize;
+L5:
+    // 5: stop
+    vm->stackSize = sp - stack;
+    vm->halt = 1;
+    vm->instructionPointer = 5;
+    return EX_OK;
+L6:
+    // 6: release
+    if (sp - stack < 1)
+    {
+        vm->stackSize = sp - stack;
+        QUARK_RAISE(6, EX_STACK_UNDERFLOW);
+    }
+    sp -= 1;
+L7:
+    // 7: put
+    if (!VM_STACK_GUARD && sp - stack >= VM_STACK_CAPACITY)
+    {
+        vm->stackSize = sp - stack;
+        QUARK_RAISE(7, EX_STACK_OVERFLOW);
+    }
+    sp[0].asI64 = INT64_C(3);
+    ++sp;
+L8:
+    // 8: return
+    if (sp - stack < 1)
+    {
+        vm->stackSize = sp - stack;
+        QUARK_RAISE(8, EX_STACK_UNDERFLOW);
+    }
+    target = sp[-1].asI64;
+    sp -= 1;
+    goto dispatch;
+    vm->stackSize = sp - stack;
+    QUARK_RAISE(9, EX_ILLEGAL_INSTRUCTION_ACCESS);
+
+dispatch:
+    switch (target)
+    {
+        case 0:
+            goto L0;
+        case 1:
+            goto L1;
+        case 2:
+            goto L2;
+        case 3:
+            goto L3;
+        case 4:
+            goto L4;
+        case 5:
+            goto L5;
+        case 6:
+            goto L6;
+        case 7:
+            goto L7;
+        case 8:
+            goto L8;
+        default:
+            vm->stackSize = sp - stack;
+            QUARK_RAISE(target, EX_ILLEGAL_INSTRUCTION_ACCESS);
+    }
+}
+
+int main(void)
+{
+    static QuarkVM quarkVm = {0};
+    QuarkVM *vm = &quarkVm;
+
+    vmInit(vm);
+    vm->program = (Instruction *) quarkProgram;
+    vm->programSize = 9;
+    vm->programBorrowed = 1;
+    vmPushNatives(vm);
+
+    VM_GUARD_STACK(vm, guard);
+    if (VM_STACK_OVERFLOWED(guard))
+    {
+        VM_RELEASE_STACK(guard);
+
+        vm->stackSize = VM_STACK_CAPACITY;
+        vm->instructionPointer = -1;
+        vmReportException(vm, EX_STACK_OVERFLOW);
+        vmDestroy(vm);
+
+        return EXIT_FAILURE;
+    }
+
+    const Exception exception = quarkRun(vm);
+    VM_RELEASE_STACK(guard);
+
+    if (exception != EX_OK) vmReportException(vm, exception);
+    vmDestroy(vm);
+
+    return exception == EX_OK ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,111 @@
+// Translated by quarkt from "bin/tests/return-swap.qce".
+// Build with: cc -O2 -I<quarklang-vm>/src/include <file>.c -o <program> -lm -pthread
+
+#include "compiler.h"
+#include "native.h"
+
+#define QUARK_RAISE(address, error) do { vm->instructionPointer = (address); return (error); } while (0)
+
+static const Instruction quarkProgram[9] = {
+        {1, {0}}, {18, {0}}, {19, {0}}, {32, {0}}, {3, {0}}, {2, {0}}, {7, {0}}, {3, {0}}, 
+        {17, {0}}
+};
+
+static Exception quarkRun(QuarkVM *vm)
+{
+    Word *const stack = vm->stack, *sp = stack;
+    Word s0 = {0};
+    Exception exception;
+    int64_t target;
+    (void) sp;
+
+    // 0: put
+    s0.asI64 = INT64_C(3);
+    // 1: invoke
+    stack[0] = s0;
+    sp = stack + 1;
+    (sp++)->asI64 = 2;
+    goto L4;
+L2:
+    // 2: native
+    stack[0] = s0;
+    vm->stackSize = 1;
+    exception = vmPrintI64(vm);
+    if (exception != EX_OK) QUARK_RAISE(2, exception);
+    // 3: stop
+    vm->stackSize = 0;
+    vm->halt = 1;
+    vm->instructionPointer = 3;
+    return EX_OK;
+L4:
+    // 4: swap
+    {
+        const Word temp = sp[-1];
+        sp[-1] = sp[-2];
+        sp[-2] = temp;
+    }
+    // 5: dup
+    sp[0] = sp[-1];
+    ++sp;
+    // 6: imul
+    sp[-2].asI64 *= sp[-1].asI64;
+    sp -= 1;
+    // 7: swap
+    {
+        const Word temp = sp[-1];
+        sp[-1] = sp[-2];
+        sp[-2] = temp;
+    }
+    // 8: return
+    target = sp[-1].asI64;
+    sp -= 1;
+    goto dispatch;
+    vm->stackSize = sp - stack;
+    QUARK_RAISE(9, EX_ILLEGAL_INSTRUCTION_ACCESS);
+
+dispatch:
+    switch (target)
+    {
+        case 2:
+            goto R2;
+        default:
+            vm->stackSize = sp - stack;
+            QUARK_RAISE(target, EX_ILLEGAL_INSTRUCTION_ACCESS);
+    }
+R2:
+    s0 = stack[0];
+    goto L2;
+}
+
+int main(void)
+{
+    static QuarkVM quarkVm = {0};
+    QuarkVM *vm = &quarkVm;
+
+    vmInit(vm);
+    vm->program = (Instruction *) quarkProgram;
+    vm->programSize = 9;
+    vm->programBorrowed = 1;
+    vmPushNatives(vm);
+
+    VM_GUARD_STACK(vm, guard);
+    if (VM_STACK_OVERFLOWED(guard))
+    {
+        VM_RELEASE_STACK(guard);
+
+        vm->stackSize = VM_STACK_CAPACITY;
+        vm->instructionPointer = -1;
+        vmReportException(vm, EX_STACK_OVERFLOW);
+        vmDestroy(vm);
+
+        return EXIT_FAILURE;
+    }
+
+    const Exception exception = quarkRun(vm);
+    VM_RELEASE_STACK(guard);
+
+    if (exception != EX_OK) vmReportException(vm, exception);
+    vmDestroy(vm);
+
+    return exception == EX_OK ? EXIT_SUCCESS : EXIT_FAILURE;
+}
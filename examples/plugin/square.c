@@ -0,0 +1,33 @@
+// Copyright 2022-Present Siddharth Praveen Bharadwaj
+// https://sid110307.github.io/Sid110307
+//
+// A QuarkLang native plugin. Build it with:
+//     cc -O2 -shared -fPIC -I<quarklang-vm>/src/include square.c -o square.so -lm
+
+#include "compiler.h"
+
+// Replaces the integer on top of the stack with its square.
+static Exception square(QuarkVM *vm)
+{
+    if (vm->stackSize < 1) return EX_STACK_UNDERFLOW;
+
+    vm->stack[vm->stackSize - 1].asI64 *= vm->stack[vm->stackSize - 1].asI64;
+    return EX_OK;
+}
+
+// Replaces the two floats on top of the stack with the length of the vector they form.
+static Exception hypot2(QuarkVM *vm)
+{
+    if (vm->stackSize < 2) return EX_STACK_UNDERFLOW;
+
+    vm->stack[vm->stackSize - 2].asF64 = hypot(vm->stack[vm->stackSize - 2].asF64, vm->stack[vm->stackSize - 1].asF64);
+    vm->stackSize--;
+
+    return EX_OK;
+}
+
+VM_PLUGIN_NATIVES = {
+        {"square", square, 1, 1},
+        {"hypot", hypot2, 2, 1},
+        {NULL, NULL, 0, 0},
+};
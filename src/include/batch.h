@@ -0,0 +1,299 @@
+#pragma once
+
+// Batch runner: runs many programs on a fixed pool of worker threads.
+//
+// Every input file is loaded (and verified) once on the calling thread; files with identical code
+// and natives share one read-only image. Each worker owns a QuarkVM with its own stack, borrows the
+// image of the job it picks up along with a copy of its natives, and captures the job's output and
+// errors in memory. Outputs are printed in input order once all jobs have finished, followed by the
+// aggregate throughput.
+
+#include "compiler.h"
+#include "native.h"
+
+#include <stdatomic.h>
+#include <dirent.h>
+#include <pthread.h>
+
+typedef struct
+{
+    QuarkVM vm;
+    VMVerification verification;
+    int valid;
+    uint64_t hash;
+} VMBatchImage;
+
+typedef struct
+{
+    const char *path;
+    char *ownedPath;
+    int64_t image;
+    Exception exception;
+    uint64_t instructions;
+    char *output;
+    size_t outputSize;
+} VMBatchJob;
+
+typedef struct
+{
+    VMBatchImage *images;
+    int64_t imageSize;
+    int64_t imageCapacity;
+
+    VMBatchJob *jobs;
+    int64_t jobSize;
+    int64_t jobCapacity;
+
+    atomic_llong next;
+} VMBatch;
+
+static void vmBatchAddFile(VMBatch *batch, const char *path, char *ownedPath)
+{
+    batch->jobs = vmReserve(batch->jobs, &batch->jobCapacity, batch->jobSize + 1, sizeof(batch->jobs[0]));
+    batch->jobs[batch->jobSize++] = (VMBatchJob) {path, ownedPath, -1, EX_OK, 0, NULL, 0};
+}
+
+static int vmBatchCompareNames(const void *a, const void *b)
+{
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+// Adds `path`, or every .qce file directly inside it (in name order) if it is a directory.
+static void vmBatchAddPath(VMBatch *batch, const char *path)
+{
+    DIR *directory = opendir(path);
+    if (directory == NULL)
+    {
+        vmBatchAddFile(batch, path, NULL);
+        return;
+    }
+
+    char **names = NULL;
+    int64_t nameSize = 0, nameCapacity = 0;
+
+    for (struct dirent *entry; (entry = readdir(directory)) != NULL;)
+    {
+        const size_t length = strlen(entry->d_name);
+        if (length <= 4 || strcmp(entry->d_name + length - 4, ".qce") != 0) continue;
+
+        char *name = malloc(strlen(path) + length + 2);
+        if (name == NULL)
+        {
+            fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not allocate memory for the batch (%s)\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        sprintf(name, "%s/%s", path, entry->d_name);
+
+        names = vmReserve(names, &nameCapacity, nameSize + 1, sizeof(names[0]));
+        names[nameSize++] = name;
+    }
+    closedir(directory);
+
+    qsort(names, nameSize, sizeof(names[0]), vmBatchCompareNames);
+    for (int64_t i = 0; i < nameSize; ++i) vmBatchAddFile(batch, names[i], names[i]);
+    free(names);
+}
+
+static uint64_t vmBatchHashBytes(uint64_t hash, const void *data, size_t size)
+{
+    const uint8_t *bytes = data;
+    for (size_t i = 0; i < size; ++i) hash = (hash ^ bytes[i]) * 1099511628211ull;
+
+    return hash;
+}
+
+// Hashes what a job runs: its code and the names its natives are bound by.
+static uint64_t vmBatchHash(const QuarkVM *vm)
+{
+    const uint64_t hash = vmBatchHashBytes(14695981039346656037ull, vm->program,
+                                           (size_t) vm->programSize * sizeof(vm->program[0]));
+    return vmBatchHashBytes(hash, vm->imports, (size_t) vm->importsSize);
+}
+
+static int vmBatchSameProgram(const QuarkVM *a, const QuarkVM *b)
+{
+    return a->programSize == b->programSize && a->importsSize == b->importsSize &&
+           memcmp(a->program, b->program, sizeof(a->program[0]) * a->programSize) == 0 &&
+           (a->importsSize == 0 || memcmp(a->imports, b->imports, (size_t) a->importsSize) == 0);
+}
+
+// Loads every job's file, sharing the image of files whose code and natives are identical.
+static void vmBatchLoad(VMBatch *batch)
+{
+    for (int64_t i = 0; i < batch->jobSize; ++i)
+    {
+        QuarkVM vm = {0};
+        vmLoadProgramFromFile(&vm, batch->jobs[i].path);
+        const uint64_t hash = vmBatchHash(&vm);
+
+        for (int64_t j = 0; j < batch->imageSize && batch->jobs[i].image < 0; ++j)
+            if (batch->images[j].hash == hash && vmBatchSameProgram(&batch->images[j].vm, &vm))
+                batch->jobs[i].image = j;
+
+        if (batch->jobs[i].image >= 0)
+        {
+            vmDestroy(&vm);
+            continue;
+        }
+
+        batch->images = vmReserve(batch->images, &batch->imageCapacity, batch->imageSize + 1,
+                                  sizeof(batch->images[0]));
+        VMBatchImage *image = &batch->images[batch->imageSize];
+        *image = (VMBatchImage) {vm, {0}, 0, hash};
+
+        vmPushNatives(&image->vm);
+        image->valid = vmVerifyProgram(&image->vm, &image->verification);
+        batch->jobs[i].image = batch->imageSize++;
+    }
+}
+
+// Collects what a job prints. POSIX systems write to memory; elsewhere a temporary file is read back.
+static FILE *vmBatchOpenOutput(VMBatchJob *job)
+{
+#if VM_HAS_MMAP
+    FILE *file = open_memstream(&job->output, &job->outputSize);
+#else
+    FILE *file = tmpfile();
+#endif
+    if (file == NULL)
+    {
+        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not capture the output of \"%s\" (%s)\n", job->path,
+                strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    return file;
+}
+
+static void vmBatchCloseOutput(VMBatchJob *job, FILE *file)
+{
+#if VM_HAS_MMAP
+    (void) job;
+    fclose(file);
+#else
+    job->outputSize = (size_t) ftell(file);
+    job->output = malloc(job->outputSize + 1);
+    rewind(file);
+    if (job->output != NULL) job->outputSize = fread(job->output, 1, job->outputSize, file);
+    else job->outputSize = 0;
+    fclose(file);
+#endif
+}
+
+static void *vmBatchWorker(void *argument)
+{
+    VMBatch *batch = argument;
+
+    QuarkVM vm = {0};
+    vmInit(&vm);
+
+    for (int64_t i; (i = atomic_fetch_add(&batch->next, 1)) < batch->jobSize;)
+    {
+        VMBatchJob *job = &batch->jobs[i];
+        const VMBatchImage *image = &batch->images[job->image];
+        if (!image->valid) continue;
+
+        FILE *output = vmBatchOpenOutput(job);
+
+        vm.program = image->vm.program;
+        vm.programSize = image->vm.programSize;
+        vm.nativeFunctions = vmReserve(vm.nativeFunctions, &vm.nativeFunctionsCapacity,
+                                       image->vm.nativeFunctionsSize, sizeof(vm.nativeFunctions[0]));
+        memcpy(vm.nativeFunctions, image->vm.nativeFunctions,
+               sizeof(vm.nativeFunctions[0]) * image->vm.nativeFunctionsSize);
+        vm.nativeFunctionsSize = image->vm.nativeFunctionsSize;
+        vm.programBorrowed = 1;
+        vm.stackSize = vm.instructionPointer = 0;
+        vm.halt = 0;
+        vm.instructionCount = 0;
+        vm.output = vm.errors = output;
+        vm.name = job->path;
+
+        job->exception = image->verification.verified ? vmExecuteProgramCountedUnchecked(&vm)
+                                                      : vmExecuteProgramCounted(&vm);
+        job->instructions = vm.instructionCount;
+
+        vmHeapRelease(&vm.heap);
+        vm.heap = (VMHeap) {0};
+
+        vmBatchCloseOutput(job, output);
+    }
+
+    vm.program = NULL;
+    vm.programSize = 0;
+    vmDestroy(&vm);
+
+    return NULL;
+}
+
+// Runs every job on `workers` threads (all processors if not positive) and prints their outputs and
+// the throughput. Returns EXIT_SUCCESS if every job ran to completion.
+static int vmBatchRun(VMBatch *batch, int64_t workers)
+{
+    if (workers <= 0) workers = vmProcessorCount();
+    if (workers > batch->jobSize) workers = batch->jobSize > 0 ? batch->jobSize : 1;
+
+    vmBatchLoad(batch);
+    atomic_init(&batch->next, 0);
+
+    pthread_t *threads = malloc(sizeof(threads[0]) * workers);
+    if (threads == NULL)
+    {
+        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not allocate memory for the workers (%s)\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    const double start = vmSeconds();
+    for (int64_t i = 0; i < workers; ++i)
+        if (pthread_create(&threads[i], NULL, vmBatchWorker, batch) != 0)
+        {
+            fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not start worker %" PRId64 "\n", i);
+            exit(EXIT_FAILURE);
+        }
+    for (int64_t i = 0; i < workers; ++i) pthread_join(threads[i], NULL);
+    const double elapsed = vmSeconds() - start;
+
+    uint64_t instructions = 0;
+    int64_t failed = 0;
+
+    for (int64_t i = 0; i < batch->jobSize; ++i)
+    {
+        const VMBatchJob *job = &batch->jobs[i];
+        instructions += job->instructions;
+
+        if (!batch->images[job->image].valid)
+            printf("[\033[1;31mERROR\033[0m]: \"%s\": Verification failed\n", job->path);
+        // A failed job has already reported itself, with its path, at the end of its output.
+        else if (job->exception == EX_OK)
+            printf("[\033[1;34mINFO\033[0m]: \"%s\": %s\n", job->path, exceptionAsCString(job->exception));
+        if (!batch->images[job->image].valid || job->exception != EX_OK) ++failed;
+
+        fwrite(job->output, 1, job->outputSize, stdout);
+    }
+
+    printf("[\033[1;34mINFO\033[0m]: %" PRId64 " jobs (%" PRId64 " failed, %" PRId64 " distinct programs) on %" PRId64
+           " workers in %.3f s: %.1f jobs/s, %" PRIu64 " instructions, %.3g instructions/s\n", batch->jobSize, failed,
+           batch->imageSize, workers, elapsed, elapsed > 0 ? batch->jobSize / elapsed : 0.0, instructions,
+           elapsed > 0 ? instructions / elapsed : 0.0);
+
+    free(threads);
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static void vmBatchDestroy(VMBatch *batch)
+{
+    for (int64_t i = 0; i < batch->imageSize; ++i)
+    {
+        vmFreeVerification(&batch->images[i].verification);
+        vmDestroy(&batch->images[i].vm);
+    }
+    for (int64_t i = 0; i < batch->jobSize; ++i)
+    {
+        free(batch->jobs[i].output);
+        free(batch->jobs[i].ownedPath);
+    }
+
+    free(batch->images);
+    free(batch->jobs);
+    *batch = (VMBatch) {0};
+}
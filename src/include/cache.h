@@ -0,0 +1,522 @@
+#pragma once
+
+// The compile cache behind quarki.
+//
+// An entry is the .qce file quarki wrote for a source, named by a hash of the source, the
+// assembler build and the options that change the output (see vmCacheKey), followed by a trailer
+// with the size and hash of the program. On a hit the program is copied to the output path without
+// parsing anything, and hashed on the way; an entry that no longer matches its trailer is dropped and
+// the source assembled again. Entries and outputs are written to a temporary file and renamed into
+// place, so concurrent builds never see a partial file and the last one to finish wins with identical
+// contents. Outputs never share a file with an entry, so writing to an output cannot change the cache.
+//
+// Hits and misses are counted in the cache directory's `stats` file under an flock.
+//
+// Windows has no flock and no POSIX mkdir, so there the cache is never opened and quarki always
+// assembles; programs are still written through a temporary file.
+
+#include "compiler.h"
+
+#if defined(_WIN32)
+#define VM_HAS_CACHE 0
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#else
+#define VM_HAS_CACHE 1
+
+#include <dirent.h>
+#include <sys/file.h>
+#endif
+
+#define VM_CACHE_KEY_SIZE 32
+#define VM_CACHE_TRAILER_MAGIC "QCACHE\0\1"
+#define VM_CACHE_TRAILER_BYTES 32
+
+typedef struct
+{
+    char *directory;
+    char key[VM_CACHE_KEY_SIZE + 1];
+    char *entryPath;
+} VMCache;
+
+#define VM_CACHE_PRIME1 0x9E3779B185EBCA87ULL
+#define VM_CACHE_PRIME2 0xC2B2AE3D27D4EB4FULL
+#define VM_CACHE_PRIME3 0x165667B19E3779F9ULL
+
+static uint64_t vmCacheRotate(uint64_t x, int n) { return (x << n) | (x >> (64 - n)); }
+
+static uint64_t vmCacheRound(uint64_t lane, uint64_t word)
+{
+    return vmCacheRotate(lane + word * VM_CACHE_PRIME2, 31) * VM_CACHE_PRIME1;
+}
+
+static uint64_t vmCacheMix(uint64_t x)
+{
+    x = (x ^ (x >> 33)) * 0xFF51AFD7ED558CCDULL;
+    x = (x ^ (x >> 33)) * 0xC4CEB9FE1A85EC53ULL;
+    return x ^ (x >> 33);
+}
+
+// A 128-bit hash: four 64-bit lanes each take every fourth 8-byte word (the rounds of xxHash64),
+// and two different combinations of the lanes, the tail and the length make the result. Not
+// cryptographic, but an accidental collision between two sources is out of the question.
+typedef struct
+{
+    uint64_t lanes[4];
+    uint8_t stripe[32];
+    size_t used;
+    uint64_t size;
+} VMCacheHash;
+
+static void vmCacheHashInit(VMCacheHash *hash)
+{
+    *hash = (VMCacheHash) {{VM_CACHE_PRIME1 + VM_CACHE_PRIME2, VM_CACHE_PRIME2, 0, -VM_CACHE_PRIME1}, {0}, 0, 0};
+}
+
+static void vmCacheHashStripe(VMCacheHash *hash, const uint8_t *stripe)
+{
+    for (int lane = 0; lane < 4; ++lane)
+    {
+        uint64_t word;
+        memcpy(&word, stripe + lane * 8, 8);
+        hash->lanes[lane] = vmCacheRound(hash->lanes[lane], word);
+    }
+}
+
+static void vmCacheHashUpdate(VMCacheHash *hash, const void *data, size_t size)
+{
+    const uint8_t *bytes = data;
+    hash->size += size;
+
+    if (hash->used > 0)
+    {
+        const size_t take = size < 32 - hash->used ? size : 32 - hash->used;
+        memcpy(hash->stripe + hash->used, bytes, take);
+        hash->used += take;
+        bytes += take;
+        size -= take;
+
+        if (hash->used < 32) return;
+        vmCacheHashStripe(hash, hash->stripe);
+        hash->used = 0;
+    }
+
+    for (; size >= 32; bytes += 32, size -= 32) vmCacheHashStripe(hash, bytes);
+
+    memcpy(hash->stripe, bytes, size);
+    hash->used = size;
+}
+
+static void vmCacheHashFinal(VMCacheHash *hash, uint64_t result[2])
+{
+    memset(hash->stripe + hash->used, 0, 32 - hash->used);
+    hash->stripe[hash->used] = 0x80;
+    vmCacheHashStripe(hash, hash->stripe);
+
+    const uint64_t *lanes = hash->lanes;
+    result[0] = vmCacheMix(vmCacheRotate(lanes[0], 1) + vmCacheRotate(lanes[1], 7) + vmCacheRotate(lanes[2], 12) +
+                           vmCacheRotate(lanes[3], 18) + hash->size * VM_CACHE_PRIME3);
+    result[1] = vmCacheMix((lanes[0] ^ vmCacheRotate(lanes[2], 29)) * VM_CACHE_PRIME2 +
+                           (lanes[1] ^ vmCacheRotate(lanes[3], 41)) * VM_CACHE_PRIME3 + result[0]);
+}
+
+// The key covers the .qce version, the build of the assembler (so rebuilding quarki starts a fresh
+// cache), the options and the contents of the file, which are read in fixed-size chunks. Returns 0
+// if the file cannot be read.
+static int vmCacheKey(const char *filePath, int fuse, int compact, int optimize, char key[VM_CACHE_KEY_SIZE + 1])
+{
+    FILE *file = fopen(filePath, "rb");
+    if (file == NULL) return 0;
+
+    char buffer[65536];
+    const int headerSize = snprintf(buffer, sizeof(buffer), "quarki %d %s %s;fuse=%d;compact=%d;optimize=%d;",
+                                    VM_QCE_VERSION, __DATE__, __TIME__, fuse, compact, optimize);
+
+    VMCacheHash hash;
+    vmCacheHashInit(&hash);
+    vmCacheHashUpdate(&hash, buffer, (size_t) headerSize + 1);
+
+    for (size_t size; (size = fread(buffer, 1, sizeof(buffer), file)) > 0;) vmCacheHashUpdate(&hash, buffer, size);
+
+    const int ok = !ferror(file);
+    fclose(file);
+
+    uint64_t result[2];
+    vmCacheHashFinal(&hash, result);
+    snprintf(key, VM_CACHE_KEY_SIZE + 1, "%016" PRIx64 "%016" PRIx64, result[0], result[1]);
+
+    return ok;
+}
+
+static char *vmCacheCopyString(const char *string)
+{
+    char *copy = malloc(strlen(string) + 1);
+    if (copy == NULL)
+    {
+        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not allocate memory for the cache path\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return strcpy(copy, string);
+}
+
+static char *vmCacheJoin(const char *directory, const char *name, const char *suffix)
+{
+    const size_t size = strlen(directory) + strlen(name) + strlen(suffix) + 2;
+    char *path = malloc(size);
+    if (path == NULL)
+    {
+        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not allocate memory for the cache path\n");
+        exit(EXIT_FAILURE);
+    }
+
+    snprintf(path, size, "%s/%s%s", directory, name, suffix);
+    return path;
+}
+
+// `QUARK_CACHE_DIR`, else `$XDG_CACHE_HOME/quark`, else `~/.cache/quark`. NULL if none are set.
+static char *vmCacheDefaultDirectory(void)
+{
+    const char *directory = getenv("QUARK_CACHE_DIR");
+    if (directory != NULL && directory[0] != '\0') return vmCacheCopyString(directory);
+
+    directory = getenv("XDG_CACHE_HOME");
+    if (directory != NULL && directory[0] != '\0') return vmCacheJoin(directory, "quark", "");
+
+    directory = getenv("HOME");
+    if (directory != NULL && directory[0] != '\0') return vmCacheJoin(directory, ".cache/quark", "");
+
+    return NULL;
+}
+
+#if VM_HAS_CACHE
+// Creates the directory and its parents. Returns 0 (with errno set) if it cannot.
+static int vmCacheMakeDirectory(const char *directory)
+{
+    char *path = vmCacheCopyString(directory);
+    for (char *slash = strchr(path + 1, '/'); slash != NULL; slash = strchr(slash + 1, '/'))
+    {
+        *slash = '\0';
+        if (mkdir(path, 0777) < 0 && errno != EEXIST)
+        {
+            free(path);
+            return 0;
+        }
+
+        *slash = '/';
+    }
+
+    free(path);
+    return mkdir(directory, 0777) == 0 || errno == EEXIST;
+}
+
+// Opens the cache in `directory` for the entry `key`. Returns 0 if the directory cannot be created.
+static int vmCacheOpen(VMCache *cache, const char *directory, const char *key)
+{
+    if (!vmCacheMakeDirectory(directory))
+    {
+        fprintf(stderr, "[\033[1;33mWARNING\033[0m]: Could not create cache directory \"%s\" (%s), not caching\n",
+                directory, strerror(errno));
+        return 0;
+    }
+
+    cache->directory = vmCacheCopyString(directory);
+    memcpy(cache->key, key, VM_CACHE_KEY_SIZE + 1);
+    cache->entryPath = vmCacheJoin(directory, key, ".qce");
+
+    return 1;
+}
+
+#else
+static int vmCacheOpen(VMCache *cache, const char *directory, const char *key)
+{
+    (void) cache;
+    (void) directory;
+    (void) key;
+
+    return 0;
+}
+#endif
+
+static void vmCacheClose(VMCache *cache)
+{
+    free(cache->directory);
+    free(cache->entryPath);
+    *cache = (VMCache) {0};
+}
+
+// A temporary path next to `filePath`, unique to this process.
+static char *vmCacheTemporaryPath(const char *filePath)
+{
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".%ld.tmp", (long) getpid());
+
+    const size_t size = strlen(filePath) + strlen(suffix) + 1;
+    char *path = malloc(size);
+    if (path == NULL)
+    {
+        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not allocate memory for the cache path\n");
+        exit(EXIT_FAILURE);
+    }
+
+    snprintf(path, size, "%s%s", filePath, suffix);
+    return path;
+}
+
+// Renames the temporary file to `filePath` and frees its path.
+static void vmCacheRename(char *temporaryPath, const char *filePath)
+{
+#if defined(_WIN32)
+    // rename does not replace an existing file on Windows.
+    remove(filePath);
+#endif
+
+    if (rename(temporaryPath, filePath) < 0)
+    {
+        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Failed to rename \"%s\" to \"%s\" (%s).\n", temporaryPath, filePath,
+                strerror(errno));
+        unlink(temporaryPath);
+        exit(EXIT_FAILURE);
+    }
+
+    free(temporaryPath);
+}
+
+// Writes the program to a temporary file and renames it to `filePath`, replacing any file there
+// without writing through it.
+static void vmCacheSaveProgram(const QuarkVM *vm, const VMTable *vmTable, int compact, const char *filePath)
+{
+    char *temporaryPath = vmCacheTemporaryPath(filePath);
+    vmSaveProgramToFile(vm, vmTable, compact, temporaryPath);
+    vmCacheRename(temporaryPath, filePath);
+}
+
+typedef struct
+{
+    uint64_t hits, misses, entries, bytes;
+} VMCacheStats;
+
+#if VM_HAS_CACHE
+// Copies `size` bytes from `source` to `destination`, adding them to `hash`. Returns 1 if all of them
+// were copied, 0 if `source` ended or could not be read first, and -1 if `destination` could not be
+// written.
+static int vmCacheCopy(int source, int destination, uint64_t size, VMCacheHash *hash)
+{
+    char buffer[65536];
+    while (size > 0)
+    {
+        const ssize_t count = read(source, buffer, size < sizeof(buffer) ? (size_t) size : sizeof(buffer));
+        if (count < 0 && errno == EINTR) continue;
+        if (count <= 0) return 0;
+
+        vmCacheHashUpdate(hash, buffer, (size_t) count);
+        size -= (uint64_t) count;
+
+        for (ssize_t written = 0; written < count;)
+        {
+            const ssize_t result = write(destination, buffer + written, (size_t) (count - written));
+            if (result > 0) written += result;
+            else if (result == 0 || errno != EINTR) return -1;
+        }
+    }
+
+    return 1;
+}
+
+// Removes an entry that does not match its trailer.
+static void vmCacheDrop(const VMCache *cache)
+{
+    fprintf(stderr, "[\033[1;33mWARNING\033[0m]: Cache entry \"%s\" is corrupt, assembling again\n", cache->entryPath);
+    unlink(cache->entryPath);
+}
+
+// Copies the program in the entry to `outputPath`. Returns 0 if there is no entry, or if the entry
+// does not match its trailer (in which case it is removed).
+static int vmCacheFetch(const VMCache *cache, const char *outputPath)
+{
+    const int entry = open(cache->entryPath, O_RDONLY);
+    if (entry < 0) return 0;
+
+    struct stat status;
+    uint8_t trailer[VM_CACHE_TRAILER_BYTES];
+    const uint64_t size = fstat(entry, &status) == 0 && status.st_size >= VM_CACHE_TRAILER_BYTES
+                          ? (uint64_t) status.st_size - VM_CACHE_TRAILER_BYTES : 0;
+
+    if (size == 0 || pread(entry, trailer, sizeof(trailer), (off_t) size) != sizeof(trailer) ||
+        memcmp(trailer, VM_CACHE_TRAILER_MAGIC, 8) != 0 || vmReadLE(trailer + 8, 8) != size)
+    {
+        close(entry);
+        vmCacheDrop(cache);
+        return 0;
+    }
+
+    char *temporaryPath = vmCacheTemporaryPath(outputPath);
+    const int output = open(temporaryPath, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (output < 0)
+    {
+        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Failed to open file \"%s\" (%s).\n", temporaryPath, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    VMCacheHash hash;
+    vmCacheHashInit(&hash);
+    int copied = vmCacheCopy(entry, output, size, &hash);
+    if (close(output) < 0) copied = -1;
+    close(entry);
+
+    uint64_t digest[2];
+    vmCacheHashFinal(&hash, digest);
+
+    const int hit = copied > 0 && vmReadLE(trailer + 16, 8) == digest[0] && vmReadLE(trailer + 24, 8) == digest[1];
+    if (copied < 0 || (hit && rename(temporaryPath, outputPath) < 0))
+    {
+        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not copy \"%s\" to \"%s\" (%s).\n", cache->entryPath,
+                outputPath, strerror(errno));
+        unlink(temporaryPath);
+        exit(EXIT_FAILURE);
+    }
+
+    if (!hit)
+    {
+        unlink(temporaryPath);
+        vmCacheDrop(cache);
+    }
+
+    free(temporaryPath);
+    return hit;
+}
+
+// Writes the program to `outputPath` and adds a copy of it, with its trailer, as the entry.
+static void vmCacheStore(const VMCache *cache, const QuarkVM *vm, const VMTable *vmTable, int compact,
+                         const char *outputPath)
+{
+    vmCacheSaveProgram(vm, vmTable, compact, outputPath);
+
+    char *temporaryPath = vmCacheTemporaryPath(cache->entryPath);
+    const int program = open(outputPath, O_RDONLY);
+    const int entry = open(temporaryPath, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+
+    struct stat status;
+    int ok = program >= 0 && entry >= 0 && fstat(program, &status) == 0;
+    if (ok)
+    {
+        VMCacheHash hash;
+        vmCacheHashInit(&hash);
+        ok = vmCacheCopy(program, entry, (uint64_t) status.st_size, &hash) > 0;
+
+        uint64_t digest[2];
+        vmCacheHashFinal(&hash, digest);
+
+        uint8_t trailer[VM_CACHE_TRAILER_BYTES];
+        memcpy(trailer, VM_CACHE_TRAILER_MAGIC, 8);
+        vmWriteLE(trailer + 8, (uint64_t) status.st_size, 8);
+        vmWriteLE(trailer + 16, digest[0], 8);
+        vmWriteLE(trailer + 24, digest[1], 8);
+        ok = ok && write(entry, trailer, sizeof(trailer)) == sizeof(trailer);
+    }
+
+    if (program >= 0) close(program);
+    if (entry >= 0 && close(entry) < 0) ok = 0;
+
+    // The output is already written, so a cache that cannot be filled is not an error.
+    if (!ok || rename(temporaryPath, cache->entryPath) < 0)
+    {
+        fprintf(stderr, "[\033[1;33mWARNING\033[0m]: Could not add \"%s\" to the cache (%s)\n", outputPath,
+                strerror(errno));
+        unlink(temporaryPath);
+    }
+
+    free(temporaryPath);
+}
+
+// Reads the hit and miss counts, adding `hits` and `misses` to them under the lock.
+static VMCacheStats vmCacheCount(const char *directory, uint64_t hits, uint64_t misses)
+{
+    VMCacheStats stats = {0};
+
+    char *path = vmCacheJoin(directory, "stats", "");
+    const int update = hits > 0 || misses > 0;
+    const int file = open(path, update ? O_RDWR | O_CREAT : O_RDONLY, 0666);
+    free(path);
+
+    if (file < 0) return stats;
+
+    if (flock(file, update ? LOCK_EX : LOCK_SH) == 0)
+    {
+        char text[128] = {0};
+        if (read(file, text, sizeof(text) - 1) > 0)
+            sscanf(text, "hits %" SCNu64 "\nmisses %" SCNu64, &stats.hits, &stats.misses);
+
+        if (update)
+        {
+            stats.hits += hits;
+            stats.misses += misses;
+
+            const int size = snprintf(text, sizeof(text), "hits %" PRIu64 "\nmisses %" PRIu64 "\n", stats.hits,
+                                      stats.misses);
+            if (pwrite(file, text, (size_t) size, 0) != size || ftruncate(file, size) < 0)
+                fprintf(stderr, "[\033[1;33mWARNING\033[0m]: Could not update the cache statistics (%s)\n",
+                        strerror(errno));
+        }
+    }
+
+    close(file);
+    return stats;
+}
+
+// Counts, and measures the entries of, the cache in `directory`.
+static VMCacheStats vmCacheStats(const char *directory)
+{
+    VMCacheStats stats = vmCacheCount(directory, 0, 0);
+
+    DIR *dir = opendir(directory);
+    if (dir == NULL) return stats;
+
+    for (struct dirent *entry; (entry = readdir(dir)) != NULL;)
+    {
+        const size_t length = strlen(entry->d_name);
+        if (length != VM_CACHE_KEY_SIZE + 4 || strcmp(entry->d_name + VM_CACHE_KEY_SIZE, ".qce") != 0) continue;
+
+        char *path = vmCacheJoin(directory, entry->d_name, "");
+        struct stat status;
+        if (stat(path, &status) == 0)
+        {
+            ++stats.entries;
+            stats.bytes += (uint64_t) status.st_size;
+        }
+
+        free(path);
+    }
+
+    closedir(dir);
+    return stats;
+}
+#else
+static int vmCacheFetch(const VMCache *cache, const char *outputPath)
+{
+    (void) cache;
+    (void) outputPath;
+
+    return 0;
+}
+
+static void vmCacheStore(const VMCache *cache, const QuarkVM *vm, const VMTable *vmTable, int compact,
+                         const char *outputPath)
+{
+    (void) cache;
+    vmCacheSaveProgram(vm, vmTable, compact, outputPath);
+}
+
+static VMCacheStats vmCacheCount(const char *directory, uint64_t hits, uint64_t misses)
+{
+    (void) directory;
+    (void) hits;
+    (void) misses;
+
+    return (VMCacheStats) {0};
+}
+
+static VMCacheStats vmCacheStats(const char *directory) { return vmCacheCount(directory, 0, 0); }
+#endif
@@ -1,5 +1,9 @@
 #pragma once
 
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -9,11 +13,48 @@
 #include <ctype.h>
 #include <math.h>
 #include <inttypes.h>
+#include <stddef.h>
+#include <time.h>
+#include <limits.h>
+
+#if defined(_WIN32)
+#define VM_STACK_GUARD 0
+#define VM_HAS_MMAP 0
+#define VM_HAS_PLUGINS 0
+#else
+#define VM_STACK_GUARD 1
+#define VM_HAS_MMAP 1
+#define VM_HAS_PLUGINS 1
+
+#include <signal.h>
+#include <setjmp.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#endif
 
 #include "stringview.h"
+#include "heap.h"
+#include "output.h"
+#include "simd.h"
 
 #define VM_CAPACITY 1024
 #define VM_STACK_CAPACITY (VM_CAPACITY * VM_CAPACITY)
+#define VM_STACK_BYTES (VM_STACK_CAPACITY * sizeof(Word))
+#define VM_STACK_CHUNK_BYTES ((size_t) 64 * 1024)
+
+#define VM_QCE_MAGIC "\177QCE"
+#define VM_QCE_VERSION 2
+#define VM_QCE_ALIGNMENT 64
+#define VM_QCE_HEADER_BYTES 16
+#define VM_QCE_SECTION_BYTES 32
+#define VM_QCE_INSTRUCTION_BYTES 16
+// Natives called by a name that is not built in get indices from here on (see native.h).
+#define VM_NATIVE_BUILTINS 10
+#define VM_COMPACT_END 0xFF
 
 typedef enum
 {
@@ -24,6 +65,8 @@ typedef enum
     EX_ILLEGAL_INSTRUCTION_ACCESS,
     EX_ILLEGAL_OPERATION,
     EX_DIVIDE_BY_ZERO,
+    EX_ILLEGAL_MEMORY_ACCESS,
+    EX_LIMIT_EXCEEDED,
 } Exception;
 
 typedef enum
@@ -67,6 +110,69 @@ typedef enum
     INST_FLEQ,
 
     INST_HALT,
+
+    INST_IPLUS_IMM,
+    INST_IMINUS_IMM,
+    INST_FPLUS_IMM,
+    INST_FMINUS_IMM,
+    INST_FMUL_IMM,
+
+    INST_JUMP_IF_DUP,
+    INST_JUMP_IF_NOT,
+    INST_JUMP_IEQ,
+    INST_JUMP_INEQ,
+    INST_JUMP_IGT,
+    INST_JUMP_ILT,
+    INST_JUMP_IGEQ,
+    INST_JUMP_ILEQ,
+    INST_JUMP_FEQ,
+    INST_JUMP_FGT,
+    INST_JUMP_FLT,
+    INST_JUMP_FGEQ,
+    INST_JUMP_FLEQ,
+
+    INST_ILOAD8,
+    INST_ILOAD32,
+    INST_ILOAD64,
+    INST_FLOAD,
+    INST_ISTORE8,
+    INST_ISTORE32,
+    INST_ISTORE64,
+    INST_FSTORE,
+    INST_MEMCPY,
+    INST_MEMSET,
+    INST_MEMCMP,
+
+    INST_VFPLUS,
+    INST_VFMINUS,
+    INST_VFMUL,
+    INST_VFDIV,
+    INST_VFFMA,
+    INST_VFLT,
+    INST_VFEQ,
+
+    INST_VIPLUS,
+    INST_VIMINUS,
+    INST_VIMUL,
+    INST_VIDIV,
+    INST_VIFMA,
+    INST_VILT,
+    INST_VIEQ,
+
+    INST_VFDOT,
+    INST_VFSUM,
+    INST_VFMIN,
+    INST_VFMAX,
+    INST_VIDOT,
+    INST_VISUM,
+    INST_VIMIN,
+    INST_VIMAX,
+
+    INST_SPAWN,
+    INST_YIELD,
+    INST_JOIN,
+
+    INST_COUNT,
 } InstructionType;
 
 typedef union
@@ -82,47 +188,381 @@ typedef struct
     Word value;
 } Instruction;
 
+typedef enum
+{
+    VM_SECTION_CODE = 1,
+    VM_SECTION_SYMBOLS,
+    VM_SECTION_COMPACT_CODE,
+    VM_SECTION_CONSTANTS,
+    VM_SECTION_NATIVES,
+    // Only in relocatable objects (see linker.h).
+    VM_SECTION_EXPORTS,
+    VM_SECTION_EXTERNS,
+    VM_SECTION_RELOCATIONS,
+} SectionType;
+
+typedef struct
+{
+    SectionType type;
+    uint64_t entrySize, offset, size, count;
+    uint8_t *data;
+} Section;
+
+typedef struct
+{
+    const void *handler;
+    Word value;
+} ThreadedInstruction;
+
+typedef enum
+{
+    ENGINE_SWITCH = 0,
+    ENGINE_THREADED,
+    ENGINE_COMPACT,
+} ExecutionEngine;
+
 typedef struct QuarkVM QuarkVM;
 
 typedef Exception(*NativeVM)(QuarkVM *);
 
+typedef struct
+{
+    NativeVM function;
+    int64_t inputs;
+    int64_t outputs;
+} NativeFunction;
+
+// The compact encoding of a program: one opcode byte per instruction followed by its operand, which
+// is a zigzag varint for dup, swap and native, a little-endian u32 byte offset for jump targets, and
+// a varint for literals whose low bit selects between an inline zigzag integer and an index into
+// `constants`. The code ends with a VM_COMPACT_END byte. `offsets` maps instruction indices to byte
+// offsets (with `offsets[programSize]` pointing at the end marker) and `indices` maps back.
+typedef struct
+{
+    const uint8_t *code;
+    int64_t size;
+    uint32_t *offsets;
+    uint32_t *indices;
+    const Word *constants;
+    int64_t constantCount;
+    Word *ownedConstants;
+} VMCompactCode;
+
+// Execution counts gathered by the profiled engines. `counts` has one entry per instruction plus one
+// for running past the end; natives are timed per index.
+typedef struct
+{
+    uint64_t *counts;
+    uint64_t *nativeCalls;
+    double *nativeSeconds;
+    int64_t nativeCount;
+} VMProfile;
+
 struct QuarkVM
 {
-    Word stack[VM_STACK_CAPACITY];
+    Word *stack;
     int64_t stackSize;
-
-    Instruction program[VM_CAPACITY];
-    int programSize;
     int64_t instructionPointer;
+    int halt;
 
-    NativeVM nativeFunctions[VM_CAPACITY];
+    Instruction *program;
+    int64_t programSize;
+    int64_t programCapacity;
+    int programBorrowed;
+
+    void *image;
+    size_t imageSize;
+    int imageMapped;
+    const uint8_t *symbols;
+    int64_t symbolsSize;
+    // The natives section: natives the program calls by name, bound to plugin functions by vmPushNatives.
+    const uint8_t *imports;
+    int64_t importsSize;
+    VMCompactCode compact;
+
+    NativeFunction *nativeFunctions;
     int64_t nativeFunctionsSize;
-
-    int halt;
+    int64_t nativeFunctionsCapacity;
+
+    // Where natives print and exceptions are reported; stdout and stderr unless the VM runs a batch job.
+    FILE *output;
+    FILE *errors;
+    // Put in front of reported exceptions when set, so a batch job's failure names its file.
+    const char *name;
+    VMOutput outputBuffer;
+    // Instructions executed, and natives called, by the switch engine and vmRun (the counted threaded
+    // engines only count instructions).
+    uint64_t instructionCount;
+    uint64_t nativeCount;
+    VMHeap heap;
+    VMProfile *profile;
+
+    // Threaded code kept between calls of vmRun, and the handlers of the engine that decoded it.
+    // `verified` is set by the host when vmVerifyProgram proved the program, to run it unchecked.
+    ThreadedInstruction *threaded;
+    const void *threadedHandlers;
+    int threadedBorrowed;
+    int verified;
+
+    // The scheduler (fiber.h) when the VM runs a fiber. vmRun then stops at spawn, yield and join
+    // with `trap` set to the instruction and `instructionPointer` still on it; `trap` is INST_KAPUT
+    // otherwise.
+    void *scheduler;
+    InstructionType trap;
 };
 
+typedef enum
+{
+    VM_LINK_LOCAL = 0,
+    VM_LINK_EXPORT,
+    VM_LINK_IMPORT,
+} Linkage;
+
+// A label. Until it is defined, `address` is -1 and `references` heads a chain of the instructions
+// that refer to it, linked through their operands and terminated by -1. Imported labels are never
+// defined; their chains become relocations (see linker.h).
 typedef struct
 {
     StringView function;
     int64_t address;
+    int64_t references;
+    int line;
+    Linkage linkage;
 } Function;
 
-typedef struct
+// Holds the names in a VMTable. Blocks are never moved, so views into them stay valid.
+typedef struct VMNameBlock
 {
-    StringView function;
-    int64_t address;
-} Hoisted;
-
+    struct VMNameBlock *next;
+    int64_t size;
+    int64_t capacity;
+    char data[];
+} VMNameBlock;
+
+#define VM_NAME_BLOCK_BYTES ((int64_t) 16 * 1024)
+
+// Labels in definition order, indexed by an open-addressing hash table (`slots` holds index + 1,
+// 0 for an empty slot; `slotCapacity` is a power of two kept at most half full). `imports` holds the
+// natives called by a name that is not built in, with their native index in `address`. Names are
+// copied into `names`, since the source they were read from does not outlive the line.
 typedef struct
 {
-    Function functions[VM_CAPACITY];
-    Hoisted hoistedFunctions[VM_CAPACITY];
+    Function *functions;
     int64_t functionSize;
-    int64_t hoistedFunctionSize;
+    int64_t functionCapacity;
+    int64_t *slots;
+    int64_t slotCapacity;
+
+    Function *imports;
+    int64_t importSize;
+    int64_t importCapacity;
+
+    VMNameBlock *names;
 } VMTable;
 
 static_assert(sizeof(Word) == 8, "The word size must be 64 bytes");
 
+// Grows `items` geometrically so that it can hold at least `count` elements of `itemSize` bytes.
+static void *vmReserve(void *items, int64_t *capacity, int64_t count, size_t itemSize)
+{
+    if (count <= *capacity) return items;
+
+    int64_t newCapacity = *capacity > 0 ? *capacity : 64;
+    while (newCapacity < count) newCapacity *= 2;
+
+    void *newItems = realloc(items, itemSize * newCapacity);
+    if (newItems == NULL)
+    {
+        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not allocate memory (%s)\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    *capacity = newCapacity;
+    return newItems;
+}
+
+static void vmPushInstruction(QuarkVM *vm, Instruction instruction)
+{
+    assert(!vm->programBorrowed && "Cannot append to a mapped program");
+    vm->program = vmReserve(vm->program, &vm->programCapacity, vm->programSize + 1, sizeof(vm->program[0]));
+    vm->program[vm->programSize++] = instruction;
+}
+
+// The operand stack is a VM_STACK_BYTES reservation followed by a VM_STACK_CHUNK_BYTES guard region.
+// The reservation is mapped read/write without reserving swap, so the system only backs the pages
+// that are touched; touching the guard region unwinds to the running engine, which reports
+// EX_STACK_OVERFLOW. This is why pushes do not compare against VM_STACK_CAPACITY when
+// VM_STACK_GUARD is set.
+//
+// Engines that keep the program counter in a register store it in `at` before each push (see
+// VM_ROOM in dispatch.h), and the handler records the faulting machine address for the JIT, so the
+// overflow can be reported at the instruction that caused it.
+#if VM_STACK_GUARD
+#if defined(MAP_NORESERVE)
+#define VM_MAP_NORESERVE MAP_NORESERVE
+#else
+#define VM_MAP_NORESERVE 0
+#endif
+
+typedef struct VMStackGuard
+{
+    QuarkVM *vm;
+    struct VMStackGuard *previous;
+    sigjmp_buf jump;
+    const void *volatile at;
+    volatile uintptr_t machineAddress;
+} VMStackGuard;
+
+static _Thread_local VMStackGuard *vmStackGuard = NULL;
+static struct sigaction vmPreviousSegvAction, vmPreviousBusAction;
+
+#define VM_GUARD_STACK(vm, guard)                                                                \
+    VMStackGuard guard; guard.vm = (vm), guard.previous = vmStackGuard, guard.at = NULL,         \
+                        guard.machineAddress = 0, vmStackGuard = &guard
+#define VM_STACK_OVERFLOWED(guard) sigsetjmp((guard).jump, 0)
+#define VM_RELEASE_STACK(guard) vmStackGuard = (guard).previous
+
+// The address of the machine instruction that faulted, where the JIT can run; 0 elsewhere.
+static uintptr_t vmFaultMachineAddress(const void *context)
+{
+#if defined(__x86_64__) && defined(__linux__)
+    return (uintptr_t) ((const ucontext_t *) context)->uc_mcontext.gregs[16]; // REG_RIP
+#elif defined(__x86_64__) && defined(__APPLE__)
+    return (uintptr_t) ((const ucontext_t *) context)->uc_mcontext->__ss.__rip;
+#else
+    (void) context;
+    return 0;
+#endif
+}
+
+// Only touches the guard and jumps, both of which are safe in a signal handler.
+static void vmStackFaultHandler(int signal, siginfo_t *info, void *context)
+{
+    VMStackGuard *guard = vmStackGuard;
+    if (guard != NULL)
+    {
+        const char *guardRegion = (const char *) guard->vm->stack + VM_STACK_BYTES, *address = info->si_addr;
+        if (address >= guardRegion && address < guardRegion + VM_STACK_CHUNK_BYTES)
+        {
+            guard->machineAddress = vmFaultMachineAddress(context);
+            siglongjmp(guard->jump, 1);
+        }
+    }
+
+    // Not ours: restore the previous handler and let the access fault again.
+    sigaction(signal, signal == SIGSEGV ? &vmPreviousSegvAction : &vmPreviousBusAction, NULL);
+}
+#else
+#define VM_GUARD_STACK(vm, guard) (void) 0
+#define VM_STACK_OVERFLOWED(guard) 0
+#define VM_RELEASE_STACK(guard) (void) 0
+#endif
+
+#if VM_STACK_GUARD
+static void vmInstallStackFaultHandler(void)
+{
+    struct sigaction action = {0};
+    action.sa_sigaction = vmStackFaultHandler;
+    action.sa_flags = SA_SIGINFO | SA_NODEFER;
+    sigemptyset(&action.sa_mask);
+
+    sigaction(SIGSEGV, &action, &vmPreviousSegvAction);
+    sigaction(SIGBUS, &action, &vmPreviousBusAction);
+}
+#endif
+
+// Sets up a VM's stack. VMs share no state, so each thread can run its own.
+static void vmInit(QuarkVM *vm)
+{
+#if VM_STACK_GUARD
+    static pthread_once_t handlerOnce = PTHREAD_ONCE_INIT;
+    pthread_once(&handlerOnce, vmInstallStackFaultHandler);
+
+    void *stack = mmap(NULL, VM_STACK_BYTES + VM_STACK_CHUNK_BYTES, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | VM_MAP_NORESERVE, -1, 0);
+    if (stack == MAP_FAILED || mprotect((char *) stack + VM_STACK_BYTES, VM_STACK_CHUNK_BYTES, PROT_NONE) != 0)
+    {
+        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not reserve memory for the stack (%s)\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+#else
+    void *stack = malloc(VM_STACK_BYTES);
+    if (stack == NULL)
+    {
+        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not allocate memory for the stack (%s)\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+#endif
+
+    vm->stack = stack;
+    vm->stackSize = 0;
+    vm->output = stdout;
+    vm->errors = stderr;
+}
+
+static void vmReleaseCompact(QuarkVM *vm)
+{
+    free(vm->compact.offsets);
+    free(vm->compact.indices);
+    free(vm->compact.ownedConstants);
+    vm->compact = (VMCompactCode) {0};
+}
+
+static void vmReleaseThreaded(QuarkVM *vm)
+{
+    if (!vm->threadedBorrowed) free(vm->threaded);
+    vm->threaded = NULL;
+    vm->threadedHandlers = NULL;
+    vm->threadedBorrowed = 0;
+}
+
+static void vmReleaseImage(QuarkVM *vm)
+{
+    vmReleaseCompact(vm);
+    vmReleaseThreaded(vm);
+    if (vm->programBorrowed) vm->program = NULL;
+#if VM_HAS_MMAP
+    if (vm->imageMapped) munmap(vm->image, vm->imageSize);
+    else free(vm->image);
+#else
+    free(vm->image);
+#endif
+
+    vm->programBorrowed = vm->imageMapped = 0;
+    vm->image = NULL;
+    vm->imageSize = 0;
+    vm->symbols = NULL;
+    vm->symbolsSize = 0;
+    vm->imports = NULL;
+    vm->importsSize = 0;
+}
+
+// Writes what the print natives have buffered to `vm->output`.
+static void vmFlushOutput(QuarkVM *vm) { vmOutputFlush(&vm->outputBuffer, vm->output); }
+
+static void vmDestroy(QuarkVM *vm)
+{
+    vmFlushOutput(vm);
+    if (!vm->programBorrowed) free(vm->program);
+    free(vm->nativeFunctions);
+    vmReleaseImage(vm);
+    vmHeapRelease(&vm->heap);
+
+    vm->program = NULL;
+    vm->programSize = vm->programCapacity = 0;
+    vm->nativeFunctions = NULL;
+    vm->nativeFunctionsSize = vm->nativeFunctionsCapacity = 0;
+
+#if VM_STACK_GUARD
+    if (vm->stack != NULL) munmap(vm->stack, VM_STACK_BYTES + VM_STACK_CHUNK_BYTES);
+#else
+    free(vm->stack);
+#endif
+
+    vm->stack = NULL;
+    vm->stackSize = 0;
+}
+
 static const char *exceptionAsCString(Exception exception)
 {
     switch (exception)
@@ -141,11 +581,34 @@ static const char *exceptionAsCString(Exception exception)
             return "Illegal instruction access";
         case EX_ILLEGAL_OPERATION:
             return "Illegal operation";
+        case EX_ILLEGAL_MEMORY_ACCESS:
+            return "Illegal memory access";
+        case EX_LIMIT_EXCEEDED:
+            return "Execution limit exceeded";
         default:
             assert(0 && "[exceptionAsCString]: Unreachable");
     }
 }
 
+static const char *getInstructionName(InstructionType type);
+
+static void vmReportException(QuarkVM *vm, Exception exception)
+{
+    vmFlushOutput(vm);
+    const char *quote = vm->name != NULL ? "\"" : "", *name = vm->name != NULL ? vm->name : "",
+               *separator = vm->name != NULL ? "\": " : "";
+
+    if (vm->instructionPointer >= 0 && vm->instructionPointer < vm->programSize)
+        fprintf(vm->errors, "[\033[1;31mERROR\033[0m]: %s%s%sError at Op %" PRId64 " (%s): %s\n", quote, name,
+                separator, vm->instructionPointer, getInstructionName(vm->program[vm->instructionPointer].type),
+                exceptionAsCString(exception));
+    else if (vm->instructionPointer >= 0)
+        fprintf(vm->errors, "[\033[1;31mERROR\033[0m]: %s%s%sError at Op %" PRId64 ": %s\n", quote, name, separator,
+                vm->instructionPointer, exceptionAsCString(exception));
+    else fprintf(vm->errors, "[\033[1;31mERROR\033[0m]: %s%s%s%s\n", quote, name, separator,
+                 exceptionAsCString(exception));
+}
+
 static void vmDumpStack(FILE *stream, const QuarkVM *quarkVm)
 {
     fprintf(stream, "Stack (top to bottom):");
@@ -235,6 +698,116 @@ static const char *getInstructionName(InstructionType type)
 
         case INST_HALT:
             return "stop";
+
+        case INST_IPLUS_IMM:
+            return "iplusi";
+        case INST_IMINUS_IMM:
+            return "iminusi";
+        case INST_FPLUS_IMM:
+            return "fplusi";
+        case INST_FMINUS_IMM:
+            return "fminusi";
+        case INST_FMUL_IMM:
+            return "fmuli";
+
+        case INST_JUMP_IF_DUP:
+            return "jifdup";
+        case INST_JUMP_IF_NOT:
+            return "jifnot";
+        case INST_JUMP_IEQ:
+            return "jieq";
+        case INST_JUMP_INEQ:
+            return "jine";
+        case INST_JUMP_IGT:
+            return "jigt";
+        case INST_JUMP_ILT:
+            return "jilt";
+        case INST_JUMP_IGEQ:
+            return "jige";
+        case INST_JUMP_ILEQ:
+            return "jile";
+        case INST_JUMP_FEQ:
+            return "jfeq";
+        case INST_JUMP_FGT:
+            return "jfgt";
+        case INST_JUMP_FLT:
+            return "jflt";
+        case INST_JUMP_FGEQ:
+            return "jfge";
+        case INST_JUMP_FLEQ:
+            return "jfle";
+        case INST_ILOAD8:
+            return "iload8";
+        case INST_ILOAD32:
+            return "iload32";
+        case INST_ILOAD64:
+            return "iload64";
+        case INST_FLOAD:
+            return "fload";
+        case INST_ISTORE8:
+            return "istore8";
+        case INST_ISTORE32:
+            return "istore32";
+        case INST_ISTORE64:
+            return "istore64";
+        case INST_FSTORE:
+            return "fstore";
+        case INST_MEMCPY:
+            return "memcpy";
+        case INST_MEMSET:
+            return "memset";
+        case INST_MEMCMP:
+            return "memcmp";
+        case INST_VFPLUS:
+            return "vfplus";
+        case INST_VFMINUS:
+            return "vfminus";
+        case INST_VFMUL:
+            return "vfmul";
+        case INST_VFDIV:
+            return "vfdiv";
+        case INST_VFFMA:
+            return "vffma";
+        case INST_VFLT:
+            return "vflt";
+        case INST_VFEQ:
+            return "vfeq";
+        case INST_VIPLUS:
+            return "viplus";
+        case INST_VIMINUS:
+            return "viminus";
+        case INST_VIMUL:
+            return "vimul";
+        case INST_VIDIV:
+            return "vidiv";
+        case INST_VIFMA:
+            return "vifma";
+        case INST_VILT:
+            return "vilt";
+        case INST_VIEQ:
+            return "vieq";
+        case INST_VFDOT:
+            return "vfdot";
+        case INST_VFSUM:
+            return "vfsum";
+        case INST_VFMIN:
+            return "vfmin";
+        case INST_VFMAX:
+            return "vfmax";
+        case INST_VIDOT:
+            return "vidot";
+        case INST_VISUM:
+            return "visum";
+        case INST_VIMIN:
+            return "vimin";
+        case INST_VIMAX:
+            return "vimax";
+        case INST_SPAWN:
+            return "spawn";
+        case INST_YIELD:
+            return "yield";
+        case INST_JOIN:
+            return "join";
         default:
             assert(0 && "[getInstructionName]: Unreachable");
     }
@@ -270,6 +843,33 @@ static int instructionWithOperand(InstructionType type)
         case INST_FGEQ:
         case INST_FLEQ:
         case INST_HALT:
+        case INST_MEMCPY:
+        case INST_MEMSET:
+        case INST_MEMCMP:
+        case INST_VFPLUS:
+        case INST_VFMINUS:
+        case INST_VFMUL:
+        case INST_VFDIV:
+        case INST_VFFMA:
+        case INST_VFLT:
+        case INST_VFEQ:
+        case INST_VIPLUS:
+        case INST_VIMINUS:
+        case INST_VIMUL:
+        case INST_VIDIV:
+        case INST_VIFMA:
+        case INST_VILT:
+        case INST_VIEQ:
+        case INST_VFDOT:
+        case INST_VFSUM:
+        case INST_VFMIN:
+        case INST_VFMAX:
+        case INST_VIDOT:
+        case INST_VISUM:
+        case INST_VIMIN:
+        case INST_VIMAX:
+        case INST_YIELD:
+        case INST_JOIN:
             return 0;
         case INST_PUT:
         case INST_DUP:
@@ -278,12 +878,285 @@ static int instructionWithOperand(InstructionType type)
         case INST_JUMP_IF:
         case INST_INVOKE:
         case INST_NATIVE:
+        case INST_IPLUS_IMM:
+        case INST_IMINUS_IMM:
+        case INST_FPLUS_IMM:
+        case INST_FMINUS_IMM:
+        case INST_FMUL_IMM:
+        case INST_JUMP_IF_DUP:
+        case INST_JUMP_IF_NOT:
+        case INST_JUMP_IEQ:
+        case INST_JUMP_INEQ:
+        case INST_JUMP_IGT:
+        case INST_JUMP_ILT:
+        case INST_JUMP_IGEQ:
+        case INST_JUMP_ILEQ:
+        case INST_JUMP_FEQ:
+        case INST_JUMP_FGT:
+        case INST_JUMP_FLT:
+        case INST_JUMP_FGEQ:
+        case INST_JUMP_FLEQ:
+        case INST_ILOAD8:
+        case INST_ILOAD32:
+        case INST_ILOAD64:
+        case INST_FLOAD:
+        case INST_ISTORE8:
+        case INST_ISTORE32:
+        case INST_ISTORE64:
+        case INST_FSTORE:
+        case INST_SPAWN:
             return 1;
         default:
             assert(0 && "[instructionWithOperand]: Unreachable");
     }
 }
 
+static int instructionWithInteger(InstructionType type)
+{
+    switch (type)
+    {
+        case INST_DUP:
+        case INST_SWAP:
+        case INST_NATIVE:
+        case INST_ILOAD8:
+        case INST_ILOAD32:
+        case INST_ILOAD64:
+        case INST_FLOAD:
+        case INST_ISTORE8:
+        case INST_ISTORE32:
+        case INST_ISTORE64:
+        case INST_FSTORE:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static int instructionWithAddress(InstructionType type)
+{
+    switch (type)
+    {
+        case INST_JUMP:
+        case INST_JUMP_IF:
+        case INST_INVOKE:
+        case INST_JUMP_IF_DUP:
+        case INST_JUMP_IF_NOT:
+        case INST_JUMP_IEQ:
+        case INST_JUMP_INEQ:
+        case INST_JUMP_IGT:
+        case INST_JUMP_ILT:
+        case INST_JUMP_IGEQ:
+        case INST_JUMP_ILEQ:
+        case INST_JUMP_FEQ:
+        case INST_JUMP_FGT:
+        case INST_JUMP_FLT:
+        case INST_JUMP_FGEQ:
+        case INST_JUMP_FLEQ:
+        case INST_SPAWN:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static int instructionStackEffect(const QuarkVM *vm, Instruction instruction, int64_t *required, int64_t *delta);
+
+// Loads and stores take their address from a pointer on the stack plus the operand, in bytes, and
+// read or write through memcpy so the address need not be aligned. Bounds are only checked against
+// the heap with --heap-debug (see vmHeapCovers).
+#define VM_MEMORY_LOAD(type, field)                                                           \
+    {                                                                                         \
+        type value;                                                                           \
+        const unsigned char *address = (const unsigned char *) top[-1].asPtr + offset;        \
+        if (!vmHeapCovers(&vm->heap, address, sizeof value)) return EX_ILLEGAL_MEMORY_ACCESS; \
+        memcpy(&value, address, sizeof value);                                                \
+        top[-1].field = value;                                                                \
+        return EX_OK;                                                                         \
+    }
+#define VM_MEMORY_STORE(type, field)                                                          \
+    {                                                                                         \
+        const type value = (type) top[-1].field;                                              \
+        unsigned char *address = (unsigned char *) top[-2].asPtr + offset;                    \
+        if (!vmHeapCovers(&vm->heap, address, sizeof value)) return EX_ILLEGAL_MEMORY_ACCESS; \
+        memcpy(address, &value, sizeof value);                                                \
+        return EX_OK;                                                                         \
+    }
+
+// memcpy, memset or memcmp on [first, second, size] just below `top`: memcpy copies from the second
+// pointer to the first, memset fills the first with the byte in the second, and memcmp leaves -1, 0 or
+// 1 in place of the first. The caller pops the rest.
+static Exception vmMemoryBulk(const QuarkVM *vm, InstructionType type, Word *top)
+{
+    const int64_t size = top[-1].asI64;
+    void *first = top[-3].asPtr, *second = top[-2].asPtr;
+    if (size < 0) return EX_ILLEGAL_OPERATION;
+    if (size == 0)
+    {
+        if (type == INST_MEMCMP) top[-3].asI64 = 0;
+        return EX_OK;
+    }
+
+    if (first == NULL || !vmHeapCovers(&vm->heap, first, (uint64_t) size) ||
+        (type != INST_MEMSET && (second == NULL || !vmHeapCovers(&vm->heap, second, (uint64_t) size))))
+        return EX_ILLEGAL_MEMORY_ACCESS;
+
+    if (type == INST_MEMCPY) memmove(first, second, (size_t) size); // The ranges may overlap.
+    else if (type == INST_MEMSET) memset(first, (int) top[-2].asI64, (size_t) size);
+    else
+    {
+        const int order = memcmp(first, second, (size_t) size);
+        top[-3].asI64 = (order > 0) - (order < 0);
+    }
+
+    return EX_OK;
+}
+
+// Whether two arrays of `bytes` bytes overlap without being the same array.
+static int vmVectorOverlaps(const void *a, const void *b, size_t bytes)
+{
+    const uintptr_t x = (uintptr_t) a, y = (uintptr_t) b;
+    return x != y && (x > y ? x - y : y - x) < bytes;
+}
+
+// Vector instructions over arrays of `n` f64 or i64 values (see simd.h): [dst, a, b, n] for the
+// elementwise ones, [a, b, n] for dot products and [a, n] for the other reductions, whose result
+// replaces the first operand. The caller pops the rest. `dst` may be `a` or `b`, but any other
+// overlap raises EX_ILLEGAL_OPERATION, as the result would depend on the SIMD width.
+static Exception vmMemoryVector(const QuarkVM *vm, InstructionType type, Word *top)
+{
+    int64_t required = 0, delta = 0;
+    instructionStackEffect(vm, (Instruction) {type, {0}}, &required, &delta);
+
+    const int64_t count = top[-1].asI64;
+    if (count < 0 || count > INT64_MAX / (int64_t) sizeof(Word)) return EX_ILLEGAL_OPERATION;
+
+    void *arrays[3] = {NULL, NULL, NULL};
+    for (int64_t i = 0; i < required - 1; ++i)
+    {
+        arrays[i] = top[i - required].asPtr;
+        if (count > 0 && (arrays[i] == NULL || !vmHeapCovers(&vm->heap, arrays[i], (uint64_t) count * sizeof(Word))))
+            return EX_ILLEGAL_MEMORY_ACCESS;
+    }
+
+    const size_t n = (size_t) count;
+    if (required == 4 && (vmVectorOverlaps(arrays[0], arrays[1], n * sizeof(Word)) ||
+                          vmVectorOverlaps(arrays[0], arrays[2], n * sizeof(Word))))
+        return EX_ILLEGAL_OPERATION;
+
+    Word *result = &top[-required];
+    switch (type)
+    {
+        case INST_VFPLUS:
+            vmVectorF64(VM_VECTOR_ADD, arrays[0], arrays[1], arrays[2], n);
+            break;
+        case INST_VFMINUS:
+            vmVectorF64(VM_VECTOR_SUB, arrays[0], arrays[1], arrays[2], n);
+            break;
+        case INST_VFMUL:
+            vmVectorF64(VM_VECTOR_MUL, arrays[0], arrays[1], arrays[2], n);
+            break;
+        case INST_VFDIV:
+            vmVectorF64(VM_VECTOR_DIV, arrays[0], arrays[1], arrays[2], n);
+            break;
+        case INST_VFFMA:
+            vmVectorF64(VM_VECTOR_FMA, arrays[0], arrays[1], arrays[2], n);
+            break;
+        case INST_VFLT:
+            vmVectorF64(VM_VECTOR_LT, arrays[0], arrays[1], arrays[2], n);
+            break;
+        case INST_VFEQ:
+            vmVectorF64(VM_VECTOR_EQ, arrays[0], arrays[1], arrays[2], n);
+            break;
+        case INST_VIPLUS:
+            vmVectorI64(VM_VECTOR_ADD, arrays[0], arrays[1], arrays[2], n);
+            break;
+        case INST_VIMINUS:
+            vmVectorI64(VM_VECTOR_SUB, arrays[0], arrays[1], arrays[2], n);
+            break;
+        case INST_VIMUL:
+            vmVectorI64(VM_VECTOR_MUL, arrays[0], arrays[1], arrays[2], n);
+            break;
+        case INST_VIDIV:
+            for (size_t i = 0; i < n; ++i)
+                if (((const int64_t *) arrays[2])[i] == 0) return EX_DIVIDE_BY_ZERO;
+
+            vmVectorI64(VM_VECTOR_DIV, arrays[0], arrays[1], arrays[2], n);
+            break;
+        case INST_VIFMA:
+            vmVectorI64(VM_VECTOR_FMA, arrays[0], arrays[1], arrays[2], n);
+            break;
+        case INST_VILT:
+            vmVectorI64(VM_VECTOR_LT, arrays[0], arrays[1], arrays[2], n);
+            break;
+        case INST_VIEQ:
+            vmVectorI64(VM_VECTOR_EQ, arrays[0], arrays[1], arrays[2], n);
+            break;
+        case INST_VFDOT:
+            result->asF64 = vmReduceF64(VM_REDUCE_DOT, arrays[0], arrays[1], n);
+            break;
+        case INST_VFSUM:
+            result->asF64 = vmReduceF64(VM_REDUCE_SUM, arrays[0], NULL, n);
+            break;
+        case INST_VFMIN:
+            result->asF64 = vmReduceF64(VM_REDUCE_MIN, arrays[0], NULL, n);
+            break;
+        case INST_VFMAX:
+            result->asF64 = vmReduceF64(VM_REDUCE_MAX, arrays[0], NULL, n);
+            break;
+        case INST_VIDOT:
+            result->asI64 = vmReduceI64(VM_REDUCE_DOT, arrays[0], arrays[1], n);
+            break;
+        case INST_VISUM:
+            result->asI64 = vmReduceI64(VM_REDUCE_SUM, arrays[0], NULL, n);
+            break;
+        case INST_VIMIN:
+            result->asI64 = vmReduceI64(VM_REDUCE_MIN, arrays[0], NULL, n);
+            break;
+        case INST_VIMAX:
+            result->asI64 = vmReduceI64(VM_REDUCE_MAX, arrays[0], NULL, n);
+            break;
+        default:
+            return EX_INVALID_INSTRUCTION;
+    }
+
+    return EX_OK;
+}
+
+// Runs a memory instruction on the values just below `top`, which must hold as many as
+// instructionStackEffect requires. The caller then pops what it says the instruction pops.
+static Exception vmExecuteMemory(const QuarkVM *vm, Instruction instruction, Word *top)
+{
+    const int64_t offset = instruction.value.asI64;
+    switch (instruction.type)
+    {
+        case INST_ILOAD8:
+            VM_MEMORY_LOAD(int8_t, asI64)
+        case INST_ILOAD32:
+            VM_MEMORY_LOAD(int32_t, asI64)
+        case INST_ILOAD64:
+            VM_MEMORY_LOAD(int64_t, asI64)
+        case INST_FLOAD:
+            VM_MEMORY_LOAD(double, asF64)
+        case INST_ISTORE8:
+            VM_MEMORY_STORE(int8_t, asI64)
+        case INST_ISTORE32:
+            VM_MEMORY_STORE(int32_t, asI64)
+        case INST_ISTORE64:
+            VM_MEMORY_STORE(int64_t, asI64)
+        case INST_FSTORE:
+            VM_MEMORY_STORE(double, asF64)
+        case INST_MEMCPY:
+        case INST_MEMSET:
+        case INST_MEMCMP:
+            return vmMemoryBulk(vm, instruction.type, top);
+        default:
+            return vmMemoryVector(vm, instruction.type, top);
+    }
+}
+
+#undef VM_MEMORY_LOAD
+#undef VM_MEMORY_STORE
+
 static Exception vmExecuteInstruction(QuarkVM *vm)
 {
     if (vm->instructionPointer >= vm->programSize) return EX_ILLEGAL_INSTRUCTION_ACCESS;
@@ -295,14 +1168,14 @@ static Exception vmExecuteInstruction(QuarkVM *vm)
             ++vm->instructionPointer;
             break;
         case INST_PUT:
-            if (vm->stackSize >= VM_STACK_CAPACITY) return EX_STACK_OVERFLOW;
+            if (!VM_STACK_GUARD && vm->stackSize >= VM_STACK_CAPACITY) return EX_STACK_OVERFLOW;
 
             vm->stack[vm->stackSize++] = instruction.value;
             ++vm->instructionPointer;
 
             break;
         case INST_DUP:
-            if (vm->stackSize >= VM_STACK_CAPACITY) return EX_STACK_OVERFLOW;
+            if (!VM_STACK_GUARD && vm->stackSize >= VM_STACK_CAPACITY) return EX_STACK_OVERFLOW;
             if (vm->stackSize - instruction.value.asI64 <= 0) return EX_STACK_UNDERFLOW;
 
             vm->stack[vm->stackSize] = vm->stack[vm->stackSize - instruction.value.asI64 - 1];
@@ -427,16 +1300,18 @@ static Exception vmExecuteInstruction(QuarkVM *vm)
 
             break;
         case INST_INVOKE:
-            if (vm->stackSize >= VM_STACK_CAPACITY) return EX_STACK_OVERFLOW;
+            if (!VM_STACK_GUARD && vm->stackSize >= VM_STACK_CAPACITY) return EX_STACK_OVERFLOW;
 
-            vm->stack[vm->stackSize].asI64 = vm->instructionPointer + 1;
+            vm->stack[vm->stackSize++].asI64 = vm->instructionPointer + 1;
             vm->instructionPointer = instruction.value.asI64;
 
             break;
         case INST_NATIVE:
-            if (instruction.value.asI64 > vm->nativeFunctionsSize) return EX_ILLEGAL_OPERATION;
+            if (instruction.value.asI64 < 0 || instruction.value.asI64 >= vm->nativeFunctionsSize)
+                return EX_ILLEGAL_OPERATION;
 
-            const Exception exception = vm->nativeFunctions[instruction.value.asI64](vm);
+            const Exception exception = vm->nativeFunctions[instruction.value.asI64].function(vm);
+            ++vm->nativeCount;
             if (exception != EX_OK) return exception;
 
             ++vm->instructionPointer;
@@ -548,6 +1423,170 @@ static Exception vmExecuteInstruction(QuarkVM *vm)
         case INST_HALT:
             vm->halt = 1;
             break;
+        case INST_IPLUS_IMM:
+            if (vm->stackSize < 1) return EX_STACK_UNDERFLOW;
+
+            vm->stack[vm->stackSize - 1].asI64 += instruction.value.asI64;
+            ++vm->instructionPointer;
+
+            break;
+        case INST_IMINUS_IMM:
+            if (vm->stackSize < 1) return EX_STACK_UNDERFLOW;
+
+            vm->stack[vm->stackSize - 1].asI64 -= instruction.value.asI64;
+            ++vm->instructionPointer;
+
+            break;
+        case INST_FPLUS_IMM:
+            if (vm->stackSize < 1) return EX_STACK_UNDERFLOW;
+
+            vm->stack[vm->stackSize - 1].asF64 += instruction.value.asF64;
+            ++vm->instructionPointer;
+
+            break;
+        case INST_FMINUS_IMM:
+            if (vm->stackSize < 1) return EX_STACK_UNDERFLOW;
+
+            vm->stack[vm->stackSize - 1].asF64 -= instruction.value.asF64;
+            ++vm->instructionPointer;
+
+            break;
+        case INST_FMUL_IMM:
+            if (vm->stackSize < 1) return EX_STACK_UNDERFLOW;
+
+            vm->stack[vm->stackSize - 1].asF64 *= instruction.value.asF64;
+            ++vm->instructionPointer;
+
+            break;
+        case INST_JUMP_IF_DUP:
+            if (vm->stackSize < 1) return EX_STACK_UNDERFLOW;
+
+            vm->stack[vm->stackSize - 1].asI64 != 0 ? vm->instructionPointer = instruction.value.asI64
+                                                    : vm->instructionPointer++;
+
+            break;
+        case INST_JUMP_IF_NOT:
+            if (vm->stackSize < 1) return EX_STACK_UNDERFLOW;
+
+            vm->stack[vm->stackSize - 1].asI64 == 0 ? vm->instructionPointer = instruction.value.asI64
+                                                    : vm->instructionPointer++;
+            vm->stackSize--;
+
+            break;
+        case INST_ILOAD8:
+        case INST_ILOAD32:
+        case INST_ILOAD64:
+        case INST_FLOAD:
+        case INST_ISTORE8:
+        case INST_ISTORE32:
+        case INST_ISTORE64:
+        case INST_FSTORE:
+        case INST_MEMCPY:
+        case INST_MEMSET:
+        case INST_MEMCMP:
+        case INST_VFPLUS:
+        case INST_VFMINUS:
+        case INST_VFMUL:
+        case INST_VFDIV:
+        case INST_VFFMA:
+        case INST_VFLT:
+        case INST_VFEQ:
+        case INST_VIPLUS:
+        case INST_VIMINUS:
+        case INST_VIMUL:
+        case INST_VIDIV:
+        case INST_VIFMA:
+        case INST_VILT:
+        case INST_VIEQ:
+        case INST_VFDOT:
+        case INST_VFSUM:
+        case INST_VFMIN:
+        case INST_VFMAX:
+        case INST_VIDOT:
+        case INST_VISUM:
+        case INST_VIMIN:
+        case INST_VIMAX:
+        {
+            int64_t required = 0, delta = 0;
+            instructionStackEffect(vm, instruction, &required, &delta);
+            if (vm->stackSize < required) return EX_STACK_UNDERFLOW;
+
+            const Exception exception = vmExecuteMemory(vm, instruction, vm->stack + vm->stackSize);
+            if (exception != EX_OK) return exception;
+
+            vm->stackSize += delta;
+            ++vm->instructionPointer;
+
+            break;
+        }
+        case INST_JUMP_IEQ:
+        case INST_JUMP_INEQ:
+        case INST_JUMP_IGT:
+        case INST_JUMP_ILT:
+        case INST_JUMP_IGEQ:
+        case INST_JUMP_ILEQ:
+        case INST_JUMP_FEQ:
+        case INST_JUMP_FGT:
+        case INST_JUMP_FLT:
+        case INST_JUMP_FGEQ:
+        case INST_JUMP_FLEQ:
+        {
+            if (vm->stackSize < 2) return EX_STACK_UNDERFLOW;
+
+            const Word a = vm->stack[vm->stackSize - 1], b = vm->stack[vm->stackSize - 2];
+            int condition = 0;
+
+            switch (instruction.type)
+            {
+                case INST_JUMP_IEQ:
+                    condition = a.asI64 == b.asI64;
+                    break;
+                case INST_JUMP_INEQ:
+                    condition = a.asI64 != b.asI64;
+                    break;
+                case INST_JUMP_IGT:
+                    condition = a.asI64 > b.asI64;
+                    break;
+                case INST_JUMP_ILT:
+                    condition = a.asI64 < b.asI64;
+                    break;
+                case INST_JUMP_IGEQ:
+                    condition = a.asI64 >= b.asI64;
+                    break;
+                case INST_JUMP_ILEQ:
+                    condition = a.asI64 <= b.asI64;
+                    break;
+                case INST_JUMP_FEQ:
+                    condition = a.asF64 == b.asF64;
+                    break;
+                case INST_JUMP_FGT:
+                    condition = a.asF64 > b.asF64;
+                    break;
+                case INST_JUMP_FLT:
+                    condition = a.asF64 < b.asF64;
+                    break;
+                case INST_JUMP_FGEQ:
+                    condition = a.asF64 >= b.asF64;
+                    break;
+                case INST_JUMP_FLEQ:
+                    condition = a.asF64 <= b.asF64;
+                    break;
+                default:
+                    break;
+            }
+
+            condition ? vm->instructionPointer = instruction.value.asI64 : vm->instructionPointer++;
+            vm->stackSize -= 2;
+
+            break;
+        }
+        case INST_SPAWN:
+        case INST_YIELD:
+        case INST_JOIN:
+            if (vm->scheduler == NULL) return EX_ILLEGAL_OPERATION;
+
+            vm->trap = instruction.type;
+            break;
         default:
             return EX_INVALID_INSTRUCTION;
     }
@@ -555,33 +1594,36 @@ static Exception vmExecuteInstruction(QuarkVM *vm)
     return EX_OK;
 }
 
-static Exception vmExecuteProgram(QuarkVM *vm, int limit, int debug)
+static Exception vmExecuteLoop(QuarkVM *vm, int limit, int debug)
 {
     if (debug)
     {
         printf("[\033[1;34mINFO\033[0m]: Debugger started.\n");
-        printf("[\033[1;34mINFO\033[0m]: Total instructions: %d\n", (int) vm->programSize);
+        printf("[\033[1;34mINFO\033[0m]: Total instructions: %" PRId64 "\n", vm->programSize);
         printf("[\033[1;34mINFO\033[0m]: Type '?' for a list of commands.\n");
     }
 
-    for (int i = 0; limit != 0 && !vm->halt && i < (int) vm->programSize; ++i)
+    for (int64_t i = 0; limit != 0 && !vm->halt && vm->trap == INST_KAPUT; ++i)
     {
+        const int64_t ip = vm->instructionPointer;
+
         Exception exception = vmExecuteInstruction(vm);
+        ++vm->instructionCount;
         if (exception != EX_OK)
         {
-            fprintf(stderr, "[\033[1;31mERROR\033[0m]: Error at Op %d (%s): %s\n", i,
-                    getInstructionName(vm->program[i].type), exceptionAsCString(exception));
+            vmReportException(vm, exception);
             return exception;
         }
 
         if (debug)
         {
-            printf("Op %d:\n", i);
-            printf("  Type: %s\n", getInstructionName(vm->program[i].type));
+            vmFlushOutput(vm);
+            printf("Op %" PRId64 ":\n", ip);
+            printf("  Type: %s\n", getInstructionName(vm->program[ip].type));
 
-            if (instructionWithOperand(vm->program[i].type))
-                printf("  I64: %" PRId64 ", F64: %lf, PTR: %p\n", vm->program[i].value.asI64,
-                       vm->program[i].value.asF64, vm->program[i].value.asPtr);
+            if (instructionWithOperand(vm->program[ip].type))
+                printf("  I64: %" PRId64 ", F64: %lf, PTR: %p\n", vm->program[ip].value.asI64,
+                       vm->program[ip].value.asF64, vm->program[ip].value.asPtr);
 
             printf("\n>> ");
             char input[256];
@@ -617,8 +1659,8 @@ static Exception vmExecuteProgram(QuarkVM *vm, int limit, int debug)
                 return EXIT_SUCCESS;
             }
 
-            if (i == (int) vm->programSize - 1)
-                printf("\n[\033[1;34mINFO\033[0m]: Debugger finished with %d executed instructions (excluding kaput).\n",
+            if (vm->halt)
+                printf("\n[\033[1;34mINFO\033[0m]: Debugger finished with %" PRId64 " executed instructions.\n",
                        i + 1);
         }
 
@@ -628,65 +1670,1065 @@ static Exception vmExecuteProgram(QuarkVM *vm, int limit, int debug)
     return EX_OK;
 }
 
-static void vmPushNativeFunc(QuarkVM *vm, NativeVM nativeFunction)
+static Exception vmExecuteProgram(QuarkVM *vm, int limit, int debug)
 {
-    assert(vm->nativeFunctionsSize < VM_CAPACITY && "Number of native functions exceeds VM capacity.");
-    vm->nativeFunctions[vm->nativeFunctionsSize++] = nativeFunction;
+    VM_GUARD_STACK(vm, guard);
+    if (VM_STACK_OVERFLOWED(guard))
+    {
+        VM_RELEASE_STACK(guard);
+
+        vm->stackSize = VM_STACK_CAPACITY;
+        vmReportException(vm, EX_STACK_OVERFLOW);
+        return EX_STACK_OVERFLOW;
+    }
+
+    const Exception exception = vmExecuteLoop(vm, limit, debug);
+    VM_RELEASE_STACK(guard);
+    vmFlushOutput(vm);
+
+    return exception;
 }
 
-static void vmLoadProgramFromMemory(QuarkVM *quarkVm, Instruction *program, int programSize)
+// Seconds on a monotonic clock where there is one.
+static double vmSeconds(void)
 {
-    assert(programSize < VM_CAPACITY && "Program size exceeds VM capacity.");
-    memcpy(quarkVm->program, program, sizeof(program[0]) * programSize);
+    struct timespec now;
+#if defined(CLOCK_MONOTONIC)
+    clock_gettime(CLOCK_MONOTONIC, &now);
+#else
+    timespec_get(&now, TIME_UTC);
+#endif
+
+    return (double) now.tv_sec + (double) now.tv_nsec / 1e9;
+}
 
-    quarkVm->programSize = programSize;
+// The number of processors online, the default number of worker threads.
+static int64_t vmProcessorCount(void)
+{
+#if defined(_SC_NPROCESSORS_ONLN)
+    const long processors = sysconf(_SC_NPROCESSORS_ONLN);
+    return processors > 0 ? processors : 1;
+#else
+    return 4;
+#endif
 }
 
-static void vmLoadProgramFromFile(QuarkVM *quarkVm, const char *filePath)
+static uint64_t vmReadLE(const uint8_t *bytes, int count)
 {
-    FILE *file = fopen(filePath, "rb");
-    if (file == NULL)
-    {
-        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Failed to open file \"%s\" (%s)\n", filePath, strerror(errno));
-        exit(EXIT_FAILURE);
-    }
+    uint64_t value = 0;
+    for (int i = count - 1; i >= 0; --i) value = value << 8 | bytes[i];
 
-    if (fseek(file, 0, SEEK_END) < 0)
-    {
-        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Failed to read file \"%s\" (%s)\n", filePath, strerror(errno));
+    return value;
+}
+
+static void vmWriteLE(uint8_t *bytes, uint64_t value, int count)
+{
+    for (int i = 0; i < count; ++i, value >>= 8) bytes[i] = (uint8_t) value;
+}
+
+// Decodes the varint at `bytes`; the engines inline the one-byte case and only call this for longer
+// encodings, together with vmVarintLength.
+static uint64_t vmVarintValue(const uint8_t *bytes)
+{
+    uint64_t value = 0;
+    for (int shift = 0;; shift += 7, ++bytes)
+    {
+        value |= (uint64_t) (*bytes & 0x7F) << shift;
+        if (!(*bytes & 0x80)) return value;
+    }
+}
+
+static int vmVarintLength(const uint8_t *bytes)
+{
+    int length = 1;
+    while (bytes[length - 1] & 0x80) ++length;
+
+    return length;
+}
+
+static int vmWriteVarint(uint8_t *bytes, uint64_t value)
+{
+    int count = 0;
+    for (; value >= 0x80; value >>= 7) bytes[count++] = (uint8_t) (value | 0x80);
+    bytes[count++] = (uint8_t) value;
+
+    return count;
+}
+
+static uint64_t vmZigzag(int64_t value) { return ((uint64_t) value << 1) ^ (uint64_t) (value >> 63); }
+
+static int64_t vmUnzigzag(uint64_t value) { return (int64_t) (value >> 1) ^ -(int64_t) (value & 1); }
+
+#if defined(__GNUC__)
+#define VM_HAS_COMPUTED_GOTO 1
+
+#define VM_DISPATCH_NAME vmExecuteProgramThreaded
+#define VM_DISPATCH_CHECKED 1
+#include "dispatch.h"
+
+#define VM_DISPATCH_NAME vmExecuteProgramUnchecked
+#define VM_DISPATCH_CHECKED 0
+#include "dispatch.h"
+
+#define VM_DISPATCH_NAME vmExecuteProgramCounted
+#define VM_DISPATCH_CHECKED 1
+#define VM_DISPATCH_COUNTED 1
+#include "dispatch.h"
+
+#define VM_DISPATCH_NAME vmExecuteProgramCountedUnchecked
+#define VM_DISPATCH_CHECKED 0
+#define VM_DISPATCH_COUNTED 1
+#include "dispatch.h"
+
+#define VM_DISPATCH_NAME vmExecuteProgramProfiled
+#define VM_DISPATCH_CHECKED 1
+#define VM_DISPATCH_PROFILED 1
+#include "dispatch.h"
+
+#define VM_DISPATCH_NAME vmExecuteProgramProfiledUnchecked
+#define VM_DISPATCH_CHECKED 0
+#define VM_DISPATCH_PROFILED 1
+#include "dispatch.h"
+
+#define VM_DISPATCH_NAME vmExecuteCompact
+#define VM_DISPATCH_CHECKED 1
+#define VM_DISPATCH_COMPACT 1
+#include "dispatch.h"
+
+#define VM_DISPATCH_NAME vmExecuteCompactUnchecked
+#define VM_DISPATCH_CHECKED 0
+#define VM_DISPATCH_COMPACT 1
+#include "dispatch.h"
+
+#define VM_DISPATCH_NAME vmRunThreaded
+#define VM_DISPATCH_CHECKED 1
+#define VM_DISPATCH_METERED 1
+#include "dispatch.h"
+
+#define VM_DISPATCH_NAME vmRunUnchecked
+#define VM_DISPATCH_CHECKED 0
+#define VM_DISPATCH_METERED 1
+#include "dispatch.h"
+#else
+#define VM_HAS_COMPUTED_GOTO 0
+
+static Exception vmExecuteProgramThreaded(QuarkVM *vm) { return vmExecuteProgram(vm, -1, 0); }
+
+static Exception vmExecuteProgramUnchecked(QuarkVM *vm) { return vmExecuteProgram(vm, -1, 0); }
+
+static Exception vmExecuteProgramCounted(QuarkVM *vm) { return vmExecuteProgram(vm, -1, 0); }
+
+static Exception vmExecuteProgramCountedUnchecked(QuarkVM *vm) { return vmExecuteProgram(vm, -1, 0); }
+
+static Exception vmExecuteProgramProfiled(QuarkVM *vm) { return vmExecuteProgram(vm, -1, 0); }
+
+static Exception vmExecuteProgramProfiledUnchecked(QuarkVM *vm) { return vmExecuteProgram(vm, -1, 0); }
+
+static Exception vmExecuteCompact(QuarkVM *vm) { return vmExecuteProgram(vm, -1, 0); }
+
+static Exception vmExecuteCompactUnchecked(QuarkVM *vm) { return vmExecuteProgram(vm, -1, 0); }
+
+static Exception vmRunThreaded(QuarkVM *vm, uint64_t budget)
+{
+    return budget == 0 ? EX_OK : vmExecuteProgram(vm, budget < INT_MAX ? (int) budget : INT_MAX, 0);
+}
+
+static Exception vmRunUnchecked(QuarkVM *vm, uint64_t budget) { return vmRunThreaded(vm, budget); }
+#endif
+
+// Runs `vm` from `vm->instructionPointer` until it stops, raises an exception (which is reported and
+// returned) or has used up about `budget` instructions, and returns EX_OK with `vm->halt` unset in
+// the last case. The VM can then be resumed by calling vmRun again, so a host can time-slice many VMs
+// on one thread. The budget is checked once per basic block, so a run can overshoot it by one block;
+// `vm->instructionCount` and `vm->nativeCount` are always exact. A zero budget only decodes the program.
+// A run also returns at spawn, yield and join when `vm->scheduler` is set (see fiber.h).
+static Exception vmRun(QuarkVM *vm, uint64_t budget)
+{
+    return vm->verified ? vmRunUnchecked(vm, budget) : vmRunThreaded(vm, budget);
+}
+
+static void vmPushNativeFunc(QuarkVM *vm, NativeVM nativeFunction, int64_t inputs, int64_t outputs)
+{
+    vm->nativeFunctions = vmReserve(vm->nativeFunctions, &vm->nativeFunctionsCapacity, vm->nativeFunctionsSize + 1,
+                                    sizeof(vm->nativeFunctions[0]));
+    vm->nativeFunctions[vm->nativeFunctionsSize++] = (NativeFunction) {nativeFunction, inputs, outputs};
+}
+
+#define VM_DEPTH_UNKNOWN INT64_MIN
+#define VM_FUNCTION_NONE (-2)
+#define VM_FUNCTION_MAIN (-1)
+
+typedef struct
+{
+    int verified;
+    int64_t maxStackDepth;
+    int64_t *stackDepth;
+    int64_t *function;
+} VMVerification;
+
+typedef struct
+{
+    int state;
+    int64_t need;
+    int64_t peak;
+    int64_t net;
+} VMFunctionSummary;
+
+typedef struct
+{
+    const QuarkVM *vm;
+    VMVerification *result;
+    VMFunctionSummary *summaries;
+    // Where the return address pushed by invoke sits at each instruction, relative like the depth
+    // (VM_DEPTH_UNKNOWN in main).
+    int64_t *returnSlot;
+} VMVerifier;
+
+static int instructionStackEffect(const QuarkVM *vm, Instruction instruction, int64_t *required, int64_t *delta)
+{
+    switch (instruction.type)
+    {
+        case INST_KAPUT:
+        case INST_JUMP:
+        case INST_HALT:
+        case INST_YIELD:
+            *required = 0, *delta = 0;
+            return 1;
+        case INST_PUT:
+        case INST_INVOKE:
+            *required = 0, *delta = 1;
+            return 1;
+        case INST_DUP:
+            *required = instruction.value.asI64 + 1, *delta = 1;
+            return 1;
+        case INST_SWAP:
+            *required = instruction.value.asI64 + 1, *delta = 0;
+            return 1;
+        case INST_RELEASE:
+        case INST_JUMP_IF:
+        case INST_RETURN:
+            *required = 1, *delta = -1;
+            return 1;
+        case INST_INEQ:
+        case INST_FNEQ:
+        case INST_IPLUS_IMM:
+        case INST_IMINUS_IMM:
+        case INST_FPLUS_IMM:
+        case INST_FMINUS_IMM:
+        case INST_FMUL_IMM:
+        case INST_JUMP_IF_DUP:
+        case INST_SPAWN:
+        case INST_JOIN:
+            *required = 1, *delta = 0;
+            return 1;
+        case INST_JUMP_IF_NOT:
+            *required = 1, *delta = -1;
+            return 1;
+        case INST_ILOAD8:
+        case INST_ILOAD32:
+        case INST_ILOAD64:
+        case INST_FLOAD:
+            *required = 1, *delta = 0;
+            return 1;
+        case INST_ISTORE8:
+        case INST_ISTORE32:
+        case INST_ISTORE64:
+        case INST_FSTORE:
+            *required = 2, *delta = -2;
+            return 1;
+        case INST_MEMCPY:
+        case INST_MEMSET:
+            *required = 3, *delta = -3;
+            return 1;
+        case INST_MEMCMP:
+        case INST_VFDOT:
+        case INST_VIDOT:
+            *required = 3, *delta = -2;
+            return 1;
+        case INST_VFPLUS:
+        case INST_VFMINUS:
+        case INST_VFMUL:
+        case INST_VFDIV:
+        case INST_VFFMA:
+        case INST_VFLT:
+        case INST_VFEQ:
+        case INST_VIPLUS:
+        case INST_VIMINUS:
+        case INST_VIMUL:
+        case INST_VIDIV:
+        case INST_VIFMA:
+        case INST_VILT:
+        case INST_VIEQ:
+            *required = 4, *delta = -4;
+            return 1;
+        case INST_VFSUM:
+        case INST_VFMIN:
+        case INST_VFMAX:
+        case INST_VISUM:
+        case INST_VIMIN:
+        case INST_VIMAX:
+            *required = 2, *delta = -1;
+            return 1;
+        case INST_JUMP_IEQ:
+        case INST_JUMP_INEQ:
+        case INST_JUMP_IGT:
+        case INST_JUMP_ILT:
+        case INST_JUMP_IGEQ:
+        case INST_JUMP_ILEQ:
+        case INST_JUMP_FEQ:
+        case INST_JUMP_FGT:
+        case INST_JUMP_FLT:
+        case INST_JUMP_FGEQ:
+        case INST_JUMP_FLEQ:
+            *required = 2, *delta = -2;
+            return 1;
+        case INST_IPLUS:
+        case INST_IMINUS:
+        case INST_IMUL:
+        case INST_IDIV:
+        case INST_IMOD:
+        case INST_FPLUS:
+        case INST_FMINUS:
+        case INST_FMUL:
+        case INST_FDIV:
+        case INST_FMOD:
+        case INST_IEQ:
+        case INST_IGT:
+        case INST_ILT:
+        case INST_IGEQ:
+        case INST_ILEQ:
+        case INST_FEQ:
+        case INST_FGT:
+        case INST_FLT:
+        case INST_FGEQ:
+        case INST_FLEQ:
+            *required = 2, *delta = -1;
+            return 1;
+        case INST_NATIVE:
+            *required = vm->nativeFunctions[instruction.value.asI64].inputs;
+            *delta = vm->nativeFunctions[instruction.value.asI64].outputs - *required;
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static int vmVerifyError(const QuarkVM *vm, int64_t address, const char *message)
+{
+    fprintf(stderr, "[\033[1;31mERROR\033[0m]: Verification failed at Op %" PRId64 " (%s): %s\n", address,
+            (unsigned) vm->program[address].type < INST_COUNT ? getInstructionName(vm->program[address].type)
+                                                               : "?", message);
+    return 0;
+}
+
+static int vmVerifyInstruction(const QuarkVM *vm, int64_t address)
+{
+    const Instruction instruction = vm->program[address];
+    switch (instruction.type)
+    {
+        case INST_DUP:
+        case INST_SWAP:
+            if (instruction.value.asI64 < 0) return vmVerifyError(vm, address, "Negative stack offset");
+            break;
+        case INST_NATIVE:
+            if (instruction.value.asI64 < 0 || instruction.value.asI64 >= vm->nativeFunctionsSize)
+                return vmVerifyError(vm, address, "Unknown native function");
+            break;
+        default:
+            if ((unsigned) instruction.type >= INST_COUNT) return vmVerifyError(vm, address, "Invalid instruction");
+            if (instructionWithAddress(instruction.type) &&
+                (instruction.value.asI64 < 0 || instruction.value.asI64 >= vm->programSize))
+                return vmVerifyError(vm, address, "Target address out of range");
+            break;
+    }
+
+    return 1;
+}
+
+// Walks every instruction reachable from `entry` without entering callees, assigning each one
+// the stack depth relative to the caller's depth before the invoke (or to an empty stack for
+// main). Returns 0 on a hard error; shapes it cannot prove (loops that grow the stack,
+// recursion, code shared between functions, computed returns) only clear `verified`.
+//
+// A function starts with its return address at depth 1. `swap` may move it, but anything else
+// that reaches it (including a callee's arguments) makes the return target unprovable, and
+// `return` must find it on top.
+static int vmVerifyFunction(VMVerifier *verifier, int64_t entry)
+{
+    const QuarkVM *vm = verifier->vm;
+    VMVerification *result = verifier->result;
+
+    const int isMain = entry == VM_FUNCTION_MAIN;
+    const int64_t start = isMain ? 0 : entry, startDepth = isMain ? 0 : 1, startSlot = isMain ? VM_DEPTH_UNKNOWN : 0;
+    int64_t *returnSlot = verifier->returnSlot;
+
+    VMFunctionSummary mainSummary = {0};
+    VMFunctionSummary *summary = isMain ? &mainSummary : &verifier->summaries[entry];
+
+    int64_t *work = malloc(sizeof(work[0]) * vm->programSize), workSize = 0;
+    if (work == NULL)
+    {
+        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not allocate memory for the verifier (%s)\n",
+                strerror(errno));
         exit(EXIT_FAILURE);
     }
 
-    long fileSize = ftell(file);
-    if (fileSize < 0)
+    *summary = (VMFunctionSummary) {1, 0, startDepth, VM_DEPTH_UNKNOWN};
+
+#define VM_VERIFY_FAIL(address, message) do { vmVerifyError(vm, address, message); free(work); return 0; } while (0)
+#define VM_VERIFY_GIVE_UP() do { result->verified = 0; free(work); return 1; } while (0)
+#define VM_VERIFY_PUSH(from, target, depth, slot)                                               \
+    do {                                                                                        \
+        if ((target) >= vm->programSize) VM_VERIFY_FAIL(from, "Execution runs past the end of the program"); \
+        if (result->function[target] == VM_FUNCTION_NONE)                                       \
+        {                                                                                       \
+            result->function[target] = entry;                                                   \
+            result->stackDepth[target] = (depth);                                               \
+            returnSlot[target] = (slot);                                                        \
+            work[workSize++] = (target);                                                        \
+        } else if (result->function[target] != entry || result->stackDepth[target] != (depth) || \
+                   returnSlot[target] != (slot))                                                \
+            VM_VERIFY_GIVE_UP();                                                                \
+    } while (0)
+
+    if (result->function[start] != VM_FUNCTION_NONE) VM_VERIFY_GIVE_UP();
+    result->function[start] = entry;
+    result->stackDepth[start] = startDepth;
+    returnSlot[start] = startSlot;
+    work[workSize++] = start;
+
+    while (workSize > 0)
+    {
+        const int64_t address = work[--workSize], depth = result->stackDepth[address], slot = returnSlot[address];
+        const Instruction instruction = vm->program[address];
+
+        int64_t required = 0, delta = 0, nextSlot = slot;
+        instructionStackEffect(vm, instruction, &required, &delta);
+
+        if (slot != VM_DEPTH_UNKNOWN && depth - required <= slot)
+        {
+            if (instruction.type == INST_SWAP)
+            {
+                const int64_t other = depth - 1 - instruction.value.asI64;
+                if (slot == depth - 1) nextSlot = other;
+                else if (slot == other) nextSlot = depth - 1;
+            } else if (instruction.type != INST_RETURN) VM_VERIFY_GIVE_UP();
+        }
+
+        if (depth < required)
+        {
+            if (isMain) VM_VERIFY_FAIL(address, "Stack underflow");
+            if (required - depth > summary->need) summary->need = required - depth;
+        }
+        if (depth + delta > summary->peak) summary->peak = depth + delta;
+
+        switch (instruction.type)
+        {
+            case INST_HALT:
+                break;
+            case INST_SPAWN:
+                // A fiber starts at the target with a stack of its own, which this walk does not model.
+                VM_VERIFY_GIVE_UP();
+            case INST_JUMP:
+                VM_VERIFY_PUSH(address, instruction.value.asI64, depth, slot);
+                break;
+            case INST_RETURN:
+                if (isMain || slot != depth - 1) VM_VERIFY_GIVE_UP();
+                if (summary->net == VM_DEPTH_UNKNOWN) summary->net = depth + delta;
+                else if (summary->net != depth + delta) VM_VERIFY_GIVE_UP();
+                break;
+            case INST_INVOKE:
+            {
+                const int64_t callee = instruction.value.asI64;
+                if (verifier->summaries[callee].state == 1) VM_VERIFY_GIVE_UP();
+                if (verifier->summaries[callee].state == 0)
+                {
+                    if (!vmVerifyFunction(verifier, callee))
+                    {
+                        free(work);
+                        return 0;
+                    }
+                    if (!result->verified)
+                    {
+                        free(work);
+                        return 1;
+                    }
+                }
+
+                const VMFunctionSummary calleeSummary = verifier->summaries[callee];
+                if (slot != VM_DEPTH_UNKNOWN && depth - calleeSummary.need <= slot) VM_VERIFY_GIVE_UP();
+                if (depth < calleeSummary.need)
+                {
+                    if (isMain) VM_VERIFY_FAIL(address, "Stack underflow in invoked function");
+                    if (calleeSummary.need - depth > summary->need) summary->need = calleeSummary.need - depth;
+                }
+                if (depth + calleeSummary.peak > summary->peak) summary->peak = depth + calleeSummary.peak;
+                if (calleeSummary.net != VM_DEPTH_UNKNOWN)
+                    VM_VERIFY_PUSH(address, address + 1, depth + calleeSummary.net, slot);
+                break;
+            }
+            default:
+                if (instructionWithAddress(instruction.type))
+                    VM_VERIFY_PUSH(address, instruction.value.asI64, depth + delta, nextSlot);
+                VM_VERIFY_PUSH(address, address + 1, depth + delta, nextSlot);
+                break;
+        }
+    }
+
+#undef VM_VERIFY_FAIL
+#undef VM_VERIFY_GIVE_UP
+#undef VM_VERIFY_PUSH
+
+    summary->state = 2;
+    if (isMain) result->maxStackDepth = summary->peak;
+
+    free(work);
+    return 1;
+}
+
+static void vmFreeVerification(VMVerification *verification)
+{
+    free(verification->stackDepth);
+    free(verification->function);
+    *verification = (VMVerification) {0};
+}
+
+// Checks the loaded program once before it runs. Programs with an invalid opcode, operand, jump or
+// invoke target, or native index, or with a guaranteed stack underflow, are rejected (returns 0).
+// Accepted programs whose stack depth could be proven at every reachable instruction and stays
+// within VM_STACK_CAPACITY are marked `verified` and may run on vmExecuteProgramUnchecked.
+static int vmVerifyProgram(const QuarkVM *vm, VMVerification *result)
+{
+    *result = (VMVerification) {1, 0, malloc(sizeof(int64_t) * (vm->programSize + 1)),
+                                malloc(sizeof(int64_t) * (vm->programSize + 1))};
+    VMFunctionSummary *summaries = calloc(vm->programSize + 1, sizeof(summaries[0]));
+    int64_t *returnSlot = malloc(sizeof(returnSlot[0]) * (vm->programSize + 1));
+    if (result->stackDepth == NULL || result->function == NULL || summaries == NULL || returnSlot == NULL)
+    {
+        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not allocate memory for the verifier (%s)\n",
+                strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    for (int64_t i = 0; i < vm->programSize; ++i)
+    {
+        result->stackDepth[i] = VM_DEPTH_UNKNOWN;
+        result->function[i] = VM_FUNCTION_NONE;
+
+        if (!vmVerifyInstruction(vm, i))
+        {
+            free(summaries);
+            free(returnSlot);
+            vmFreeVerification(result);
+            return 0;
+        }
+    }
+
+    if (vm->programSize == 0) result->verified = 0;
+    else
+    {
+        VMVerifier verifier = {vm, result, summaries, returnSlot};
+        if (!vmVerifyFunction(&verifier, VM_FUNCTION_MAIN))
+        {
+            free(summaries);
+            free(returnSlot);
+            vmFreeVerification(result);
+            return 0;
+        }
+    }
+
+    if (result->maxStackDepth > VM_STACK_CAPACITY) result->verified = 0;
+
+    free(summaries);
+    free(returnSlot);
+    return 1;
+}
+
+// Whether the program uses spawn, yield or join, and so has to run on the fiber scheduler.
+static int vmUsesFibers(const QuarkVM *vm)
+{
+    for (int64_t i = 0; i < vm->programSize; ++i)
+        if (vm->program[i].type == INST_SPAWN || vm->program[i].type == INST_YIELD || vm->program[i].type == INST_JOIN)
+            return 1;
+
+    return 0;
+}
+
+static void vmLoadProgramFromMemory(QuarkVM *quarkVm, const Instruction *program, int64_t programSize)
+{
+    if (quarkVm->programBorrowed) vmReleaseImage(quarkVm);
+    vmReleaseCompact(quarkVm);
+    vmReleaseThreaded(quarkVm);
+
+    quarkVm->program = vmReserve(quarkVm->program, &quarkVm->programCapacity, programSize, sizeof(program[0]));
+    memcpy(quarkVm->program, program, sizeof(program[0]) * programSize);
+
+    quarkVm->programSize = programSize;
+}
+
+// Whether an encoded instruction record (u32 opcode, 4 bytes of padding, 64-bit little-endian
+// operand) has the same layout as `Instruction`, so that code sections can be executed in place.
+static int vmLittleEndian(void)
+{
+    const uint16_t probe = 1;
+    return *(const uint8_t *) &probe == 1;
+}
+
+static int vmNativeInstructionLayout(void)
+{
+    return sizeof(Instruction) == VM_QCE_INSTRUCTION_BYTES && sizeof(InstructionType) == 4 &&
+           offsetof(Instruction, value) == 8 && vmLittleEndian();
+}
+
+static void vmInvalidBytecode(const char *filePath, const char *reason)
+{
+    fprintf(stderr, "[\033[1;31mERROR\033[0m]: Invalid bytecode file \"%s\" (%s)\n", filePath, reason);
+    exit(EXIT_FAILURE);
+}
+
+// Maps (or, without mmap, reads) the whole file into `quarkVm->image`.
+static void vmMapImage(QuarkVM *quarkVm, const char *filePath)
+{
+#if VM_HAS_MMAP
+    const int file = open(filePath, O_RDONLY);
+    struct stat status;
+    if (file < 0 || fstat(file, &status) != 0)
+    {
+        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Failed to open file \"%s\" (%s)\n", filePath, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    quarkVm->imageSize = (size_t) status.st_size;
+    if (quarkVm->imageSize > 0)
+    {
+        quarkVm->image = mmap(NULL, quarkVm->imageSize, PROT_READ, MAP_PRIVATE, file, 0);
+        if (quarkVm->image == MAP_FAILED)
+        {
+            fprintf(stderr, "[\033[1;31mERROR\033[0m]: Failed to map file \"%s\" (%s)\n", filePath, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        quarkVm->imageMapped = 1;
+    }
+
+    close(file);
+#else
+    FILE *file = fopen(filePath, "rb");
+    if (file == NULL || fseek(file, 0, SEEK_END) < 0)
+    {
+        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Failed to open file \"%s\" (%s)\n", filePath, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    const long fileSize = ftell(file);
+    quarkVm->image = malloc(fileSize > 0 ? fileSize : 1);
+    if (fileSize < 0 || quarkVm->image == NULL || fseek(file, 0, SEEK_SET) < 0 ||
+        fread(quarkVm->image, 1, fileSize, file) != (size_t) fileSize)
+    {
+        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Failed to read file \"%s\" (%s)\n", filePath, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    quarkVm->imageSize = (size_t) fileSize;
+    fclose(file);
+#endif
+}
+
+static int vmReadVarintChecked(const uint8_t *code, uint64_t end, uint64_t *position, uint64_t *value)
+{
+    *value = 0;
+    for (int shift = 0; shift < 64 && *position < end; shift += 7)
+    {
+        const uint8_t byte = code[(*position)++];
+        *value |= (uint64_t) (byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return 1;
+    }
+
+    return 0;
+}
+
+// Validates the compact code section, builds its offset tables and decodes it into `program` for
+// the verifier and the other engines.
+static void vmDecodeCompact(QuarkVM *quarkVm, const uint8_t *code, uint64_t size, uint64_t count,
+                            const char *filePath)
+{
+    if (size == 0 || size > UINT32_MAX || count >= size || code[size - 1] != VM_COMPACT_END)
+        vmInvalidBytecode(filePath, "malformed compact code section");
+
+    VMCompactCode *compact = &quarkVm->compact;
+    compact->code = code;
+    compact->size = (int64_t) size;
+    compact->offsets = malloc(sizeof(compact->offsets[0]) * (count + 1));
+    compact->indices = malloc(sizeof(compact->indices[0]) * size);
+    quarkVm->program = vmReserve(NULL, &quarkVm->programCapacity, (int64_t) count, sizeof(Instruction));
+    if (compact->offsets == NULL || compact->indices == NULL)
+    {
+        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not allocate memory for \"%s\" (%s)\n", filePath,
+                strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    memset(compact->indices, 0xFF, sizeof(compact->indices[0]) * size);
+
+    uint64_t position = 0, value = 0;
+    for (uint64_t i = 0; i < count; ++i)
+    {
+        if (position >= size - 1 || code[position] >= INST_COUNT)
+            vmInvalidBytecode(filePath, "invalid opcode in compact code");
+
+        const InstructionType type = code[position];
+        compact->offsets[i] = (uint32_t) position;
+        compact->indices[position++] = (uint32_t) i;
+
+        Instruction instruction = {type, {0}};
+        if (instructionWithAddress(type))
+        {
+            if (size - 1 - position < 4) vmInvalidBytecode(filePath, "truncated compact code");
+            instruction.value.asI64 = (int64_t) vmReadLE(code + position, 4);
+            position += 4;
+        } else if (instructionWithOperand(type))
+        {
+            if (!vmReadVarintChecked(code, size - 1, &position, &value))
+                vmInvalidBytecode(filePath, "truncated compact code");
+
+            if (instructionWithInteger(type)) instruction.value.asI64 = vmUnzigzag(value);
+            else if (!(value & 1)) instruction.value.asI64 = vmUnzigzag(value >> 1);
+            else if ((value >> 1) < (uint64_t) compact->constantCount)
+                instruction.value = compact->constants[value >> 1];
+            else vmInvalidBytecode(filePath, "constant index out of range");
+        }
+
+        quarkVm->program[i] = instruction;
+    }
+
+    if (position != size - 1) vmInvalidBytecode(filePath, "trailing bytes in compact code");
+    compact->offsets[count] = (uint32_t) position;
+    compact->indices[position] = (uint32_t) count;
+
+    for (uint64_t i = 0; i < count; ++i)
+        if (instructionWithAddress(quarkVm->program[i].type))
+        {
+            const uint64_t target = (uint64_t) quarkVm->program[i].value.asI64;
+            if (target >= size || compact->indices[target] == UINT32_MAX)
+                vmInvalidBytecode(filePath, "jump into the middle of an instruction");
+
+            quarkVm->program[i].value.asI64 = compact->indices[target];
+        }
+
+    quarkVm->programSize = (int64_t) count;
+}
+
+// Whether a section of `size` bytes holds exactly `count` entries of `entrySize` bytes. Divides
+// instead of multiplying, since a crafted `count` can make `count * entrySize` wrap.
+static int vmSectionHolds(uint64_t size, uint64_t count, uint64_t entrySize)
+{
+    return size % entrySize == 0 && size / entrySize == count;
+}
+
+// Symbol and native records (see vmNextRecord) take at least this many bytes each.
+#define VM_QCE_RECORD_MIN_BYTES 16
+
+// Loads a .qce file. Version 2 files start with a 16 byte header (magic, u16 version, u16 section
+// count, 8 reserved bytes) followed by a table of 32 byte section entries (u32 type, u32 entry size,
+// u64 offset, u64 size, u64 entry count); sections start on VM_QCE_ALIGNMENT byte boundaries and all
+// integers are little-endian. The program is either a code section of fixed 16 byte records or a
+// compact code section (see VMCompactCode) with its constants section. On hosts where a fixed record
+// matches `Instruction`, the program points straight into the read-only mapping, as does the compact
+// code. Headerless files are the raw `Instruction` dumps written before version 2.
+static void vmLoadProgramFromFile(QuarkVM *quarkVm, const char *filePath)
+{
+    if (!quarkVm->programBorrowed) free(quarkVm->program);
+    vmReleaseImage(quarkVm);
+    quarkVm->program = NULL;
+    quarkVm->programSize = quarkVm->programCapacity = 0;
+
+    vmMapImage(quarkVm, filePath);
+    const uint8_t *image = quarkVm->image;
+    const uint64_t imageSize = quarkVm->imageSize;
+
+    if (imageSize < VM_QCE_HEADER_BYTES || memcmp(image, VM_QCE_MAGIC, 4) != 0)
+    {
+        if (imageSize % sizeof(Instruction) != 0) vmInvalidBytecode(filePath, "unknown format");
+        if (imageSize == 0) vmInvalidBytecode(filePath, "empty program");
+
+        vmLoadProgramFromMemory(quarkVm, (const Instruction *) image, (int64_t) (imageSize / sizeof(Instruction)));
+        vmReleaseImage(quarkVm);
+        return;
+    }
+
+    if (vmReadLE(image + 4, 2) != VM_QCE_VERSION) vmInvalidBytecode(filePath, "unsupported version");
+
+    const uint64_t sectionCount = vmReadLE(image + 6, 2);
+    if (VM_QCE_HEADER_BYTES + sectionCount * VM_QCE_SECTION_BYTES > imageSize)
+        vmInvalidBytecode(filePath, "truncated section table");
+
+    int hasCode = 0;
+    const uint8_t *compactCode = NULL;
+    uint64_t compactSize = 0, compactCount = 0;
+    for (uint64_t i = 0; i < sectionCount; ++i)
+    {
+        const uint8_t *section = image + VM_QCE_HEADER_BYTES + i * VM_QCE_SECTION_BYTES;
+        const uint64_t type = vmReadLE(section, 4), entrySize = vmReadLE(section + 4, 4);
+        const uint64_t offset = vmReadLE(section + 8, 8), size = vmReadLE(section + 16, 8);
+        const uint64_t count = vmReadLE(section + 24, 8);
+
+        if (offset % VM_QCE_ALIGNMENT != 0 || offset > imageSize || size > imageSize - offset)
+            vmInvalidBytecode(filePath, "section out of bounds");
+
+        if (type == VM_SECTION_CODE)
+        {
+            if (entrySize != VM_QCE_INSTRUCTION_BYTES || !vmSectionHolds(size, count, VM_QCE_INSTRUCTION_BYTES))
+                vmInvalidBytecode(filePath, "malformed code section");
+            if (count == 0) vmInvalidBytecode(filePath, "empty code section");
+
+            if (vmNativeInstructionLayout())
+            {
+                quarkVm->program = (Instruction *) (image + offset);
+                quarkVm->programBorrowed = 1;
+            } else
+            {
+                quarkVm->program = vmReserve(NULL, &quarkVm->programCapacity, (int64_t) count, sizeof(Instruction));
+                for (uint64_t j = 0; j < count; ++j)
+                {
+                    quarkVm->program[j].type = (InstructionType) vmReadLE(image + offset + j * entrySize, 4);
+                    quarkVm->program[j].value.asI64 = (int64_t) vmReadLE(image + offset + j * entrySize + 8, 8);
+                }
+            }
+
+            quarkVm->programSize = (int64_t) count;
+            hasCode = 1;
+        } else if (type == VM_SECTION_COMPACT_CODE)
+        {
+            if (count == 0) vmInvalidBytecode(filePath, "empty code section");
+
+            compactCode = image + offset;
+            compactSize = size;
+            compactCount = count;
+            hasCode = 1;
+        } else if (type == VM_SECTION_CONSTANTS)
+        {
+            if (entrySize != sizeof(Word) || !vmSectionHolds(size, count, sizeof(Word)))
+                vmInvalidBytecode(filePath, "malformed constants section");
+
+            if (vmLittleEndian()) quarkVm->compact.constants = (const Word *) (image + offset);
+            else
+            {
+                int64_t capacity = 0;
+                quarkVm->compact.ownedConstants = vmReserve(NULL, &capacity, (int64_t) count, sizeof(Word));
+                for (uint64_t j = 0; j < count; ++j)
+                    quarkVm->compact.ownedConstants[j].asI64 = (int64_t) vmReadLE(image + offset + j * sizeof(Word), 8);
+
+                quarkVm->compact.constants = quarkVm->compact.ownedConstants;
+            }
+
+            quarkVm->compact.constantCount = (int64_t) count;
+        } else if (type == VM_SECTION_SYMBOLS)
+        {
+            if (count > size / VM_QCE_RECORD_MIN_BYTES) vmInvalidBytecode(filePath, "malformed symbols section");
+
+            quarkVm->symbols = image + offset;
+            quarkVm->symbolsSize = (int64_t) size;
+        } else if (type == VM_SECTION_NATIVES)
+        {
+            if (count > size / VM_QCE_RECORD_MIN_BYTES) vmInvalidBytecode(filePath, "malformed natives section");
+
+            quarkVm->imports = image + offset;
+            quarkVm->importsSize = (int64_t) size;
+        } else if (type == VM_SECTION_RELOCATIONS)
+            vmInvalidBytecode(filePath, "relocatable object, link it with quarkl first");
+    }
+
+    if (!hasCode) vmInvalidBytecode(filePath, "missing code section");
+    if (compactCode != NULL) vmDecodeCompact(quarkVm, compactCode, compactSize, compactCount, filePath);
+}
+
+// Iterates a section of named records: u64 value, u32 name length, then the name padded to a
+// multiple of 8 bytes. Returns 0 at the end or on a malformed record.
+static int vmNextRecord(const uint8_t *records, int64_t size, int64_t *cursor, StringView *name, int64_t *value)
+{
+    if (*cursor < 0 || size - *cursor < 12) return 0;
+
+    const uint8_t *record = records + *cursor;
+    const int64_t length = (int64_t) vmReadLE(record + 8, 4);
+    if (length > size - *cursor - 12) return 0;
+
+    *value = (int64_t) vmReadLE(record, 8);
+    *name = (StringView) {length, (const char *) record + 12};
+    *cursor += (12 + length + 7) & ~(int64_t) 7;
+
+    return 1;
+}
+
+// Iterates the symbols section, which holds one record per label in address order.
+static int vmNextSymbol(const QuarkVM *vm, int64_t *cursor, StringView *name, int64_t *address)
+{
+    return vmNextRecord(vm->symbols, vm->symbolsSize, cursor, name, address);
+}
+
+// Iterates the natives section, which holds one record per native called by name, in index order.
+static int vmNextImport(const QuarkVM *vm, int64_t *cursor, StringView *name, int64_t *index)
+{
+    return vmNextRecord(vm->imports, vm->importsSize, cursor, name, index);
+}
+
+// Encodes the program in the compact format (see VMCompactCode). Integer literals whose zigzag form
+// fits in 27 bits are stored inline; every other literal goes through the deduplicated constant pool.
+static void vmEncodeCompact(const QuarkVM *vm, uint8_t **code, uint64_t *codeSize, Word **constants,
+                            int64_t *constantCount)
+{
+    const int64_t programSize = vm->programSize;
+    uint64_t *operands = malloc(sizeof(operands[0]) * (programSize + 1));
+    uint64_t *offsets = malloc(sizeof(offsets[0]) * (programSize + 1));
+    int64_t slotCapacity = 64, constantCapacity = 0;
+    while (slotCapacity < programSize * 2) slotCapacity *= 2;
+    int64_t *slots = calloc(slotCapacity, sizeof(slots[0]));
+    uint8_t scratch[10];
+
+    if (operands == NULL || offsets == NULL || slots == NULL)
     {
-        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Failed to read file \"%s\" (%s)\n", filePath, strerror(errno));
+        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not allocate memory for compact code (%s)\n",
+                strerror(errno));
         exit(EXIT_FAILURE);
     }
 
-    assert(fileSize % sizeof(quarkVm->program[0]) == 0 && "Invalid bytecode");
-    assert((size_t) fileSize <= VM_CAPACITY * sizeof(quarkVm->program[0]) && "Bytecode too large");
+    *constants = NULL;
+    *constantCount = 0;
+    uint64_t size = 0;
+    for (int64_t i = 0; i < programSize; ++i)
+    {
+        const Instruction instruction = vm->program[i];
+        offsets[i] = size++;
+
+        if (instructionWithAddress(instruction.type)) size += 4;
+        else if (instructionWithInteger(instruction.type))
+        {
+            operands[i] = vmZigzag(instruction.value.asI64);
+            size += vmWriteVarint(scratch, operands[i]);
+        } else if (instructionWithOperand(instruction.type))
+        {
+            const uint64_t key = (uint64_t) instruction.value.asI64;
+            if (vmZigzag(instruction.value.asI64) < (1u << 27)) operands[i] = vmZigzag(instruction.value.asI64) << 1;
+            else
+            {
+                uint64_t slot = (key * 0x9E3779B97F4A7C15ULL) >> 32 & (slotCapacity - 1);
+                while (slots[slot] != 0 && (uint64_t) (*constants)[slots[slot] - 1].asI64 != key)
+                    slot = (slot + 1) & (slotCapacity - 1);
+
+                if (slots[slot] == 0)
+                {
+                    *constants = vmReserve(*constants, &constantCapacity, *constantCount + 1, sizeof(Word));
+                    (*constants)[(*constantCount)++] = instruction.value;
+                    slots[slot] = *constantCount;
+                }
+
+                operands[i] = (uint64_t) (slots[slot] - 1) << 1 | 1;
+            }
+
+            size += vmWriteVarint(scratch, operands[i]);
+        }
+    }
+    offsets[programSize] = size++;
 
-    if (fseek(file, 0, SEEK_SET) < 0)
+    *code = malloc(size);
+    if (*code == NULL || size > UINT32_MAX)
     {
-        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Failed to read file \"%s\" (%s)\n", filePath, strerror(errno));
+        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not encode compact code (%" PRIu64 " bytes)\n", size);
         exit(EXIT_FAILURE);
     }
 
-    quarkVm->programSize = (int) fread(quarkVm->program, sizeof(quarkVm->program[0]),
-                                       fileSize / sizeof(quarkVm->program[0]), file);
+    uint8_t *cursor = *code;
+    for (int64_t i = 0; i < programSize; ++i)
+    {
+        const Instruction instruction = vm->program[i];
+        *cursor++ = (uint8_t) instruction.type;
+
+        if (instructionWithAddress(instruction.type))
+        {
+            const uint64_t target = (uint64_t) instruction.value.asI64;
+            vmWriteLE(cursor, offsets[target < (uint64_t) programSize ? target : (uint64_t) programSize], 4);
+            cursor += 4;
+        } else if (instructionWithOperand(instruction.type)) cursor += vmWriteVarint(cursor, operands[i]);
+    }
+    *cursor = VM_COMPACT_END;
+
+    *codeSize = size;
+    free(operands);
+    free(offsets);
+    free(slots);
+}
 
-    if (ferror(file))
+static int vmCompareFunctions(const void *a, const void *b)
+{
+    const int64_t first = ((const Function *) a)->address, second = ((const Function *) b)->address;
+    return (first > second) - (first < second);
+}
+
+static uint64_t vmAlignSection(uint64_t offset)
+{
+    return (offset + VM_QCE_ALIGNMENT - 1) & ~(uint64_t) (VM_QCE_ALIGNMENT - 1);
+}
+
+// Encodes `records` for vmNextRecord, with each label's address as its value. Returns NULL if out of memory.
+static uint8_t *vmEncodeRecords(const Function *records, int64_t count, uint64_t *size)
+{
+    *size = 0;
+    for (int64_t i = 0; i < count; ++i) *size += (12 + records[i].function.count + 7) & ~(int64_t) 7;
+
+    uint8_t *data = calloc(*size + 1, 1);
+    for (uint8_t *record = data; record != NULL && record < data + *size; ++records)
     {
-        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Failed to read file \"%s\" (%s)\n", filePath, strerror(errno));
-        exit(EXIT_FAILURE);
+        vmWriteLE(record, (uint64_t) records->address, 8);
+        vmWriteLE(record + 8, (uint64_t) records->function.count, 4);
+        memcpy(record + 12, records->function.data, records->function.count);
+        record += (12 + records->function.count + 7) & ~(int64_t) 7;
     }
 
-    fclose(file);
+    return data;
 }
 
-static void vmSaveProgramToFile(const QuarkVM *vm, const char *filePath)
+// Lays out `sections` as a version 2 .qce image (see vmLoadProgramFromFile), writes it to `filePath`
+// and frees the section data.
+static void vmWriteSections(Section *sections, int sectionCount, const char *filePath)
 {
+    uint64_t imageSize = VM_QCE_HEADER_BYTES + (uint64_t) sectionCount * VM_QCE_SECTION_BYTES;
+    for (int i = 0; i < sectionCount; ++i)
+    {
+        if (sections[i].data == NULL)
+        {
+            fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not allocate memory for \"%s\" (%s).\n", filePath,
+                    strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        sections[i].offset = vmAlignSection(imageSize);
+        imageSize = sections[i].offset + sections[i].size;
+    }
+
+    uint8_t *image = calloc(imageSize, 1);
+    if (image == NULL)
+    {
+        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not allocate memory for \"%s\" (%s).\n", filePath,
+                strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    memcpy(image, VM_QCE_MAGIC, 4);
+    vmWriteLE(image + 4, VM_QCE_VERSION, 2);
+    vmWriteLE(image + 6, (uint64_t) sectionCount, 2);
+
+    for (int i = 0; i < sectionCount; ++i)
+    {
+        uint8_t *section = image + VM_QCE_HEADER_BYTES + i * VM_QCE_SECTION_BYTES;
+        vmWriteLE(section, sections[i].type, 4);
+        vmWriteLE(section + 4, sections[i].entrySize, 4);
+        vmWriteLE(section + 8, sections[i].offset, 8);
+        vmWriteLE(section + 16, sections[i].size, 8);
+        vmWriteLE(section + 24, sections[i].count, 8);
+
+        memcpy(image + sections[i].offset, sections[i].data, sections[i].size);
+        free(sections[i].data);
+    }
+
     FILE *file = fopen(filePath, "wb");
     if (file == NULL)
     {
@@ -694,7 +2736,7 @@ static void vmSaveProgramToFile(const QuarkVM *vm, const char *filePath)
         exit(EXIT_FAILURE);
     }
 
-    fwrite(vm->program, sizeof(vm->program[0]), vm->programSize, file);
+    fwrite(image, 1, imageSize, file);
     if (ferror(file))
     {
         fprintf(stderr, "[\033[1;31mERROR\033[0m]: Failed to write to file \"%s\" (%s).\n", filePath, strerror(errno));
@@ -702,175 +2744,557 @@ static void vmSaveProgramToFile(const QuarkVM *vm, const char *filePath)
     }
 
     fclose(file);
+    free(image);
 }
 
-static int64_t vmTableFindAddress(const VMTable *table, StringView function)
+// Writes a version 2 .qce file (see vmLoadProgramFromFile), with fixed-size or compact code.
+// `vmTable` may be NULL, in which case no symbols section is emitted.
+static void vmSaveProgramToFile(const QuarkVM *vm, const VMTable *vmTable, int compact, const char *filePath)
 {
-    for (int64_t i = 0; i < table->functionSize; ++i)
-        if (sv_equals(table->functions[i].function, function)) return table->functions[i].address;
+    Section sections[4];
+    int sectionCount = 0;
 
-    fprintf(stderr, "[\033[1;31mERROR\033[0m]: Function \"%.*s\" does not exist.\n", (int) function.count,
-            function.data);
-    exit(EXIT_FAILURE);
+    if (compact)
+    {
+        uint8_t *code = NULL;
+        uint64_t codeSize = 0;
+        Word *constants = NULL;
+        int64_t constantCount = 0;
+        vmEncodeCompact(vm, &code, &codeSize, &constants, &constantCount);
+
+        uint8_t *pool = malloc(sizeof(Word) * constantCount + 1);
+        for (int64_t i = 0; pool != NULL && i < constantCount; ++i)
+            vmWriteLE(pool + i * sizeof(Word), (uint64_t) constants[i].asI64, 8);
+        free(constants);
+
+        sections[sectionCount++] = (Section) {VM_SECTION_COMPACT_CODE, 1, 0, codeSize, (uint64_t) vm->programSize,
+                                              code};
+        sections[sectionCount++] = (Section) {VM_SECTION_CONSTANTS, sizeof(Word), 0, sizeof(Word) * constantCount,
+                                              (uint64_t) constantCount, pool};
+    } else
+    {
+        uint8_t *code = malloc(VM_QCE_INSTRUCTION_BYTES * vm->programSize + 1);
+        for (int64_t i = 0; code != NULL && i < vm->programSize; ++i)
+        {
+            vmWriteLE(code + i * VM_QCE_INSTRUCTION_BYTES, (uint64_t) vm->program[i].type, 4);
+            vmWriteLE(code + i * VM_QCE_INSTRUCTION_BYTES + 4, 0, 4);
+            vmWriteLE(code + i * VM_QCE_INSTRUCTION_BYTES + 8, (uint64_t) vm->program[i].value.asI64, 8);
+        }
+
+        sections[sectionCount++] = (Section) {VM_SECTION_CODE, VM_QCE_INSTRUCTION_BYTES, 0,
+                                              VM_QCE_INSTRUCTION_BYTES * vm->programSize, (uint64_t) vm->programSize,
+                                              code};
+    }
+
+    const int64_t symbolCount = vmTable != NULL ? vmTable->functionSize : 0;
+    if (symbolCount > 0)
+    {
+        Function *symbols = malloc(sizeof(symbols[0]) * symbolCount);
+        uint64_t symbolsSize = 0;
+        uint8_t *data = NULL;
+        if (symbols != NULL)
+        {
+            memcpy(symbols, vmTable->functions, sizeof(symbols[0]) * symbolCount);
+            qsort(symbols, symbolCount, sizeof(symbols[0]), vmCompareFunctions);
+            data = vmEncodeRecords(symbols, symbolCount, &symbolsSize);
+        }
+
+        free(symbols);
+        sections[sectionCount++] = (Section) {VM_SECTION_SYMBOLS, 0, 0, symbolsSize, (uint64_t) symbolCount, data};
+    }
+
+    if (vmTable != NULL && vmTable->importSize > 0)
+    {
+        uint64_t importsSize = 0;
+        uint8_t *data = vmEncodeRecords(vmTable->imports, vmTable->importSize, &importsSize);
+        sections[sectionCount++] = (Section) {VM_SECTION_NATIVES, 0, 0, importsSize, (uint64_t) vmTable->importSize,
+                                              data};
+    }
+
+    vmWriteSections(sections, sectionCount, filePath);
 }
 
-static void vmTablePushFunction(VMTable *table, StringView function, int64_t address)
+static uint64_t vmTableHash(StringView function)
 {
-    assert(table->functionSize < VM_CAPACITY && "Number of functions exceeds VM capacity.");
-    table->functions[table->functionSize++] = (Function) {function, address};
+    uint64_t hash = 14695981039346656037ULL;
+    for (int64_t i = 0; i < function.count; ++i) hash = (hash ^ (unsigned char) function.data[i]) * 1099511628211ULL;
+
+    return hash;
 }
 
-static void vmTablePushHoisted(VMTable *table, int64_t address, StringView function)
+static int64_t *vmTableSlot(const VMTable *table, StringView function)
 {
-    assert(table->hoistedFunctionSize < VM_CAPACITY && "Number of hoisted functions exceeds VM capacity.");
-    table->hoistedFunctions[table->hoistedFunctionSize++] = (Hoisted) {function, address};
+    const uint64_t mask = (uint64_t) table->slotCapacity - 1;
+    for (uint64_t i = vmTableHash(function) & mask;; i = (i + 1) & mask)
+        if (table->slots[i] == 0 || sv_equals(table->functions[table->slots[i] - 1].function, function))
+            return &table->slots[i];
 }
 
-static Word numberToWord(StringView source)
+// Copies `name` into the table's name blocks.
+static StringView vmTableIntern(VMTable *table, StringView name)
 {
-    assert(source.count < VM_CAPACITY && "Number literal exceeds VM capacity.");
-    char cString[VM_CAPACITY], *endPtr = NULL;
+    VMNameBlock *block = table->names;
+    if (block == NULL || block->capacity - block->size < name.count)
+    {
+        const int64_t capacity = name.count > VM_NAME_BLOCK_BYTES ? name.count : VM_NAME_BLOCK_BYTES;
+        block = malloc(sizeof(VMNameBlock) + capacity);
+        if (block == NULL)
+        {
+            fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not allocate memory for labels (%s)\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        *block = (VMNameBlock) {table->names, 0, capacity};
+        table->names = block;
+    }
 
-    memcpy(cString, source.data, source.count);
-    cString[source.count] = '\0';
+    char *data = block->data + block->size;
+    memcpy(data, name.data, name.count);
+    block->size += name.count;
 
-    Word result = {0};
-    result.asI64 = strtoll(cString, &endPtr, 10);
+    return (StringView) {name.count, data};
+}
 
-    if ((endPtr - cString) != source.count)
+static int64_t vmTableLookup(VMTable *table, StringView function, int line)
+{
+    if (table->slotCapacity == 0 || (table->functionSize + 1) * 2 > table->slotCapacity)
     {
-        result.asF64 = strtod(cString, &endPtr);
-        if ((endPtr - cString) != source.count)
+        const int64_t slotCapacity = table->slotCapacity > 0 ? table->slotCapacity * 2 : 64;
+        int64_t *slots = calloc(slotCapacity, sizeof(slots[0]));
+        if (slots == NULL)
         {
-            fprintf(stderr, "[\033[1;31mERROR\033[0m]: Invalid number literal \"%s\"\n", cString);
+            fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not allocate memory for labels (%s)\n", strerror(errno));
             exit(EXIT_FAILURE);
         }
+
+        free(table->slots);
+        table->slots = slots;
+        table->slotCapacity = slotCapacity;
+
+        for (int64_t i = 0; i < table->functionSize; ++i)
+            *vmTableSlot(table, table->functions[i].function) = i + 1;
+    }
+
+    int64_t *slot = vmTableSlot(table, function);
+    if (*slot == 0)
+    {
+        table->functions = vmReserve(table->functions, &table->functionCapacity, table->functionSize + 1,
+                                     sizeof(table->functions[0]));
+        table->functions[table->functionSize++] = (Function) {vmTableIntern(table, function), -1, -1, line,
+                                                              VM_LINK_LOCAL};
+        *slot = table->functionSize;
+    }
+
+    return *slot - 1;
+}
+
+// Defines `function` at `address` and backpatches every earlier reference to it.
+static void vmTableDefine(VMTable *table, QuarkVM *vm, StringView function, int64_t address, int line,
+                          const char *inputFilePath)
+{
+    const int64_t index = vmTableLookup(table, function, line);
+    Function *entry = &table->functions[index];
+    if (entry->linkage == VM_LINK_IMPORT)
+    {
+        fprintf(stderr, "[\033[1;31mERROR\033[0m]: (In file \"%s\"): Label \"%.*s\" on line %d is imported (on line %d).\n",
+                inputFilePath, (int) function.count, function.data, line, entry->line);
+        exit(EXIT_FAILURE);
+    }
+
+    if (entry->address >= 0)
+    {
+        fprintf(stderr,
+                "[\033[1;31mERROR\033[0m]: (In file \"%s\"): Duplicate label \"%.*s\" on line %d (first defined on line %d).\n",
+                inputFilePath, (int) function.count, function.data, line, entry->line);
+        exit(EXIT_FAILURE);
+    }
+
+    for (int64_t reference = entry->references; reference >= 0;)
+    {
+        const int64_t next = vm->program[reference].value.asI64;
+        vm->program[reference].value.asI64 = address;
+        reference = next;
+    }
+
+    entry->address = address;
+    entry->references = -1;
+    entry->line = line;
+}
+
+// Returns the operand for an instruction at `address` that refers to `function`: the label's
+// address if it is already defined, otherwise the previous head of its reference chain.
+static int64_t vmTableReference(VMTable *table, StringView function, int64_t address, int line)
+{
+    const int64_t index = vmTableLookup(table, function, line);
+    Function *entry = &table->functions[index];
+    if (entry->address >= 0) return entry->address;
+
+    const int64_t next = entry->references;
+    entry->references = address;
+
+    return next;
+}
+
+// Marks `function` as exported (defined here, visible to other files) or imported (defined in
+// another file, resolved by the linker).
+static void vmTableLink(VMTable *table, StringView function, Linkage linkage, int line, const char *inputFilePath)
+{
+    const int64_t index = vmTableLookup(table, function, line);
+    Function *entry = &table->functions[index];
+    if ((entry->linkage != VM_LINK_LOCAL && entry->linkage != linkage) ||
+        (linkage == VM_LINK_IMPORT && entry->address >= 0))
+    {
+        fprintf(stderr, "[\033[1;31mERROR\033[0m]: (In file \"%s\"): Label \"%.*s\" on line %d is %s.\n", inputFilePath,
+                (int) function.count, function.data, line,
+                entry->address >= 0 ? "defined in this file" : "both imported and exported");
+        exit(EXIT_FAILURE);
+    }
+
+    if (entry->linkage == VM_LINK_LOCAL && entry->address < 0) entry->line = line;
+    entry->linkage = linkage;
+}
+
+static int64_t vmBuiltinNative(StringView name);
+
+// Returns the native index for `native name`: the index of a built-in native, or the index the name
+// was given in `imports`, which follow the built-in natives in order of first use.
+static int64_t vmTableNative(VMTable *table, StringView name)
+{
+    const int64_t builtin = vmBuiltinNative(name);
+    if (builtin >= 0) return builtin;
+
+    for (int64_t i = 0; i < table->importSize; ++i)
+        if (sv_equals(table->imports[i].function, name)) return table->imports[i].address;
+
+    table->imports = vmReserve(table->imports, &table->importCapacity, table->importSize + 1,
+                               sizeof(table->imports[0]));
+    table->imports[table->importSize] = (Function) {vmTableIntern(table, name), VM_NATIVE_BUILTINS + table->importSize,
+                                                    -1, 0, VM_LINK_LOCAL};
+
+    return table->imports[table->importSize++].address;
+}
+
+static void vmTableDestroy(VMTable *table)
+{
+    free(table->functions);
+    free(table->slots);
+    free(table->imports);
+
+    while (table->names != NULL)
+    {
+        VMNameBlock *next = table->names->next;
+        free(table->names);
+        table->names = next;
+    }
+
+    *table = (VMTable) {0};
+}
+
+static int numberToWord(StringView source, Word *result)
+{
+    *result = (Word) {0};
+    if (sv_parseI64(source, &result->asI64)) return 1;
+
+    return sv_parseF64(source, &result->asF64);
+}
+
+#define VM_MNEMONIC_SLOTS 1024
+
+// Perfect hash from mnemonic to opcode. The seed is searched once, on first use, until every
+// mnemonic lands in its own slot, so a lookup is one hash, one probe and one memcmp.
+typedef struct
+{
+    uint32_t seed;
+    uint8_t lengths[INST_COUNT];
+    uint8_t slots[VM_MNEMONIC_SLOTS];
+} VMMnemonicTable;
+
+static uint32_t vmMnemonicHash(uint32_t seed, StringView mnemonic)
+{
+    uint32_t hash = seed;
+    for (int64_t i = 0; i < mnemonic.count; ++i) hash = (hash ^ (unsigned char) mnemonic.data[i]) * 16777619u;
+
+    return (hash ^ (hash >> 15)) & (VM_MNEMONIC_SLOTS - 1);
+}
+
+static const VMMnemonicTable *vmMnemonicTable(void)
+{
+    static VMMnemonicTable table;
+    static int ready = 0;
+    if (ready) return &table;
+
+    for (table.seed = 2166136261u;; ++table.seed)
+    {
+        memset(table.slots, 0, sizeof(table.slots));
+
+        InstructionType type = 0;
+        for (; type < INST_COUNT; ++type)
+        {
+            const StringView name = sv_cStringAsStringView(getInstructionName(type));
+            const uint32_t slot = vmMnemonicHash(table.seed, name);
+            if (table.slots[slot] != 0) break;
+
+            table.slots[slot] = (uint8_t) (type + 1);
+            table.lengths[type] = (uint8_t) name.count;
+        }
+
+        if (type == INST_COUNT) break;
     }
 
-    return result;
+    ready = 1;
+    return &table;
+}
+
+static InstructionType vmLookupMnemonic(StringView token)
+{
+    const VMMnemonicTable *table = vmMnemonicTable();
+    const uint8_t entry = table->slots[vmMnemonicHash(table->seed, token)];
+    if (entry == 0) return INST_COUNT;
+
+    const InstructionType type = entry - 1;
+    if (table->lengths[type] != token.count || memcmp(getInstructionName(type), token.data, token.count) != 0)
+        return INST_COUNT;
+
+    return type;
+}
+
+static void vmParseError(const char *inputFilePath, int lineNumber, const char *message, StringView token)
+{
+    fprintf(stderr, "[\033[1;31mERROR\033[0m]: (In file \"%s\"): %s \"%.*s\" on line %d.\n", inputFilePath, message,
+            (int) token.count, token.data, lineNumber);
+    exit(EXIT_FAILURE);
 }
 
-static void vmParseSource(StringView source, QuarkVM *vm, VMTable *vmTable, const char *inputFilePath)
+static int vmIsComment(StringView sv) { return sv.count >= 2 && sv.data[0] == '-' && sv.data[1] == '-'; }
+
+// Assembles the lines of `reader` one at a time. Only the current line is held; labels that are
+// used before they are defined are backpatched through the label table (see vmTableDefine).
+// `export <label>` and `import <label>` lines set a label's linkage; imported labels are left
+// undefined, with their references chained for the linker.
+static void vmParseSource(SVReader *reader, QuarkVM *vm, VMTable *vmTable, const char *inputFilePath)
 {
     int lineNumber = 0;
     vm->programSize = 0;
 
-    while (source.count > 0)
+    StringView line;
+    while (sv_readLine(reader, &line))
     {
-        assert(vm->programSize < VM_CAPACITY && "Number of instructions exceeds VM capacity.");
-        StringView line = sv_trim(sv_trimByDelimiter(&source, '\n'));
         ++lineNumber;
 
-        if (line.count > 0 && !(line.data[0] == '-' && line.data[1] == '-'))
+        StringView token = sv_chopToken(&line);
+        if (token.count == 0 || vmIsComment(token)) continue;
+
+        if (token.data[token.count - 1] == ':')
+        {
+            vmTableDefine(vmTable, vm, (StringView) {token.count - 1, token.data}, vm->programSize, lineNumber,
+                          inputFilePath);
+
+            token = sv_chopToken(&line);
+            if (token.count == 0 || vmIsComment(token)) continue;
+        }
+
+        const int exports = sv_equals(token, sv_cStringAsStringView("export"));
+        if (exports || sv_equals(token, sv_cStringAsStringView("import")))
+        {
+            const StringView name = sv_chopToken(&line);
+            if (name.count == 0 || vmIsComment(name)) vmParseError(inputFilePath, lineNumber, "Missing label for", token);
+
+            const StringView rest = sv_chopToken(&line);
+            if (rest.count > 0 && !vmIsComment(rest)) vmParseError(inputFilePath, lineNumber, "Unexpected token", rest);
+
+            vmTableLink(vmTable, name, exports ? VM_LINK_EXPORT : VM_LINK_IMPORT, lineNumber, inputFilePath);
+            continue;
+        }
+
+        const InstructionType type = vmLookupMnemonic(token);
+        if (type == INST_COUNT) vmParseError(inputFilePath, lineNumber, "Invalid instruction", token);
+
+        Instruction instruction = {type, {0}};
+        if (instructionWithOperand(type))
         {
-            StringView token = sv_trimByDelimiter(&line, ' ');
+            const StringView operand = sv_chopToken(&line);
+            if (operand.count == 0 || vmIsComment(operand))
+                vmParseError(inputFilePath, lineNumber, "Missing operand for instruction", token);
 
-            if (token.count > 0 && token.data[token.count - 1] == ':')
+            if (instructionWithAddress(type) && !isdigit((unsigned char) operand.data[0]))
+                instruction.value.asI64 = vmTableReference(vmTable, operand, vm->programSize, lineNumber);
+            else if (type == INST_NATIVE && (isalpha((unsigned char) operand.data[0]) || operand.data[0] == '_'))
             {
-                vmTablePushFunction(vmTable, (StringView) {token.count - 1, token.data}, vm->programSize);
-                token = sv_trim(sv_trimByDelimiter(&line, ' '));
+                for (int64_t i = 0; i < operand.count; ++i)
+                    if (!isalnum((unsigned char) operand.data[i]) && operand.data[i] != '_' && operand.data[i] != '.')
+                        vmParseError(inputFilePath, lineNumber, "Invalid native name", operand);
+
+                instruction.value.asI64 = vmTableNative(vmTable, operand);
             }
-            if (token.count > 0)
+            else if (instructionWithAddress(type) || instructionWithInteger(type))
             {
-                StringView operand = sv_trim(sv_trimByDelimiter(&line, '-'));
+                if (!sv_parseI64(operand, &instruction.value.asI64))
+                    vmParseError(inputFilePath, lineNumber, "Invalid integer operand", operand);
+            } else if (!numberToWord(operand, &instruction.value))
+                vmParseError(inputFilePath, lineNumber, "Invalid number literal", operand);
+        }
 
-                if (sv_equals(token, sv_cStringAsStringView(getInstructionName(INST_PUT))))
-                {
-                    vm->program[vm->programSize++] = (Instruction) {INST_PUT, numberToWord(operand)};
-                } else if (sv_equals(token, sv_cStringAsStringView(getInstructionName(INST_KAPUT))))
-                    vm->program[vm->programSize++] = (Instruction) {INST_KAPUT, {0}};
-                else if (sv_equals(token, sv_cStringAsStringView(getInstructionName(INST_DUP))))
-                    vm->program[vm->programSize++] = (Instruction) {INST_DUP, .value.asI64 = sv_toInt(operand)};
-                else if (sv_equals(token, sv_cStringAsStringView(getInstructionName(INST_SWAP))))
-                    vm->program[vm->programSize++] = (Instruction) {INST_SWAP, .value.asI64 = sv_toInt(operand)};
-                else if (sv_equals(token, sv_cStringAsStringView(getInstructionName(INST_RELEASE))))
-                    vm->program[vm->programSize++] = (Instruction) {INST_RELEASE, {0}};
-                else if (sv_equals(token, sv_cStringAsStringView(getInstructionName(INST_IPLUS))))
-                    vm->program[vm->programSize++] = (Instruction) {INST_IPLUS, {0}};
-                else if (sv_equals(token, sv_cStringAsStringView(getInstructionName(INST_IMINUS))))
-                    vm->program[vm->programSize++] = (Instruction) {INST_IMINUS, {0}};
-                else if (sv_equals(token, sv_cStringAsStringView(getInstructionName(INST_IMUL))))
-                    vm->program[vm->programSize++] = (Instruction) {INST_IMUL, {0}};
-                else if (sv_equals(token, sv_cStringAsStringView(getInstructionName(INST_IDIV))))
-                    vm->program[vm->programSize++] = (Instruction) {INST_IDIV, {0}};
-                else if (sv_equals(token, sv_cStringAsStringView(getInstructionName(INST_IMOD))))
-                    vm->program[vm->programSize++] = (Instruction) {INST_IMOD, {0}};
-                else if (sv_equals(token, sv_cStringAsStringView(getInstructionName(INST_FPLUS))))
-                    vm->program[vm->programSize++] = (Instruction) {INST_FPLUS, {0}};
-                else if (sv_equals(token, sv_cStringAsStringView(getInstructionName(INST_FMINUS))))
-                    vm->program[vm->programSize++] = (Instruction) {INST_FMINUS, {0}};
-                else if (sv_equals(token, sv_cStringAsStringView(getInstructionName(INST_FMUL))))
-                    vm->program[vm->programSize++] = (Instruction) {INST_FMUL, {0}};
-                else if (sv_equals(token, sv_cStringAsStringView(getInstructionName(INST_FDIV))))
-                    vm->program[vm->programSize++] = (Instruction) {INST_FDIV, {0}};
-                else if (sv_equals(token, sv_cStringAsStringView(getInstructionName(INST_FMOD))))
-                    vm->program[vm->programSize++] = (Instruction) {INST_FMOD, {0}};
-                else if (sv_equals(token, sv_cStringAsStringView(getInstructionName(INST_JUMP))))
-                    if (operand.count > 0 && isdigit(*operand.data))
-                        vm->program[vm->programSize++] = (Instruction) {INST_JUMP, .value.asI64 = sv_toInt(operand)};
-                    else
-                    {
-                        vmTablePushHoisted(vmTable, vm->programSize, operand);
-                        vm->program[vm->programSize++] = (Instruction) {INST_JUMP, {0}};
-                    }
-                else if (sv_equals(token, sv_cStringAsStringView(getInstructionName(INST_JUMP_IF))))
-                    if (operand.count > 0 && isdigit(*operand.data))
-                        vm->program[vm->programSize++] = (Instruction) {INST_JUMP_IF, .value.asI64 = sv_toInt(operand)};
-                    else
-                    {
-                        vmTablePushHoisted(vmTable, vm->programSize, operand);
-                        vm->program[vm->programSize++] = (Instruction) {INST_JUMP_IF, {0}};
-                    }
-                else if (sv_equals(token, sv_cStringAsStringView(getInstructionName(INST_RETURN))))
-                    vm->program[vm->programSize++] = (Instruction) {INST_RETURN, {0}};
-                else if (sv_equals(token, sv_cStringAsStringView(getInstructionName(INST_INVOKE))))
-                    if (operand.count > 0 && isdigit(*operand.data))
-                        vm->program[vm->programSize++] = (Instruction) {INST_INVOKE, .value.asI64 = sv_toInt(operand)};
-                    else
-                    {
-                        vmTablePushHoisted(vmTable, vm->programSize, operand);
-                        vm->program[vm->programSize++] = (Instruction) {INST_INVOKE, {0}};
-                    }
-                else if (sv_equals(token, sv_cStringAsStringView(getInstructionName(INST_NATIVE))))
-                    vm->program[vm->programSize++] = (Instruction) {INST_NATIVE, .value.asI64 = sv_toInt(operand)};
-                else if (sv_equals(token, sv_cStringAsStringView(getInstructionName(INST_IEQ))))
-                    vm->program[vm->programSize++] = (Instruction) {INST_IEQ, {0}};
-                else if (sv_equals(token, sv_cStringAsStringView(getInstructionName(INST_INEQ))))
-                    vm->program[vm->programSize++] = (Instruction) {INST_INEQ, {0}};
-                else if (sv_equals(token, sv_cStringAsStringView(getInstructionName(INST_IGT))))
-                    vm->program[vm->programSize++] = (Instruction) {INST_IGT, {0}};
-                else if (sv_equals(token, sv_cStringAsStringView(getInstructionName(INST_ILT))))
-                    vm->program[vm->programSize++] = (Instruction) {INST_ILT, {0}};
-                else if (sv_equals(token, sv_cStringAsStringView(getInstructionName(INST_IGEQ))))
-                    vm->program[vm->programSize++] = (Instruction) {INST_IGEQ, {0}};
-                else if (sv_equals(token, sv_cStringAsStringView(getInstructionName(INST_ILEQ))))
-                    vm->program[vm->programSize++] = (Instruction) {INST_ILEQ, {0}};
-                else if (sv_equals(token, sv_cStringAsStringView(getInstructionName(INST_FEQ))))
-                    vm->program[vm->programSize++] = (Instruction) {INST_FEQ, {0}};
-                else if (sv_equals(token, sv_cStringAsStringView(getInstructionName(INST_FNEQ))))
-                    vm->program[vm->programSize++] = (Instruction) {INST_FNEQ, {0}};
-                else if (sv_equals(token, sv_cStringAsStringView(getInstructionName(INST_FGT))))
-                    vm->program[vm->programSize++] = (Instruction) {INST_FGT, {0}};
-                else if (sv_equals(token, sv_cStringAsStringView(getInstructionName(INST_FLT))))
-                    vm->program[vm->programSize++] = (Instruction) {INST_FLT, {0}};
-                else if (sv_equals(token, sv_cStringAsStringView(getInstructionName(INST_FGEQ))))
-                    vm->program[vm->programSize++] = (Instruction) {INST_FGEQ, {0}};
-                else if (sv_equals(token, sv_cStringAsStringView(getInstructionName(INST_FLEQ))))
-                    vm->program[vm->programSize++] = (Instruction) {INST_FLEQ, {0}};
-                else if (sv_equals(token, sv_cStringAsStringView(getInstructionName(INST_HALT))))
-                    vm->program[vm->programSize++] = (Instruction) {INST_HALT, {0}};
-                else
-                {
-                    fprintf(stderr,
-                            "[\033[1;31mERROR\033[0m]: (In file \"%s\"): Invalid instruction \"%.*s\" on line %d.\n",
-                            inputFilePath, (int) token.count, token.data, lineNumber);
-                    exit(EXIT_FAILURE);
-                }
-            }
+        const StringView rest = sv_chopToken(&line);
+        if (rest.count > 0 && !vmIsComment(rest)) vmParseError(inputFilePath, lineNumber, "Unexpected token", rest);
+
+        vmPushInstruction(vm, instruction);
+    }
+
+    for (int64_t i = 0; i < vmTable->functionSize; ++i)
+        if (vmTable->functions[i].address < 0 && vmTable->functions[i].linkage != VM_LINK_IMPORT)
+        {
+            fprintf(stderr, "[\033[1;31mERROR\033[0m]: (In file \"%s\"): Undefined label \"%.*s\" on line %d.\n",
+                    inputFilePath, (int) vmTable->functions[i].function.count, vmTable->functions[i].function.data,
+                    vmTable->functions[i].line);
+            exit(EXIT_FAILURE);
+        }
+}
+
+static int64_t vmFuseAt(const Instruction *program, int64_t address, int64_t programSize, const uint8_t *isTarget,
+                        Instruction *fused)
+{
+    const Instruction first = program[address];
+    if (address + 1 >= programSize || isTarget[address + 1]) return 1;
+
+    const Instruction second = program[address + 1];
+    if (address + 2 < programSize && !isTarget[address + 2] && first.type == INST_IEQ && second.type == INST_INEQ &&
+        program[address + 2].type == INST_JUMP_IF)
+    {
+        *fused = (Instruction) {INST_JUMP_INEQ, program[address + 2].value};
+        return 3;
+    }
+
+    InstructionType type = INST_COUNT;
+    if (first.type == INST_PUT)
+        switch (second.type)
+        {
+            case INST_IPLUS:
+                type = INST_IPLUS_IMM;
+                break;
+            case INST_IMINUS:
+                type = INST_IMINUS_IMM;
+                break;
+            case INST_FPLUS:
+                type = INST_FPLUS_IMM;
+                break;
+            case INST_FMINUS:
+                type = INST_FMINUS_IMM;
+                break;
+            case INST_FMUL:
+                type = INST_FMUL_IMM;
+                break;
+            default:
+                break;
         }
+
+    if (type != INST_COUNT)
+    {
+        *fused = (Instruction) {type, first.value};
+        return 2;
+    }
+
+    if (second.type != INST_JUMP_IF) return 1;
+    switch (first.type)
+    {
+        case INST_DUP:
+            if (first.value.asI64 == 0) type = INST_JUMP_IF_DUP;
+            break;
+        case INST_INEQ:
+            type = INST_JUMP_IF_NOT;
+            break;
+        case INST_IEQ:
+            type = INST_JUMP_IEQ;
+            break;
+        case INST_IGT:
+            type = INST_JUMP_IGT;
+            break;
+        case INST_ILT:
+            type = INST_JUMP_ILT;
+            break;
+        case INST_IGEQ:
+            type = INST_JUMP_IGEQ;
+            break;
+        case INST_ILEQ:
+            type = INST_JUMP_ILEQ;
+            break;
+        case INST_FEQ:
+            type = INST_JUMP_FEQ;
+            break;
+        case INST_FGT:
+            type = INST_JUMP_FGT;
+            break;
+        case INST_FLT:
+            type = INST_JUMP_FLT;
+            break;
+        case INST_FGEQ:
+            type = INST_JUMP_FGEQ;
+            break;
+        case INST_FLEQ:
+            type = INST_JUMP_FLEQ;
+            break;
+        default:
+            break;
+    }
+
+    if (type == INST_COUNT) return 1;
+
+    *fused = (Instruction) {type, second.value};
+    return 2;
+}
+
+// Rewrites common instruction pairs and triples into superinstructions (e.g. `put 1` / `iminus` into
+// `iminusi 1`, `ilt` / `jif` into `jilt`). Sequences are never fused across a jump target, a label or
+// the return address of an invoke, and every address in the program and in `vmTable` is remapped
+// afterwards. Returns the number of instructions removed.
+static int64_t vmFuseInstructions(QuarkVM *vm, VMTable *vmTable)
+{
+    const int64_t programSize = vm->programSize;
+    uint8_t *isTarget = calloc(programSize + 1, sizeof(isTarget[0]));
+    int64_t *newAddress = malloc(sizeof(newAddress[0]) * (programSize + 1));
+    if (isTarget == NULL || newAddress == NULL)
+    {
+        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not allocate memory for instruction fusion (%s)\n",
+                strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    for (int64_t i = 0; i < programSize; ++i)
+    {
+        if (instructionWithAddress(vm->program[i].type) && vm->program[i].value.asI64 >= 0 &&
+            vm->program[i].value.asI64 < programSize)
+            isTarget[vm->program[i].value.asI64] = 1;
+        if (vm->program[i].type == INST_INVOKE) isTarget[i + 1] = 1;
+    }
+    for (int64_t i = 0; i < vmTable->functionSize; ++i)
+        if (vmTable->functions[i].address >= 0 && vmTable->functions[i].address < programSize)
+            isTarget[vmTable->functions[i].address] = 1;
+
+    int64_t size = 0;
+    for (int64_t i = 0; i < programSize;)
+    {
+        Instruction instruction = vm->program[i];
+        const int64_t consumed = vmFuseAt(vm->program, i, programSize, isTarget, &instruction);
+
+        for (int64_t j = 0; j < consumed; ++j) newAddress[i + j] = size;
+        vm->program[size++] = instruction;
+        i += consumed;
     }
+    newAddress[programSize] = size;
+
+    for (int64_t i = 0; i < size; ++i)
+        if (instructionWithAddress(vm->program[i].type) && vm->program[i].value.asI64 >= 0 &&
+            vm->program[i].value.asI64 <= programSize)
+            vm->program[i].value.asI64 = newAddress[vm->program[i].value.asI64];
+    for (int64_t i = 0; i < vmTable->functionSize; ++i)
+        if (vmTable->functions[i].address >= 0 && vmTable->functions[i].address <= programSize)
+            vmTable->functions[i].address = newAddress[vmTable->functions[i].address];
 
-    for (int64_t i = 0; i < vmTable->hoistedFunctionSize; ++i)
-        vm->program[vmTable->hoistedFunctions[i].address].value.asI64 = vmTableFindAddress(vmTable,
-                                                                                           vmTable->hoistedFunctions[i].function);
+    vm->programSize = size;
+
+    free(isTarget);
+    free(newAddress);
+    return programSize - size;
 }
+
+#include "jit.h"
+#include "native.h"
@@ -0,0 +1,697 @@
+// Direct-threaded execution engine.
+//
+// This file is a template: it is included from compiler.h once per engine variant, with
+// VM_DISPATCH_NAME set to the name of the function to generate and VM_DISPATCH_CHECKED set to 0
+// to drop the stack and operand checks for programs accepted by vmVerifyProgram. The program is pre-decoded
+// into an array of ThreadedInstruction (handler address + operand) and every handler jumps
+// straight to the next one with a computed goto, keeping the stack top and program counter in
+// locals instead of going through vmExecuteInstruction.
+//
+// With VM_DISPATCH_COMPACT set to 1 the engine runs the compact encoding in `vm->compact` instead:
+// it dispatches on the opcode byte and decodes operands in the handlers, so no pre-decoded copy of
+// the program is made.
+//
+// With VM_DISPATCH_COUNTED set to 1 the engine counts every instruction it dispatches into
+// `vm->instructionCount` (not updated when the stack overflows). With VM_DISPATCH_PROFILED set to 1
+// (threaded code only) it counts every instruction address in `vm->profile` and times natives.
+//
+// With VM_DISPATCH_METERED set to 1 (threaded code only) the function takes an instruction budget and
+// counts instructions and natives into `vm->instructionCount` and `vm->nativeCount`. The budget is
+// only checked when control transfers (jumps taken, calls and returns), so a run stops at most one
+// straight-line stretch of code past it, with the VM ready to resume at `vm->instructionPointer`. The
+// threaded code is kept in `vm->threaded` between runs, and a zero budget only prepares it. Under the
+// fiber scheduler, spawn, yield and join end the run with `vm->trap` set; the other engines raise
+// EX_ILLEGAL_OPERATION on them.
+
+#ifndef VM_DISPATCH_NAME
+#error "VM_DISPATCH_NAME must be defined before including dispatch.h"
+#endif
+
+#ifndef VM_DISPATCH_CHECKED
+#define VM_DISPATCH_CHECKED 1
+#endif
+
+#ifndef VM_DISPATCH_COMPACT
+#define VM_DISPATCH_COMPACT 0
+#endif
+
+#ifndef VM_DISPATCH_COUNTED
+#define VM_DISPATCH_COUNTED 0
+#endif
+
+#ifndef VM_DISPATCH_PROFILED
+#define VM_DISPATCH_PROFILED 0
+#endif
+
+#ifndef VM_DISPATCH_METERED
+#define VM_DISPATCH_METERED 0
+#endif
+
+#if VM_DISPATCH_PROFILED && VM_DISPATCH_COMPACT
+#error "The compact engine cannot be profiled"
+#endif
+
+#if VM_DISPATCH_METERED && (VM_DISPATCH_COMPACT || VM_DISPATCH_PROFILED || VM_DISPATCH_COUNTED)
+#error "Only the plain threaded engine can be metered"
+#endif
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+
+#if VM_DISPATCH_METERED
+static Exception VM_DISPATCH_NAME(QuarkVM *vm, uint64_t budget)
+#else
+static Exception VM_DISPATCH_NAME(QuarkVM *vm)
+#endif
+{
+    static const void *const handlers[] = {
+            [INST_KAPUT] = &&L_KAPUT,
+            [INST_PUT] = &&L_PUT,
+            [INST_DUP] = &&L_DUP,
+            [INST_SWAP] = &&L_SWAP,
+            [INST_RELEASE] = &&L_RELEASE,
+
+            [INST_IPLUS] = &&L_IPLUS,
+            [INST_IMINUS] = &&L_IMINUS,
+            [INST_IMUL] = &&L_IMUL,
+            [INST_IDIV] = &&L_IDIV,
+            [INST_IMOD] = &&L_IMOD,
+
+            [INST_FPLUS] = &&L_FPLUS,
+            [INST_FMINUS] = &&L_FMINUS,
+            [INST_FMUL] = &&L_FMUL,
+            [INST_FDIV] = &&L_FDIV,
+            [INST_FMOD] = &&L_FMOD,
+
+            [INST_JUMP] = &&L_JUMP,
+            [INST_JUMP_IF] = &&L_JUMP_IF,
+            [INST_RETURN] = &&L_RETURN,
+            [INST_INVOKE] = &&L_INVOKE,
+            [INST_NATIVE] = &&L_NATIVE,
+
+            [INST_IEQ] = &&L_IEQ,
+            [INST_INEQ] = &&L_INEQ,
+            [INST_IGT] = &&L_IGT,
+            [INST_ILT] = &&L_ILT,
+            [INST_IGEQ] = &&L_IGEQ,
+            [INST_ILEQ] = &&L_ILEQ,
+
+            [INST_FEQ] = &&L_FEQ,
+            [INST_FNEQ] = &&L_FNEQ,
+            [INST_FGT] = &&L_FGT,
+            [INST_FLT] = &&L_FLT,
+            [INST_FGEQ] = &&L_FGEQ,
+            [INST_FLEQ] = &&L_FLEQ,
+
+            [INST_HALT] = &&L_HALT,
+
+            [INST_IPLUS_IMM] = &&L_IPLUS_IMM,
+            [INST_IMINUS_IMM] = &&L_IMINUS_IMM,
+            [INST_FPLUS_IMM] = &&L_FPLUS_IMM,
+            [INST_FMINUS_IMM] = &&L_FMINUS_IMM,
+            [INST_FMUL_IMM] = &&L_FMUL_IMM,
+
+            [INST_JUMP_IF_DUP] = &&L_JUMP_IF_DUP,
+            [INST_JUMP_IF_NOT] = &&L_JUMP_IF_NOT,
+            [INST_JUMP_IEQ] = &&L_JUMP_IEQ,
+            [INST_JUMP_INEQ] = &&L_JUMP_INEQ,
+            [INST_JUMP_IGT] = &&L_JUMP_IGT,
+            [INST_JUMP_ILT] = &&L_JUMP_ILT,
+            [INST_JUMP_IGEQ] = &&L_JUMP_IGEQ,
+            [INST_JUMP_ILEQ] = &&L_JUMP_ILEQ,
+            [INST_JUMP_FEQ] = &&L_JUMP_FEQ,
+            [INST_JUMP_FGT] = &&L_JUMP_FGT,
+            [INST_JUMP_FLT] = &&L_JUMP_FLT,
+            [INST_JUMP_FGEQ] = &&L_JUMP_FGEQ,
+            [INST_JUMP_FLEQ] = &&L_JUMP_FLEQ,
+
+            [INST_ILOAD8] = &&L_ILOAD8,
+            [INST_ILOAD32] = &&L_ILOAD32,
+            [INST_ILOAD64] = &&L_ILOAD64,
+            [INST_FLOAD] = &&L_FLOAD,
+            [INST_ISTORE8] = &&L_ISTORE8,
+            [INST_ISTORE32] = &&L_ISTORE32,
+            [INST_ISTORE64] = &&L_ISTORE64,
+            [INST_FSTORE] = &&L_FSTORE,
+            [INST_MEMCPY] = &&L_MEMCPY,
+            [INST_MEMSET] = &&L_MEMSET,
+            [INST_MEMCMP] = &&L_MEMCMP,
+
+            [INST_VFPLUS] = &&L_VFPLUS,
+            [INST_VFMINUS] = &&L_VFMINUS,
+            [INST_VFMUL] = &&L_VFMUL,
+            [INST_VFDIV] = &&L_VFDIV,
+            [INST_VFFMA] = &&L_VFFMA,
+            [INST_VFLT] = &&L_VFLT,
+            [INST_VFEQ] = &&L_VFEQ,
+
+            [INST_VIPLUS] = &&L_VIPLUS,
+            [INST_VIMINUS] = &&L_VIMINUS,
+            [INST_VIMUL] = &&L_VIMUL,
+            [INST_VIDIV] = &&L_VIDIV,
+            [INST_VIFMA] = &&L_VIFMA,
+            [INST_VILT] = &&L_VILT,
+            [INST_VIEQ] = &&L_VIEQ,
+
+            [INST_VFDOT] = &&L_VFDOT,
+            [INST_VFSUM] = &&L_VFSUM,
+            [INST_VFMIN] = &&L_VFMIN,
+            [INST_VFMAX] = &&L_VFMAX,
+            [INST_VIDOT] = &&L_VIDOT,
+            [INST_VISUM] = &&L_VISUM,
+            [INST_VIMIN] = &&L_VIMIN,
+            [INST_VIMAX] = &&L_VIMAX,
+
+            [INST_SPAWN] = &&L_FIBER,
+            [INST_YIELD] = &&L_FIBER,
+            [INST_JOIN] = &&L_FIBER,
+    };
+
+    if (vm->halt) return EX_OK;
+
+    const int64_t programSize = vm->programSize;
+#if VM_DISPATCH_COMPACT
+    const void *table[256];
+    for (int i = 0; i < 256; ++i) table[i] = i < INST_COUNT ? handlers[i] : &&L_INVALID;
+    table[VM_COMPACT_END] = &&L_OUT_OF_BOUNDS;
+
+    const uint8_t *const code = vm->compact.code;
+    const uint32_t *const offsets = vm->compact.offsets;
+    const Word *const constants = vm->compact.constants;
+#else
+#if VM_DISPATCH_METERED
+    ThreadedInstruction *volatile decoded = vm->threaded;
+    if (decoded != NULL && vm->threadedHandlers == handlers) goto L_DECODED;
+
+    vmReleaseThreaded(vm);
+    decoded = malloc(sizeof(decoded[0]) * (programSize + 1));
+#else
+    ThreadedInstruction *volatile decoded = malloc(sizeof(decoded[0]) * (programSize + 1));
+#endif
+    if (decoded == NULL)
+    {
+        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not allocate memory for threaded code (%s)\n",
+                strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    for (int64_t i = 0; i < programSize; ++i)
+    {
+        const Instruction instruction = vm->program[i];
+
+        decoded[i].handler = (unsigned) instruction.type < INST_COUNT ? handlers[instruction.type] : &&L_INVALID;
+        decoded[i].value = instruction.value;
+
+        if (decoded[i].handler != &&L_INVALID && instructionWithAddress(instruction.type))
+            decoded[i].value.asPtr = instruction.value.asI64 >= 0 && instruction.value.asI64 < programSize
+                                     ? &decoded[instruction.value.asI64] : &decoded[programSize];
+    }
+    decoded[programSize] = (ThreadedInstruction) {&&L_OUT_OF_BOUNDS, {0}};
+#if VM_DISPATCH_METERED
+    vm->threaded = decoded;
+    vm->threadedHandlers = handlers;
+L_DECODED:
+    if (budget == 0) return EX_OK;
+#endif
+    // Assigned once, so that it keeps its value when an overflow longjmps back below.
+    ThreadedInstruction *const code = decoded;
+#endif
+
+#if !VM_STACK_GUARD
+#define VM_OVERFLOW_INDEX() ((int64_t) -1)
+#elif VM_DISPATCH_COMPACT
+#define VM_OVERFLOW_INDEX() \
+    (guard.at == NULL ? -1 : (int64_t) vm->compact.indices[(const uint8_t *) guard.at - code])
+#else
+#define VM_OVERFLOW_INDEX() (guard.at == NULL ? -1 : (int64_t) ((const ThreadedInstruction *) guard.at - code))
+#endif
+    VM_GUARD_STACK(vm, guard);
+    if (VM_STACK_OVERFLOWED(guard))
+    {
+        VM_RELEASE_STACK(guard);
+
+        // pc lived in a register, but every push stored it in `guard.at` first (see VM_ROOM).
+        vm->stackSize = VM_STACK_CAPACITY;
+        vm->instructionPointer = VM_OVERFLOW_INDEX();
+#if VM_DISPATCH_METERED
+        vmReleaseThreaded(vm);
+#elif !VM_DISPATCH_COMPACT
+        free(code);
+#endif
+
+        vmReportException(vm, EX_STACK_OVERFLOW);
+        return EX_STACK_OVERFLOW;
+    }
+
+    Word *const stack = vm->stack;
+    Word *top = stack + vm->stackSize;
+    const int64_t entry = vm->instructionPointer >= 0 && vm->instructionPointer < programSize
+                          ? vm->instructionPointer : programSize;
+    Exception exception = EX_OK;
+    Word operand;
+    uint64_t raw;
+#if VM_DISPATCH_PROFILED
+    uint64_t *const counts = vm->profile->counts;
+#define VM_ENTER() (++counts[pc - code])
+#elif VM_DISPATCH_COUNTED || VM_DISPATCH_METERED
+    uint64_t executed = 0;
+#define VM_ENTER() (++executed)
+#else
+#define VM_ENTER() (void) 0
+#endif
+
+#if VM_DISPATCH_COMPACT
+    const uint8_t *pc = code + offsets[entry], *current = pc, *target;
+
+#define VM_NEXT() do { VM_ENTER(); current = pc; goto *table[*pc++]; } while (0)
+#define VM_GOTO(destination) do { pc = (destination); VM_NEXT(); } while (0)
+#define VM_ADDRESS(index) (code + offsets[(uint64_t) (index) < (uint64_t) programSize ? (index) : programSize])
+#define VM_INDEX() ((int64_t) vm->compact.indices[current - code])
+#define VM_VARINT()                                                             \
+    do {                                                                        \
+        raw = *pc;                                                              \
+        if (raw < 0x80) ++pc;                                                   \
+        else raw = vmVarintValue(pc), pc += vmVarintLength(pc);                 \
+    } while (0)
+#define VM_LITERAL()                                                                               \
+    do {                                                                                           \
+        VM_VARINT();                                                                               \
+        if (raw & 1) operand = constants[raw >> 1];                                                \
+        else operand.asI64 = vmUnzigzag(raw >> 1);                                                 \
+    } while (0)
+#define VM_INTEGER() do { VM_VARINT(); operand.asI64 = vmUnzigzag(raw); } while (0)
+#define VM_TARGET() (target = code + vmReadLE(pc, 4), pc += 4)
+#else
+    ThreadedInstruction *pc = &code[entry], *target;
+
+#define VM_NEXT() do { ++pc; VM_ENTER(); goto *pc->handler; } while (0)
+#if VM_DISPATCH_METERED
+    uint64_t natives = 0;
+#define VM_GOTO(destination)                               \
+    do {                                                   \
+        pc = (destination);                                \
+        if (executed >= budget) goto L_PREEMPT;            \
+        VM_ENTER();                                        \
+        goto *pc->handler;                                 \
+    } while (0)
+#else
+#define VM_GOTO(destination) do { pc = (destination); VM_ENTER(); goto *pc->handler; } while (0)
+#endif
+#define VM_ADDRESS(index) (&code[(uint64_t) (index) < (uint64_t) programSize ? (index) : programSize])
+#define VM_INDEX() ((int64_t) (pc - code))
+#define VM_LITERAL() (operand = pc->value)
+#define VM_INTEGER() (operand = pc->value)
+    (void) raw;
+#define VM_TARGET() (target = (ThreadedInstruction *) pc->value.asPtr)
+#endif
+#define VM_RAISE(ex) do { exception = (ex); goto L_EXIT; } while (0)
+#if VM_DISPATCH_CHECKED
+#define VM_CHECK(condition, ex) do { if (condition) VM_RAISE(ex); } while (0)
+#else
+#define VM_CHECK(condition, ex) (void) 0
+#endif
+#define VM_NEED(n) VM_CHECK(top - stack < (n), EX_STACK_UNDERFLOW)
+#if VM_STACK_GUARD
+// The guard catches overflow; pushes only note where they are, for the report.
+#if VM_DISPATCH_COMPACT
+#define VM_MARK() (guard.at = current)
+#else
+#define VM_MARK() (guard.at = pc)
+#endif
+#define VM_ROOM() VM_MARK()
+#else
+#define VM_MARK() (void) 0
+#define VM_ROOM() VM_CHECK(top - stack >= VM_STACK_CAPACITY, EX_STACK_OVERFLOW)
+#endif
+#define VM_BINARY(field, op) do { VM_NEED(2); top[-2].field op top[-1].field; --top; VM_NEXT(); } while (0)
+#define VM_COMPARE(field, op) \
+    do { VM_NEED(2); top[-2].asI64 = top[-1].field op top[-2].field; --top; VM_NEXT(); } while (0)
+#define VM_IMMEDIATE(field, op) \
+    do { VM_NEED(1); VM_LITERAL(); top[-1].field op operand.field; VM_NEXT(); } while (0)
+#define VM_COMPARE_JUMP(field, op)                               \
+    do {                                                         \
+        VM_NEED(2);                                              \
+        VM_TARGET();                                             \
+        top -= 2;                                                \
+        if (top[1].field op top[0].field) VM_GOTO(target);       \
+        VM_NEXT();                                               \
+    } while (0)
+#define VM_LOAD(type, field)                                                                     \
+    do {                                                                                         \
+        VM_NEED(1);                                                                              \
+        VM_INTEGER();                                                                            \
+        type value;                                                                              \
+        const unsigned char *address = (const unsigned char *) top[-1].asPtr + operand.asI64;    \
+        if (!vmHeapCovers(&vm->heap, address, sizeof value)) VM_RAISE(EX_ILLEGAL_MEMORY_ACCESS); \
+        memcpy(&value, address, sizeof value);                                                   \
+        top[-1].field = value;                                                                   \
+        VM_NEXT();                                                                               \
+    } while (0)
+#define VM_STORE(type, field)                                                                    \
+    do {                                                                                         \
+        VM_NEED(2);                                                                              \
+        VM_INTEGER();                                                                            \
+        const type value = (type) top[-1].field;                                                 \
+        unsigned char *address = (unsigned char *) top[-2].asPtr + operand.asI64;                \
+        if (!vmHeapCovers(&vm->heap, address, sizeof value)) VM_RAISE(EX_ILLEGAL_MEMORY_ACCESS); \
+        memcpy(address, &value, sizeof value);                                                   \
+        top -= 2;                                                                                \
+        VM_NEXT();                                                                               \
+    } while (0)
+#define VM_CALL(function, type, required, pops)                                                \
+    do {                                                                                       \
+        VM_NEED(required);                                                                     \
+        exception = function(vm, (type), top);                                                 \
+        if (exception != EX_OK) goto L_EXIT;                                                   \
+        top -= (pops);                                                                         \
+        VM_NEXT();                                                                             \
+    } while (0)
+
+#if VM_DISPATCH_COMPACT
+    VM_NEXT();
+#else
+    VM_ENTER();
+    goto *pc->handler;
+#endif
+
+L_KAPUT:
+    VM_NEXT();
+L_PUT:
+    VM_ROOM();
+    VM_LITERAL();
+    *top++ = operand;
+    VM_NEXT();
+L_DUP:
+    VM_ROOM();
+    VM_INTEGER();
+    VM_CHECK((top - stack) - operand.asI64 <= 0, EX_STACK_UNDERFLOW);
+    *top = top[-operand.asI64 - 1];
+    ++top;
+    VM_NEXT();
+L_SWAP:
+    VM_INTEGER();
+    VM_CHECK(operand.asI64 >= top - stack, EX_STACK_UNDERFLOW);
+    {
+        Word temp = top[-1];
+        top[-1] = top[-operand.asI64 - 1];
+        top[-operand.asI64 - 1] = temp;
+    }
+    VM_NEXT();
+L_RELEASE:
+    VM_NEED(1);
+    --top;
+    VM_NEXT();
+
+L_IPLUS:
+    VM_BINARY(asI64, +=);
+L_IMINUS:
+    VM_BINARY(asI64, -=);
+L_IMUL:
+    VM_BINARY(asI64, *=);
+L_IDIV:
+    VM_NEED(2);
+    if (top[-1].asI64 == 0) VM_RAISE(EX_DIVIDE_BY_ZERO);
+    top[-2].asI64 /= top[-1].asI64;
+    --top;
+    VM_NEXT();
+L_IMOD:
+    VM_BINARY(asI64, %=);
+
+L_FPLUS:
+    VM_BINARY(asF64, +=);
+L_FMINUS:
+    VM_BINARY(asF64, -=);
+L_FMUL:
+    VM_BINARY(asF64, *=);
+L_FDIV:
+    VM_NEED(2);
+    if (top[-1].asF64 == 0.0) VM_RAISE(EX_DIVIDE_BY_ZERO);
+    top[-2].asF64 /= top[-1].asF64;
+    --top;
+    VM_NEXT();
+L_FMOD:
+    VM_NEED(2);
+    top[-2].asF64 = fmod(top[-2].asF64, top[-1].asF64);
+    --top;
+    VM_NEXT();
+
+L_JUMP:
+    VM_TARGET();
+    VM_GOTO(target);
+L_JUMP_IF:
+    VM_NEED(1);
+    VM_TARGET();
+    if ((--top)->asI64 != 0) VM_GOTO(target);
+    VM_NEXT();
+L_RETURN:
+    VM_NEED(1);
+    --top;
+    VM_GOTO(VM_ADDRESS(top->asI64));
+L_INVOKE:
+    VM_ROOM();
+    VM_TARGET();
+    (top++)->asI64 = VM_INDEX() + 1;
+    VM_GOTO(target);
+L_NATIVE:
+    VM_INTEGER();
+    VM_CHECK(operand.asI64 < 0 || operand.asI64 >= vm->nativeFunctionsSize, EX_ILLEGAL_OPERATION);
+
+    VM_MARK();
+    vm->stackSize = top - stack;
+    vm->instructionPointer = VM_INDEX();
+
+#if VM_DISPATCH_PROFILED
+    {
+        const double start = vmSeconds();
+        exception = vm->nativeFunctions[operand.asI64].function(vm);
+
+        ++vm->profile->nativeCalls[operand.asI64];
+        vm->profile->nativeSeconds[operand.asI64] += vmSeconds() - start;
+    }
+#else
+    exception = vm->nativeFunctions[operand.asI64].function(vm);
+#endif
+#if VM_DISPATCH_METERED
+    ++natives;
+#endif
+    if (exception != EX_OK) goto L_EXIT;
+
+    top = stack + vm->stackSize;
+    VM_NEXT();
+
+L_IEQ:
+    VM_COMPARE(asI64, ==);
+L_INEQ:
+    VM_NEED(1);
+    top[-1].asI64 = !top[-1].asI64;
+    VM_NEXT();
+L_IGT:
+    VM_COMPARE(asI64, >);
+L_ILT:
+    VM_COMPARE(asI64, <);
+L_IGEQ:
+    VM_COMPARE(asI64, >=);
+L_ILEQ:
+    VM_COMPARE(asI64, <=);
+
+L_FEQ:
+    VM_COMPARE(asF64, ==);
+L_FNEQ:
+    VM_NEED(1);
+    top[-1].asI64 = !top[-1].asF64;
+    VM_NEXT();
+L_FGT:
+    VM_COMPARE(asF64, >);
+L_FLT:
+    VM_COMPARE(asF64, <);
+L_FGEQ:
+    VM_COMPARE(asF64, >=);
+L_FLEQ:
+    VM_COMPARE(asF64, <=);
+
+L_HALT:
+    vm->halt = 1;
+    goto L_EXIT;
+
+L_IPLUS_IMM:
+    VM_IMMEDIATE(asI64, +=);
+L_IMINUS_IMM:
+    VM_IMMEDIATE(asI64, -=);
+L_FPLUS_IMM:
+    VM_IMMEDIATE(asF64, +=);
+L_FMINUS_IMM:
+    VM_IMMEDIATE(asF64, -=);
+L_FMUL_IMM:
+    VM_IMMEDIATE(asF64, *=);
+
+L_JUMP_IF_DUP:
+    VM_NEED(1);
+    VM_TARGET();
+    if (top[-1].asI64 != 0) VM_GOTO(target);
+    VM_NEXT();
+L_JUMP_IF_NOT:
+    VM_NEED(1);
+    VM_TARGET();
+    if ((--top)->asI64 == 0) VM_GOTO(target);
+    VM_NEXT();
+L_JUMP_IEQ:
+    VM_COMPARE_JUMP(asI64, ==);
+L_JUMP_INEQ:
+    VM_COMPARE_JUMP(asI64, !=);
+L_JUMP_IGT:
+    VM_COMPARE_JUMP(asI64, >);
+L_JUMP_ILT:
+    VM_COMPARE_JUMP(asI64, <);
+L_JUMP_IGEQ:
+    VM_COMPARE_JUMP(asI64, >=);
+L_JUMP_ILEQ:
+    VM_COMPARE_JUMP(asI64, <=);
+L_JUMP_FEQ:
+    VM_COMPARE_JUMP(asF64, ==);
+L_JUMP_FGT:
+    VM_COMPARE_JUMP(asF64, >);
+L_JUMP_FLT:
+    VM_COMPARE_JUMP(asF64, <);
+L_JUMP_FGEQ:
+    VM_COMPARE_JUMP(asF64, >=);
+L_JUMP_FLEQ:
+    VM_COMPARE_JUMP(asF64, <=);
+
+L_ILOAD8:
+    VM_LOAD(int8_t, asI64);
+L_ILOAD32:
+    VM_LOAD(int32_t, asI64);
+L_ILOAD64:
+    VM_LOAD(int64_t, asI64);
+L_FLOAD:
+    VM_LOAD(double, asF64);
+L_ISTORE8:
+    VM_STORE(int8_t, asI64);
+L_ISTORE32:
+    VM_STORE(int32_t, asI64);
+L_ISTORE64:
+    VM_STORE(int64_t, asI64);
+L_FSTORE:
+    VM_STORE(double, asF64);
+L_MEMCPY:
+    VM_CALL(vmMemoryBulk, INST_MEMCPY, 3, 3);
+L_MEMSET:
+    VM_CALL(vmMemoryBulk, INST_MEMSET, 3, 3);
+L_MEMCMP:
+    VM_CALL(vmMemoryBulk, INST_MEMCMP, 3, 2);
+
+L_VFPLUS:
+    VM_CALL(vmMemoryVector, INST_VFPLUS, 4, 4);
+L_VFMINUS:
+    VM_CALL(vmMemoryVector, INST_VFMINUS, 4, 4);
+L_VFMUL:
+    VM_CALL(vmMemoryVector, INST_VFMUL, 4, 4);
+L_VFDIV:
+    VM_CALL(vmMemoryVector, INST_VFDIV, 4, 4);
+L_VFFMA:
+    VM_CALL(vmMemoryVector, INST_VFFMA, 4, 4);
+L_VFLT:
+    VM_CALL(vmMemoryVector, INST_VFLT, 4, 4);
+L_VFEQ:
+    VM_CALL(vmMemoryVector, INST_VFEQ, 4, 4);
+
+L_VIPLUS:
+    VM_CALL(vmMemoryVector, INST_VIPLUS, 4, 4);
+L_VIMINUS:
+    VM_CALL(vmMemoryVector, INST_VIMINUS, 4, 4);
+L_VIMUL:
+    VM_CALL(vmMemoryVector, INST_VIMUL, 4, 4);
+L_VIDIV:
+    VM_CALL(vmMemoryVector, INST_VIDIV, 4, 4);
+L_VIFMA:
+    VM_CALL(vmMemoryVector, INST_VIFMA, 4, 4);
+L_VILT:
+    VM_CALL(vmMemoryVector, INST_VILT, 4, 4);
+L_VIEQ:
+    VM_CALL(vmMemoryVector, INST_VIEQ, 4, 4);
+
+L_VFDOT:
+    VM_CALL(vmMemoryVector, INST_VFDOT, 3, 2);
+L_VFSUM:
+    VM_CALL(vmMemoryVector, INST_VFSUM, 2, 1);
+L_VFMIN:
+    VM_CALL(vmMemoryVector, INST_VFMIN, 2, 1);
+L_VFMAX:
+    VM_CALL(vmMemoryVector, INST_VFMAX, 2, 1);
+L_VIDOT:
+    VM_CALL(vmMemoryVector, INST_VIDOT, 3, 2);
+L_VISUM:
+    VM_CALL(vmMemoryVector, INST_VISUM, 2, 1);
+L_VIMIN:
+    VM_CALL(vmMemoryVector, INST_VIMIN, 2, 1);
+L_VIMAX:
+    VM_CALL(vmMemoryVector, INST_VIMAX, 2, 1);
+
+L_FIBER:
+#if VM_DISPATCH_METERED
+    if (vm->scheduler != NULL)
+    {
+        vm->trap = vm->program[VM_INDEX()].type;
+        goto L_EXIT;
+    }
+#endif
+    VM_RAISE(EX_ILLEGAL_OPERATION);
+
+L_INVALID:
+    VM_RAISE(EX_INVALID_INSTRUCTION);
+L_OUT_OF_BOUNDS:
+    VM_RAISE(EX_ILLEGAL_INSTRUCTION_ACCESS);
+
+#if VM_DISPATCH_METERED
+L_PREEMPT:
+#endif
+L_EXIT:
+    VM_RELEASE_STACK(guard);
+
+    vm->stackSize = top - stack;
+    vm->instructionPointer = VM_INDEX();
+#if (VM_DISPATCH_COUNTED || VM_DISPATCH_METERED) && !VM_DISPATCH_PROFILED
+    vm->instructionCount += executed;
+#endif
+#if VM_DISPATCH_METERED
+    vm->nativeCount += natives;
+#elif !VM_DISPATCH_COMPACT
+    free(code);
+#endif
+
+    vmFlushOutput(vm);
+    if (exception != EX_OK) vmReportException(vm, exception);
+    return exception;
+
+#undef VM_NEXT
+#undef VM_GOTO
+#undef VM_ADDRESS
+#undef VM_INDEX
+#undef VM_VARINT
+#undef VM_LITERAL
+#undef VM_INTEGER
+#undef VM_TARGET
+#undef VM_RAISE
+#undef VM_CHECK
+#undef VM_NEED
+#undef VM_MARK
+#undef VM_ROOM
+#undef VM_OVERFLOW_INDEX
+#undef VM_BINARY
+#undef VM_COMPARE
+#undef VM_IMMEDIATE
+#undef VM_COMPARE_JUMP
+#undef VM_LOAD
+#undef VM_STORE
+#undef VM_CALL
+#undef VM_ENTER
+}
+
+#pragma GCC diagnostic pop
+
+#undef VM_DISPATCH_NAME
+#undef VM_DISPATCH_CHECKED
+#undef VM_DISPATCH_COMPACT
+#undef VM_DISPATCH_COUNTED
+#undef VM_DISPATCH_PROFILED
+#undef VM_DISPATCH_METERED
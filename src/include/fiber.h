@@ -0,0 +1,529 @@
+#pragma once
+
+// Fibers: green threads started by `spawn`, run M:N on a pool of worker threads.
+//
+// A fiber is a QuarkVM with its own operand stack and instruction pointer that borrows the program,
+// the threaded code and the natives of the host VM. Fiber 0 runs the program from the host's
+// instruction pointer. `spawn label` pops a value, starts a fiber at `label` with that value as its
+// only stack entry and pushes the new fiber's id; `yield` lets other fibers run; `join` waits until
+// the fiber whose id is on top of the stack has stopped and replaces the id with its result (the top
+// of its stack at `stop`, or 0). The program ends when fiber 0 stops, abandoning any other fibers, or
+// when a fiber raises an exception.
+//
+// Every worker owns a deque of runnable fibers. It runs the fiber at the bottom of its own deque (the
+// one spawned or woken last) and, when that is empty, steals the one at the top of another worker's.
+// A fiber runs until vmRun returns at spawn, yield or join, which the worker then carries out, or
+// until its time slice is used up; a preempted or yielding fiber goes back on top, behind the others.
+// A fiber blocked in join is parked on the fiber it waits for and pushed again by the worker that
+// sees that fiber stop. VMs of stopped fibers are kept and reused by later spawns.
+//
+// All fibers share the host's heap: natives 0 and 1 are replaced by versions that lock it. Other
+// natives, plugin natives included, may run on several workers at once. Each fiber buffers its own
+// output, which is written out at the end of every slice.
+
+#include "compiler.h"
+#include "native.h"
+
+#include <stdatomic.h>
+#include <pthread.h>
+
+typedef struct VMFiber
+{
+    QuarkVM *vm;
+    int64_t id;
+    int done;
+    Word result;
+    // The fibers blocked in join on this one, linked through `next`.
+    struct VMFiber *waiters;
+    struct VMFiber *next;
+} VMFiber;
+
+// A ring buffer of runnable fibers. The owner pushes and takes at the bottom; preempted fibers are
+// pushed on top, where thieves take from.
+typedef struct
+{
+    pthread_mutex_t lock;
+    VMFiber **items;
+    int64_t head;
+    int64_t size;
+    int64_t capacity;
+} VMFiberDeque;
+
+// Set `workerCount` (one per processor if not positive), `slice`, and optionally `maxInstructions` and
+// `timeout` (in seconds) before vmRunFibers; the rest is filled in while it runs.
+typedef struct
+{
+    int64_t workerCount;
+    uint64_t slice;
+    uint64_t maxInstructions;
+    double timeout;
+
+    QuarkVM *host;
+    NativeFunction *nativeFunctions;
+    double deadline;
+    VMFiberDeque *deques;
+
+    // `lock` guards the fiber table, the waiter lists, the VM pool and `exception`; `heapLock` guards
+    // the host's heap.
+    pthread_mutex_t lock;
+    pthread_mutex_t heapLock;
+    pthread_cond_t wake;
+
+    VMFiber **fibers;
+    int64_t fiberSize;
+    int64_t fiberCapacity;
+    QuarkVM **pool;
+    int64_t poolSize;
+    int64_t poolCapacity;
+    Exception exception;
+    int halted;
+
+    // `queued` is at least the number of fibers in the deques; idle workers sleep on `wake`.
+    atomic_llong queued;
+    atomic_int sleeping;
+    atomic_int finished;
+
+    atomic_ullong instructionCount;
+    atomic_ullong nativeCount;
+    atomic_ullong switches;
+    atomic_ullong steals;
+} VMScheduler;
+
+static Exception vmFiberAllocate(QuarkVM *vm)
+{
+    if (vm->stackSize < 1) return EX_STACK_UNDERFLOW;
+
+    VMScheduler *scheduler = vm->scheduler;
+    pthread_mutex_lock(&scheduler->heapLock);
+    vm->stack[vm->stackSize - 1].asPtr = vmHeapAllocate(&scheduler->host->heap, vm->stack[vm->stackSize - 1].asI64);
+    pthread_mutex_unlock(&scheduler->heapLock);
+
+    return EX_OK;
+}
+
+static Exception vmFiberFree(QuarkVM *vm)
+{
+    if (vm->stackSize < 1) return EX_STACK_UNDERFLOW;
+
+    VMScheduler *scheduler = vm->scheduler;
+    pthread_mutex_lock(&scheduler->heapLock);
+    const int freed = vmHeapFree(&scheduler->host->heap, vm->stack[vm->stackSize - 1].asPtr);
+    pthread_mutex_unlock(&scheduler->heapLock);
+
+    if (!freed) return EX_ILLEGAL_OPERATION;
+    vm->stackSize--;
+
+    return EX_OK;
+}
+
+static void *vmFiberAllocateMemory(size_t size)
+{
+    void *memory = calloc(1, size);
+    if (memory == NULL)
+    {
+        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not allocate memory for a fiber (%s)\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    return memory;
+}
+
+static void vmFiberDequePush(VMFiberDeque *deque, VMFiber *fiber, int bottom)
+{
+    pthread_mutex_lock(&deque->lock);
+    if (deque->size == deque->capacity)
+    {
+        const int64_t capacity = deque->capacity > 0 ? deque->capacity * 2 : 64;
+        VMFiber **items = vmFiberAllocateMemory(sizeof(items[0]) * capacity);
+        for (int64_t i = 0; i < deque->size; ++i) items[i] = deque->items[(deque->head + i) % deque->capacity];
+
+        free(deque->items);
+        deque->items = items;
+        deque->head = 0;
+        deque->capacity = capacity;
+    }
+
+    if (bottom) deque->items[(deque->head + deque->size) % deque->capacity] = fiber;
+    else
+    {
+        deque->head = (deque->head + deque->capacity - 1) % deque->capacity;
+        deque->items[deque->head] = fiber;
+    }
+    ++deque->size;
+    pthread_mutex_unlock(&deque->lock);
+}
+
+// Takes the fiber at the bottom or at the top, or returns NULL if the deque is empty.
+static VMFiber *vmFiberDequeTake(VMFiberDeque *deque, int bottom)
+{
+    VMFiber *fiber = NULL;
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->size > 0)
+    {
+        if (bottom) fiber = deque->items[(deque->head + deque->size - 1) % deque->capacity];
+        else
+        {
+            fiber = deque->items[deque->head];
+            deque->head = (deque->head + 1) % deque->capacity;
+        }
+        --deque->size;
+    }
+    pthread_mutex_unlock(&deque->lock);
+
+    return fiber;
+}
+
+// Ends the run with `exception`. Returns 0 if it had already ended. Called without `lock` held.
+static int vmFiberFinishAll(VMScheduler *scheduler, Exception exception)
+{
+    pthread_mutex_lock(&scheduler->lock);
+    const int first = !atomic_load(&scheduler->finished);
+    if (first) scheduler->exception = exception;
+    atomic_store(&scheduler->finished, 1);
+    pthread_cond_broadcast(&scheduler->wake);
+    pthread_mutex_unlock(&scheduler->lock);
+
+    return first;
+}
+
+static void vmFiberReady(VMScheduler *scheduler, int64_t worker, VMFiber *fiber, int bottom)
+{
+    atomic_fetch_add(&scheduler->queued, 1);
+    vmFiberDequePush(&scheduler->deques[worker], fiber, bottom);
+
+    if (atomic_load(&scheduler->sleeping) > 0)
+    {
+        pthread_mutex_lock(&scheduler->lock);
+        pthread_cond_signal(&scheduler->wake);
+        pthread_mutex_unlock(&scheduler->lock);
+    }
+}
+
+// Creates a fiber that starts at `entry` with `argument` (if not NULL) on its stack, reusing the VM
+// of a stopped fiber if there is one.
+static VMFiber *vmFiberCreate(VMScheduler *scheduler, int64_t entry, const Word *argument)
+{
+    VMFiber *fiber = vmFiberAllocateMemory(sizeof(*fiber));
+
+    pthread_mutex_lock(&scheduler->lock);
+    QuarkVM *vm = scheduler->poolSize > 0 ? scheduler->pool[--scheduler->poolSize] : NULL;
+    scheduler->fibers = vmReserve(scheduler->fibers, &scheduler->fiberCapacity, scheduler->fiberSize + 1,
+                                  sizeof(scheduler->fibers[0]));
+    fiber->id = scheduler->fiberSize;
+    scheduler->fibers[scheduler->fiberSize++] = fiber;
+    pthread_mutex_unlock(&scheduler->lock);
+
+    if (vm == NULL)
+    {
+        const QuarkVM *host = scheduler->host;
+
+        vm = vmFiberAllocateMemory(sizeof(*vm));
+        vmInit(vm);
+        vm->program = host->program;
+        vm->programSize = host->programSize;
+        vm->programBorrowed = 1;
+        vm->nativeFunctions = scheduler->nativeFunctions;
+        vm->nativeFunctionsSize = host->nativeFunctionsSize;
+        vm->threaded = host->threaded;
+        vm->threadedHandlers = host->threadedHandlers;
+        vm->threadedBorrowed = 1;
+        vm->verified = host->verified;
+        vm->output = host->output;
+        vm->errors = host->errors;
+        vm->name = host->name;
+        vm->scheduler = scheduler;
+    }
+
+    vm->stackSize = 0;
+    vm->halt = 0;
+    vm->trap = INST_KAPUT;
+    vm->instructionPointer = entry;
+    if (argument != NULL) vm->stack[vm->stackSize++] = *argument;
+
+    fiber->vm = vm;
+    return fiber;
+}
+
+// Records the result of a fiber that stopped, returns its VM to the pool and wakes its joiners.
+static void vmFiberStop(VMScheduler *scheduler, int64_t worker, VMFiber *fiber)
+{
+    QuarkVM *vm = fiber->vm;
+    const Word result = vm->stackSize > 0 ? vm->stack[vm->stackSize - 1] : (Word) {0};
+
+    pthread_mutex_lock(&scheduler->lock);
+    fiber->done = 1;
+    fiber->result = result;
+    fiber->vm = NULL;
+
+    VMFiber *waiters = fiber->waiters;
+    fiber->waiters = NULL;
+
+    scheduler->pool = vmReserve(scheduler->pool, &scheduler->poolCapacity, scheduler->poolSize + 1,
+                                sizeof(scheduler->pool[0]));
+    scheduler->pool[scheduler->poolSize++] = vm;
+    pthread_mutex_unlock(&scheduler->lock);
+
+    if (fiber->id == 0)
+    {
+        scheduler->halted = 1;
+        vmFiberFinishAll(scheduler, EX_OK);
+        return;
+    }
+
+    while (waiters != NULL)
+    {
+        VMFiber *next = waiters->next;
+        QuarkVM *waiting = waiters->vm;
+
+        waiting->stack[waiting->stackSize - 1] = result;
+        ++waiting->instructionPointer;
+        vmFiberReady(scheduler, worker, waiters, 1);
+
+        waiters = next;
+    }
+}
+
+// Carries out `join` for `fiber`. Returns 1 if it can go on running, 0 if it was parked or failed.
+static int vmFiberJoin(VMScheduler *scheduler, VMFiber *fiber, Exception *exception)
+{
+    QuarkVM *vm = fiber->vm;
+    const int64_t id = vm->stack[vm->stackSize - 1].asI64;
+
+    pthread_mutex_lock(&scheduler->lock);
+    VMFiber *target = id >= 0 && id < scheduler->fiberSize && id != fiber->id ? scheduler->fibers[id] : NULL;
+    if (target == NULL)
+    {
+        pthread_mutex_unlock(&scheduler->lock);
+        *exception = EX_ILLEGAL_OPERATION;
+        return 0;
+    }
+
+    if (target->done)
+    {
+        vm->stack[vm->stackSize - 1] = target->result;
+        ++vm->instructionPointer;
+        pthread_mutex_unlock(&scheduler->lock);
+        return 1;
+    }
+
+    fiber->next = target->waiters;
+    target->waiters = fiber;
+    pthread_mutex_unlock(&scheduler->lock);
+
+    return 0;
+}
+
+// Runs `fiber` until it stops, blocks, is preempted or fails.
+static void vmFiberRun(VMScheduler *scheduler, int64_t worker, VMFiber *fiber)
+{
+    QuarkVM *vm = fiber->vm;
+    atomic_fetch_add(&scheduler->switches, 1);
+
+    while (!atomic_load(&scheduler->finished))
+    {
+        const uint64_t instructions = vm->instructionCount, natives = vm->nativeCount;
+        Exception exception = vmRun(vm, scheduler->slice);
+
+        const uint64_t executed = vm->instructionCount - instructions;
+        const uint64_t total = atomic_fetch_add(&scheduler->instructionCount, executed) + executed;
+        atomic_fetch_add(&scheduler->nativeCount, vm->nativeCount - natives);
+
+        if (exception == EX_OK && vm->halt)
+        {
+            vmFiberStop(scheduler, worker, fiber);
+            return;
+        }
+
+        if (exception == EX_OK && ((scheduler->maxInstructions > 0 && total >= scheduler->maxInstructions) ||
+                                   (scheduler->deadline > 0 && vmSeconds() >= scheduler->deadline)))
+        {
+            if (vmFiberFinishAll(scheduler, EX_LIMIT_EXCEEDED)) vmReportException(vm, EX_LIMIT_EXCEEDED);
+            return;
+        }
+
+        if (exception != EX_OK)
+        {
+            vmFiberFinishAll(scheduler, exception);
+            return;
+        }
+
+        const InstructionType trap = vm->trap;
+        vm->trap = INST_KAPUT;
+
+        if (trap == INST_KAPUT || trap == INST_YIELD)
+        {
+            if (trap == INST_YIELD) ++vm->instructionPointer;
+            vmFiberReady(scheduler, worker, fiber, 0);
+            return;
+        }
+
+        if (vm->stackSize < 1) exception = EX_STACK_UNDERFLOW;
+        else if (trap == INST_SPAWN)
+        {
+            VMFiber *child = vmFiberCreate(scheduler, vm->program[vm->instructionPointer].value.asI64,
+                                           &vm->stack[vm->stackSize - 1]);
+            vm->stack[vm->stackSize - 1].asI64 = child->id;
+            ++vm->instructionPointer;
+
+            vmFiberReady(scheduler, worker, child, 1);
+            continue;
+        } else if (vmFiberJoin(scheduler, fiber, &exception)) continue;
+        else if (exception == EX_OK) return;
+
+        vmReportException(vm, exception);
+        vmFiberFinishAll(scheduler, exception);
+        return;
+    }
+}
+
+// The next fiber for `worker` to run: its own newest, or else one stolen from another worker. Sleeps
+// while there is none, and returns NULL once the run has finished. Ends the run if every worker is
+// idle with nothing queued, as every remaining fiber is then blocked in join.
+static VMFiber *vmFiberNext(VMScheduler *scheduler, int64_t worker)
+{
+    while (!atomic_load(&scheduler->finished))
+    {
+        VMFiber *fiber = vmFiberDequeTake(&scheduler->deques[worker], 1);
+        for (int64_t i = 1; fiber == NULL && i < scheduler->workerCount; ++i)
+            if ((fiber = vmFiberDequeTake(&scheduler->deques[(worker + i) % scheduler->workerCount], 0)) != NULL)
+                atomic_fetch_add(&scheduler->steals, 1);
+
+        if (fiber != NULL)
+        {
+            atomic_fetch_sub(&scheduler->queued, 1);
+            return fiber;
+        }
+
+        pthread_mutex_lock(&scheduler->lock);
+        if (atomic_fetch_add(&scheduler->sleeping, 1) + 1 == scheduler->workerCount &&
+            atomic_load(&scheduler->queued) == 0 && !atomic_load(&scheduler->finished))
+        {
+            fprintf(scheduler->host->errors, "[\033[1;31mERROR\033[0m]: Deadlock: every fiber is waiting in join.\n");
+            scheduler->exception = EX_ILLEGAL_OPERATION;
+            atomic_store(&scheduler->finished, 1);
+            pthread_cond_broadcast(&scheduler->wake);
+        }
+
+        while (atomic_load(&scheduler->queued) == 0 && !atomic_load(&scheduler->finished))
+            pthread_cond_wait(&scheduler->wake, &scheduler->lock);
+        atomic_fetch_sub(&scheduler->sleeping, 1);
+        pthread_mutex_unlock(&scheduler->lock);
+    }
+
+    return NULL;
+}
+
+typedef struct
+{
+    VMScheduler *scheduler;
+    int64_t worker;
+} VMFiberWorker;
+
+static void *vmFiberWorker(void *argument)
+{
+    const VMFiberWorker *worker = argument;
+    for (VMFiber *fiber; (fiber = vmFiberNext(worker->scheduler, worker->worker)) != NULL;)
+        vmFiberRun(worker->scheduler, worker->worker, fiber);
+
+    return NULL;
+}
+
+// Runs the program loaded in `host` (with its natives pushed, and `verified` set if it was) as fiber 0
+// until it stops, and returns EX_OK, or the first exception any fiber raised. Sets `host->halt` if
+// fiber 0 stopped and adds the instructions and natives of every fiber to the host's counts.
+static Exception vmRunFibers(QuarkVM *host, VMScheduler *scheduler)
+{
+    if (scheduler->workerCount <= 0) scheduler->workerCount = vmProcessorCount();
+    if (scheduler->slice == 0) scheduler->slice = 1 << 20;
+
+    scheduler->host = host;
+    pthread_mutex_init(&scheduler->lock, NULL);
+    pthread_mutex_init(&scheduler->heapLock, NULL);
+    pthread_cond_init(&scheduler->wake, NULL);
+    atomic_init(&scheduler->queued, 0);
+    atomic_init(&scheduler->sleeping, 0);
+    atomic_init(&scheduler->finished, 0);
+    atomic_init(&scheduler->instructionCount, 0);
+    atomic_init(&scheduler->nativeCount, 0);
+    atomic_init(&scheduler->switches, 0);
+    atomic_init(&scheduler->steals, 0);
+
+    scheduler->nativeFunctions = vmFiberAllocateMemory(sizeof(scheduler->nativeFunctions[0]) * (host->nativeFunctionsSize + 1));
+    for (int64_t i = 0; i < host->nativeFunctionsSize; ++i)
+    {
+        scheduler->nativeFunctions[i] = host->nativeFunctions[i];
+        if (host->nativeFunctions[i].function == vmAllocate) scheduler->nativeFunctions[i].function = vmFiberAllocate;
+        else if (host->nativeFunctions[i].function == vmFree) scheduler->nativeFunctions[i].function = vmFiberFree;
+    }
+
+    scheduler->deques = vmFiberAllocateMemory(sizeof(scheduler->deques[0]) * scheduler->workerCount);
+    for (int64_t i = 0; i < scheduler->workerCount; ++i) pthread_mutex_init(&scheduler->deques[i].lock, NULL);
+
+    // Decode the threaded code once for every fiber to borrow.
+    vmRun(host, 0);
+
+    const double start = vmSeconds();
+    scheduler->deadline = scheduler->timeout > 0 ? start + scheduler->timeout : 0;
+    vmFiberReady(scheduler, 0, vmFiberCreate(scheduler, host->instructionPointer, NULL), 1);
+
+    pthread_t *threads = vmFiberAllocateMemory(sizeof(threads[0]) * scheduler->workerCount);
+    VMFiberWorker *workers = vmFiberAllocateMemory(sizeof(workers[0]) * scheduler->workerCount);
+    for (int64_t i = 0; i < scheduler->workerCount; ++i)
+    {
+        workers[i] = (VMFiberWorker) {scheduler, i};
+        if (pthread_create(&threads[i], NULL, vmFiberWorker, &workers[i]) != 0)
+        {
+            fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not start worker %" PRId64 "\n", i);
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int64_t i = 0; i < scheduler->workerCount; ++i) pthread_join(threads[i], NULL);
+
+    free(threads);
+    free(workers);
+
+    host->halt = scheduler->halted;
+    host->instructionCount += atomic_load(&scheduler->instructionCount);
+    host->nativeCount += atomic_load(&scheduler->nativeCount);
+
+    return scheduler->exception;
+}
+
+static void vmSchedulerDestroy(VMScheduler *scheduler)
+{
+    for (int64_t i = 0; i < scheduler->fiberSize; ++i)
+    {
+        QuarkVM *vm = scheduler->fibers[i]->vm;
+        if (vm != NULL)
+        {
+            scheduler->pool = vmReserve(scheduler->pool, &scheduler->poolCapacity, scheduler->poolSize + 1,
+                                        sizeof(scheduler->pool[0]));
+            scheduler->pool[scheduler->poolSize++] = vm;
+        }
+        free(scheduler->fibers[i]);
+    }
+
+    for (int64_t i = 0; i < scheduler->poolSize; ++i)
+    {
+        scheduler->pool[i]->nativeFunctions = NULL;
+        vmDestroy(scheduler->pool[i]);
+        free(scheduler->pool[i]);
+    }
+
+    for (int64_t i = 0; i < scheduler->workerCount && scheduler->deques != NULL; ++i)
+    {
+        pthread_mutex_destroy(&scheduler->deques[i].lock);
+        free(scheduler->deques[i].items);
+    }
+
+    pthread_mutex_destroy(&scheduler->lock);
+    pthread_mutex_destroy(&scheduler->heapLock);
+    pthread_cond_destroy(&scheduler->wake);
+
+    free(scheduler->deques);
+    free(scheduler->nativeFunctions);
+    free(scheduler->fibers);
+    free(scheduler->pool);
+    *scheduler = (VMScheduler) {0};
+}
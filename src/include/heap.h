@@ -0,0 +1,249 @@
+#pragma once
+
+// The heap behind natives 0 (allocate) and 1 (free).
+//
+// Requests of up to VM_HEAP_MAX_SMALL bytes are rounded up to a power-of-two size class and carved
+// out of VM_HEAP_SLAB_BYTES slabs with a bump pointer; freed blocks go to a per-class free list and
+// are handed out again before the slab grows. Larger requests go to malloc. Every block starts with a
+// VMHeapBlock header, so free needs no size. A heap belongs to one VM, and so to one thread at a time:
+// nothing here is locked.
+//
+// With `debug` set, free checks that the pointer was handed out by this heap and is still live, and
+// fails instead of corrupting the free lists, and the memory instructions check that every access
+// stays inside a live block (vmHeapCovers).
+
+#include <stdio.h>
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <inttypes.h>
+
+#define VM_HEAP_MIN_SHIFT 4
+#define VM_HEAP_CLASSES 9
+#define VM_HEAP_MAX_SMALL ((size_t) 1 << (VM_HEAP_MIN_SHIFT + VM_HEAP_CLASSES - 1))
+#define VM_HEAP_LARGE VM_HEAP_CLASSES
+#define VM_HEAP_SLAB_BYTES ((size_t) 64 * 1024)
+
+#define VM_HEAP_LIVE 0x4C495645u
+#define VM_HEAP_FREE 0x46524545u
+
+typedef struct
+{
+    uint32_t sizeClass;
+    uint32_t state;
+    uint64_t size;
+} VMHeapBlock;
+
+typedef struct VMHeapFree
+{
+    struct VMHeapFree *next;
+} VMHeapFree;
+
+typedef struct VMHeapSlab
+{
+    struct VMHeapSlab *next;
+    size_t used;
+    _Alignas(16) unsigned char data[];
+} VMHeapSlab;
+
+typedef struct VMHeapLarge
+{
+    struct VMHeapLarge *previous;
+    struct VMHeapLarge *next;
+    VMHeapBlock block;
+} VMHeapLarge;
+
+typedef struct
+{
+    VMHeapFree *free[VM_HEAP_CLASSES];
+    VMHeapSlab *slabs;
+    VMHeapLarge *large;
+    int debug;
+
+    uint64_t liveBytes;
+    uint64_t peakBytes;
+    uint64_t liveBlocks;
+    uint64_t allocations[VM_HEAP_CLASSES + 1];
+    uint64_t frees;
+} VMHeap;
+
+static_assert(sizeof(VMHeapBlock) == 16 && sizeof(VMHeapLarge) % 16 == 0, "Heap blocks must stay 16-byte aligned");
+
+static size_t vmHeapClassSize(int sizeClass) { return (size_t) 1 << (VM_HEAP_MIN_SHIFT + sizeClass); }
+
+static int vmHeapClass(size_t size)
+{
+    int sizeClass = 0;
+    while (vmHeapClassSize(sizeClass) < size) ++sizeClass;
+
+    return sizeClass;
+}
+
+static void *vmHeapAllocate(VMHeap *heap, int64_t size)
+{
+    if (size < 0) return NULL;
+
+    VMHeapBlock *block;
+    if ((uint64_t) size > VM_HEAP_MAX_SMALL)
+    {
+        VMHeapLarge *large = malloc(sizeof(VMHeapLarge) + (size_t) size);
+        if (large == NULL) return NULL;
+
+        large->previous = NULL;
+        large->next = heap->large;
+        if (heap->large != NULL) heap->large->previous = large;
+        heap->large = large;
+
+        block = &large->block;
+        block->sizeClass = VM_HEAP_LARGE;
+    } else
+    {
+        const int sizeClass = vmHeapClass((size_t) size);
+        if (heap->free[sizeClass] != NULL)
+        {
+            block = (VMHeapBlock *) heap->free[sizeClass] - 1;
+            heap->free[sizeClass] = heap->free[sizeClass]->next;
+        } else
+        {
+            const size_t bytes = sizeof(VMHeapBlock) + vmHeapClassSize(sizeClass);
+            if (heap->slabs == NULL || heap->slabs->used + bytes > VM_HEAP_SLAB_BYTES)
+            {
+                VMHeapSlab *slab = malloc(sizeof(VMHeapSlab) + VM_HEAP_SLAB_BYTES);
+                if (slab == NULL) return NULL;
+
+                slab->next = heap->slabs;
+                slab->used = 0;
+                heap->slabs = slab;
+            }
+
+            block = (VMHeapBlock *) (heap->slabs->data + heap->slabs->used);
+            heap->slabs->used += bytes;
+        }
+
+        block->sizeClass = (uint32_t) sizeClass;
+    }
+
+    block->state = VM_HEAP_LIVE;
+    block->size = (uint64_t) size;
+
+    heap->liveBytes += block->size;
+    if (heap->liveBytes > heap->peakBytes) heap->peakBytes = heap->liveBytes;
+    ++heap->liveBlocks;
+    ++heap->allocations[block->sizeClass];
+
+    return block + 1;
+}
+
+// The block this heap handed out (live or freed) whose data `pointer` points into, or NULL.
+static const VMHeapBlock *vmHeapFind(const VMHeap *heap, const void *pointer)
+{
+    const unsigned char *address = pointer;
+    for (const VMHeapSlab *slab = heap->slabs; slab != NULL; slab = slab->next)
+        if (address >= slab->data + sizeof(VMHeapBlock) && address < slab->data + slab->used)
+        {
+            // Blocks are laid out back to back, so walk the slab to find the block around the address.
+            for (size_t offset = 0; offset < slab->used;)
+            {
+                const VMHeapBlock *block = (const VMHeapBlock *) (slab->data + offset);
+                const unsigned char *data = (const unsigned char *) (block + 1);
+                const size_t bytes = vmHeapClassSize((int) block->sizeClass);
+                if (address >= data && address < data + bytes) return block;
+                offset += sizeof(VMHeapBlock) + bytes;
+            }
+            return NULL;
+        }
+
+    for (const VMHeapLarge *large = heap->large; large != NULL; large = large->next)
+    {
+        const unsigned char *data = (const unsigned char *) (&large->block + 1);
+        if (address == data || (address > data && address < data + large->block.size)) return &large->block;
+    }
+
+    return NULL;
+}
+
+// Whether `pointer` is the start of a block this heap handed out (live or freed).
+static int vmHeapOwns(const VMHeap *heap, const void *pointer)
+{
+    const VMHeapBlock *block = vmHeapFind(heap, pointer);
+    return block != NULL && (const void *) (block + 1) == pointer;
+}
+
+// Whether the `bytes` bytes at `pointer` lie inside one live block of this heap. Only checked in debug
+// mode; otherwise the pointer is trusted, as in vmHeapFree.
+static int vmHeapCovers(const VMHeap *heap, const void *pointer, uint64_t bytes)
+{
+    if (!heap->debug || bytes == 0) return 1;
+
+    const VMHeapBlock *block = vmHeapFind(heap, pointer);
+    if (block == NULL || block->state != VM_HEAP_LIVE) return 0;
+
+    const uint64_t offset = (uint64_t) ((const unsigned char *) pointer - (const unsigned char *) (block + 1));
+    return offset <= block->size && bytes <= block->size - offset;
+}
+
+// Returns 0 if `pointer` cannot be freed (only detected in debug mode).
+static int vmHeapFree(VMHeap *heap, void *pointer)
+{
+    if (pointer == NULL) return 1;
+    if (heap->debug && (!vmHeapOwns(heap, pointer) || ((VMHeapBlock *) pointer - 1)->state != VM_HEAP_LIVE))
+        return 0;
+
+    VMHeapBlock *block = (VMHeapBlock *) pointer - 1;
+    block->state = VM_HEAP_FREE;
+
+    heap->liveBytes -= block->size;
+    --heap->liveBlocks;
+    ++heap->frees;
+
+    if (block->sizeClass == VM_HEAP_LARGE)
+    {
+        VMHeapLarge *large = (VMHeapLarge *) ((unsigned char *) block - offsetof(VMHeapLarge, block));
+        if (large->previous != NULL) large->previous->next = large->next;
+        else heap->large = large->next;
+        if (large->next != NULL) large->next->previous = large->previous;
+
+        free(large);
+        return 1;
+    }
+
+    VMHeapFree *entry = pointer;
+    entry->next = heap->free[block->sizeClass];
+    heap->free[block->sizeClass] = entry;
+
+    return 1;
+}
+
+// Releases every slab and large block, live or not. Statistics are kept; `debug` too.
+static void vmHeapRelease(VMHeap *heap)
+{
+    for (VMHeapSlab *slab = heap->slabs, *next; slab != NULL; slab = next)
+    {
+        next = slab->next;
+        free(slab);
+    }
+    for (VMHeapLarge *large = heap->large, *next; large != NULL; large = next)
+    {
+        next = large->next;
+        free(large);
+    }
+
+    memset(heap->free, 0, sizeof(heap->free));
+    heap->slabs = NULL;
+    heap->large = NULL;
+}
+
+static void vmHeapReport(FILE *stream, const VMHeap *heap)
+{
+    fprintf(stream, "Heap: %" PRIu64 " bytes live in %" PRIu64 " blocks, %" PRIu64 " bytes peak, %" PRIu64 " frees\n",
+            heap->liveBytes, heap->liveBlocks, heap->peakBytes, heap->frees);
+    for (int i = 0; i <= VM_HEAP_CLASSES; ++i)
+        if (heap->allocations[i] > 0)
+        {
+            if (i == VM_HEAP_LARGE) fprintf(stream, "  > %zu bytes: %" PRIu64 " allocations\n", VM_HEAP_MAX_SMALL,
+                                            heap->allocations[i]);
+            else fprintf(stream, "  %zu bytes: %" PRIu64 " allocations\n", vmHeapClassSize(i), heap->allocations[i]);
+        }
+}
@@ -0,0 +1,967 @@
+// x86-64 JIT compiler.
+//
+// Translates a verified program into native code with a single pass over the instructions. Within a
+// basic block the top of the operand stack is kept in a small virtual stack of registers and
+// constants, and only written back to the VM stack at block boundaries, before calls into C (natives
+// and fmod) and on exceptional exits. Every jump target, invoke return site and the entry point
+// starts with an empty virtual stack, so control can reach them from anywhere.
+//
+// Only programs accepted by vmVerifyProgram are compiled, which is what allows the generated code to
+// skip stack underflow checks; overflow is caught by the stack guard like in the unchecked engine.
+// Everything else, and any program run with heap bounds checking, runs on the threaded interpreter.
+
+#if defined(__x86_64__) && defined(__GNUC__) && VM_HAS_MMAP && VM_STACK_GUARD
+#define VM_HAS_JIT 1
+
+#define VM_JIT_PENDING 16
+
+enum
+{
+    JIT_RAX = 0, JIT_RCX, JIT_RDX, JIT_RBX, JIT_RSP, JIT_RBP, JIT_RSI, JIT_RDI,
+    JIT_R8, JIT_R9, JIT_R10, JIT_R11, JIT_R12, JIT_R13, JIT_R14, JIT_R15,
+};
+
+enum
+{
+    JIT_CC_B = 0x2, JIT_CC_AE = 0x3, JIT_CC_E = 0x4, JIT_CC_NE = 0x5, JIT_CC_A = 0x7, JIT_CC_P = 0xA,
+    JIT_CC_NP = 0xB, JIT_CC_L = 0xC, JIT_CC_GE = 0xD, JIT_CC_LE = 0xE, JIT_CC_G = 0xF,
+};
+
+// Registers available to the virtual stack. rax, rcx and rdx are scratch, rbx holds the VM stack
+// top and r12 the QuarkVM pointer.
+#define VM_JIT_POOL ((1u << JIT_RSI) | (1u << JIT_RDI) | (1u << JIT_R8) | (1u << JIT_R9) | (1u << JIT_R10) | \
+                     (1u << JIT_R11) | (1u << JIT_R14) | (1u << JIT_R15))
+
+typedef struct
+{
+    int isRegister;
+    int reg;
+    int64_t constant;
+} VMJitValue;
+
+typedef struct
+{
+    int64_t at;
+    int64_t target;
+} VMJitPatch;
+
+typedef struct
+{
+    uint8_t *code;
+    int64_t size;
+    int64_t capacity;
+
+    // Virtual stack entries above the VM stack, bottom first. Entry `i` belongs at
+    // [rbx + 8 * (offset + i)].
+    VMJitValue pending[VM_JIT_PENDING];
+    int count;
+    int64_t offset;
+    unsigned freeRegisters;
+
+    int64_t *addresses;
+    VMJitPatch *patches;
+    int64_t patchSize;
+    int64_t patchCapacity;
+    int64_t exit;
+} VMJit;
+
+typedef Exception (*VMJitEntry)(QuarkVM *vm, Word *top, const void *entry);
+
+static void vmJitByte(VMJit *jit, uint8_t byte)
+{
+    jit->code = vmReserve(jit->code, &jit->capacity, jit->size + 1, 1);
+    jit->code[jit->size++] = byte;
+}
+
+static void vmJitBytes(VMJit *jit, const uint8_t *bytes, int count)
+{
+    for (int i = 0; i < count; ++i) vmJitByte(jit, bytes[i]);
+}
+
+static void vmJitU32(VMJit *jit, uint32_t value)
+{
+    for (int i = 0; i < 4; ++i, value >>= 8) vmJitByte(jit, (uint8_t) value);
+}
+
+static void vmJitU64(VMJit *jit, uint64_t value)
+{
+    for (int i = 0; i < 8; ++i, value >>= 8) vmJitByte(jit, (uint8_t) value);
+}
+
+static int vmJitFitsI32(int64_t value) { return value >= INT32_MIN && value <= INT32_MAX; }
+
+// <op> with REX.W, `reg` in ModRM.reg and the register `rm` in ModRM.rm.
+static void vmJitRR(VMJit *jit, uint8_t opcode, int reg, int rm)
+{
+    vmJitByte(jit, 0x48 | (reg >= 8 ? 4 : 0) | (rm >= 8 ? 1 : 0));
+    if (opcode == 0xAF) vmJitByte(jit, 0x0F);
+    vmJitByte(jit, opcode);
+    vmJitByte(jit, 0xC0 | (reg & 7) << 3 | (rm & 7));
+}
+
+// <op> with the REX prefix `rex` (0x40, or 0x48 for REX.W), `reg` in ModRM.reg and [base + displacement]
+// in ModRM.rm. Opcodes above 0xFF are two bytes, emitted high byte first.
+static void vmJitMemory(VMJit *jit, uint8_t rex, uint16_t opcode, int reg, int base, int32_t displacement)
+{
+    vmJitByte(jit, rex | (reg >= 8 ? 4 : 0) | (base >= 8 ? 1 : 0));
+    if (opcode > 0xFF) vmJitByte(jit, (uint8_t) (opcode >> 8));
+    vmJitByte(jit, (uint8_t) opcode);
+    vmJitByte(jit, 0x80 | (reg & 7) << 3 | (base & 7));
+    if ((base & 7) == JIT_RSP) vmJitByte(jit, 0x24);
+    vmJitU32(jit, (uint32_t) displacement);
+}
+
+// <op> with REX.W, `reg` in ModRM.reg and [base + displacement] in ModRM.rm.
+static void vmJitRM(VMJit *jit, uint8_t opcode, int reg, int base, int32_t displacement)
+{
+    vmJitMemory(jit, 0x48, opcode, reg, base, displacement);
+}
+
+static void vmJitMove(VMJit *jit, int destination, int source)
+{
+    if (destination != source) vmJitRR(jit, 0x89, source, destination);
+}
+
+static void vmJitLoad(VMJit *jit, int destination, int base, int32_t displacement)
+{
+    vmJitRM(jit, 0x8B, destination, base, displacement);
+}
+
+static void vmJitStore(VMJit *jit, int base, int32_t displacement, int source)
+{
+    vmJitRM(jit, 0x89, source, base, displacement);
+}
+
+static void vmJitConstant(VMJit *jit, int destination, int64_t value)
+{
+    vmJitByte(jit, 0x48 | (destination >= 8 ? 1 : 0));
+    vmJitByte(jit, 0xB8 + (destination & 7));
+    vmJitU64(jit, (uint64_t) value);
+}
+
+// mov qword [base + displacement], imm32 (sign-extended)
+static void vmJitStoreImmediate(VMJit *jit, int base, int32_t displacement, int32_t value)
+{
+    vmJitRM(jit, 0xC7, 0, base, displacement);
+    vmJitU32(jit, (uint32_t) value);
+}
+
+// add/sub/cmp r64, imm32 (`extension` is 0, 5 or 7)
+static void vmJitImmediate(VMJit *jit, int extension, int reg, int32_t value)
+{
+    vmJitByte(jit, 0x48 | (reg >= 8 ? 1 : 0));
+    vmJitByte(jit, 0x81);
+    vmJitByte(jit, 0xC0 | extension << 3 | (reg & 7));
+    vmJitU32(jit, (uint32_t) value);
+}
+
+// movq xmm, r64 (`toXmm`) or movq r64, xmm
+static void vmJitMoveXmm(VMJit *jit, int xmm, int reg, int toXmm)
+{
+    vmJitByte(jit, 0x66);
+    vmJitByte(jit, 0x48 | (reg >= 8 ? 1 : 0));
+    vmJitByte(jit, 0x0F);
+    vmJitByte(jit, toXmm ? 0x6E : 0x7E);
+    vmJitByte(jit, 0xC0 | xmm << 3 | (reg & 7));
+}
+
+// setcc al; movzx eax, al
+static void vmJitSetCondition(VMJit *jit, int condition)
+{
+    vmJitBytes(jit, (const uint8_t[]) {0x0F, 0x90 + condition, 0xC0, 0x0F, 0xB6, 0xC0}, 6);
+}
+
+// Emits a rel32 jump (`condition` < 0 for jmp) and returns the offset of its displacement.
+static int64_t vmJitJump(VMJit *jit, int condition)
+{
+    if (condition < 0) vmJitByte(jit, 0xE9);
+    else vmJitBytes(jit, (const uint8_t[]) {0x0F, 0x80 + condition}, 2);
+
+    vmJitU32(jit, 0);
+    return jit->size - 4;
+}
+
+static void vmJitBind(VMJit *jit, int64_t at, int64_t target)
+{
+    const int32_t displacement = (int32_t) (target - (at + 4));
+    memcpy(jit->code + at, &displacement, 4);
+}
+
+static void vmJitJumpTo(VMJit *jit, int condition, int64_t target)
+{
+    const int64_t at = vmJitJump(jit, condition);
+    jit->patches = vmReserve(jit->patches, &jit->patchCapacity, jit->patchSize + 1, sizeof(jit->patches[0]));
+    jit->patches[jit->patchSize++] = (VMJitPatch) {at, target};
+}
+
+// Writes the virtual stack back to the VM stack and moves rbx to the real top, without changing the
+// compile-time state (exception paths use this on their way out).
+static void vmJitSync(VMJit *jit)
+{
+    for (int i = 0; i < jit->count; ++i)
+    {
+        const int32_t displacement = (int32_t) (8 * (jit->offset + i));
+        if (jit->pending[i].isRegister) vmJitStore(jit, JIT_RBX, displacement, jit->pending[i].reg);
+        else if (vmJitFitsI32(jit->pending[i].constant))
+            vmJitStoreImmediate(jit, JIT_RBX, displacement, (int32_t) jit->pending[i].constant);
+        else
+        {
+            vmJitConstant(jit, JIT_RAX, jit->pending[i].constant);
+            vmJitStore(jit, JIT_RBX, displacement, JIT_RAX);
+        }
+    }
+
+    if (jit->offset + jit->count != 0) vmJitImmediate(jit, 0, JIT_RBX, (int32_t) (8 * (jit->offset + jit->count)));
+}
+
+static void vmJitFlush(VMJit *jit)
+{
+    vmJitSync(jit);
+    jit->count = 0;
+    jit->offset = 0;
+    jit->freeRegisters = VM_JIT_POOL;
+}
+
+static void vmJitSpillBottom(VMJit *jit)
+{
+    const VMJitValue bottom = jit->pending[0];
+    const int32_t displacement = (int32_t) (8 * jit->offset);
+
+    if (bottom.isRegister)
+    {
+        vmJitStore(jit, JIT_RBX, displacement, bottom.reg);
+        jit->freeRegisters |= 1u << bottom.reg;
+    } else if (vmJitFitsI32(bottom.constant)) vmJitStoreImmediate(jit, JIT_RBX, displacement, (int32_t) bottom.constant);
+    else
+    {
+        vmJitConstant(jit, JIT_RAX, bottom.constant);
+        vmJitStore(jit, JIT_RBX, displacement, JIT_RAX);
+    }
+
+    memmove(jit->pending, jit->pending + 1, sizeof(jit->pending[0]) * --jit->count);
+    ++jit->offset;
+}
+
+static int vmJitAllocate(VMJit *jit)
+{
+    while (jit->freeRegisters == 0) vmJitSpillBottom(jit);
+
+    const int reg = __builtin_ctz(jit->freeRegisters);
+    jit->freeRegisters &= ~(1u << reg);
+
+    return reg;
+}
+
+static void vmJitRelease(VMJit *jit, int reg) { jit->freeRegisters |= 1u << reg; }
+
+static void vmJitPush(VMJit *jit, VMJitValue value)
+{
+    if (jit->count == VM_JIT_PENDING) vmJitSpillBottom(jit);
+    jit->pending[jit->count++] = value;
+}
+
+static void vmJitPushRegister(VMJit *jit, int reg) { vmJitPush(jit, (VMJitValue) {1, reg, 0}); }
+
+static int vmJitPopIsConstant(const VMJit *jit) { return jit->count > 0 && !jit->pending[jit->count - 1].isRegister; }
+
+// Pops the top of the stack into a register owned by the caller.
+static int vmJitPop(VMJit *jit)
+{
+    if (jit->count > 0)
+    {
+        const VMJitValue top = jit->pending[--jit->count];
+        if (top.isRegister) return top.reg;
+
+        const int reg = vmJitAllocate(jit);
+        vmJitConstant(jit, reg, top.constant);
+        return reg;
+    }
+
+    const int reg = vmJitAllocate(jit);
+    vmJitLoad(jit, reg, JIT_RBX, (int32_t) (8 * --jit->offset));
+    return reg;
+}
+
+static void vmJitDrop(VMJit *jit)
+{
+    if (jit->count == 0) --jit->offset;
+    else if (jit->pending[--jit->count].isRegister) vmJitRelease(jit, jit->pending[jit->count].reg);
+}
+
+// Leaves through the exit stub with `exception`, reporting `address` as the faulting instruction.
+static void vmJitRaise(VMJit *jit, Exception exception, int64_t address)
+{
+    vmJitSync(jit);
+    vmJitStoreImmediate(jit, JIT_R12, (int32_t) offsetof(QuarkVM, instructionPointer), (int32_t) address);
+    vmJitBytes(jit, (const uint8_t[]) {0xB8}, 1);
+    vmJitU32(jit, (uint32_t) exception);
+
+    const int64_t at = vmJitJump(jit, -1);
+    vmJitBind(jit, at, jit->exit);
+}
+
+// Raises `exception` unless `condition` holds.
+static void vmJitCheck(VMJit *jit, int condition, Exception exception, int64_t address)
+{
+    const int64_t skip = vmJitJump(jit, condition);
+    vmJitRaise(jit, exception, address);
+    vmJitBind(jit, skip, jit->size);
+}
+
+static void vmJitBinary(VMJit *jit, uint8_t opcode)
+{
+    const int rhs = vmJitPop(jit), lhs = vmJitPop(jit);
+    vmJitRR(jit, opcode, opcode == 0xAF ? lhs : rhs, opcode == 0xAF ? rhs : lhs);
+    vmJitRelease(jit, rhs);
+    vmJitPushRegister(jit, lhs);
+}
+
+// `opcode` is the second byte of the SSE2 scalar double instruction (0x58 add, 0x5C sub, 0x59 mul,
+// 0x5E div). Computes second <op> top, or top <op> `immediate` when `immediate` is non-NULL.
+static void vmJitFloat(VMJit *jit, uint8_t opcode, const Word *immediate)
+{
+    int rhs = JIT_RAX;
+    if (immediate != NULL) vmJitConstant(jit, JIT_RAX, immediate->asI64);
+    else rhs = vmJitPop(jit);
+
+    const int lhs = vmJitPop(jit);
+    vmJitMoveXmm(jit, 0, lhs, 1);
+    vmJitMoveXmm(jit, 1, rhs, 1);
+    vmJitBytes(jit, (const uint8_t[]) {0xF2, 0x0F, opcode, 0xC1}, 4);
+    vmJitMoveXmm(jit, 0, lhs, 0);
+
+    if (immediate == NULL) vmJitRelease(jit, rhs);
+    vmJitPushRegister(jit, lhs);
+}
+
+// Sets the flags from `cmp top, second`, or from `ucomisd` of the same pair when `isFloat` (second
+// against top when `swap`).
+static void vmJitCompare(VMJit *jit, int isFloat, int swap, int top, int second)
+{
+    if (!isFloat)
+    {
+        vmJitRR(jit, 0x39, second, top);
+        return;
+    }
+
+    vmJitMoveXmm(jit, 0, swap ? second : top, 1);
+    vmJitMoveXmm(jit, 1, swap ? top : second, 1);
+    vmJitBytes(jit, (const uint8_t[]) {0x66, 0x0F, 0x2E, 0xC1}, 4);
+}
+
+static int vmJitCondition(InstructionType type, int *isFloat, int *swap)
+{
+    *isFloat = 0;
+    *swap = 0;
+
+    switch (type)
+    {
+        case INST_IEQ:
+        case INST_JUMP_IEQ:
+            return JIT_CC_E;
+        case INST_JUMP_INEQ:
+            return JIT_CC_NE;
+        case INST_IGT:
+        case INST_JUMP_IGT:
+            return JIT_CC_G;
+        case INST_ILT:
+        case INST_JUMP_ILT:
+            return JIT_CC_L;
+        case INST_IGEQ:
+        case INST_JUMP_IGEQ:
+            return JIT_CC_GE;
+        case INST_ILEQ:
+        case INST_JUMP_ILEQ:
+            return JIT_CC_LE;
+        case INST_FEQ:
+        case INST_JUMP_FEQ:
+            *isFloat = 1;
+            return JIT_CC_E;
+        case INST_FGT:
+        case INST_JUMP_FGT:
+            *isFloat = 1;
+            return JIT_CC_A;
+        case INST_FGEQ:
+        case INST_JUMP_FGEQ:
+            *isFloat = 1;
+            return JIT_CC_AE;
+        case INST_FLT:
+        case INST_JUMP_FLT:
+            *isFloat = *swap = 1;
+            return JIT_CC_A;
+        case INST_FLEQ:
+        case INST_JUMP_FLEQ:
+            *isFloat = *swap = 1;
+            return JIT_CC_AE;
+        default:
+            assert(0 && "[vmJitCondition]: Unreachable");
+            return JIT_CC_E;
+    }
+}
+
+// Float equality is ZF set and PF clear; store the result of that in eax.
+static void vmJitFloatEqual(VMJit *jit)
+{
+    vmJitBytes(jit, (const uint8_t[]) {0x0F, 0x94, 0xC0, 0x0F, 0x9B, 0xC1, 0x20, 0xC8, 0x0F, 0xB6, 0xC0}, 11);
+}
+
+// Loads or stores (`value` set) through the pointer in `pointer` plus `offset`. Loads replace the
+// pointer with the sign-extended value; stores release both registers.
+static void vmJitAccess(VMJit *jit, InstructionType type, int pointer, int value, int64_t offset)
+{
+    if (!vmJitFitsI32(offset))
+    {
+        vmJitConstant(jit, JIT_RAX, offset);
+        vmJitRR(jit, 0x01, JIT_RAX, pointer);
+        offset = 0;
+    }
+
+    switch (type)
+    {
+        case INST_ILOAD8:
+            vmJitMemory(jit, 0x48, 0x0FBE, pointer, pointer, (int32_t) offset); // movsx r64, byte
+            break;
+        case INST_ILOAD32:
+            vmJitMemory(jit, 0x48, 0x63, pointer, pointer, (int32_t) offset); // movsxd r64, dword
+            break;
+        case INST_ILOAD64:
+        case INST_FLOAD:
+            vmJitLoad(jit, pointer, pointer, (int32_t) offset);
+            break;
+        case INST_ISTORE8:
+            vmJitMemory(jit, 0x40, 0x88, value, pointer, (int32_t) offset); // REX for sil and dil
+            break;
+        case INST_ISTORE32:
+            vmJitMemory(jit, 0x40, 0x89, value, pointer, (int32_t) offset);
+            break;
+        default:
+            vmJitStore(jit, pointer, (int32_t) offset, value);
+            break;
+    }
+}
+
+static void vmJitInstruction(VMJit *jit, const QuarkVM *vm, int64_t address)
+{
+    const Instruction instruction = vm->program[address];
+    const int64_t value = instruction.value.asI64;
+    int isFloat, swap, top, second, reg;
+
+    switch (instruction.type)
+    {
+        case INST_KAPUT:
+            break;
+        case INST_PUT:
+            vmJitPush(jit, (VMJitValue) {0, 0, value});
+            break;
+        case INST_DUP:
+            if (value < jit->count)
+            {
+                const VMJitValue source = jit->pending[jit->count - 1 - value];
+                if (!source.isRegister)
+                {
+                    vmJitPush(jit, source);
+                    break;
+                }
+
+                reg = vmJitAllocate(jit);
+                vmJitMove(jit, reg, source.reg);
+            } else
+            {
+                const int64_t slot = jit->offset - 1 - (value - jit->count);
+                reg = vmJitAllocate(jit);
+                vmJitLoad(jit, reg, JIT_RBX, (int32_t) (8 * slot));
+            }
+
+            vmJitPushRegister(jit, reg);
+            break;
+        case INST_SWAP:
+            if (value == 0) break;
+            if (value < jit->count)
+            {
+                const VMJitValue temp = jit->pending[jit->count - 1];
+                jit->pending[jit->count - 1] = jit->pending[jit->count - 1 - value];
+                jit->pending[jit->count - 1 - value] = temp;
+            } else if (jit->count > 0)
+            {
+                const int64_t slot = jit->offset - 1 - (value - jit->count);
+                reg = vmJitPop(jit);
+                vmJitLoad(jit, JIT_RAX, JIT_RBX, (int32_t) (8 * slot));
+                vmJitStore(jit, JIT_RBX, (int32_t) (8 * slot), reg);
+                vmJitMove(jit, reg, JIT_RAX);
+                vmJitPushRegister(jit, reg);
+            } else
+            {
+                const int32_t first = (int32_t) (8 * (jit->offset - 1)), other = (int32_t) (8 * (jit->offset - 1 - value));
+                vmJitLoad(jit, JIT_RAX, JIT_RBX, first);
+                vmJitLoad(jit, JIT_RCX, JIT_RBX, other);
+                vmJitStore(jit, JIT_RBX, first, JIT_RCX);
+                vmJitStore(jit, JIT_RBX, other, JIT_RAX);
+            }
+            break;
+        case INST_RELEASE:
+            vmJitDrop(jit);
+            break;
+
+        case INST_IPLUS:
+        case INST_IMINUS:
+            if (vmJitPopIsConstant(jit) && vmJitFitsI32(jit->pending[jit->count - 1].constant))
+            {
+                const int32_t immediate = (int32_t) jit->pending[--jit->count].constant;
+                reg = vmJitPop(jit);
+                vmJitImmediate(jit, instruction.type == INST_IPLUS ? 0 : 5, reg, immediate);
+                vmJitPushRegister(jit, reg);
+            } else vmJitBinary(jit, instruction.type == INST_IPLUS ? 0x01 : 0x29);
+            break;
+        case INST_IMUL:
+            vmJitBinary(jit, 0xAF);
+            break;
+        case INST_IDIV:
+        case INST_IMOD:
+            top = vmJitPop(jit);
+            second = vmJitPop(jit);
+            if (instruction.type == INST_IDIV)
+            {
+                vmJitRR(jit, 0x85, top, top);
+                vmJitCheck(jit, JIT_CC_NE, EX_DIVIDE_BY_ZERO, address);
+            }
+
+            vmJitMove(jit, JIT_RAX, second);
+            vmJitBytes(jit, (const uint8_t[]) {0x48, 0x99}, 2);
+            vmJitByte(jit, 0x48 | (top >= 8 ? 1 : 0));
+            vmJitBytes(jit, (const uint8_t[]) {0xF7, 0xF8 | (top & 7)}, 2);
+            vmJitMove(jit, second, instruction.type == INST_IDIV ? JIT_RAX : JIT_RDX);
+            vmJitRelease(jit, top);
+            vmJitPushRegister(jit, second);
+            break;
+
+        case INST_FPLUS:
+            vmJitFloat(jit, 0x58, NULL);
+            break;
+        case INST_FMINUS:
+            vmJitFloat(jit, 0x5C, NULL);
+            break;
+        case INST_FMUL:
+            vmJitFloat(jit, 0x59, NULL);
+            break;
+        case INST_FDIV:
+            reg = vmJitPop(jit);
+            vmJitMove(jit, JIT_RAX, reg);
+            vmJitRR(jit, 0x01, JIT_RAX, JIT_RAX);
+            vmJitPushRegister(jit, reg);
+            vmJitCheck(jit, JIT_CC_NE, EX_DIVIDE_BY_ZERO, address);
+            vmJitFloat(jit, 0x5E, NULL);
+            break;
+        case INST_FMOD:
+            vmJitFlush(jit);
+            vmJitLoad(jit, JIT_RAX, JIT_RBX, -16);
+            vmJitMoveXmm(jit, 0, JIT_RAX, 1);
+            vmJitLoad(jit, JIT_RAX, JIT_RBX, -8);
+            vmJitMoveXmm(jit, 1, JIT_RAX, 1);
+            vmJitConstant(jit, JIT_RAX, (int64_t) (uintptr_t) fmod);
+            vmJitBytes(jit, (const uint8_t[]) {0xFF, 0xD0}, 2);
+            vmJitMoveXmm(jit, 0, JIT_RAX, 0);
+            vmJitStore(jit, JIT_RBX, -16, JIT_RAX);
+            vmJitImmediate(jit, 5, JIT_RBX, 8);
+            break;
+
+        case INST_JUMP:
+            vmJitFlush(jit);
+            vmJitJumpTo(jit, -1, value);
+            break;
+        case INST_JUMP_IF:
+        case INST_JUMP_IF_NOT:
+            reg = vmJitPop(jit);
+            vmJitFlush(jit);
+            vmJitRR(jit, 0x85, reg, reg);
+            vmJitJumpTo(jit, instruction.type == INST_JUMP_IF ? JIT_CC_NE : JIT_CC_E, value);
+            break;
+        case INST_JUMP_IF_DUP:
+            vmJitFlush(jit);
+            vmJitLoad(jit, JIT_RAX, JIT_RBX, -8);
+            vmJitRR(jit, 0x85, JIT_RAX, JIT_RAX);
+            vmJitJumpTo(jit, JIT_CC_NE, value);
+            break;
+        case INST_RETURN:
+            reg = vmJitPop(jit);
+            vmJitFlush(jit);
+            vmJitMove(jit, JIT_RAX, reg);
+            if (vmJitFitsI32(vm->programSize)) vmJitImmediate(jit, 7, JIT_RAX, (int32_t) vm->programSize);
+            else
+            {
+                vmJitConstant(jit, JIT_RCX, vm->programSize);
+                vmJitRR(jit, 0x39, JIT_RCX, JIT_RAX);
+            }
+
+            vmJitCheck(jit, JIT_CC_B, EX_ILLEGAL_INSTRUCTION_ACCESS, vm->programSize);
+            vmJitConstant(jit, JIT_RCX, 0);
+            jit->addresses[vm->programSize + 1 + address] = jit->size - 8;
+            vmJitBytes(jit, (const uint8_t[]) {0xFF, 0x24, 0xC1}, 3);
+            break;
+        case INST_INVOKE:
+            vmJitFlush(jit);
+            vmJitStoreImmediate(jit, JIT_RBX, 0, (int32_t) (address + 1));
+            vmJitImmediate(jit, 0, JIT_RBX, 8);
+            vmJitJumpTo(jit, -1, value);
+            break;
+        case INST_NATIVE:
+            vmJitFlush(jit);
+            if (value < 0 || value >= vm->nativeFunctionsSize)
+            {
+                vmJitRaise(jit, EX_ILLEGAL_OPERATION, address);
+                break;
+            }
+
+            vmJitMove(jit, JIT_RAX, JIT_RBX);
+            vmJitRM(jit, 0x2B, JIT_RAX, JIT_R12, (int32_t) offsetof(QuarkVM, stack));
+            vmJitBytes(jit, (const uint8_t[]) {0x48, 0xC1, 0xF8, 0x03}, 4);
+            vmJitStore(jit, JIT_R12, (int32_t) offsetof(QuarkVM, stackSize), JIT_RAX);
+            vmJitStoreImmediate(jit, JIT_R12, (int32_t) offsetof(QuarkVM, instructionPointer), (int32_t) address);
+            vmJitMove(jit, JIT_RDI, JIT_R12);
+            vmJitConstant(jit, JIT_RAX, (int64_t) (uintptr_t) vm->nativeFunctions[value].function);
+            vmJitBytes(jit, (const uint8_t[]) {0xFF, 0xD0}, 2);
+
+            vmJitLoad(jit, JIT_RCX, JIT_R12, (int32_t) offsetof(QuarkVM, stack));
+            vmJitLoad(jit, JIT_RDX, JIT_R12, (int32_t) offsetof(QuarkVM, stackSize));
+            vmJitBytes(jit, (const uint8_t[]) {0x48, 0x8D, 0x1C, 0xD1, 0x85, 0xC0}, 6);
+            vmJitBind(jit, vmJitJump(jit, JIT_CC_NE), jit->exit);
+            break;
+
+        case INST_IEQ:
+        case INST_IGT:
+        case INST_ILT:
+        case INST_IGEQ:
+        case INST_ILEQ:
+        case INST_FEQ:
+        case INST_FGT:
+        case INST_FLT:
+        case INST_FGEQ:
+        case INST_FLEQ:
+        {
+            const int condition = vmJitCondition(instruction.type, &isFloat, &swap);
+            top = vmJitPop(jit);
+            second = vmJitPop(jit);
+            vmJitCompare(jit, isFloat, swap, top, second);
+            if (instruction.type == INST_FEQ) vmJitFloatEqual(jit);
+            else vmJitSetCondition(jit, condition);
+
+            vmJitMove(jit, second, JIT_RAX);
+            vmJitRelease(jit, top);
+            vmJitPushRegister(jit, second);
+            break;
+        }
+        case INST_INEQ:
+        case INST_FNEQ:
+            reg = vmJitPop(jit);
+            vmJitMove(jit, JIT_RAX, reg);
+            if (instruction.type == INST_FNEQ) vmJitRR(jit, 0x01, JIT_RAX, JIT_RAX);
+            else vmJitRR(jit, 0x85, JIT_RAX, JIT_RAX);
+
+            vmJitSetCondition(jit, JIT_CC_E);
+            vmJitMove(jit, reg, JIT_RAX);
+            vmJitPushRegister(jit, reg);
+            break;
+
+        case INST_HALT:
+            vmJitFlush(jit);
+            vmJitBytes(jit, (const uint8_t[]) {0x41, 0xC7, 0x84, 0x24}, 4);
+            vmJitU32(jit, (uint32_t) offsetof(QuarkVM, halt));
+            vmJitU32(jit, 1);
+            vmJitRaise(jit, EX_OK, address);
+            break;
+
+        case INST_IPLUS_IMM:
+        case INST_IMINUS_IMM:
+            reg = vmJitPop(jit);
+            if (vmJitFitsI32(value)) vmJitImmediate(jit, instruction.type == INST_IPLUS_IMM ? 0 : 5, reg, (int32_t) value);
+            else
+            {
+                vmJitConstant(jit, JIT_RAX, value);
+                vmJitRR(jit, instruction.type == INST_IPLUS_IMM ? 0x01 : 0x29, JIT_RAX, reg);
+            }
+
+            vmJitPushRegister(jit, reg);
+            break;
+        case INST_FPLUS_IMM:
+            vmJitFloat(jit, 0x58, &instruction.value);
+            break;
+        case INST_FMINUS_IMM:
+            vmJitFloat(jit, 0x5C, &instruction.value);
+            break;
+        case INST_FMUL_IMM:
+            vmJitFloat(jit, 0x59, &instruction.value);
+            break;
+
+        case INST_JUMP_IEQ:
+        case INST_JUMP_INEQ:
+        case INST_JUMP_IGT:
+        case INST_JUMP_ILT:
+        case INST_JUMP_IGEQ:
+        case INST_JUMP_ILEQ:
+        case INST_JUMP_FEQ:
+        case INST_JUMP_FGT:
+        case INST_JUMP_FLT:
+        case INST_JUMP_FGEQ:
+        case INST_JUMP_FLEQ:
+        {
+            const int condition = vmJitCondition(instruction.type, &isFloat, &swap);
+            top = vmJitPop(jit);
+            second = vmJitPop(jit);
+            vmJitFlush(jit);
+
+            // The comparison must come after the flush, which clobbers the flags.
+            vmJitCompare(jit, isFloat, swap, top, second);
+
+            if (instruction.type == INST_JUMP_FEQ)
+            {
+                const int64_t unordered = vmJitJump(jit, JIT_CC_P);
+                vmJitJumpTo(jit, JIT_CC_E, value);
+                vmJitBind(jit, unordered, jit->size);
+            } else vmJitJumpTo(jit, condition, value);
+            break;
+        }
+
+        case INST_ILOAD8:
+        case INST_ILOAD32:
+        case INST_ILOAD64:
+        case INST_FLOAD:
+            reg = vmJitPop(jit);
+            vmJitAccess(jit, instruction.type, reg, -1, value);
+            vmJitPushRegister(jit, reg);
+            break;
+        case INST_ISTORE8:
+        case INST_ISTORE32:
+        case INST_ISTORE64:
+        case INST_FSTORE:
+            top = vmJitPop(jit);
+            second = vmJitPop(jit);
+            vmJitAccess(jit, instruction.type, second, top, value);
+            vmJitRelease(jit, top);
+            vmJitRelease(jit, second);
+            break;
+        case INST_MEMCPY:
+        case INST_MEMSET:
+        case INST_MEMCMP:
+        case INST_VFPLUS:
+        case INST_VFMINUS:
+        case INST_VFMUL:
+        case INST_VFDIV:
+        case INST_VFFMA:
+        case INST_VFLT:
+        case INST_VFEQ:
+        case INST_VIPLUS:
+        case INST_VIMINUS:
+        case INST_VIMUL:
+        case INST_VIDIV:
+        case INST_VIFMA:
+        case INST_VILT:
+        case INST_VIEQ:
+        case INST_VFDOT:
+        case INST_VFSUM:
+        case INST_VFMIN:
+        case INST_VFMAX:
+        case INST_VIDOT:
+        case INST_VISUM:
+        case INST_VIMIN:
+        case INST_VIMAX:
+        {
+            // vmMemoryBulk or vmMemoryVector(vm, type, top), leaving the operands on the stack if it fails.
+            Exception (*function)(const QuarkVM *, InstructionType, Word *) = vmMemoryVector;
+            if (instruction.type == INST_MEMCPY || instruction.type == INST_MEMSET || instruction.type == INST_MEMCMP)
+                function = vmMemoryBulk;
+
+            int64_t required = 0, delta = 0;
+            instructionStackEffect(vm, instruction, &required, &delta);
+
+            vmJitFlush(jit);
+            vmJitStoreImmediate(jit, JIT_R12, (int32_t) offsetof(QuarkVM, instructionPointer), (int32_t) address);
+            vmJitMove(jit, JIT_RDI, JIT_R12);
+            vmJitByte(jit, 0xBE);
+            vmJitU32(jit, (uint32_t) instruction.type);
+            vmJitMove(jit, JIT_RDX, JIT_RBX);
+            vmJitConstant(jit, JIT_RAX, (int64_t) (uintptr_t) function);
+            vmJitBytes(jit, (const uint8_t[]) {0xFF, 0xD0, 0x85, 0xC0}, 4);
+            vmJitBind(jit, vmJitJump(jit, JIT_CC_NE), jit->exit);
+            vmJitImmediate(jit, 5, JIT_RBX, (int32_t) (-8 * delta));
+            break;
+        }
+
+        case INST_SPAWN:
+        case INST_YIELD:
+        case INST_JOIN:
+            // Fibers only run on the scheduler in fiber.h.
+            vmJitFlush(jit);
+            vmJitRaise(jit, EX_ILLEGAL_OPERATION, address);
+            break;
+        default:
+            vmJitFlush(jit);
+            vmJitRaise(jit, EX_INVALID_INSTRUCTION, address);
+            break;
+    }
+}
+
+// Compiles `vm->program` into an executable mapping of `size` bytes. `table` receives the native
+// address of every return site and of `entry`. While compiling, `addresses` holds the offset of each
+// block start and, past `programSize`, where each return's table address has to be patched in.
+static uint8_t *vmJitCompile(const QuarkVM *vm, int64_t entry, const void ***table, int64_t **starts, size_t *size)
+{
+    const int64_t programSize = vm->programSize;
+    VMJit jit = {0};
+    jit.freeRegisters = VM_JIT_POOL;
+    jit.addresses = malloc(sizeof(jit.addresses[0]) * (2 * programSize + 2));
+    uint8_t *isTarget = calloc(programSize + 1, 1);
+    *starts = malloc(sizeof((*starts)[0]) * (programSize + 1));
+    if (jit.addresses == NULL || isTarget == NULL || *starts == NULL)
+    {
+        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not allocate memory for the JIT (%s)\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    for (int64_t i = 0; i < 2 * programSize + 2; ++i) jit.addresses[i] = -1;
+    for (int64_t i = 0; i < programSize; ++i)
+    {
+        const Instruction instruction = vm->program[i];
+        if (instructionWithAddress(instruction.type) && instruction.value.asI64 >= 0 &&
+            instruction.value.asI64 < programSize)
+            isTarget[instruction.value.asI64] = 1;
+        if (instruction.type == INST_INVOKE) isTarget[i + 1] = 1;
+    }
+    isTarget[entry] = 1;
+
+    // Entry: push rbx, rbp, r12-r15; keep the stack 16-byte aligned; rbx = top, r12 = vm; jump to
+    // the entry instruction. Exit: store the stack size, restore and return eax.
+    vmJitBytes(&jit, (const uint8_t[]) {0x53, 0x55, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57, 0x48, 0x83,
+                                        0xEC, 0x08, 0x48, 0x89, 0xF3, 0x49, 0x89, 0xFC, 0xFF, 0xE2}, 22);
+    jit.exit = jit.size;
+    vmJitMove(&jit, JIT_RCX, JIT_RBX);
+    vmJitRM(&jit, 0x2B, JIT_RCX, JIT_R12, (int32_t) offsetof(QuarkVM, stack));
+    vmJitBytes(&jit, (const uint8_t[]) {0x48, 0xC1, 0xF9, 0x03}, 4);
+    vmJitStore(&jit, JIT_R12, (int32_t) offsetof(QuarkVM, stackSize), JIT_RCX);
+    vmJitBytes(&jit, (const uint8_t[]) {0x48, 0x83, 0xC4, 0x08, 0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C,
+                                        0x5D, 0x5B, 0xC3}, 15);
+
+    for (int64_t i = 0; i < programSize; ++i)
+    {
+        if (isTarget[i])
+        {
+            vmJitFlush(&jit);
+            jit.addresses[i] = jit.size;
+        }
+
+        (*starts)[i] = jit.size;
+        vmJitInstruction(&jit, vm, i);
+    }
+
+    vmJitFlush(&jit);
+    jit.addresses[programSize] = jit.size;
+    vmJitRaise(&jit, EX_ILLEGAL_INSTRUCTION_ACCESS, programSize);
+
+    for (int64_t i = 0; i < jit.patchSize; ++i)
+    {
+        const int64_t target = jit.patches[i].target;
+        vmJitBind(&jit, jit.patches[i].at, jit.addresses[target >= 0 && target < programSize ? target : programSize]);
+    }
+
+    *size = (size_t) jit.size;
+    uint8_t *code = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    *table = malloc(sizeof((*table)[0]) * (programSize + 1));
+    if (code == MAP_FAILED || *table == NULL)
+    {
+        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not allocate memory for the JIT (%s)\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    // Returns may only land on invoke return sites; anything else goes to the out-of-bounds exit. The
+    // entry is looked up in the same table.
+    for (int64_t i = 0; i <= programSize; ++i)
+        (*table)[i] = code + jit.addresses[i > 0 && vm->program[i - 1].type == INST_INVOKE ? i : programSize];
+    (*table)[entry] = code + jit.addresses[entry];
+
+    memcpy(code, jit.code, *size);
+    for (int64_t i = 0; i < programSize; ++i)
+        if (jit.addresses[programSize + 1 + i] >= 0)
+        {
+            const void *const *base = *table;
+            memcpy(code + jit.addresses[programSize + 1 + i], &base, sizeof(base));
+        }
+
+    if (mprotect(code, *size, PROT_READ | PROT_EXEC) != 0)
+    {
+        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not map JIT code as executable (%s)\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    free(jit.code);
+    free(jit.addresses);
+    free(jit.patches);
+    free(isTarget);
+
+    return code;
+}
+
+// The instruction whose code was running at `machineAddress` when the stack overflowed. Pushes are
+// written back at the end of a basic block, so this can be a later instruction in the block than the
+// push. Faults outside the generated code come from natives and memory instructions, which store
+// their own address before calling into C.
+static int64_t vmJitFaultInstruction(const QuarkVM *vm, const uint8_t *code, size_t size, const int64_t *starts,
+                                     uintptr_t machineAddress)
+{
+    if (machineAddress < (uintptr_t) code || machineAddress >= (uintptr_t) code + size) return vm->instructionPointer;
+
+    const int64_t offset = (int64_t) (machineAddress - (uintptr_t) code);
+    int64_t low = 0, high = vm->programSize;
+    while (low < high)
+    {
+        const int64_t middle = low + (high - low) / 2;
+        if (starts[middle] <= offset) low = middle + 1;
+        else high = middle;
+    }
+
+    return low - 1;
+}
+
+// Runs the program with the JIT if it has been verified, otherwise with the threaded interpreter, which
+// also takes over when the heap is in debug mode, as only it checks memory accesses.
+static Exception vmExecuteJit(QuarkVM *vm, const VMVerification *verification)
+{
+    if (!verification->verified || vm->heap.debug) return vmExecuteProgramThreaded(vm);
+    if (vm->halt) return EX_OK;
+
+    const int64_t entry = vm->instructionPointer >= 0 && vm->instructionPointer < vm->programSize
+                          ? vm->instructionPointer : vm->programSize;
+    const void **table = NULL;
+    int64_t *starts = NULL;
+    size_t size = 0;
+    uint8_t *code = vmJitCompile(vm, entry, &table, &starts, &size);
+    Exception exception;
+
+    VM_GUARD_STACK(vm, guard);
+    if (VM_STACK_OVERFLOWED(guard))
+    {
+        vm->stackSize = VM_STACK_CAPACITY;
+        vm->instructionPointer = vmJitFaultInstruction(vm, code, size, starts, guard.machineAddress);
+        exception = EX_STACK_OVERFLOW;
+    } else
+    {
+        VMJitEntry function;
+        memcpy(&function, &code, sizeof(function));
+        exception = function(vm, vm->stack + vm->stackSize, table[entry]);
+    }
+    VM_RELEASE_STACK(guard);
+
+    munmap(code, size);
+    free(table);
+    free(starts);
+
+    vmFlushOutput(vm);
+    if (exception != EX_OK) vmReportException(vm, exception);
+    return exception;
+}
+#else
+#define VM_HAS_JIT 0
+
+static Exception vmExecuteJit(QuarkVM *vm, const VMVerification *verification)
+{
+    (void) verification;
+    return vmExecuteProgramThreaded(vm);
+}
+#endif
@@ -0,0 +1,529 @@
+#pragma once
+
+// Separate compilation: relocatable objects and the linker behind quarkl.
+//
+// An object (.qco) is a version 2 container (see vmLoadProgramFromFile) with the fixed-size code of
+// one source file, every address in it relative to the start of that file, and these sections:
+// - Symbols and natives: its local labels and its plugin natives, as in a .qce file.
+// - Exports: the labels it exports, with their addresses.
+// - Externs: the labels it imports, with their index.
+// - Relocations: one 16 byte entry (u64 address, u32 kind, u32 index) per operand the linker fixes up.
+//   VM_RELOCATE_LOCAL adds the base address of the file, VM_RELOCATE_EXTERN replaces the operand with
+//   the address of extern `index`, and VM_RELOCATE_NATIVE renumbers native `index` of the file.
+//
+// The linker lays the objects out in input order, so the program starts at the first instruction of
+// the first input. It resolves every extern against the exports of all inputs, merges plugin natives
+// by name and prefixes each local label with the name of its file. Sources are assembled to objects
+// next to them on a pool of threads, skipping those whose object is newer than the source.
+
+#include "compiler.h"
+#include "cache.h"
+
+#include <stdatomic.h>
+#include <pthread.h>
+
+#define VM_RELOCATION_BYTES 16
+
+typedef enum
+{
+    VM_RELOCATE_LOCAL = 1,
+    VM_RELOCATE_EXTERN,
+    VM_RELOCATE_NATIVE,
+} RelocationKind;
+
+typedef struct
+{
+    const char *path;
+    char *objectPath;
+    int isSource;
+    int assembled;
+
+    uint8_t *image;
+    Instruction *program;
+    int64_t programSize;
+    const uint8_t *symbols, *natives, *exports, *externs, *relocations;
+    int64_t symbolsSize, nativesSize, exportsSize, externsSize, relocationCount;
+} VMObject;
+
+typedef struct
+{
+    VMObject *objects;
+    int64_t objectCount;
+    int force;
+
+    atomic_int_fast64_t next;
+    atomic_int_fast64_t assembled;
+} VMLinkJobs;
+
+// Returns the first imported label of `vmTable`, or NULL if there is none.
+static const Function *vmFirstExtern(const VMTable *vmTable)
+{
+    for (int64_t i = 0; i < vmTable->functionSize; ++i)
+        if (vmTable->functions[i].linkage == VM_LINK_IMPORT) return &vmTable->functions[i];
+
+    return NULL;
+}
+
+// Encodes the labels of `vmTable` with `linkage` for vmNextRecord, in address order.
+static uint8_t *vmEncodeLinkage(const VMTable *vmTable, Linkage linkage, uint64_t *size, uint64_t *count)
+{
+    Function *records = malloc(sizeof(records[0]) * vmTable->functionSize + 1);
+    if (records == NULL) return NULL;
+
+    *count = 0;
+    for (int64_t i = 0; i < vmTable->functionSize; ++i)
+        if (vmTable->functions[i].linkage == linkage) records[(*count)++] = vmTable->functions[i];
+
+    if (linkage != VM_LINK_IMPORT) qsort(records, *count, sizeof(records[0]), vmCompareFunctions);
+    else
+        for (uint64_t i = 0; i < *count; ++i) records[i].address = (int64_t) i;
+
+    uint8_t *data = vmEncodeRecords(records, (int64_t) *count, size);
+    free(records);
+
+    return data;
+}
+
+// Writes `vm` as an object, through a temporary file like vmCacheSaveProgram. References to imported
+// labels are chained through their operands (see vmTableReference); they become relocations, and
+// their operands are cleared in place.
+static void vmSaveObjectToFile(QuarkVM *vm, const VMTable *vmTable, const char *filePath)
+{
+    int64_t *externs = malloc(sizeof(externs[0]) * vm->programSize + 1);
+    uint8_t *relocations = malloc(VM_RELOCATION_BYTES * vm->programSize + 1);
+    if (externs == NULL || relocations == NULL)
+    {
+        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not allocate memory for \"%s\" (%s).\n", filePath,
+                strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    for (int64_t i = 0; i < vm->programSize; ++i) externs[i] = -1;
+
+    int64_t externCount = 0;
+    for (int64_t i = 0; i < vmTable->functionSize; ++i)
+    {
+        if (vmTable->functions[i].linkage != VM_LINK_IMPORT) continue;
+
+        for (int64_t reference = vmTable->functions[i].references; reference >= 0;)
+        {
+            const int64_t next = vm->program[reference].value.asI64;
+            externs[reference] = externCount;
+            vm->program[reference].value.asI64 = 0;
+            reference = next;
+        }
+
+        ++externCount;
+    }
+
+    uint64_t relocationCount = 0;
+    for (int64_t i = 0; i < vm->programSize; ++i)
+    {
+        const Instruction instruction = vm->program[i];
+        uint64_t kind = 0, index = 0;
+
+        if (externs[i] >= 0)
+        {
+            kind = VM_RELOCATE_EXTERN;
+            index = (uint64_t) externs[i];
+        } else if (instructionWithAddress(instruction.type)) kind = VM_RELOCATE_LOCAL;
+        else if (instruction.type == INST_NATIVE && instruction.value.asI64 >= VM_NATIVE_BUILTINS)
+        {
+            kind = VM_RELOCATE_NATIVE;
+            index = (uint64_t) (instruction.value.asI64 - VM_NATIVE_BUILTINS);
+        }
+
+        if (kind == 0) continue;
+
+        uint8_t *relocation = relocations + relocationCount++ * VM_RELOCATION_BYTES;
+        vmWriteLE(relocation, (uint64_t) i, 8);
+        vmWriteLE(relocation + 8, kind, 4);
+        vmWriteLE(relocation + 12, index, 4);
+    }
+
+    free(externs);
+
+    Section sections[6];
+    int sectionCount = 0;
+
+    uint8_t *code = malloc(VM_QCE_INSTRUCTION_BYTES * vm->programSize + 1);
+    for (int64_t i = 0; code != NULL && i < vm->programSize; ++i)
+    {
+        vmWriteLE(code + i * VM_QCE_INSTRUCTION_BYTES, (uint64_t) vm->program[i].type, 4);
+        vmWriteLE(code + i * VM_QCE_INSTRUCTION_BYTES + 4, 0, 4);
+        vmWriteLE(code + i * VM_QCE_INSTRUCTION_BYTES + 8, (uint64_t) vm->program[i].value.asI64, 8);
+    }
+
+    sections[sectionCount++] = (Section) {VM_SECTION_CODE, VM_QCE_INSTRUCTION_BYTES, 0,
+                                          VM_QCE_INSTRUCTION_BYTES * vm->programSize, (uint64_t) vm->programSize, code};
+
+    const Linkage linkages[3] = {VM_LINK_LOCAL, VM_LINK_EXPORT, VM_LINK_IMPORT};
+    const SectionType types[3] = {VM_SECTION_SYMBOLS, VM_SECTION_EXPORTS, VM_SECTION_EXTERNS};
+    for (int i = 0; i < 3; ++i)
+    {
+        uint64_t size = 0, count = 0;
+        uint8_t *data = vmEncodeLinkage(vmTable, linkages[i], &size, &count);
+        sections[sectionCount++] = (Section) {types[i], 0, 0, size, count, data};
+    }
+
+    uint64_t nativesSize = 0;
+    uint8_t *natives = vmEncodeRecords(vmTable->imports, vmTable->importSize, &nativesSize);
+    sections[sectionCount++] = (Section) {VM_SECTION_NATIVES, 0, 0, nativesSize, (uint64_t) vmTable->importSize,
+                                          natives};
+    sections[sectionCount++] = (Section) {VM_SECTION_RELOCATIONS, VM_RELOCATION_BYTES, 0,
+                                          VM_RELOCATION_BYTES * relocationCount, relocationCount, relocations};
+
+    char *temporaryPath = vmCacheTemporaryPath(filePath);
+    vmWriteSections(sections, sectionCount, temporaryPath);
+    vmCacheRename(temporaryPath, filePath);
+}
+
+static void vmInvalidObject(const char *filePath, const char *reason)
+{
+    fprintf(stderr, "[\033[1;31mERROR\033[0m]: Invalid object file \"%s\" (%s)\n", filePath, reason);
+    exit(EXIT_FAILURE);
+}
+
+// Reads the object at `object->objectPath`.
+static void vmLoadObject(VMObject *object)
+{
+    const char *filePath = object->objectPath;
+    FILE *file = fopen(filePath, "rb");
+    if (file == NULL)
+    {
+        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not open file \"%s\" (%s)\n", filePath, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    struct stat status;
+    if (fstat(fileno(file), &status) < 0 || (object->image = malloc((size_t) status.st_size + 1)) == NULL ||
+        fread(object->image, 1, (size_t) status.st_size, file) != (size_t) status.st_size)
+    {
+        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not read file \"%s\" (%s)\n", filePath, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    fclose(file);
+
+    const uint8_t *image = object->image;
+    const uint64_t imageSize = (uint64_t) status.st_size;
+    if (imageSize < VM_QCE_HEADER_BYTES || memcmp(image, VM_QCE_MAGIC, 4) != 0 ||
+        vmReadLE(image + 4, 2) != VM_QCE_VERSION)
+        vmInvalidObject(filePath, "not a version 2 container");
+
+    const uint64_t sectionCount = vmReadLE(image + 6, 2);
+    if (VM_QCE_HEADER_BYTES + sectionCount * VM_QCE_SECTION_BYTES > imageSize)
+        vmInvalidObject(filePath, "truncated section table");
+
+    int hasCode = 0, hasRelocations = 0;
+    for (uint64_t i = 0; i < sectionCount; ++i)
+    {
+        const uint8_t *section = image + VM_QCE_HEADER_BYTES + i * VM_QCE_SECTION_BYTES;
+        const uint64_t type = vmReadLE(section, 4), entrySize = vmReadLE(section + 4, 4);
+        const uint64_t offset = vmReadLE(section + 8, 8), size = vmReadLE(section + 16, 8);
+        const uint64_t count = vmReadLE(section + 24, 8);
+
+        if (offset > imageSize || size > imageSize - offset) vmInvalidObject(filePath, "section out of bounds");
+
+        if (type == VM_SECTION_CODE)
+        {
+            if (entrySize != VM_QCE_INSTRUCTION_BYTES || !vmSectionHolds(size, count, VM_QCE_INSTRUCTION_BYTES))
+                vmInvalidObject(filePath, "malformed code section");
+
+            int64_t capacity = 0;
+            object->program = vmReserve(NULL, &capacity, (int64_t) count + 1, sizeof(Instruction));
+            for (uint64_t j = 0; j < count; ++j)
+            {
+                object->program[j].type = (InstructionType) vmReadLE(image + offset + j * entrySize, 4);
+                object->program[j].value.asI64 = (int64_t) vmReadLE(image + offset + j * entrySize + 8, 8);
+            }
+
+            object->programSize = (int64_t) count;
+            hasCode = 1;
+        } else if (type == VM_SECTION_RELOCATIONS)
+        {
+            if (entrySize != VM_RELOCATION_BYTES || !vmSectionHolds(size, count, VM_RELOCATION_BYTES))
+                vmInvalidObject(filePath, "malformed relocations section");
+
+            object->relocations = image + offset;
+            object->relocationCount = (int64_t) count;
+            hasRelocations = 1;
+        } else if (type == VM_SECTION_SYMBOLS)
+        {
+            object->symbols = image + offset;
+            object->symbolsSize = (int64_t) size;
+        } else if (type == VM_SECTION_NATIVES)
+        {
+            object->natives = image + offset;
+            object->nativesSize = (int64_t) size;
+        } else if (type == VM_SECTION_EXPORTS)
+        {
+            object->exports = image + offset;
+            object->exportsSize = (int64_t) size;
+        } else if (type == VM_SECTION_EXTERNS)
+        {
+            object->externs = image + offset;
+            object->externsSize = (int64_t) size;
+        }
+    }
+
+    if (!hasCode || !hasRelocations) vmInvalidObject(filePath, "not a relocatable object");
+}
+
+static void vmFreeObject(VMObject *object)
+{
+    free(object->objectPath);
+    free(object->image);
+    free(object->program);
+    *object = (VMObject) {0};
+}
+
+// `filePath` with its extension replaced by `extension`.
+static char *vmReplaceExtension(const char *filePath, const char *extension)
+{
+    char *result = malloc(strlen(filePath) + strlen(extension) + 1);
+    if (result == NULL)
+    {
+        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not allocate memory for output file\n");
+        exit(EXIT_FAILURE);
+    }
+
+    strcpy(result, filePath);
+
+    char *dot = strrchr(result, '.');
+    if (dot != NULL && strchr(dot, '/') == NULL) *dot = '\0';
+
+    return strcat(result, extension);
+}
+
+// Whether the object is missing or not newer than its source. Objects from the same second as
+// their source are rebuilt, since file times may only have one-second resolution.
+static int vmObjectStale(const char *sourcePath, const char *objectPath)
+{
+    struct stat source, object;
+    if (stat(sourcePath, &source) < 0)
+    {
+        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not open file \"%s\" (%s)\n", sourcePath, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    return stat(objectPath, &object) < 0 || object.st_mtime <= source.st_mtime;
+}
+
+// Assembles the source at `sourcePath` to an object at `objectPath`.
+static void vmAssembleObject(const char *sourcePath, const char *objectPath)
+{
+    QuarkVM vm = {0};
+    VMTable table = {0};
+
+    SVReader reader = sv_openReader(sourcePath);
+    vmParseSource(&reader, &vm, &table, sourcePath);
+    sv_closeReader(&reader);
+
+    vmSaveObjectToFile(&vm, &table, objectPath);
+    free(vm.program);
+    vmTableDestroy(&table);
+}
+
+// Takes inputs in order, assembling the stale sources and loading every object.
+static void *vmLinkWorker(void *argument)
+{
+    VMLinkJobs *jobs = argument;
+    for (int64_t i; (i = atomic_fetch_add(&jobs->next, 1)) < jobs->objectCount;)
+    {
+        VMObject *object = &jobs->objects[i];
+        if (object->isSource && (jobs->force || vmObjectStale(object->path, object->objectPath)))
+        {
+            vmAssembleObject(object->path, object->objectPath);
+            object->assembled = 1;
+            atomic_fetch_add(&jobs->assembled, 1);
+        }
+
+        vmLoadObject(object);
+    }
+
+    return NULL;
+}
+
+// Prepares `objects` for vmLinkObjects on `workerCount` threads. Inputs ending in .qco are objects;
+// anything else is a source, assembled to the .qco next to it when that is stale (or `force` is set).
+// Returns the number of sources assembled.
+static int64_t vmLoadObjects(VMObject *objects, int64_t objectCount, int64_t workerCount, int force)
+{
+    for (int64_t i = 0; i < objectCount; ++i)
+    {
+        const char *dot = strrchr(objects[i].path, '.');
+        objects[i].isSource = dot == NULL || strcmp(dot, ".qco") != 0;
+        objects[i].objectPath = objects[i].isSource ? vmReplaceExtension(objects[i].path, ".qco")
+                                                    : vmCacheCopyString(objects[i].path);
+    }
+
+    // Searches for the mnemonic table's seed here, so the workers only read it.
+    vmLookupMnemonic(sv_cStringAsStringView("stop"));
+
+    VMLinkJobs jobs = {objects, objectCount, force, 0, 0};
+    if (workerCount > objectCount) workerCount = objectCount;
+    if (workerCount < 1) workerCount = 1;
+
+    pthread_t *threads = malloc(sizeof(threads[0]) * workerCount);
+    if (threads == NULL)
+    {
+        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not allocate memory for %" PRId64 " workers\n", workerCount);
+        exit(EXIT_FAILURE);
+    }
+
+    for (int64_t i = 1; i < workerCount; ++i)
+        if (pthread_create(&threads[i], NULL, vmLinkWorker, &jobs) != 0)
+        {
+            fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not start worker thread (%s)\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+    vmLinkWorker(&jobs);
+    for (int64_t i = 1; i < workerCount; ++i) pthread_join(threads[i], NULL);
+    free(threads);
+
+    return (int64_t) atomic_load(&jobs.assembled);
+}
+
+// The name of a file without its directory and extension, used to qualify its local labels.
+static StringView vmObjectName(const char *filePath)
+{
+    const char *slash = strrchr(filePath, '/');
+    const char *name = slash != NULL ? slash + 1 : filePath;
+    const char *dot = strrchr(name, '.');
+
+    return (StringView) {dot != NULL && dot != name ? dot - name : (int64_t) strlen(name), name};
+}
+
+static void vmLinkError(const char *filePath, const char *message, StringView name)
+{
+    fprintf(stderr, "[\033[1;31mERROR\033[0m]: (In file \"%s\"): %s \"%.*s\".\n", filePath, message, (int) name.count,
+            name.data);
+    exit(EXIT_FAILURE);
+}
+
+// Links `objects` into `vm`, filling `vmTable` with every label (locals as `file.label`) and the
+// merged natives.
+static void vmLinkObjects(VMObject *objects, int64_t objectCount, QuarkVM *vm, VMTable *vmTable)
+{
+    int64_t programSize = 0;
+    for (int64_t i = 0; i < objectCount; ++i) programSize += objects[i].programSize;
+
+    VMTable exports = {0};
+    for (int64_t i = 0, base = 0; i < objectCount; base += objects[i++].programSize)
+    {
+        StringView name;
+        int64_t address, cursor = 0;
+        while (vmNextRecord(objects[i].exports, objects[i].exportsSize, &cursor, &name, &address))
+        {
+            const int64_t index = vmTableLookup(&exports, name, (int) i);
+            Function *entry = &exports.functions[index];
+            if (entry->address >= 0)
+            {
+                fprintf(stderr, "[\033[1;31mERROR\033[0m]: Label \"%.*s\" is exported by both \"%s\" and \"%s\".\n",
+                        (int) name.count, name.data, objects[entry->line].path, objects[i].path);
+                exit(EXIT_FAILURE);
+            }
+
+            entry->address = base + address;
+            entry->line = (int) i;
+        }
+    }
+
+    vm->program = vmReserve(vm->program, &vm->programCapacity, programSize + 1, sizeof(vm->program[0]));
+    vm->programSize = 0;
+
+    int64_t *externs = NULL, *natives = NULL, externCapacity = 0, nativeCapacity = 0, labelCapacity = 0;
+    char *label = NULL;
+    for (int64_t i = 0, base = 0; i < objectCount; base += objects[i++].programSize)
+    {
+        const VMObject *object = &objects[i];
+
+        StringView name;
+        int64_t value, cursor = 0, externCount = 0, nativeCount = 0;
+        while (vmNextRecord(object->externs, object->externsSize, &cursor, &name, &value))
+        {
+            const int64_t index = exports.slotCapacity > 0 ? *vmTableSlot(&exports, name) - 1 : -1;
+            if (index < 0 || exports.functions[index].address < 0)
+                vmLinkError(object->path, "Undefined imported label", name);
+
+            externs = vmReserve(externs, &externCapacity, externCount + 1, sizeof(externs[0]));
+            externs[externCount++] = exports.functions[index].address;
+        }
+
+        cursor = 0;
+        while (vmNextRecord(object->natives, object->nativesSize, &cursor, &name, &value))
+        {
+            natives = vmReserve(natives, &nativeCapacity, nativeCount + 1, sizeof(natives[0]));
+            natives[nativeCount++] = vmTableNative(vmTable, name);
+        }
+
+        memcpy(vm->program + base, object->program, sizeof(object->program[0]) * object->programSize);
+        for (int64_t j = 0; j < object->relocationCount; ++j)
+        {
+            const uint8_t *relocation = object->relocations + j * VM_RELOCATION_BYTES;
+            const uint64_t address = vmReadLE(relocation, 8), kind = vmReadLE(relocation + 8, 4);
+            const int64_t index = (int64_t) vmReadLE(relocation + 12, 4);
+            if (address >= (uint64_t) object->programSize) vmInvalidObject(object->objectPath, "relocation out of bounds");
+
+            Word *operand = &vm->program[base + (int64_t) address].value;
+            if (kind == VM_RELOCATE_LOCAL)
+            {
+                if (operand->asI64 < 0 || operand->asI64 > object->programSize)
+                    vmInvalidObject(object->objectPath, "address outside the file");
+
+                operand->asI64 += base;
+            }
+            else if (kind == VM_RELOCATE_EXTERN && index < externCount) operand->asI64 = externs[index];
+            else if (kind == VM_RELOCATE_NATIVE && index < nativeCount) operand->asI64 = natives[index];
+            else vmInvalidObject(object->objectPath, "malformed relocation");
+        }
+
+        // Labels: locals as `file.label`, exports as they are.
+        const StringView prefix = vmObjectName(object->path);
+        for (int exported = 0; exported < 2; ++exported)
+        {
+            const uint8_t *records = exported ? object->exports : object->symbols;
+            const int64_t size = exported ? object->exportsSize : object->symbolsSize;
+
+            cursor = 0;
+            while (vmNextRecord(records, size, &cursor, &name, &value))
+            {
+                if (!exported)
+                {
+                    label = vmReserve(label, &labelCapacity, prefix.count + name.count + 1, 1);
+                    memcpy(label, prefix.data, prefix.count);
+                    label[prefix.count] = '.';
+                    memcpy(label + prefix.count + 1, name.data, name.count);
+                    name = (StringView) {prefix.count + name.count + 1, label};
+                }
+
+                vmTable->functions = vmReserve(vmTable->functions, &vmTable->functionCapacity,
+                                               vmTable->functionSize + 1, sizeof(vmTable->functions[0]));
+                vmTable->functions[vmTable->functionSize++] = (Function) {vmTableIntern(vmTable, name), base + value, -1,
+                                                                          0, exported ? VM_LINK_EXPORT : VM_LINK_LOCAL};
+            }
+        }
+    }
+
+    vm->programSize = programSize;
+    free(externs);
+    free(natives);
+    free(label);
+    vmTableDestroy(&exports);
+
+    // Index the labels the way vmTableLookup would; names from different files may repeat, and only
+    // the optimizer's label removal looks them up.
+    free(vmTable->slots);
+    vmTable->slotCapacity = 64;
+    while (vmTable->slotCapacity < vmTable->functionSize * 2) vmTable->slotCapacity *= 2;
+    vmTable->slots = calloc(vmTable->slotCapacity, sizeof(vmTable->slots[0]));
+    if (vmTable->slots == NULL)
+    {
+        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not allocate memory for labels (%s)\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    for (int64_t i = 0; i < vmTable->functionSize; ++i) *vmTableSlot(vmTable, vmTable->functions[i].function) = i + 1;
+}
@@ -6,7 +6,7 @@ static Exception vmAllocate(QuarkVM *vm)
 {
     if (vm->stackSize < 1) return EX_STACK_UNDERFLOW;
 
-    vm->stack[vm->stackSize - 1].asPtr = malloc(vm->stack[vm->stackSize - 1].asI64);
+    vm->stack[vm->stackSize - 1].asPtr = vmHeapAllocate(&vm->heap, vm->stack[vm->stackSize - 1].asI64);
     return EX_OK;
 }
 
@@ -14,7 +14,7 @@ static Exception vmFree(QuarkVM *vm)
 {
     if (vm->stackSize < 1) return EX_STACK_UNDERFLOW;
 
-    free(vm->stack[vm->stackSize - 1].asPtr);
+    if (!vmHeapFree(&vm->heap, vm->stack[vm->stackSize - 1].asPtr)) return EX_ILLEGAL_OPERATION;
     vm->stackSize--;
 
     return EX_OK;
@@ -24,7 +24,7 @@ static Exception vmPrintF64(QuarkVM *vm)
 {
     if (vm->stackSize < 1) return EX_STACK_UNDERFLOW;
 
-    printf("%lf\n", vm->stack[vm->stackSize - 1].asF64);
+    vmOutputF64(&vm->outputBuffer, vm->output, vm->stack[vm->stackSize - 1].asF64);
     vm->stackSize--;
 
     return EX_OK;
@@ -34,7 +34,7 @@ static Exception vmPrintI64(QuarkVM *vm)
 {
     if (vm->stackSize < 1) return EX_STACK_UNDERFLOW;
 
-    printf("%" PRId64 "\n", vm->stack[vm->stackSize - 1].asI64);
+    vmOutputI64(&vm->outputBuffer, vm->output, vm->stack[vm->stackSize - 1].asI64);
     vm->stackSize--;
 
     return EX_OK;
@@ -44,8 +44,226 @@ static Exception vmPrintPtr(QuarkVM *vm)
 {
     if (vm->stackSize < 1) return EX_STACK_UNDERFLOW;
 
-    printf("%p\n", vm->stack[vm->stackSize - 1].asPtr);
+    vmOutputPtr(&vm->outputBuffer, vm->output, vm->stack[vm->stackSize - 1].asPtr);
     vm->stackSize--;
 
     return EX_OK;
 }
+
+static Exception vmFlush(QuarkVM *vm)
+{
+    vmFlushOutput(vm);
+    fflush(vm->output);
+
+    return EX_OK;
+}
+
+// Pops a count `n` and prints the `n` values below it, top first, as `n` calls to vmPrintI64 would,
+// but leaves them on the stack.
+static Exception vmPrintI64s(QuarkVM *vm)
+{
+    if (vm->stackSize < 1) return EX_STACK_UNDERFLOW;
+
+    const int64_t count = vm->stack[vm->stackSize - 1].asI64;
+    if (count < 0) return EX_ILLEGAL_OPERATION;
+    if (count > vm->stackSize - 1) return EX_STACK_UNDERFLOW;
+
+    vm->stackSize--;
+    for (int64_t i = 1; i <= count; ++i)
+        vmOutputI64(&vm->outputBuffer, vm->output, vm->stack[vm->stackSize - i].asI64);
+
+    return EX_OK;
+}
+
+static Exception vmPrintF64s(QuarkVM *vm)
+{
+    if (vm->stackSize < 1) return EX_STACK_UNDERFLOW;
+
+    const int64_t count = vm->stack[vm->stackSize - 1].asI64;
+    if (count < 0) return EX_ILLEGAL_OPERATION;
+    if (count > vm->stackSize - 1) return EX_STACK_UNDERFLOW;
+
+    vm->stackSize--;
+    for (int64_t i = 1; i <= count; ++i)
+        vmOutputF64(&vm->outputBuffer, vm->output, vm->stack[vm->stackSize - i].asF64);
+
+    return EX_OK;
+}
+
+// Pops a count `n` and a pointer, and prints the first `n` elements of the array it points to.
+static Exception vmPrintI64Array(QuarkVM *vm)
+{
+    if (vm->stackSize < 2) return EX_STACK_UNDERFLOW;
+
+    const int64_t count = vm->stack[vm->stackSize - 1].asI64;
+    const int64_t *array = vm->stack[vm->stackSize - 2].asPtr;
+    if (count < 0 || count > INT64_MAX / (int64_t) sizeof(array[0]) || (count > 0 && array == NULL))
+        return EX_ILLEGAL_OPERATION;
+    if (!vmHeapCovers(&vm->heap, array, (uint64_t) count * sizeof(array[0]))) return EX_ILLEGAL_MEMORY_ACCESS;
+
+    for (int64_t i = 0; i < count; ++i) vmOutputI64(&vm->outputBuffer, vm->output, array[i]);
+    vm->stackSize -= 2;
+
+    return EX_OK;
+}
+
+static Exception vmPrintF64Array(QuarkVM *vm)
+{
+    if (vm->stackSize < 2) return EX_STACK_UNDERFLOW;
+
+    const int64_t count = vm->stack[vm->stackSize - 1].asI64;
+    const double *array = vm->stack[vm->stackSize - 2].asPtr;
+    if (count < 0 || count > INT64_MAX / (int64_t) sizeof(array[0]) || (count > 0 && array == NULL))
+        return EX_ILLEGAL_OPERATION;
+    if (!vmHeapCovers(&vm->heap, array, (uint64_t) count * sizeof(array[0]))) return EX_ILLEGAL_MEMORY_ACCESS;
+
+    for (int64_t i = 0; i < count; ++i) vmOutputF64(&vm->outputBuffer, vm->output, array[i]);
+    vm->stackSize -= 2;
+
+    return EX_OK;
+}
+
+typedef struct
+{
+    const char *name;
+    const char *symbol;
+    NativeVM function;
+    int64_t inputs;
+    int64_t outputs;
+} VMNative;
+
+#define VM_NATIVE(function, symbol, inputs, outputs) {#function, symbol, function, inputs, outputs}
+
+// The natives every tool registers, in index order. Translated programs call them by their C name,
+// and assembly programs by index or by `symbol` (`native print_i64`).
+static const VMNative vmNatives[] = {
+        VM_NATIVE(vmAllocate, "allocate", 1, 1),             // 0
+        VM_NATIVE(vmFree, "free", 1, 0),                     // 1
+        VM_NATIVE(vmPrintF64, "print_f64", 1, 0),            // 2
+        VM_NATIVE(vmPrintI64, "print_i64", 1, 0),            // 3
+        VM_NATIVE(vmPrintPtr, "print_ptr", 1, 0),            // 4
+        VM_NATIVE(vmFlush, "flush", 0, 0),                   // 5
+        VM_NATIVE(vmPrintI64s, "print_i64s", 1, 0),          // 6
+        VM_NATIVE(vmPrintF64s, "print_f64s", 1, 0),          // 7
+        VM_NATIVE(vmPrintI64Array, "print_i64_array", 2, 0), // 8
+        VM_NATIVE(vmPrintF64Array, "print_f64_array", 2, 0), // 9
+};
+
+#define VM_NATIVE_COUNT ((int64_t) (sizeof(vmNatives) / sizeof(vmNatives[0])))
+
+static_assert(sizeof(vmNatives) / sizeof(vmNatives[0]) == VM_NATIVE_BUILTINS,
+              "VM_NATIVE_BUILTINS must match the number of built-in natives");
+
+static int64_t vmBuiltinNative(StringView name)
+{
+    for (int64_t i = 0; i < VM_NATIVE_COUNT; ++i)
+        if (sv_equals(sv_cStringAsStringView(vmNatives[i].symbol), name)) return i;
+
+    return -1;
+}
+
+// Plugins are shared objects that export `quarkNatives`, an array of these ended by an entry whose
+// name is NULL. A plugin includes compiler.h and defines it with VM_PLUGIN_NATIVES:
+//
+//     VM_PLUGIN_NATIVES = {{"square", square, 1, 1}, {NULL, NULL, 0, 0}};
+typedef struct
+{
+    const char *name;
+    NativeVM function;
+    int64_t inputs;
+    int64_t outputs;
+} VMPluginNative;
+
+#define VM_PLUGIN_SYMBOL "quarkNatives"
+#define VM_PLUGIN_NATIVES const VMPluginNative quarkNatives[]
+
+// Every native of every plugin loaded into this process. Plugins are loaded before any VM starts,
+// so workers only ever read the registry.
+static VMPluginNative *vmPluginNatives = NULL;
+static int64_t vmPluginNativeSize = 0, vmPluginNativeCapacity = 0;
+static const char **vmPluginPaths = NULL;
+static int64_t vmPluginPathSize = 0, vmPluginPathCapacity = 0;
+
+static const VMPluginNative *vmFindPluginNative(StringView name)
+{
+    for (int64_t i = 0; i < vmPluginNativeSize; ++i)
+        if (sv_equals(sv_cStringAsStringView(vmPluginNatives[i].name), name)) return &vmPluginNatives[i];
+
+    return NULL;
+}
+
+// Opens the shared object at `path` and registers its natives. A path without a slash is searched
+// for like any other shared library.
+static void vmLoadPlugin(const char *path)
+{
+#if VM_HAS_PLUGINS
+    void *library = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    const VMPluginNative *natives = library != NULL ? dlsym(library, VM_PLUGIN_SYMBOL) : NULL;
+    if (natives == NULL)
+    {
+        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not load plugin \"%s\" (%s)\n", path,
+                library != NULL ? "it does not export " VM_PLUGIN_SYMBOL : dlerror());
+        exit(EXIT_FAILURE);
+    }
+
+    for (; natives->name != NULL; ++natives)
+    {
+        const StringView name = sv_cStringAsStringView(natives->name);
+        if (natives->function == NULL || natives->inputs < 0 || natives->outputs < 0 || name.count == 0 ||
+            vmBuiltinNative(name) >= 0 || vmFindPluginNative(name) != NULL)
+        {
+            fprintf(stderr, "[\033[1;31mERROR\033[0m]: Plugin \"%s\" has an invalid or duplicate native \"%s\"\n",
+                    path, natives->name);
+            exit(EXIT_FAILURE);
+        }
+
+        vmPluginNatives = vmReserve(vmPluginNatives, &vmPluginNativeCapacity, vmPluginNativeSize + 1,
+                                    sizeof(vmPluginNatives[0]));
+        vmPluginNatives[vmPluginNativeSize++] = *natives;
+    }
+
+    vmPluginPaths = vmReserve(vmPluginPaths, &vmPluginPathCapacity, vmPluginPathSize + 1, sizeof(vmPluginPaths[0]));
+    vmPluginPaths[vmPluginPathSize++] = path;
+#else
+    fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not load plugin \"%s\" (plugins are not supported on this "
+                    "platform)\n", path);
+    exit(EXIT_FAILURE);
+#endif
+}
+
+// Binds a native the program calls by name to the plugin function of that name, as the next index.
+static void vmPushImport(QuarkVM *vm, StringView name)
+{
+    const VMPluginNative *native = vmFindPluginNative(name);
+    if (native == NULL)
+    {
+        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Native \"%.*s\" is not provided by any plugin (load one with "
+                        "--plugin)\n", (int) name.count, name.data);
+        exit(EXIT_FAILURE);
+    }
+
+    vmPushNativeFunc(vm, native->function, native->inputs, native->outputs);
+}
+
+// Registers the built-in natives, then binds the natives section of the loaded program, so that
+// every call by name costs the same indirect call as one by index.
+static void vmPushNatives(QuarkVM *vm)
+{
+    for (int64_t i = 0; i < VM_NATIVE_COUNT; ++i)
+        vmPushNativeFunc(vm, vmNatives[i].function, vmNatives[i].inputs, vmNatives[i].outputs);
+
+    StringView name = {0};
+    int64_t cursor = 0, index = 0;
+    while (vmNextImport(vm, &cursor, &name, &index))
+    {
+        if (index != vm->nativeFunctionsSize)
+        {
+            fprintf(stderr, "[\033[1;31mERROR\033[0m]: Native \"%.*s\" has index %" PRId64 ", expected %" PRId64
+                            " (the program was assembled for different built-in natives)\n", (int) name.count,
+                    name.data, index, vm->nativeFunctionsSize);
+            exit(EXIT_FAILURE);
+        }
+
+        vmPushImport(vm, name);
+    }
+}
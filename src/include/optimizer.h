@@ -0,0 +1,391 @@
+#pragma once
+
+// The optimizer behind `quarki -O1` and `quarki -O2`.
+//
+// -O1 works inside basic blocks: it folds constant arithmetic and comparisons (`put 4.0` / `put 2.0` /
+// `fplus` into `put 6.0`), turns a constant `jif` into a `jmp` or nothing, and removes `kaput` and
+// `put` / `release`. -O2 also threads jumps through chains of `jmp`, drops jumps to the next instruction,
+// removes every instruction that cannot be reached from address 0 along with the labels on it, and
+// repeats all of it until nothing changes.
+//
+// Folding never hides an exception: divisions by zero and INT64_MIN / -1 are left to run. As in
+// vmFuseInstructions, addresses are only remapped in jump operands and labels, so return addresses
+// must come from `invoke`.
+
+#include "compiler.h"
+
+typedef struct
+{
+    int64_t before;
+    int64_t after;
+    int64_t folded;
+    int64_t threaded;
+    int64_t unreachable;
+    int64_t labels;
+} VMOptimization;
+
+static void *vmOptimizeAllocate(size_t size)
+{
+    void *memory = calloc(size, 1);
+    if (memory == NULL)
+    {
+        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not allocate memory for the optimizer (%s)\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    return memory;
+}
+
+// Marks every address control can arrive at other than by falling through: jump and invoke targets,
+// and the return address of every invoke.
+static uint8_t *vmOptimizeTargets(const QuarkVM *vm)
+{
+    uint8_t *isTarget = vmOptimizeAllocate(vm->programSize + 1);
+    for (int64_t i = 0; i < vm->programSize; ++i)
+    {
+        if (instructionWithAddress(vm->program[i].type) && vm->program[i].value.asI64 >= 0 &&
+            vm->program[i].value.asI64 < vm->programSize)
+            isTarget[vm->program[i].value.asI64] = 1;
+        if (vm->program[i].type == INST_INVOKE) isTarget[i + 1] = 1;
+    }
+
+    return isTarget;
+}
+
+// The instruction before `address` in its basic block, skipping `kaput`, or -1 if there is none.
+static int64_t vmOptimizePrevious(const QuarkVM *vm, const uint8_t *isTarget, int64_t address)
+{
+    if (isTarget[address]) return -1;
+
+    for (int64_t i = address - 1; i >= 0; --i)
+    {
+        if (vm->program[i].type != INST_KAPUT) return i;
+        if (isTarget[i]) return -1;
+    }
+
+    return -1;
+}
+
+// The first instruction at or after `address` that is not `kaput`.
+static int64_t vmOptimizeNext(const QuarkVM *vm, int64_t address)
+{
+    while (address >= 0 && address < vm->programSize && vm->program[address].type == INST_KAPUT) ++address;
+    return address;
+}
+
+// Where a jump to `address` ends up after a chain of `jmp`. A `kaput` in the way stops the chain until it
+// is removed, so that the labels on it stay reachable.
+static int64_t vmOptimizeFollow(const QuarkVM *vm, int64_t address)
+{
+    for (int64_t steps = 0; steps <= vm->programSize && address >= 0 && address < vm->programSize; ++steps)
+    {
+        if (vm->program[address].type != INST_JUMP) break;
+        address = vm->program[address].value.asI64;
+    }
+
+    return address;
+}
+
+// Computes `second <type> top` as the VM would, where `top` was pushed last. Returns 0 if the
+// instruction cannot be folded, or would raise an exception.
+static int vmFoldBinary(InstructionType type, Word second, Word top, Word *result)
+{
+    const int64_t a = second.asI64, b = top.asI64;
+    const double x = second.asF64, y = top.asF64;
+
+    *result = (Word) {0};
+    switch (type)
+    {
+        case INST_IPLUS:
+            result->asI64 = (int64_t) ((uint64_t) a + (uint64_t) b);
+            return 1;
+        case INST_IMINUS:
+            result->asI64 = (int64_t) ((uint64_t) a - (uint64_t) b);
+            return 1;
+        case INST_IMUL:
+            result->asI64 = (int64_t) ((uint64_t) a * (uint64_t) b);
+            return 1;
+        case INST_IDIV:
+            if (b == 0 || (a == INT64_MIN && b == -1)) return 0;
+
+            result->asI64 = a / b;
+            return 1;
+        case INST_IMOD:
+            if (b == 0 || (a == INT64_MIN && b == -1)) return 0;
+
+            result->asI64 = a % b;
+            return 1;
+        case INST_FPLUS:
+            result->asF64 = x + y;
+            return 1;
+        case INST_FMINUS:
+            result->asF64 = x - y;
+            return 1;
+        case INST_FMUL:
+            result->asF64 = x * y;
+            return 1;
+        case INST_FDIV:
+            if (y == 0.0) return 0;
+
+            result->asF64 = x / y;
+            return 1;
+        case INST_FMOD:
+            result->asF64 = fmod(x, y);
+            return 1;
+        case INST_IEQ:
+            result->asI64 = b == a;
+            return 1;
+        case INST_IGT:
+            result->asI64 = b > a;
+            return 1;
+        case INST_ILT:
+            result->asI64 = b < a;
+            return 1;
+        case INST_IGEQ:
+            result->asI64 = b >= a;
+            return 1;
+        case INST_ILEQ:
+            result->asI64 = b <= a;
+            return 1;
+        case INST_FEQ:
+            result->asI64 = y == x;
+            return 1;
+        case INST_FGT:
+            result->asI64 = y > x;
+            return 1;
+        case INST_FLT:
+            result->asI64 = y < x;
+            return 1;
+        case INST_FGEQ:
+            result->asI64 = y >= x;
+            return 1;
+        case INST_FLEQ:
+            result->asI64 = y <= x;
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+// Folds constants inside basic blocks in one forward pass, leaving `kaput` where instructions went
+// away; the result of a fold replaces its last instruction, so chains fold all the way. Only the first
+// instruction of a folded sequence may be a jump target. Returns the number of instructions folded away.
+static int64_t vmOptimizeFold(QuarkVM *vm, const uint8_t *isTarget)
+{
+    Instruction *program = vm->program;
+    int64_t folded = 0;
+
+    for (int64_t i = 0; i < vm->programSize; ++i)
+    {
+        const int64_t top = vmOptimizePrevious(vm, isTarget, i);
+        if (program[i].type == INST_KAPUT || top < 0 || program[top].type != INST_PUT) continue;
+
+        const Word value = program[top].value;
+        Word result = {0};
+        InstructionType immediate = INST_COUNT;
+        switch (program[i].type)
+        {
+            case INST_RELEASE:
+                program[i] = (Instruction) {INST_KAPUT, {0}};
+                break;
+            case INST_INEQ:
+                result.asI64 = !value.asI64;
+                program[i] = (Instruction) {INST_PUT, result};
+                break;
+            case INST_FNEQ:
+                result.asI64 = !value.asF64;
+                program[i] = (Instruction) {INST_PUT, result};
+                break;
+            case INST_JUMP_IF:
+                if (value.asI64 != 0) program[i].type = INST_JUMP;
+                else program[i] = (Instruction) {INST_KAPUT, {0}};
+                break;
+            case INST_JUMP_IF_NOT:
+                if (value.asI64 == 0) program[i].type = INST_JUMP;
+                else program[i] = (Instruction) {INST_KAPUT, {0}};
+                break;
+            case INST_IPLUS_IMM:
+                immediate = INST_IPLUS;
+                break;
+            case INST_IMINUS_IMM:
+                immediate = INST_IMINUS;
+                break;
+            case INST_FPLUS_IMM:
+                immediate = INST_FPLUS;
+                break;
+            case INST_FMINUS_IMM:
+                immediate = INST_FMINUS;
+                break;
+            case INST_FMUL_IMM:
+                immediate = INST_FMUL;
+                break;
+            default:
+            {
+                const int64_t second = vmOptimizePrevious(vm, isTarget, top);
+                if (second < 0 || program[second].type != INST_PUT ||
+                    !vmFoldBinary(program[i].type, program[second].value, value, &result))
+                    continue;
+
+                program[second] = (Instruction) {INST_KAPUT, {0}};
+                program[i] = (Instruction) {INST_PUT, result};
+                ++folded;
+                break;
+            }
+        }
+
+        if (immediate != INST_COUNT)
+        {
+            if (!vmFoldBinary(immediate, value, program[i].value, &result)) continue;
+            program[i] = (Instruction) {INST_PUT, result};
+        }
+
+        program[top] = (Instruction) {INST_KAPUT, {0}};
+        folded += program[i].type == INST_KAPUT ? 2 : 1;
+    }
+
+    return folded;
+}
+
+// Points every jump at the end of its chain of `jmp`, and drops jumps to the next instruction (a
+// conditional one still pops its condition). Returns the number of jumps changed.
+static int64_t vmOptimizeThread(QuarkVM *vm)
+{
+    int64_t threaded = 0;
+    for (int64_t i = 0; i < vm->programSize; ++i)
+    {
+        Instruction *instruction = &vm->program[i];
+        if (!instructionWithAddress(instruction->type)) continue;
+
+        // A chain that ends in a `jmp` is a cycle, which is left alone.
+        const int64_t target = vmOptimizeFollow(vm, instruction->value.asI64);
+        if (target >= 0 && target < vm->programSize && vm->program[target].type == INST_JUMP) continue;
+        if (target != instruction->value.asI64)
+        {
+            instruction->value.asI64 = target;
+            ++threaded;
+        }
+
+        if (vmOptimizeNext(vm, target) != vmOptimizeNext(vm, i + 1)) continue;
+        if (instruction->type == INST_JUMP) *instruction = (Instruction) {INST_KAPUT, {0}};
+        else if (instruction->type == INST_JUMP_IF || instruction->type == INST_JUMP_IF_NOT)
+            *instruction = (Instruction) {INST_RELEASE, {0}};
+        else continue;
+
+        ++threaded;
+    }
+
+    return threaded;
+}
+
+// Marks every instruction reachable from address 0, assuming that both ways out of every conditional
+// jump can be taken and that every invoke returns.
+static uint8_t *vmOptimizeReachable(const QuarkVM *vm)
+{
+    uint8_t *reachable = vmOptimizeAllocate(vm->programSize + 1);
+    int64_t *work = vmOptimizeAllocate(sizeof(work[0]) * (vm->programSize + 1));
+    int64_t workSize = 0;
+
+    work[workSize++] = 0;
+    while (workSize > 0)
+        for (int64_t address = work[--workSize]; address >= 0 && address < vm->programSize && !reachable[address];
+             ++address)
+        {
+            const Instruction instruction = vm->program[address];
+            reachable[address] = 1;
+
+            if (instructionWithAddress(instruction.type) && instruction.value.asI64 >= 0 &&
+                instruction.value.asI64 < vm->programSize && !reachable[instruction.value.asI64])
+                work[workSize++] = instruction.value.asI64;
+            if (instruction.type == INST_JUMP || instruction.type == INST_RETURN || instruction.type == INST_HALT)
+                break;
+        }
+
+    free(work);
+    return reachable;
+}
+
+// Removes every `kaput`, remaps jump operands and labels like vmFuseInstructions, and drops the labels
+// of unreachable code if `reachable` is given. Returns the number of instructions removed.
+static int64_t vmOptimizeCompact(QuarkVM *vm, VMTable *vmTable, const uint8_t *reachable, int64_t *labels)
+{
+    const int64_t programSize = vm->programSize;
+    int64_t *newAddress = vmOptimizeAllocate(sizeof(newAddress[0]) * (programSize + 1));
+
+    int64_t size = 0;
+    for (int64_t i = 0; i < programSize; ++i)
+    {
+        newAddress[i] = size;
+        if (vm->program[i].type != INST_KAPUT) vm->program[size++] = vm->program[i];
+    }
+    newAddress[programSize] = size;
+
+    for (int64_t i = 0; i < size; ++i)
+        if (instructionWithAddress(vm->program[i].type) && vm->program[i].value.asI64 >= 0 &&
+            vm->program[i].value.asI64 <= programSize)
+            vm->program[i].value.asI64 = newAddress[vm->program[i].value.asI64];
+
+    int64_t kept = 0;
+    for (int64_t i = 0; i < vmTable->functionSize; ++i)
+    {
+        Function function = vmTable->functions[i];
+        if (function.address >= 0 && function.address < programSize && reachable != NULL &&
+            !reachable[function.address])
+            continue;
+
+        if (function.address >= 0 && function.address <= programSize)
+            function.address = newAddress[function.address];
+        vmTable->functions[kept++] = function;
+    }
+
+    if (kept < vmTable->functionSize)
+    {
+        *labels += vmTable->functionSize - kept;
+        vmTable->functionSize = kept;
+
+        memset(vmTable->slots, 0, sizeof(vmTable->slots[0]) * vmTable->slotCapacity);
+        for (int64_t i = 0; i < kept; ++i) *vmTableSlot(vmTable, vmTable->functions[i].function) = i + 1;
+    }
+
+    vm->programSize = size;
+
+    free(newAddress);
+    return programSize - size;
+}
+
+// Runs the passes for `level` (1 or 2) on a parsed program, before any fusion.
+static VMOptimization vmOptimizeProgram(QuarkVM *vm, VMTable *vmTable, int level)
+{
+    VMOptimization result = {vm->programSize, vm->programSize, 0, 0, 0, 0};
+
+    for (int changed = 1; changed;)
+    {
+        uint8_t *isTarget = vmOptimizeTargets(vm);
+        const int64_t folded = vmOptimizeFold(vm, isTarget);
+        free(isTarget);
+
+        int64_t threaded = 0;
+        uint8_t *reachable = NULL;
+        if (level >= 2)
+        {
+            threaded = vmOptimizeThread(vm);
+            reachable = vmOptimizeReachable(vm);
+
+            for (int64_t i = 0; i < vm->programSize; ++i)
+                if (!reachable[i] && vm->program[i].type != INST_KAPUT)
+                {
+                    vm->program[i] = (Instruction) {INST_KAPUT, {0}};
+                    ++result.unreachable;
+                }
+        }
+
+        const int64_t removed = vmOptimizeCompact(vm, vmTable, reachable, &result.labels);
+        free(reachable);
+
+        result.folded += folded;
+        result.threaded += threaded;
+        changed = level >= 2 && folded + threaded + removed > 0;
+    }
+
+    result.after = vm->programSize;
+    return result;
+}
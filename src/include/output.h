@@ -0,0 +1,114 @@
+#pragma once
+
+// The buffer behind the print natives.
+//
+// Natives format values straight into a VM-owned buffer that is written to the VM's output stream
+// when it fills up, when an engine returns (on stop or on an exception), at the flush native, and
+// when the VM is destroyed. Integers and most floats are formatted by hand; the result is always
+// exactly what printf would have printed for the same value.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#define VM_OUTPUT_BYTES 8192
+// Room for one printed value and its newline; "%f" of -DBL_MAX is 317 characters.
+#define VM_OUTPUT_MAX_VALUE 384
+
+typedef struct
+{
+    size_t size;
+    char data[VM_OUTPUT_BYTES];
+} VMOutput;
+
+static void vmOutputFlush(VMOutput *buffer, FILE *file)
+{
+    if (buffer->size == 0) return;
+
+    fwrite(buffer->data, 1, buffer->size, file);
+    buffer->size = 0;
+}
+
+// Returns where the next value can be written, flushing first if fewer than VM_OUTPUT_MAX_VALUE bytes
+// are left.
+static char *vmOutputReserve(VMOutput *buffer, FILE *file)
+{
+    if (buffer->size + VM_OUTPUT_MAX_VALUE > VM_OUTPUT_BYTES) vmOutputFlush(buffer, file);
+
+    return buffer->data + buffer->size;
+}
+
+static size_t vmFormatU64(char *out, uint64_t value)
+{
+    char digits[20];
+    size_t count = 0;
+    do digits[count++] = (char) ('0' + value % 10);
+    while ((value /= 10) > 0);
+
+    for (size_t i = 0; i < count; ++i) out[i] = digits[count - 1 - i];
+    return count;
+}
+
+// Same as "%" PRId64.
+static size_t vmFormatI64(char *out, int64_t value)
+{
+    if (value >= 0) return vmFormatU64(out, (uint64_t) value);
+
+    out[0] = '-';
+    return 1 + vmFormatU64(out + 1, -(uint64_t) value);
+}
+
+// Same as "%f". The integer and fractional parts of a double below 1e15 are exact, and scaling the
+// fraction by 1e6 is off by far less than 1e-6, so the rounding is only left to printf when the scaled
+// fraction is that close to a tie (and for NaN, infinities and large values).
+static size_t vmFormatF64(char *out, double value)
+{
+    const double magnitude = fabs(value);
+    if (!(magnitude < 1e15)) return (size_t) snprintf(out, VM_OUTPUT_MAX_VALUE, "%f", value);
+
+    const double whole = floor(magnitude), scaled = (magnitude - whole) * 1e6;
+    double micros = floor(scaled);
+    if (fabs(scaled - micros - 0.5) < 1e-6) return (size_t) snprintf(out, VM_OUTPUT_MAX_VALUE, "%f", value);
+    if (scaled - micros > 0.5) ++micros;
+
+    uint64_t integer = (uint64_t) whole, fraction = (uint64_t) micros;
+    if (fraction == 1000000)
+    {
+        ++integer;
+        fraction = 0;
+    }
+
+    size_t length = 0;
+    if (signbit(value)) out[length++] = '-';
+    length += vmFormatU64(out + length, integer);
+    out[length++] = '.';
+    for (int i = 5; i >= 0; --i, fraction /= 10) out[length + i] = (char) ('0' + fraction % 10);
+
+    return length + 6;
+}
+
+static void vmOutputI64(VMOutput *buffer, FILE *file, int64_t value)
+{
+    char *out = vmOutputReserve(buffer, file);
+    const size_t length = vmFormatI64(out, value);
+
+    out[length] = '\n';
+    buffer->size += length + 1;
+}
+
+static void vmOutputF64(VMOutput *buffer, FILE *file, double value)
+{
+    char *out = vmOutputReserve(buffer, file);
+    const size_t length = vmFormatF64(out, value);
+
+    out[length] = '\n';
+    buffer->size += length + 1;
+}
+
+// Pointers are rare and their format is up to the C library, so they always go through snprintf.
+static void vmOutputPtr(VMOutput *buffer, FILE *file, void *value)
+{
+    char *out = vmOutputReserve(buffer, file);
+    buffer->size += (size_t) snprintf(out, VM_OUTPUT_MAX_VALUE, "%p\n", value);
+}
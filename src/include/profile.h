@@ -0,0 +1,252 @@
+#pragma once
+
+// Profiler reports for `quarkc --profile`.
+//
+// The counts come from vmExecuteProgramProfiled, which counts every instruction address as it is
+// dispatched and times each native call. Opcode and label totals are derived from the address counts
+// when the report is made, attributing each instruction to the nearest label at or before it in the
+// symbols section.
+
+#include "compiler.h"
+
+typedef struct
+{
+    StringView name;
+    int64_t address;
+    uint64_t count;
+} VMProfileLabel;
+
+typedef struct
+{
+    int64_t key;
+    uint64_t count;
+} VMProfileEntry;
+
+static void vmProfileCreate(QuarkVM *vm)
+{
+    VMProfile *profile = malloc(sizeof(*profile));
+    if (profile != NULL)
+        *profile = (VMProfile) {calloc(vm->programSize + 1, sizeof(uint64_t)),
+                                calloc(vm->nativeFunctionsSize + 1, sizeof(uint64_t)),
+                                calloc(vm->nativeFunctionsSize + 1, sizeof(double)), vm->nativeFunctionsSize};
+    if (profile == NULL || profile->counts == NULL || profile->nativeCalls == NULL || profile->nativeSeconds == NULL)
+    {
+        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not allocate memory for the profiler (%s)\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    vm->profile = profile;
+}
+
+static void vmProfileDestroy(QuarkVM *vm)
+{
+    if (vm->profile == NULL) return;
+
+    free(vm->profile->counts);
+    free(vm->profile->nativeCalls);
+    free(vm->profile->nativeSeconds);
+    free(vm->profile);
+    vm->profile = NULL;
+}
+
+static int vmProfileCompareEntries(const void *a, const void *b)
+{
+    const VMProfileEntry *x = a, *y = b;
+    if (x->count != y->count) return x->count < y->count ? 1 : -1;
+
+    return (x->key > y->key) - (x->key < y->key);
+}
+
+// The labels of the program in address order, with the instructions from each one up to the next
+// attributed to it. Instructions before the first label belong to a nameless entry at address 0.
+static VMProfileLabel *vmProfileLabels(const QuarkVM *vm, int64_t *labelCount)
+{
+    VMProfileLabel *labels = NULL;
+    int64_t size = 0, capacity = 0, cursor = 0, address;
+    StringView name;
+
+    labels = vmReserve(labels, &capacity, 1, sizeof(labels[0]));
+    labels[size++] = (VMProfileLabel) {{0, ""}, 0, 0};
+
+    while (vmNextSymbol(vm, &cursor, &name, &address))
+    {
+        if (address == labels[size - 1].address && labels[size - 1].name.count == 0) --size;
+
+        labels = vmReserve(labels, &capacity, size + 1, sizeof(labels[0]));
+        labels[size++] = (VMProfileLabel) {name, address, 0};
+    }
+
+    for (int64_t i = 0, label = 0; i <= vm->programSize; ++i)
+    {
+        while (label + 1 < size && labels[label + 1].address <= i) ++label;
+        labels[label].count += vm->profile->counts[i];
+    }
+
+    *labelCount = size;
+    return labels;
+}
+
+static const VMProfileLabel *vmProfileLabelAt(const VMProfileLabel *labels, int64_t labelCount, int64_t address)
+{
+    int64_t label = 0;
+    while (label + 1 < labelCount && labels[label + 1].address <= address) ++label;
+
+    return &labels[label];
+}
+
+static uint64_t vmProfileTotal(const QuarkVM *vm)
+{
+    uint64_t total = 0;
+    for (int64_t i = 0; i <= vm->programSize; ++i) total += vm->profile->counts[i];
+
+    return total;
+}
+
+static double vmProfilePercent(uint64_t count, uint64_t total) { return total > 0 ? 100.0 * count / total : 0.0; }
+
+// Prints the opcodes, labels and `hottest` instructions by execution count, and the natives.
+static void vmProfileReport(FILE *stream, const QuarkVM *vm, double seconds, int64_t hottest)
+{
+    const uint64_t total = vmProfileTotal(vm);
+    fprintf(stream, "Profile: %" PRIu64 " instructions in %.3f s\n", total, seconds);
+
+    VMProfileEntry opcodes[INST_COUNT];
+    for (int i = 0; i < INST_COUNT; ++i) opcodes[i] = (VMProfileEntry) {i, 0};
+    for (int64_t i = 0; i < vm->programSize; ++i)
+        if ((unsigned) vm->program[i].type < INST_COUNT) opcodes[vm->program[i].type].count += vm->profile->counts[i];
+    qsort(opcodes, INST_COUNT, sizeof(opcodes[0]), vmProfileCompareEntries);
+
+    fprintf(stream, "\nBy opcode:\n");
+    for (int i = 0; i < INST_COUNT && opcodes[i].count > 0; ++i)
+        fprintf(stream, "  %14" PRIu64 " %6.2f%%  %s\n", opcodes[i].count, vmProfilePercent(opcodes[i].count, total),
+                getInstructionName(opcodes[i].key));
+
+    int64_t labelCount = 0;
+    VMProfileLabel *labels = vmProfileLabels(vm, &labelCount);
+
+    VMProfileEntry *entries = malloc(sizeof(entries[0]) * (vm->programSize + labelCount + 1));
+    if (entries == NULL)
+    {
+        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not allocate memory for the profiler (%s)\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    for (int64_t i = 0; i < labelCount; ++i) entries[i] = (VMProfileEntry) {i, labels[i].count};
+    qsort(entries, labelCount, sizeof(entries[0]), vmProfileCompareEntries);
+
+    fprintf(stream, "\nBy label:\n");
+    for (int64_t i = 0; i < labelCount && entries[i].count > 0; ++i)
+    {
+        const VMProfileLabel *label = &labels[entries[i].key];
+        fprintf(stream, "  %14" PRIu64 " %6.2f%%  %.*s (Op %" PRId64 ")\n", label->count,
+                vmProfilePercent(label->count, total), label->name.count > 0 ? (int) label->name.count : 7,
+                label->name.count > 0 ? label->name.data : "<start>", label->address);
+    }
+
+    for (int64_t i = 0; i < vm->programSize; ++i) entries[i] = (VMProfileEntry) {i, vm->profile->counts[i]};
+    qsort(entries, vm->programSize, sizeof(entries[0]), vmProfileCompareEntries);
+
+    fprintf(stream, "\nHottest instructions:\n");
+    for (int64_t i = 0; i < vm->programSize && i < hottest && entries[i].count > 0; ++i)
+    {
+        const VMProfileLabel *label = vmProfileLabelAt(labels, labelCount, entries[i].key);
+        fprintf(stream, "  %14" PRIu64 " %6.2f%%  Op %" PRId64 " (%s) in %.*s+%" PRId64 "\n", entries[i].count,
+                vmProfilePercent(entries[i].count, total), entries[i].key,
+                getInstructionName(vm->program[entries[i].key].type),
+                label->name.count > 0 ? (int) label->name.count : 7, label->name.count > 0 ? label->name.data : "<start>",
+                entries[i].key - label->address);
+    }
+
+    fprintf(stream, "\nNatives:\n");
+    for (int64_t i = 0; i < vm->profile->nativeCount; ++i)
+        if (vm->profile->nativeCalls[i] > 0)
+            fprintf(stream, "  %" PRId64 ": %" PRIu64 " calls, %.3f ms, %.0f ns per call\n", i,
+                    vm->profile->nativeCalls[i], vm->profile->nativeSeconds[i] * 1e3,
+                    vm->profile->nativeSeconds[i] * 1e9 / (double) vm->profile->nativeCalls[i]);
+
+    free(entries);
+    free(labels);
+}
+
+static void vmProfileWriteString(FILE *file, StringView string)
+{
+    fputc('"', file);
+    for (int64_t i = 0; i < string.count; ++i)
+    {
+        const unsigned char c = (unsigned char) string.data[i];
+        if (c == '"' || c == '\\') fprintf(file, "\\%c", c);
+        else if (c < 0x20) fprintf(file, "\\u%04x", c);
+        else fputc(c, file);
+    }
+    fputc('"', file);
+}
+
+// Writes the same data as vmProfileReport as JSON, with every executed instruction instead of the
+// hottest ones.
+static void vmProfileWriteJson(const char *filePath, const QuarkVM *vm, double seconds)
+{
+    FILE *file = fopen(filePath, "w");
+    if (file == NULL)
+    {
+        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not open file \"%s\": %s\n", filePath, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    int64_t labelCount = 0;
+    VMProfileLabel *labels = vmProfileLabels(vm, &labelCount);
+
+    fprintf(file, "{\n  \"instructions\": %" PRIu64 ",\n  \"seconds\": %.9f,\n  \"opcodes\": {", vmProfileTotal(vm),
+            seconds);
+
+    uint64_t opcodes[INST_COUNT] = {0};
+    for (int64_t i = 0; i < vm->programSize; ++i)
+        if ((unsigned) vm->program[i].type < INST_COUNT) opcodes[vm->program[i].type] += vm->profile->counts[i];
+
+    const char *separator = "";
+    for (int i = 0; i < INST_COUNT; ++i)
+        if (opcodes[i] > 0)
+        {
+            fprintf(file, "%s\n    \"%s\": %" PRIu64, separator, getInstructionName(i), opcodes[i]);
+            separator = ",";
+        }
+
+    fprintf(file, "\n  },\n  \"labels\": [");
+    separator = "";
+    for (int64_t i = 0; i < labelCount; ++i)
+    {
+        fprintf(file, "%s\n    {\"label\": ", separator);
+        vmProfileWriteString(file, labels[i].name);
+        fprintf(file, ", \"address\": %" PRId64 ", \"count\": %" PRIu64 "}", labels[i].address, labels[i].count);
+        separator = ",";
+    }
+
+    fprintf(file, "\n  ],\n  \"addresses\": [");
+    separator = "";
+    for (int64_t i = 0; i < vm->programSize; ++i)
+        if (vm->profile->counts[i] > 0)
+        {
+            fprintf(file, "%s\n    {\"address\": %" PRId64 ", \"opcode\": \"%s\", \"label\": ", separator, i,
+                    getInstructionName(vm->program[i].type));
+            vmProfileWriteString(file, vmProfileLabelAt(labels, labelCount, i)->name);
+            fprintf(file, ", \"count\": %" PRIu64 "}", vm->profile->counts[i]);
+            separator = ",";
+        }
+
+    fprintf(file, "\n  ],\n  \"natives\": [");
+    separator = "";
+    for (int64_t i = 0; i < vm->profile->nativeCount; ++i)
+        if (vm->profile->nativeCalls[i] > 0)
+        {
+            fprintf(file, "%s\n    {\"index\": %" PRId64 ", \"calls\": %" PRIu64 ", \"seconds\": %.9f}", separator, i,
+                    vm->profile->nativeCalls[i], vm->profile->nativeSeconds[i]);
+            separator = ",";
+        }
+    fprintf(file, "\n  ]\n}\n");
+
+    free(labels);
+    if (fclose(file) != 0)
+    {
+        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not write file \"%s\": %s\n", filePath, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+}
@@ -0,0 +1,490 @@
+#pragma once
+
+// Kernels behind the vector instructions, which work on arrays of f64 or i64 values.
+//
+// Every kernel has a scalar version and, on x86-64 with GCC or Clang, SSE2 and AVX2 versions. The best
+// one the CPU supports is picked at run time (vmSimdLevel); vmSimdLimit caps it (quarkc --simd). All
+// versions give bit-identical results:
+// - Elementwise arithmetic is correctly rounded either way, and integer arithmetic wraps.
+// - Fused multiply-add is always fused: the scalar version uses fma(), so it is only vectorized on CPUs
+//   with FMA3. Nothing else is fused (the Makefile builds with -std=c11, which keeps the compiler from
+//   contracting a * b + c on its own).
+// - Reductions keep VM_SIMD_LANES partial results, one per element index modulo VM_SIMD_LANES, which the
+//   SIMD versions hold in registers, and combine them pairwise at the end (vmReduceF64Finish).
+//
+// Elementwise kernels may write to one of their inputs, but the arrays must not otherwise overlap;
+// vmMemoryVector rejects anything else before calling them.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define VM_HAS_X86_SIMD 1
+#include <immintrin.h>
+#else
+#define VM_HAS_X86_SIMD 0
+#endif
+
+#define VM_SIMD_LANES 16
+
+typedef enum
+{
+    VM_SIMD_SCALAR = 0,
+    VM_SIMD_SSE2,
+    VM_SIMD_AVX2,
+} VMSimdLevel;
+
+typedef enum
+{
+    VM_VECTOR_ADD,
+    VM_VECTOR_SUB,
+    VM_VECTOR_MUL,
+    VM_VECTOR_DIV,
+    VM_VECTOR_FMA,
+    VM_VECTOR_LT,
+    VM_VECTOR_EQ,
+} VMVectorOp;
+
+typedef enum
+{
+    VM_REDUCE_SUM,
+    VM_REDUCE_MIN,
+    VM_REDUCE_MAX,
+    VM_REDUCE_DOT,
+} VMReduceOp;
+
+static VMSimdLevel vmSimdLimit = VM_SIMD_AVX2;
+
+static const char *vmSimdLevelName(VMSimdLevel level)
+{
+    return level == VM_SIMD_AVX2 ? "avx2" : level == VM_SIMD_SSE2 ? "sse2" : "scalar";
+}
+
+static VMSimdLevel vmSimdLevel(void)
+{
+#if VM_HAS_X86_SIMD
+    const VMSimdLevel level = __builtin_cpu_supports("avx2") ? VM_SIMD_AVX2 : VM_SIMD_SSE2;
+#else
+    const VMSimdLevel level = VM_SIMD_SCALAR;
+#endif
+    return level < vmSimdLimit ? level : vmSimdLimit;
+}
+
+// Elements [from, n) of an f64 elementwise operation. Compares store 1 or 0 as i64.
+static void vmVectorF64Scalar(VMVectorOp op, void *dst, const double *a, const double *b, size_t from, size_t n)
+{
+    double *out = dst;
+    int64_t *flags = dst;
+    switch (op)
+    {
+        case VM_VECTOR_ADD:
+            for (size_t i = from; i < n; ++i) out[i] = a[i] + b[i];
+            break;
+        case VM_VECTOR_SUB:
+            for (size_t i = from; i < n; ++i) out[i] = a[i] - b[i];
+            break;
+        case VM_VECTOR_MUL:
+            for (size_t i = from; i < n; ++i) out[i] = a[i] * b[i];
+            break;
+        case VM_VECTOR_DIV:
+            for (size_t i = from; i < n; ++i) out[i] = a[i] / b[i];
+            break;
+        case VM_VECTOR_FMA:
+            for (size_t i = from; i < n; ++i) out[i] = fma(a[i], b[i], out[i]);
+            break;
+        case VM_VECTOR_LT:
+            for (size_t i = from; i < n; ++i) flags[i] = a[i] < b[i];
+            break;
+        case VM_VECTOR_EQ:
+            for (size_t i = from; i < n; ++i) flags[i] = a[i] == b[i];
+            break;
+    }
+}
+
+// Elements [from, n) of an i64 elementwise operation, wrapping on overflow. Division by zero must have
+// been ruled out; INT64_MIN / -1 wraps to INT64_MIN.
+static void vmVectorI64Scalar(VMVectorOp op, int64_t *dst, const int64_t *a, const int64_t *b, size_t from, size_t n)
+{
+    switch (op)
+    {
+        case VM_VECTOR_ADD:
+            for (size_t i = from; i < n; ++i) dst[i] = (int64_t) ((uint64_t) a[i] + (uint64_t) b[i]);
+            break;
+        case VM_VECTOR_SUB:
+            for (size_t i = from; i < n; ++i) dst[i] = (int64_t) ((uint64_t) a[i] - (uint64_t) b[i]);
+            break;
+        case VM_VECTOR_MUL:
+            for (size_t i = from; i < n; ++i) dst[i] = (int64_t) ((uint64_t) a[i] * (uint64_t) b[i]);
+            break;
+        case VM_VECTOR_DIV:
+            for (size_t i = from; i < n; ++i) dst[i] = b[i] == -1 ? (int64_t) -(uint64_t) a[i] : a[i] / b[i];
+            break;
+        case VM_VECTOR_FMA:
+            for (size_t i = from; i < n; ++i)
+                dst[i] = (int64_t) ((uint64_t) dst[i] + (uint64_t) a[i] * (uint64_t) b[i]);
+            break;
+        case VM_VECTOR_LT:
+            for (size_t i = from; i < n; ++i) dst[i] = a[i] < b[i];
+            break;
+        case VM_VECTOR_EQ:
+            for (size_t i = from; i < n; ++i) dst[i] = a[i] == b[i];
+            break;
+    }
+}
+
+static double vmReduceF64Step(VMReduceOp op, double partial, double a, double b)
+{
+    switch (op)
+    {
+        case VM_REDUCE_SUM:
+            return partial + a;
+        case VM_REDUCE_MIN:
+            return a < partial ? a : partial; // What minpd computes, NaNs and signed zeros included.
+        case VM_REDUCE_MAX:
+            return a > partial ? a : partial;
+        default:
+            return partial + a * b;
+    }
+}
+
+static void vmReduceF64Start(VMReduceOp op, double lanes[VM_SIMD_LANES])
+{
+    const double start = op == VM_REDUCE_MIN ? INFINITY : op == VM_REDUCE_MAX ? -INFINITY : 0.0;
+    for (int i = 0; i < VM_SIMD_LANES; ++i) lanes[i] = start;
+}
+
+// Folds elements [from, n) into their lanes, then the lanes into one result.
+static double vmReduceF64Finish(VMReduceOp op, double lanes[VM_SIMD_LANES], const double *a, const double *b,
+                                size_t from, size_t n)
+{
+    for (size_t i = from; i < n; ++i)
+        lanes[i % VM_SIMD_LANES] = vmReduceF64Step(op, lanes[i % VM_SIMD_LANES], a[i], b != NULL ? b[i] : 0.0);
+
+    for (int width = VM_SIMD_LANES / 2; width > 0; width /= 2)
+        for (int i = 0; i < width; ++i)
+            lanes[i] = vmReduceF64Step(op == VM_REDUCE_DOT ? VM_REDUCE_SUM : op, lanes[i], lanes[i + width], 0.0);
+
+    return lanes[0];
+}
+
+static int64_t vmReduceI64Scalar(VMReduceOp op, int64_t result, const int64_t *a, const int64_t *b, size_t from,
+                                 size_t n)
+{
+    for (size_t i = from; i < n; ++i)
+        switch (op)
+        {
+            case VM_REDUCE_SUM:
+                result = (int64_t) ((uint64_t) result + (uint64_t) a[i]);
+                break;
+            case VM_REDUCE_MIN:
+                result = a[i] < result ? a[i] : result;
+                break;
+            case VM_REDUCE_MAX:
+                result = a[i] > result ? a[i] : result;
+                break;
+            case VM_REDUCE_DOT:
+                result = (int64_t) ((uint64_t) result + (uint64_t) a[i] * (uint64_t) b[i]);
+                break;
+        }
+
+    return result;
+}
+
+#if VM_HAS_X86_SIMD
+// The SIMD versions return how many leading elements they handled; the scalar versions do the rest.
+
+static size_t vmVectorF64Sse2(VMVectorOp op, void *dst, const double *a, const double *b, size_t n)
+{
+    double *out = dst;
+    const __m128i one = _mm_set1_epi64x(1);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2)
+    {
+        const __m128d x = _mm_loadu_pd(a + i), y = _mm_loadu_pd(b + i);
+        switch (op)
+        {
+            case VM_VECTOR_ADD:
+                _mm_storeu_pd(out + i, _mm_add_pd(x, y));
+                break;
+            case VM_VECTOR_SUB:
+                _mm_storeu_pd(out + i, _mm_sub_pd(x, y));
+                break;
+            case VM_VECTOR_MUL:
+                _mm_storeu_pd(out + i, _mm_mul_pd(x, y));
+                break;
+            case VM_VECTOR_DIV:
+                _mm_storeu_pd(out + i, _mm_div_pd(x, y));
+                break;
+            case VM_VECTOR_LT:
+                _mm_storeu_si128((__m128i *) (out + i), _mm_and_si128(_mm_castpd_si128(_mm_cmplt_pd(x, y)), one));
+                break;
+            case VM_VECTOR_EQ:
+                _mm_storeu_si128((__m128i *) (out + i), _mm_and_si128(_mm_castpd_si128(_mm_cmpeq_pd(x, y)), one));
+                break;
+            default:
+                return 0; // SSE2 has no fused multiply-add.
+        }
+    }
+
+    return i;
+}
+
+__attribute__((target("avx2"))) static size_t vmVectorF64Avx2(VMVectorOp op, void *dst, const double *a,
+                                                               const double *b, size_t n)
+{
+    double *out = dst;
+    const __m256i one = _mm256_set1_epi64x(1);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        const __m256d x = _mm256_loadu_pd(a + i), y = _mm256_loadu_pd(b + i);
+        switch (op)
+        {
+            case VM_VECTOR_ADD:
+                _mm256_storeu_pd(out + i, _mm256_add_pd(x, y));
+                break;
+            case VM_VECTOR_SUB:
+                _mm256_storeu_pd(out + i, _mm256_sub_pd(x, y));
+                break;
+            case VM_VECTOR_MUL:
+                _mm256_storeu_pd(out + i, _mm256_mul_pd(x, y));
+                break;
+            case VM_VECTOR_DIV:
+                _mm256_storeu_pd(out + i, _mm256_div_pd(x, y));
+                break;
+            case VM_VECTOR_LT:
+                _mm256_storeu_si256((__m256i *) (out + i),
+                                    _mm256_and_si256(_mm256_castpd_si256(_mm256_cmp_pd(x, y, _CMP_LT_OQ)), one));
+                break;
+            case VM_VECTOR_EQ:
+                _mm256_storeu_si256((__m256i *) (out + i),
+                                    _mm256_and_si256(_mm256_castpd_si256(_mm256_cmp_pd(x, y, _CMP_EQ_OQ)), one));
+                break;
+            default:
+                return 0;
+        }
+    }
+
+    return i;
+}
+
+__attribute__((target("avx2,fma"))) static size_t vmVectorFmaF64Avx2(double *dst, const double *a, const double *b,
+                                                                      size_t n)
+{
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        _mm256_storeu_pd(dst + i, _mm256_fmadd_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i),
+                                                  _mm256_loadu_pd(dst + i)));
+
+    return i;
+}
+
+static size_t vmVectorI64Sse2(VMVectorOp op, int64_t *dst, const int64_t *a, const int64_t *b, size_t n)
+{
+    if (op != VM_VECTOR_ADD && op != VM_VECTOR_SUB) return 0;
+
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2)
+    {
+        const __m128i x = _mm_loadu_si128((const __m128i *) (a + i)), y = _mm_loadu_si128((const __m128i *) (b + i));
+        _mm_storeu_si128((__m128i *) (dst + i), op == VM_VECTOR_ADD ? _mm_add_epi64(x, y) : _mm_sub_epi64(x, y));
+    }
+
+    return i;
+}
+
+// AVX2 has no 64-bit multiply or divide, so those stay scalar.
+__attribute__((target("avx2"))) static size_t vmVectorI64Avx2(VMVectorOp op, int64_t *dst, const int64_t *a,
+                                                               const int64_t *b, size_t n)
+{
+    if (op == VM_VECTOR_MUL || op == VM_VECTOR_DIV || op == VM_VECTOR_FMA) return 0;
+
+    const __m256i one = _mm256_set1_epi64x(1);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        const __m256i x = _mm256_loadu_si256((const __m256i *) (a + i));
+        const __m256i y = _mm256_loadu_si256((const __m256i *) (b + i));
+        __m256i result;
+        switch (op)
+        {
+            case VM_VECTOR_ADD:
+                result = _mm256_add_epi64(x, y);
+                break;
+            case VM_VECTOR_SUB:
+                result = _mm256_sub_epi64(x, y);
+                break;
+            case VM_VECTOR_LT:
+                result = _mm256_and_si256(_mm256_cmpgt_epi64(y, x), one);
+                break;
+            default:
+                result = _mm256_and_si256(_mm256_cmpeq_epi64(x, y), one);
+                break;
+        }
+        _mm256_storeu_si256((__m256i *) (dst + i), result);
+    }
+
+    return i;
+}
+
+static size_t vmReduceF64Sse2(VMReduceOp op, double lanes[VM_SIMD_LANES], const double *a, const double *b, size_t n)
+{
+    __m128d partial[VM_SIMD_LANES / 2];
+    for (int j = 0; j < VM_SIMD_LANES / 2; ++j) partial[j] = _mm_loadu_pd(lanes + 2 * j);
+
+    size_t i = 0;
+    for (; i + VM_SIMD_LANES <= n; i += VM_SIMD_LANES)
+        for (int j = 0; j < VM_SIMD_LANES / 2; ++j)
+        {
+            const __m128d x = _mm_loadu_pd(a + i + 2 * j);
+            switch (op)
+            {
+                case VM_REDUCE_SUM:
+                    partial[j] = _mm_add_pd(partial[j], x);
+                    break;
+                case VM_REDUCE_MIN:
+                    partial[j] = _mm_min_pd(x, partial[j]);
+                    break;
+                case VM_REDUCE_MAX:
+                    partial[j] = _mm_max_pd(x, partial[j]);
+                    break;
+                case VM_REDUCE_DOT:
+                    partial[j] = _mm_add_pd(partial[j], _mm_mul_pd(x, _mm_loadu_pd(b + i + 2 * j)));
+                    break;
+            }
+        }
+
+    for (int j = 0; j < VM_SIMD_LANES / 2; ++j) _mm_storeu_pd(lanes + 2 * j, partial[j]);
+    return i;
+}
+
+// Not compiled with FMA, so the multiply and add of the dot product stay separate, as in the scalar version.
+__attribute__((target("avx2"))) static size_t vmReduceF64Avx2(VMReduceOp op, double lanes[VM_SIMD_LANES],
+                                                               const double *a, const double *b, size_t n)
+{
+    __m256d partial[VM_SIMD_LANES / 4];
+    for (int j = 0; j < VM_SIMD_LANES / 4; ++j) partial[j] = _mm256_loadu_pd(lanes + 4 * j);
+
+    size_t i = 0;
+    for (; i + VM_SIMD_LANES <= n; i += VM_SIMD_LANES)
+        for (int j = 0; j < VM_SIMD_LANES / 4; ++j)
+        {
+            const __m256d x = _mm256_loadu_pd(a + i + 4 * j);
+            switch (op)
+            {
+                case VM_REDUCE_SUM:
+                    partial[j] = _mm256_add_pd(partial[j], x);
+                    break;
+                case VM_REDUCE_MIN:
+                    partial[j] = _mm256_min_pd(x, partial[j]);
+                    break;
+                case VM_REDUCE_MAX:
+                    partial[j] = _mm256_max_pd(x, partial[j]);
+                    break;
+                case VM_REDUCE_DOT:
+                    partial[j] = _mm256_add_pd(partial[j], _mm256_mul_pd(x, _mm256_loadu_pd(b + i + 4 * j)));
+                    break;
+            }
+        }
+
+    for (int j = 0; j < VM_SIMD_LANES / 4; ++j) _mm256_storeu_pd(lanes + 4 * j, partial[j]);
+    return i;
+}
+
+// Sums, minimums and maximums; integer dot products have no 64-bit multiply to use.
+__attribute__((target("avx2"))) static size_t vmReduceI64Avx2(VMReduceOp op, int64_t *result, const int64_t *a,
+                                                               size_t n)
+{
+    if (op == VM_REDUCE_DOT) return 0;
+
+    const __m256i start = op == VM_REDUCE_SUM ? _mm256_setzero_si256() : _mm256_set1_epi64x(*result);
+    __m256i partial[4] = {start, start, start, start};
+
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+        for (int j = 0; j < 4; ++j)
+        {
+            const __m256i x = _mm256_loadu_si256((const __m256i *) (a + i + 4 * j));
+            if (op == VM_REDUCE_SUM) partial[j] = _mm256_add_epi64(partial[j], x);
+            else if (op == VM_REDUCE_MIN)
+                partial[j] = _mm256_blendv_epi8(partial[j], x, _mm256_cmpgt_epi64(partial[j], x));
+            else partial[j] = _mm256_blendv_epi8(partial[j], x, _mm256_cmpgt_epi64(x, partial[j]));
+        }
+
+    int64_t lanes[16];
+    for (int j = 0; j < 4; ++j) _mm256_storeu_si256((__m256i *) (lanes + 4 * j), partial[j]);
+
+    *result = vmReduceI64Scalar(op, *result, lanes, NULL, 0, 16);
+    return i;
+}
+
+static size_t vmReduceI64Sse2(VMReduceOp op, int64_t *result, const int64_t *a, size_t n)
+{
+    if (op != VM_REDUCE_SUM) return 0;
+
+    __m128i partial = _mm_set_epi64x(0, *result);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) partial = _mm_add_epi64(partial, _mm_loadu_si128((const __m128i *) (a + i)));
+
+    int64_t lanes[2];
+    _mm_storeu_si128((__m128i *) lanes, partial);
+    *result = (int64_t) ((uint64_t) lanes[0] + (uint64_t) lanes[1]);
+    return i;
+}
+#endif
+
+static void vmVectorF64(VMVectorOp op, void *dst, const double *a, const double *b, size_t n)
+{
+    size_t done = 0;
+#if VM_HAS_X86_SIMD
+    const VMSimdLevel level = vmSimdLevel();
+    if (op == VM_VECTOR_FMA)
+    {
+        if (level == VM_SIMD_AVX2 && __builtin_cpu_supports("fma")) done = vmVectorFmaF64Avx2(dst, a, b, n);
+    } else if (level == VM_SIMD_AVX2) done = vmVectorF64Avx2(op, dst, a, b, n);
+    else if (level == VM_SIMD_SSE2) done = vmVectorF64Sse2(op, dst, a, b, n);
+#endif
+    vmVectorF64Scalar(op, dst, a, b, done, n);
+}
+
+static void vmVectorI64(VMVectorOp op, int64_t *dst, const int64_t *a, const int64_t *b, size_t n)
+{
+    size_t done = 0;
+#if VM_HAS_X86_SIMD
+    const VMSimdLevel level = vmSimdLevel();
+    if (level == VM_SIMD_AVX2) done = vmVectorI64Avx2(op, dst, a, b, n);
+    else if (level == VM_SIMD_SSE2) done = vmVectorI64Sse2(op, dst, a, b, n);
+#endif
+    vmVectorI64Scalar(op, dst, a, b, done, n);
+}
+
+// `b` is only read by dot products. An empty minimum is infinity, an empty maximum minus infinity.
+static double vmReduceF64(VMReduceOp op, const double *a, const double *b, size_t n)
+{
+    double lanes[VM_SIMD_LANES];
+    vmReduceF64Start(op, lanes);
+
+    size_t done = 0;
+#if VM_HAS_X86_SIMD
+    const VMSimdLevel level = vmSimdLevel();
+    if (level == VM_SIMD_AVX2) done = vmReduceF64Avx2(op, lanes, a, b, n);
+    else if (level == VM_SIMD_SSE2) done = vmReduceF64Sse2(op, lanes, a, b, n);
+#endif
+    return vmReduceF64Finish(op, lanes, a, b, done, n);
+}
+
+// An empty minimum is INT64_MAX, an empty maximum INT64_MIN.
+static int64_t vmReduceI64(VMReduceOp op, const int64_t *a, const int64_t *b, size_t n)
+{
+    int64_t result = op == VM_REDUCE_MIN ? INT64_MAX : op == VM_REDUCE_MAX ? INT64_MIN : 0;
+
+    size_t done = 0;
+#if VM_HAS_X86_SIMD
+    const VMSimdLevel level = vmSimdLevel();
+    if (level == VM_SIMD_AVX2) done = vmReduceI64Avx2(op, &result, a, n);
+    else if (level == VM_SIMD_SSE2) done = vmReduceI64Sse2(op, &result, a, n);
+#endif
+    return vmReduceI64Scalar(op, result, a, b, done, n);
+}
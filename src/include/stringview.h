@@ -64,54 +64,214 @@ static int sv_toInt(StringView sv)
     return result;
 }
 
-static StringView sv_readFile(const char *filePath)
+static int sv_isSpace(char c) { return c == ' ' || (c >= '\t' && c <= '\r'); }
+
+static StringView sv_chopToken(StringView *sv)
+{
+    int64_t start = 0;
+    while (start < sv->count && sv_isSpace(sv->data[start])) ++start;
+
+    int64_t end = start;
+    while (end < sv->count && !sv_isSpace(sv->data[end])) ++end;
+
+    StringView result = {end - start, sv->data + start};
+    sv->count -= end;
+    sv->data += end;
+
+    return result;
+}
+
+// Parses the whole view as a decimal integer with an optional sign. Fails on empty input,
+// trailing characters and values that do not fit in 64 bits.
+static int sv_parseI64(StringView sv, int64_t *result)
 {
-    FILE *file = fopen(filePath, "r");
-    if (file == NULL)
+    int64_t i = 0;
+    const int negative = sv.count > 0 && sv.data[0] == '-';
+    if (sv.count > 0 && (sv.data[0] == '-' || sv.data[0] == '+')) ++i;
+    if (i == sv.count) return 0;
+
+    uint64_t value = 0;
+    for (; i < sv.count; ++i)
     {
-        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not open file \"%s\" (%s)\n", filePath, strerror(errno));
-        exit(EXIT_FAILURE);
+        const unsigned digit = (unsigned char) sv.data[i] - '0';
+        if (digit > 9 || value > (UINT64_MAX - digit) / 10) return 0;
+        value = value * 10 + digit;
     }
 
-    if (fseek(file, 0, SEEK_END) < 0)
+    if (value > (uint64_t) INT64_MAX + negative) return 0;
+    *result = negative ? (int64_t) (0 - value) : (int64_t) value;
+
+    return 1;
+}
+
+// Parses the whole view as a decimal floating point number. Literals with at most 19
+// significant digits whose mantissa and power of ten are both exactly representable take
+// Clinger's fast path (one correctly rounded multiply or divide); everything else, including
+// "inf" and "nan", falls back to strtod on a temporary copy.
+static int sv_parseF64(StringView sv, double *result)
+{
+    static const double powersOfTen[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                         1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+    int64_t i = 0, exponent = 0, digits = 0;
+    const int negative = sv.count > 0 && sv.data[0] == '-';
+    if (sv.count > 0 && (sv.data[0] == '-' || sv.data[0] == '+')) ++i;
+
+    uint64_t mantissa = 0;
+    int fast = 1, seenDigit = 0, seenPoint = 0;
+    for (; i < sv.count; ++i)
     {
-        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not set EOF for file \"%s\" (%s)\n", filePath,
-                strerror(errno));
-        exit(EXIT_FAILURE);
+        const char c = sv.data[i];
+        if (c >= '0' && c <= '9')
+        {
+            seenDigit = 1;
+            if (mantissa == 0 && c == '0')
+            {
+                if (seenPoint) --exponent;
+                continue;
+            }
+
+            if (++digits > 19) fast = 0;
+            else mantissa = mantissa * 10 + (uint64_t) (c - '0');
+            if (seenPoint) --exponent;
+        } else if (c == '.' && !seenPoint) seenPoint = 1;
+        else break;
     }
 
-    long fileSize = ftell(file);
-    if (fileSize < 0)
+    if (seenDigit && i < sv.count && (sv.data[i] == 'e' || sv.data[i] == 'E'))
     {
-        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not determine length of file \"%s\" (%s)\n", filePath,
-                strerror(errno));
-        exit(EXIT_FAILURE);
+        int64_t j = i + 1, written = 0;
+        const int negativeExponent = j < sv.count && sv.data[j] == '-';
+        if (j < sv.count && (sv.data[j] == '-' || sv.data[j] == '+')) ++j;
+
+        if (j < sv.count && isdigit((unsigned char) sv.data[j]))
+        {
+            for (; j < sv.count && isdigit((unsigned char) sv.data[j]); ++j)
+                if (written < 100000) written = written * 10 + (sv.data[j] - '0');
+
+            exponent += negativeExponent ? -written : written;
+            i = j;
+        }
     }
 
-    char *fileContents = malloc(fileSize);
-    if (fileContents == NULL)
+    if (fast && seenDigit && i == sv.count && mantissa <= ((uint64_t) 1 << 53) && exponent >= -22 && exponent <= 22)
     {
-        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not allocate memory for file \"%s\" (%s)\n", filePath,
-                strerror(errno));
-        exit(EXIT_FAILURE);
+        double value = (double) mantissa;
+        value = exponent < 0 ? value / powersOfTen[-exponent] : value * powersOfTen[exponent];
+        *result = negative ? -value : value;
+
+        return 1;
     }
 
-    if (fseek(file, 0, SEEK_SET) < 0)
+    if (sv.count <= 0) return 0;
+
+    char buffer[64], *endPtr = NULL;
+    char *copy = sv.count < (int64_t) sizeof(buffer) ? buffer : malloc((size_t) sv.count + 1);
+    if (copy == NULL) return 0;
+
+    memcpy(copy, sv.data, sv.count);
+    copy[sv.count] = '\0';
+    *result = strtod(copy, &endPtr);
+
+    const int parsed = endPtr - copy == sv.count;
+    if (copy != buffer) free(copy);
+
+    return parsed;
+}
+
+#define SV_READER_CAPACITY ((int64_t) 64 * 1024)
+
+// Reads a file, or stdin for "-", one line at a time through a fixed buffer of SV_READER_CAPACITY
+// bytes, so pipes work and memory use does not depend on the size of the input. A line (without its
+// '\n') stays valid until the next call to sv_readLine, and may be at most SV_READER_CAPACITY - 1
+// bytes long.
+typedef struct
+{
+    FILE *file;
+    const char *filePath;
+    char *buffer;
+    int64_t start;
+    int64_t end;
+    int eof;
+} SVReader;
+
+static SVReader sv_openReader(const char *filePath)
+{
+    const int fromStdin = strcmp(filePath, "-") == 0;
+
+    SVReader reader = {0};
+    reader.filePath = fromStdin ? "<stdin>" : filePath;
+    reader.file = fromStdin ? stdin : fopen(filePath, "r");
+    if (reader.file == NULL)
     {
-        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not read file \"%s\" (%s)\n", filePath, strerror(errno));
+        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not open file \"%s\" (%s)\n", filePath, strerror(errno));
         exit(EXIT_FAILURE);
     }
 
-    int64_t readBytes = (int64_t) fread(fileContents, 1, fileSize, file);
-    if (ferror(file))
+    reader.buffer = malloc(SV_READER_CAPACITY);
+    if (reader.buffer == NULL)
     {
-        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not get contents for file \"%s\" (%s)\n", filePath,
+        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not allocate memory for file \"%s\" (%s)\n", filePath,
                 strerror(errno));
         exit(EXIT_FAILURE);
     }
 
-    fileContents[fileSize] = '\0';
-    fclose(file);
+    return reader;
+}
+
+static void sv_closeReader(SVReader *reader)
+{
+    if (reader->file != stdin) fclose(reader->file);
+    free(reader->buffer);
+    *reader = (SVReader) {0};
+}
+
+// Sets `line` to the next line and returns 1, or returns 0 at the end of the input. A partial line
+// at the end of the buffer is moved to its start before refilling, so lines never straddle chunks.
+static int sv_readLine(SVReader *reader, StringView *line)
+{
+    for (;;)
+    {
+        const char *data = reader->buffer + reader->start;
+        const int64_t available = reader->end - reader->start;
+        const char *newline = available > 0 ? memchr(data, '\n', available) : NULL;
 
-    return (StringView) {readBytes, fileContents};
+        if (newline != NULL)
+        {
+            *line = (StringView) {newline - data, data};
+            reader->start += line->count + 1;
+            return 1;
+        }
+
+        if (reader->eof)
+        {
+            if (available == 0) return 0;
+
+            *line = (StringView) {available, data};
+            reader->start = reader->end;
+            return 1;
+        }
+
+        memmove(reader->buffer, data, available);
+        reader->start = 0;
+        reader->end = available;
+
+        if (reader->end == SV_READER_CAPACITY)
+        {
+            fprintf(stderr, "[\033[1;31mERROR\033[0m]: A line of file \"%s\" is longer than %" PRId64 " bytes\n",
+                    reader->filePath, SV_READER_CAPACITY - 1);
+            exit(EXIT_FAILURE);
+        }
+
+        const size_t readBytes = fread(reader->buffer + reader->end, 1, SV_READER_CAPACITY - reader->end, reader->file);
+        if (ferror(reader->file))
+        {
+            fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not read file \"%s\" (%s)\n", reader->filePath,
+                    strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        reader->end += (int64_t) readBytes;
+        reader->eof = readBytes == 0 || feof(reader->file);
+    }
 }
@@ -0,0 +1,600 @@
+#pragma once
+
+// Ahead-of-time translation of a loaded program to C.
+//
+// Every instruction becomes a few lines of C behind a label, jumps become gotos and returns go
+// through a switch over the return sites: the instructions after each invoke, which are the only
+// targets the verifier accepts, or every instruction if the program could not be verified. In a
+// verified program, main's operand stack lives in local
+// variables (one per statically known depth), which the C compiler can keep in registers; they are
+// written to the VM stack only around invokes, natives and exits. Code reached through invoke, and
+// every instruction of a program that could not be verified, works on the VM stack through a
+// pointer, with the same stack checks as the interpreter where the program is unverified.
+//
+// The output includes compiler.h and native.h, calls natives by name and reports exceptions exactly
+// like quarkc.
+
+#include "compiler.h"
+#include "native.h"
+
+typedef struct
+{
+    FILE *out;
+    const QuarkVM *vm;
+    const VMVerification *verification;
+    int64_t address;
+    int local;
+    int64_t depth;
+} VMTranslator;
+
+static int vmTranslateIsLocal(const VMTranslator *t, int64_t address)
+{
+    return t->verification->verified && t->verification->function[address] == VM_FUNCTION_MAIN;
+}
+
+static int vmTranslateIsReachable(const VMTranslator *t, int64_t address)
+{
+    return !t->verification->verified || t->verification->function[address] != VM_FUNCTION_NONE;
+}
+
+// The `k`th value from the top of the stack (1 is the top).
+static const char *vmTranslateSlot(const VMTranslator *t, int64_t k, char *buffer, size_t size)
+{
+    if (t->local) snprintf(buffer, size, "s%" PRId64, t->depth - k);
+    else if (k == 0) snprintf(buffer, size, "sp[0]");
+    else snprintf(buffer, size, "sp[-%" PRId64 "]", k);
+    return buffer;
+}
+
+static void vmTranslateInteger(FILE *out, int64_t value)
+{
+    if (value == INT64_MIN) fprintf(out, "INT64_MIN");
+    else fprintf(out, "INT64_C(%" PRId64 ")", value);
+}
+
+static void vmTranslateFloat(FILE *out, Word value)
+{
+    if (isfinite(value.asF64)) fprintf(out, "%a", value.asF64);
+    else
+    {
+        fprintf(out, "((Word) {.asI64 = ");
+        vmTranslateInteger(out, value.asI64);
+        fprintf(out, "}).asF64");
+    }
+}
+
+static void vmTranslateSpill(const VMTranslator *t, const char *indent, int64_t from, int64_t to)
+{
+    for (int64_t i = from; i < to; ++i) fprintf(t->out, "%sstack[%" PRId64 "] = s%" PRId64 ";\n", indent, i, i);
+}
+
+static void vmTranslateReload(const VMTranslator *t, const char *indent, int64_t from, int64_t to)
+{
+    for (int64_t i = from; i < to; ++i) fprintf(t->out, "%ss%" PRId64 " = stack[%" PRId64 "];\n", indent, i, i);
+}
+
+// Writes the stack back to the VM, as every exit from the generated code leaves it.
+static void vmTranslateSync(const VMTranslator *t, const char *indent)
+{
+    if (t->local)
+    {
+        vmTranslateSpill(t, indent, 0, t->depth);
+        fprintf(t->out, "%svm->stackSize = %" PRId64 ";\n", indent, t->depth);
+    } else fprintf(t->out, "%svm->stackSize = sp - stack;\n", indent);
+}
+
+static void vmTranslateRaise(const VMTranslator *t, const char *condition, const char *exception)
+{
+    fprintf(t->out, "    if (%s)\n    {\n", condition);
+    vmTranslateSync(t, "        ");
+    fprintf(t->out, "        QUARK_RAISE(%" PRId64 ", %s);\n    }\n", t->address, exception);
+}
+
+static void vmTranslatePop(const VMTranslator *t, int64_t count)
+{
+    if (!t->local && count > 0) fprintf(t->out, "    sp -= %" PRId64 ";\n", count);
+}
+
+static void vmTranslatePush(const VMTranslator *t)
+{
+    if (!t->local) fprintf(t->out, "    ++sp;\n");
+}
+
+// Only unverified code checks the stack; verified code is proven not to underflow or overflow.
+static void vmTranslateCheck(const VMTranslator *t, int64_t required, int pushes)
+{
+    if (t->verification->verified) return;
+
+    char condition[64];
+    if (required > 0)
+    {
+        snprintf(condition, sizeof condition, "sp - stack < %" PRId64, required);
+        vmTranslateRaise(t, condition, "EX_STACK_UNDERFLOW");
+    }
+    if (pushes) vmTranslateRaise(t, "!VM_STACK_GUARD && sp - stack >= VM_STACK_CAPACITY", "EX_STACK_OVERFLOW");
+}
+
+static const char *vmTranslateOperator(InstructionType type)
+{
+    switch (type)
+    {
+        case INST_IPLUS:
+        case INST_FPLUS:
+        case INST_IPLUS_IMM:
+        case INST_FPLUS_IMM:
+            return "+";
+        case INST_IMINUS:
+        case INST_FMINUS:
+        case INST_IMINUS_IMM:
+        case INST_FMINUS_IMM:
+            return "-";
+        case INST_IMUL:
+        case INST_FMUL:
+        case INST_FMUL_IMM:
+            return "*";
+        case INST_IDIV:
+        case INST_FDIV:
+            return "/";
+        case INST_IMOD:
+            return "%";
+        case INST_IEQ:
+        case INST_FEQ:
+        case INST_JUMP_IEQ:
+        case INST_JUMP_FEQ:
+            return "==";
+        case INST_JUMP_INEQ:
+            return "!=";
+        case INST_IGT:
+        case INST_FGT:
+        case INST_JUMP_IGT:
+        case INST_JUMP_FGT:
+            return ">";
+        case INST_ILT:
+        case INST_FLT:
+        case INST_JUMP_ILT:
+        case INST_JUMP_FLT:
+            return "<";
+        case INST_IGEQ:
+        case INST_FGEQ:
+        case INST_JUMP_IGEQ:
+        case INST_JUMP_FGEQ:
+            return ">=";
+        case INST_ILEQ:
+        case INST_FLEQ:
+        case INST_JUMP_ILEQ:
+        case INST_JUMP_FLEQ:
+            return "<=";
+        default:
+            assert(0 && "[vmTranslateOperator]: Unreachable");
+            return "";
+    }
+}
+
+static int vmTranslateIsFloat(InstructionType type)
+{
+    switch (type)
+    {
+        case INST_FPLUS:
+        case INST_FMINUS:
+        case INST_FMUL:
+        case INST_FDIV:
+        case INST_FMOD:
+        case INST_FEQ:
+        case INST_FNEQ:
+        case INST_FGT:
+        case INST_FLT:
+        case INST_FGEQ:
+        case INST_FLEQ:
+        case INST_FPLUS_IMM:
+        case INST_FMINUS_IMM:
+        case INST_FMUL_IMM:
+        case INST_JUMP_FEQ:
+        case INST_JUMP_FGT:
+        case INST_JUMP_FLT:
+        case INST_JUMP_FGEQ:
+        case INST_JUMP_FLEQ:
+        case INST_FLOAD:
+        case INST_FSTORE:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+// The C type a load or store reads or writes.
+static const char *vmTranslateMemoryType(InstructionType type)
+{
+    switch (type)
+    {
+        case INST_ILOAD8:
+        case INST_ISTORE8:
+            return "int8_t";
+        case INST_ILOAD32:
+        case INST_ISTORE32:
+            return "int32_t";
+        case INST_ILOAD64:
+        case INST_ISTORE64:
+            return "int64_t";
+        default:
+            return "double";
+    }
+}
+
+// Pops `pops` values and jumps to the operand if `condition` (over the values before the pop) holds.
+static void vmTranslateBranch(const VMTranslator *t, const char *condition, int64_t pops, int64_t target)
+{
+    fprintf(t->out, "    {\n        const int condition = %s;\n", condition);
+    if (!t->local && pops > 0) fprintf(t->out, "        sp -= %" PRId64 ";\n", pops);
+    fprintf(t->out, "        if (condition) goto L%" PRId64 ";\n    }\n", target);
+}
+
+static void vmTranslateInstruction(VMTranslator *t)
+{
+    const Instruction instruction = t->vm->program[t->address];
+    const char *field = vmTranslateIsFloat(instruction.type) ? "asF64" : "asI64";
+    FILE *out = t->out;
+
+    char a[32], b[32], c[32], condition[128];
+    vmTranslateSlot(t, 1, a, sizeof a);
+    vmTranslateSlot(t, 2, b, sizeof b);
+
+    int64_t required = 0, delta = 0;
+    instructionStackEffect(t->vm, instruction, &required, &delta);
+
+    switch (instruction.type)
+    {
+        case INST_KAPUT:
+            break;
+        case INST_PUT:
+            vmTranslateCheck(t, 0, 1);
+            fprintf(out, "    %s.asI64 = ", vmTranslateSlot(t, 0, c, sizeof c));
+            vmTranslateInteger(out, instruction.value.asI64);
+            fprintf(out, ";\n");
+            vmTranslatePush(t);
+            break;
+        case INST_DUP:
+            vmTranslateCheck(t, required, 1);
+            fprintf(out, "    %s = ", vmTranslateSlot(t, 0, c, sizeof c));
+            fprintf(out, "%s;\n", vmTranslateSlot(t, instruction.value.asI64 + 1, c, sizeof c));
+            vmTranslatePush(t);
+            break;
+        case INST_SWAP:
+            vmTranslateCheck(t, required, 0);
+            if (instruction.value.asI64 == 0) break;
+
+            vmTranslateSlot(t, instruction.value.asI64 + 1, c, sizeof c);
+            fprintf(out, "    {\n        const Word temp = %s;\n        %s = %s;\n        %s = temp;\n    }\n", a, a, c, c);
+            break;
+        case INST_RELEASE:
+            vmTranslateCheck(t, required, 0);
+            vmTranslatePop(t, 1);
+            break;
+        case INST_IPLUS:
+        case INST_IMINUS:
+        case INST_IMUL:
+        case INST_IDIV:
+        case INST_IMOD:
+        case INST_FPLUS:
+        case INST_FMINUS:
+        case INST_FMUL:
+        case INST_FDIV:
+            vmTranslateCheck(t, required, 0);
+            if (instruction.type == INST_IDIV || instruction.type == INST_FDIV)
+            {
+                snprintf(condition, sizeof condition, "%s.%s == 0", a, field);
+                vmTranslateRaise(t, condition, "EX_DIVIDE_BY_ZERO");
+            }
+
+            fprintf(out, "    %s.%s %s= %s.%s;\n", b, field, vmTranslateOperator(instruction.type), a, field);
+            vmTranslatePop(t, 1);
+            break;
+        case INST_FMOD:
+            vmTranslateCheck(t, required, 0);
+            fprintf(out, "    %s.asF64 = fmod(%s.asF64, %s.asF64);\n", b, b, a);
+            vmTranslatePop(t, 1);
+            break;
+        case INST_JUMP:
+            fprintf(out, "    goto L%" PRId64 ";\n", instruction.value.asI64);
+            break;
+        case INST_JUMP_IF:
+        case INST_JUMP_IF_DUP:
+        case INST_JUMP_IF_NOT:
+            vmTranslateCheck(t, required, 0);
+            snprintf(condition, sizeof condition, "%s.asI64 %s 0", a, instruction.type == INST_JUMP_IF_NOT ? "==" : "!=");
+            vmTranslateBranch(t, condition, -delta, instruction.value.asI64);
+            break;
+        case INST_RETURN:
+            vmTranslateCheck(t, required, 0);
+            fprintf(out, "    target = %s.asI64;\n", a);
+            if (t->local)
+            {
+                vmTranslateSpill(t, "    ", 0, t->depth - 1);
+                fprintf(out, "    sp = stack + %" PRId64 ";\n", t->depth - 1);
+            } else vmTranslatePop(t, 1);
+            fprintf(out, "    goto dispatch;\n");
+            break;
+        case INST_INVOKE:
+            vmTranslateCheck(t, 0, 1);
+            if (t->local)
+            {
+                vmTranslateSpill(t, "    ", 0, t->depth);
+                fprintf(out, "    sp = stack + %" PRId64 ";\n", t->depth);
+            }
+            fprintf(out, "    (sp++)->asI64 = %" PRId64 ";\n    goto L%" PRId64 ";\n", t->address + 1,
+                    instruction.value.asI64);
+            break;
+        case INST_NATIVE:
+        {
+            const NativeFunction native = t->vm->nativeFunctions[instruction.value.asI64];
+            const char *name = instruction.value.asI64 < VM_NATIVE_COUNT &&
+                               vmNatives[instruction.value.asI64].function == native.function
+                               ? vmNatives[instruction.value.asI64].name : NULL;
+
+            // Natives may read below their inputs (e.g. vmPrintI64s), so the whole stack is spilled.
+            if (t->local)
+            {
+                vmTranslateSpill(t, "    ", 0, t->depth);
+                fprintf(out, "    vm->stackSize = %" PRId64 ";\n", t->depth);
+            } else fprintf(out, "    vm->stackSize = sp - stack;\n");
+
+            if (name != NULL) fprintf(out, "    exception = %s(vm);\n", name);
+            else fprintf(out, "    exception = vm->nativeFunctions[%" PRId64 "].function(vm);\n", instruction.value.asI64);
+
+            fprintf(out, "    if (exception != EX_OK) QUARK_RAISE(%" PRId64 ", exception);\n", t->address);
+
+            if (t->local) vmTranslateReload(t, "    ", t->depth - native.inputs, t->depth + delta);
+            else fprintf(out, "    sp = stack + vm->stackSize;\n");
+            break;
+        }
+        case INST_IEQ:
+        case INST_IGT:
+        case INST_ILT:
+        case INST_IGEQ:
+        case INST_ILEQ:
+        case INST_FEQ:
+        case INST_FGT:
+        case INST_FLT:
+        case INST_FGEQ:
+        case INST_FLEQ:
+            vmTranslateCheck(t, required, 0);
+            fprintf(out, "    %s.asI64 = %s.%s %s %s.%s;\n", b, a, field, vmTranslateOperator(instruction.type), b, field);
+            vmTranslatePop(t, 1);
+            break;
+        case INST_INEQ:
+        case INST_FNEQ:
+            vmTranslateCheck(t, required, 0);
+            fprintf(out, "    %s.asI64 = !%s.%s;\n", a, a, field);
+            break;
+        case INST_HALT:
+            vmTranslateSync(t, "    ");
+            fprintf(out, "    vm->halt = 1;\n    vm->instructionPointer = %" PRId64 ";\n    return EX_OK;\n", t->address);
+            break;
+        case INST_IPLUS_IMM:
+        case INST_IMINUS_IMM:
+        case INST_FPLUS_IMM:
+        case INST_FMINUS_IMM:
+        case INST_FMUL_IMM:
+            vmTranslateCheck(t, required, 0);
+            fprintf(out, "    %s.%s %s= ", a, field, vmTranslateOperator(instruction.type));
+            if (vmTranslateIsFloat(instruction.type)) vmTranslateFloat(out, instruction.value);
+            else vmTranslateInteger(out, instruction.value.asI64);
+            fprintf(out, ";\n");
+            break;
+        case INST_JUMP_IEQ:
+        case INST_JUMP_INEQ:
+        case INST_JUMP_IGT:
+        case INST_JUMP_ILT:
+        case INST_JUMP_IGEQ:
+        case INST_JUMP_ILEQ:
+        case INST_JUMP_FEQ:
+        case INST_JUMP_FGT:
+        case INST_JUMP_FLT:
+        case INST_JUMP_FGEQ:
+        case INST_JUMP_FLEQ:
+            vmTranslateCheck(t, required, 0);
+            snprintf(condition, sizeof condition, "%s.%s %s %s.%s", a, field, vmTranslateOperator(instruction.type), b,
+                     field);
+            vmTranslateBranch(t, condition, 2, instruction.value.asI64);
+            break;
+        case INST_ILOAD8:
+        case INST_ILOAD32:
+        case INST_ILOAD64:
+        case INST_FLOAD:
+            // Translated programs never run with --heap-debug, so memory accesses are not bounds checked.
+            vmTranslateCheck(t, required, 0);
+            fprintf(out, "    {\n        %s value;\n        memcpy(&value, (const unsigned char *) %s.asPtr + ",
+                    vmTranslateMemoryType(instruction.type), a);
+            vmTranslateInteger(out, instruction.value.asI64);
+            fprintf(out, ", sizeof value);\n        %s.%s = value;\n    }\n", a, field);
+            break;
+        case INST_ISTORE8:
+        case INST_ISTORE32:
+        case INST_ISTORE64:
+        case INST_FSTORE:
+            vmTranslateCheck(t, required, 0);
+            fprintf(out, "    {\n        const %s value = (%s) %s.%s;\n        memcpy((unsigned char *) %s.asPtr + ",
+                    vmTranslateMemoryType(instruction.type), vmTranslateMemoryType(instruction.type), a, field, b);
+            vmTranslateInteger(out, instruction.value.asI64);
+            fprintf(out, ", &value, sizeof value);\n    }\n");
+            vmTranslatePop(t, 2);
+            break;
+        case INST_MEMCPY:
+        case INST_MEMSET:
+        case INST_MEMCMP:
+        case INST_VFPLUS:
+        case INST_VFMINUS:
+        case INST_VFMUL:
+        case INST_VFDIV:
+        case INST_VFFMA:
+        case INST_VFLT:
+        case INST_VFEQ:
+        case INST_VIPLUS:
+        case INST_VIMINUS:
+        case INST_VIMUL:
+        case INST_VIDIV:
+        case INST_VIFMA:
+        case INST_VILT:
+        case INST_VIEQ:
+        case INST_VFDOT:
+        case INST_VFSUM:
+        case INST_VFMIN:
+        case INST_VFMAX:
+        case INST_VIDOT:
+        case INST_VISUM:
+        case INST_VIMIN:
+        case INST_VIMAX:
+        {
+            // The operands go through an array, as vmMemoryBulk and vmMemoryVector work on the VM stack.
+            const int bulk = instruction.type == INST_MEMCPY || instruction.type == INST_MEMSET ||
+                             instruction.type == INST_MEMCMP;
+            vmTranslateCheck(t, required, 0);
+            fprintf(out, "    {\n        Word operands[%" PRId64 "] = {", required);
+            for (int64_t k = required; k > 0; --k)
+                fprintf(out, "%s%s", vmTranslateSlot(t, k, c, sizeof c), k > 1 ? ", " : "};\n");
+            fprintf(out, "        exception = %s(vm, %d, operands + %" PRId64 ");\n",
+                    bulk ? "vmMemoryBulk" : "vmMemoryVector", (int) instruction.type, required);
+            fprintf(out, "        %s = operands[0];\n    }\n", vmTranslateSlot(t, required, c, sizeof c));
+            vmTranslateRaise(t, "exception != EX_OK", "exception");
+            vmTranslatePop(t, -delta);
+            break;
+        }
+        default:
+            assert(0 && "[vmTranslateInstruction]: Unreachable");
+    }
+}
+
+// Writes a standalone C program equivalent to `vm`'s program, which must have passed vmVerifyProgram.
+static void vmTranslateProgram(FILE *out, const QuarkVM *vm, const VMVerification *verification,
+                               const char *inputFilePath)
+{
+    VMTranslator t = {out, vm, verification, 0, 0, 0};
+    const int64_t programSize = vm->programSize;
+
+    // referenced[i]: 1 if L<i> is the target of a goto, 2 if it is also a return site.
+    uint8_t *referenced = calloc(programSize + 1, 1);
+    if (referenced == NULL)
+    {
+        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not allocate memory for the translator (%s)\n",
+                strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    int64_t locals = 0;
+    int hasCall = 0, hasReturn = 0;
+
+    for (int64_t i = 0; i < programSize; ++i)
+    {
+        if (!vmTranslateIsReachable(&t, i)) continue;
+
+        const Instruction instruction = vm->program[i];
+        if (instructionWithAddress(instruction.type)) referenced[instruction.value.asI64] |= 1;
+        if (instruction.type == INST_INVOKE && i + 1 < programSize && vmTranslateIsReachable(&t, i + 1))
+            referenced[i + 1] |= 2;
+        if (instruction.type == INST_NATIVE || instruction.type >= INST_MEMCPY) hasCall = 1;
+        if (instruction.type == INST_RETURN) hasReturn = 1;
+        int64_t required = 0, delta = 0;
+        instructionStackEffect(vm, instruction, &required, &delta);
+        if (instruction.type == INST_INVOKE) delta = 0; // Spills instead of pushing a local.
+        if (vmTranslateIsLocal(&t, i) && verification->stackDepth[i] + (delta > 0 ? delta : 0) > locals)
+            locals = verification->stackDepth[i] + (delta > 0 ? delta : 0);
+    }
+
+    // Unverified programs can return anywhere. Returns into main go through a stub that reloads its locals.
+    for (int64_t i = 0; i < programSize; ++i)
+    {
+        if (!verification->verified && hasReturn) referenced[i] |= 2;
+        if (referenced[i] & 2 && vmTranslateIsLocal(&t, i)) referenced[i] |= 1;
+    }
+
+    fprintf(out, "// Translated by quarkt from \"%s\".\n", inputFilePath);
+    fprintf(out, "// Build with: cc -O2 -I<quarklang-vm>/src/include <file>.c -o <program> -lm -pthread\n\n");
+    fprintf(out, "#include \"compiler.h\"\n#include \"native.h\"\n\n");
+    fprintf(out, "#define QUARK_RAISE(address, error) do { vm->instructionPointer = (address); return (error); } "
+                 "while (0)\n\n");
+
+    // Only the opcodes are kept, so that exceptions name the failing instruction.
+    fprintf(out, "static const Instruction quarkProgram[%" PRId64 "] = {", programSize > 0 ? programSize : 1);
+    for (int64_t i = 0; i < programSize; ++i)
+        fprintf(out, "%s{%d, {0}}%s", i % 8 == 0 ? "\n        " : "", (int) vm->program[i].type, i + 1 < programSize ? ", " : "");
+    fprintf(out, "\n};\n\n");
+
+    fprintf(out, "static Exception quarkRun(QuarkVM *vm)\n{\n");
+    fprintf(out, "    Word *const stack = vm->stack, *sp = stack;\n");
+    for (int64_t i = 0; i < locals; ++i) fprintf(out, "    Word s%" PRId64 " = {0};\n", i);
+    if (hasCall) fprintf(out, "    Exception exception;\n");
+    if (hasReturn) fprintf(out, "    int64_t target;\n");
+    fprintf(out, "    (void) sp;\n\n");
+
+    for (int64_t i = 0; i < programSize; ++i)
+    {
+        if (!vmTranslateIsReachable(&t, i)) continue;
+
+        t.address = i;
+        t.local = vmTranslateIsLocal(&t, i);
+        t.depth = t.local ? verification->stackDepth[i] : 0;
+
+        if (referenced[i] & 1 || (referenced[i] & 2 && !t.local)) fprintf(out, "L%" PRId64 ":\n", i);
+        fprintf(out, "    // %" PRId64 ": %s\n", i, getInstructionName(vm->program[i].type));
+        vmTranslateInstruction(&t);
+    }
+
+    // Running past the last instruction.
+    t.address = programSize;
+    t.local = 0;
+    fprintf(out, "    vm->stackSize = sp - stack;\n    QUARK_RAISE(%" PRId64 ", EX_ILLEGAL_INSTRUCTION_ACCESS);\n",
+            programSize);
+
+    if (hasReturn)
+    {
+        fprintf(out, "\ndispatch:\n    switch (target)\n    {\n");
+        for (int64_t i = 0; i < programSize; ++i)
+            if (referenced[i] & 2)
+                fprintf(out, "        case %" PRId64 ":\n            goto %c%" PRId64 ";\n", i,
+                        vmTranslateIsLocal(&t, i) ? 'R' : 'L', i);
+        fprintf(out, "        default:\n            vm->stackSize = sp - stack;\n"
+                     "            QUARK_RAISE(target, EX_ILLEGAL_INSTRUCTION_ACCESS);\n    }\n");
+
+        for (int64_t i = 0; i < programSize; ++i)
+            if (referenced[i] & 2 && vmTranslateIsLocal(&t, i))
+            {
+                t.depth = verification->stackDepth[i];
+                fprintf(out, "R%" PRId64 ":\n", i);
+                vmTranslateReload(&t, "    ", 0, t.depth);
+                fprintf(out, "    goto L%" PRId64 ";\n", i);
+            }
+    }
+
+    fprintf(out, "}\n\n");
+
+    // Natives called by name are bound at startup, from the plugins quarkt was given.
+    if (vm->importsSize > 0)
+    {
+        fprintf(out, "static const char *const quarkPlugins[%" PRId64 "] = {", vmPluginPathSize > 0 ? vmPluginPathSize : 1);
+        for (int64_t i = 0; i < vmPluginPathSize; ++i)
+            fprintf(out, "\"%s\"%s", vmPluginPaths[i], i + 1 < vmPluginPathSize ? ", " : "");
+        fprintf(out, "};\n\n");
+    }
+
+    fprintf(out, "int main(void)\n{\n");
+    fprintf(out, "    static QuarkVM quarkVm = {0};\n    QuarkVM *vm = &quarkVm;\n\n    vmInit(vm);\n");
+    fprintf(out, "    vm->program = (Instruction *) quarkProgram;\n    vm->programSize = %" PRId64 ";\n", programSize);
+    fprintf(out, "    vm->programBorrowed = 1;\n");
+    if (vm->importsSize > 0)
+        fprintf(out, "    for (size_t i = 0; i < %" PRId64 "; ++i) vmLoadPlugin(quarkPlugins[i]);\n", vmPluginPathSize);
+    fprintf(out, "    vmPushNatives(vm);\n");
+
+    StringView name = {0};
+    int64_t cursor = 0, index = 0;
+    while (vmNextImport(vm, &cursor, &name, &index))
+        fprintf(out, "    vmPushImport(vm, sv_cStringAsStringView(\"%.*s\"));\n", (int) name.count, name.data);
+    fprintf(out, "\n");
+    fprintf(out, "    VM_GUARD_STACK(vm, guard);\n    if (VM_STACK_OVERFLOWED(guard))\n    {\n");
+    fprintf(out, "        VM_RELEASE_STACK(guard);\n\n        vm->stackSize = VM_STACK_CAPACITY;\n"
+                 "        vm->instructionPointer = -1;\n        vmReportException(vm, EX_STACK_OVERFLOW);\n"
+                 "        vmDestroy(vm);\n\n        return EXIT_FAILURE;\n    }\n\n");
+    fprintf(out, "    const Exception exception = quarkRun(vm);\n    VM_RELEASE_STACK(guard);\n\n");
+    fprintf(out, "    if (exception != EX_OK) vmReportException(vm, exception);\n    vmDestroy(vm);\n\n");
+    fprintf(out, "    return exception == EX_OK ? EXIT_SUCCESS : EXIT_FAILURE;\n}\n");
+
+    free(referenced);
+}
@@ -1,9 +1,17 @@
 #include "include/native.h"
 #include "include/compiler.h"
+#include "include/batch.h"
+#include "include/fiber.h"
+#include "include/profile.h"
 #include <stdio.h>
 
 QuarkVM quarkVm = {0};
-int debug = 0, stepDebug = 0, limit = -1, dump = 0;
+int debug = 0, stepDebug = 0, limit = -1, dump = 0, verify = 1, jit = 0;
+int64_t workers = 0;
+int heapStats = 0, heapDebug = 0, profile = 0, stats = 0;
+uint64_t maxInstructions = 0, timeoutMs = 0, slice = 1 << 20;
+const char *profileJsonPath = NULL;
+ExecutionEngine engine = VM_HAS_COMPUTED_GOTO ? ENGINE_THREADED : ENGINE_SWITCH;
 
 int main(int argc, char **argv)
 {
@@ -13,15 +21,137 @@ int main(int argc, char **argv)
             if (strcmp(argv[i], "--debug") == 0 || strcmp(argv[i], "-d") == 0) debug = 1;
             else if (strcmp(argv[i], "--step") == 0 || strcmp(argv[i], "-s") == 0) stepDebug = 1;
             else if (strcmp(argv[i], "--dump") == 0 || strcmp(argv[i], "-D") == 0) dump = 1;
+            else if (strcmp(argv[i], "--no-verify") == 0) verify = 0;
+            else if (strcmp(argv[i], "--jit") == 0 || strcmp(argv[i], "-j") == 0) jit = 1;
+            else if (strcmp(argv[i], "--heap-stats") == 0) heapStats = 1;
+            else if (strcmp(argv[i], "--heap-debug") == 0) heapDebug = 1;
+            else if (strcmp(argv[i], "--profile") == 0) profile = 1;
+            else if (strcmp(argv[i], "--stats") == 0) stats = 1;
+            else if (strcmp(argv[i], "--max-instructions") == 0 || strcmp(argv[i], "--timeout-ms") == 0 ||
+                     strcmp(argv[i], "--slice") == 0)
+            {
+                const char *option = argv[i], *count = argv[++i];
+                char *end = NULL;
+                const unsigned long long value = count != NULL ? strtoull(count, &end, 10) : 0;
+                if (count == NULL || *count == '-' || *end != '\0' || value == 0)
+                {
+                    fprintf(stderr, "[\033[1;31mERROR\033[0m]: Expected a positive number after %s.\n", option);
+                    exit(EXIT_FAILURE);
+                }
+
+                if (strcmp(option, "--max-instructions") == 0) maxInstructions = value;
+                else if (strcmp(option, "--timeout-ms") == 0) timeoutMs = value;
+                else slice = value;
+            }
+            else if (strcmp(argv[i], "--profile-json") == 0)
+            {
+                profile = 1;
+                profileJsonPath = argv[++i];
+                if (profileJsonPath == NULL)
+                {
+                    fprintf(stderr, "[\033[1;31mERROR\033[0m]: Missing profile file.\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            else if (strcmp(argv[i], "--plugin") == 0 || strcmp(argv[i], "-p") == 0)
+            {
+                if (argv[++i] == NULL)
+                {
+                    fprintf(stderr, "[\033[1;31mERROR\033[0m]: Missing plugin file.\n");
+                    exit(EXIT_FAILURE);
+                }
+
+                vmLoadPlugin(argv[i]);
+            }
+            else if (strcmp(argv[i], "--workers") == 0 || strcmp(argv[i], "-w") == 0)
+            {
+                const char *count = argv[++i];
+                if (count == NULL || (workers = strtoll(count, NULL, 10)) <= 0)
+                {
+                    fprintf(stderr, "[\033[1;31mERROR\033[0m]: Expected a positive number of workers.\n");
+                    exit(EXIT_FAILURE);
+                }
+            } else if (strcmp(argv[i], "--batch") == 0 || strcmp(argv[i], "-b") == 0)
+            {
+                if (i + 1 >= argc)
+                {
+                    fprintf(stderr, "[\033[1;31mERROR\033[0m]: Missing batch files.\n");
+                    printf("[\033[1;34mINFO\033[0m]: Usage: %s [options] [--batch | -b] <file | directory>...\n\n",
+                           argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+
+                VMBatch batch = {0};
+                while (++i < argc) vmBatchAddPath(&batch, argv[i]);
+
+                const int status = vmBatchRun(&batch, workers);
+                vmBatchDestroy(&batch);
+
+                return status;
+            }
+            else if (strcmp(argv[i], "--engine") == 0 || strcmp(argv[i], "-e") == 0)
+            {
+                const char *engineName = argv[++i];
+                if (engineName != NULL && strcmp(engineName, "switch") == 0) engine = ENGINE_SWITCH;
+                else if (engineName != NULL && strcmp(engineName, "threaded") == 0) engine = ENGINE_THREADED;
+                else if (engineName != NULL && strcmp(engineName, "compact") == 0) engine = ENGINE_COMPACT;
+                else
+                {
+                    fprintf(stderr, "[\033[1;31mERROR\033[0m]: Unknown engine \"%s\" (expected \"switch\", \"threaded\" or "
+                                    "\"compact\").\n", engineName == NULL ? "" : engineName);
+                    exit(EXIT_FAILURE);
+                }
+            }
+            else if (strcmp(argv[i], "--simd") == 0)
+            {
+                const char *levelName = argv[++i];
+                if (levelName != NULL && strcmp(levelName, "scalar") == 0) vmSimdLimit = VM_SIMD_SCALAR;
+                else if (levelName != NULL && strcmp(levelName, "sse2") == 0) vmSimdLimit = VM_SIMD_SSE2;
+                else if (levelName != NULL && strcmp(levelName, "avx2") == 0) vmSimdLimit = VM_SIMD_AVX2;
+                else
+                {
+                    fprintf(stderr, "[\033[1;31mERROR\033[0m]: Unknown SIMD level \"%s\" (expected \"scalar\", \"sse2\" or "
+                                    "\"avx2\").\n", levelName == NULL ? "" : levelName);
+                    exit(EXIT_FAILURE);
+                }
+            }
             else if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0)
             {
-                printf("[\033[1;34mINFO\033[0m]: Usage: %s [options] [--file | -f] <input_file.qce>\n\n", argv[0]);
+                printf("[\033[1;34mINFO\033[0m]: Usage: %s [options] [--file | -f] <input_file.qce>\n", argv[0]);
+                printf("[\033[1;34mINFO\033[0m]:        %s [--workers <n>] [--batch | -b] <file | directory>...\n\n",
+                       argv[0]);
                 printf("[\033[1;34mINFO\033[0m]: Required:\n");
                 printf("[\033[1;34mINFO\033[0m]:   --file <file>  | -f <file>: The file to compile\n");
+                printf("[\033[1;34mINFO\033[0m]:   --batch <path>...  | -b <path>...: Run every file (or every .qce file in "
+                       "a directory) on a pool of worker threads\n");
                 printf("[\033[1;34mINFO\033[0m]: Optional:\n");
                 printf("[\033[1;34mINFO\033[0m]:   --debug        | -d: Start an interactive debugger\n");
                 printf("[\033[1;34mINFO\033[0m]:   --step         | -s: Step through the program\n");
                 printf("[\033[1;34mINFO\033[0m]:   --dump         | -D: Dump the stack at the end of execution\n");
+                printf("[\033[1;34mINFO\033[0m]:   --engine <e>   | -e <e>: Execution engine, \"switch\", \"threaded\" or \"compact\" "
+                       "(default: %s)\n", VM_HAS_COMPUTED_GOTO ? "threaded" : "switch");
+                printf("[\033[1;34mINFO\033[0m]:   --jit          | -j: Compile verified programs to native code%s\n",
+                       VM_HAS_JIT ? "" : " (not supported on this platform)");
+                printf("[\033[1;34mINFO\033[0m]:   --workers <n>  | -w <n>: Worker threads for --batch and for fibers "
+                       "(default: one per processor)\n");
+                printf("[\033[1;34mINFO\033[0m]:   --plugin <so>  | -p <so>: Load the natives of a plugin (before --file or "
+                       "--batch, may be repeated)%s\n", VM_HAS_PLUGINS ? "" : " (not supported on this platform)");
+                printf("[\033[1;34mINFO\033[0m]:   --heap-stats: Print heap statistics and leaks at exit\n");
+                printf("[\033[1;34mINFO\033[0m]:   --heap-debug: Fail on double frees and frees of unknown pointers, report "
+                       "leaks\n");
+                printf("[\033[1;34mINFO\033[0m]:   --profile: Count executions per opcode, instruction and label, time natives "
+                       "and print a report at exit%s\n", VM_HAS_COMPUTED_GOTO ? "" : " (not supported by this compiler)");
+                printf("[\033[1;34mINFO\033[0m]:   --profile-json <file>: Like --profile, and also write the profile to a JSON "
+                       "file\n");
+                printf("[\033[1;34mINFO\033[0m]:   --max-instructions <n>: Fail once the program has executed <n> "
+                       "instructions\n");
+                printf("[\033[1;34mINFO\033[0m]:   --timeout-ms <n>: Fail once the program has run for <n> milliseconds\n");
+                printf("[\033[1;34mINFO\033[0m]:   --slice <n>: Instructions per time slice when a limit is set (default: "
+                       "%" PRIu64 ")\n", slice);
+                printf("[\033[1;34mINFO\033[0m]:   --stats: Print the number of instructions executed and natives called\n");
+                printf("[\033[1;34mINFO\033[0m]:   --simd <level>: Cap the vector instructions at \"scalar\", \"sse2\" or "
+                       "\"avx2\" (default: the best this processor supports, %s)\n", vmSimdLevelName(vmSimdLevel()));
+                printf("[\033[1;34mINFO\033[0m]:   --no-verify: Skip bytecode verification (always run with stack checks)\n");
                 printf("[\033[1;34mINFO\033[0m]:   --help         | -h: Print this help message and exit\n");
 
                 exit(EXIT_SUCCESS);
@@ -35,24 +165,34 @@ int main(int argc, char **argv)
                     exit(EXIT_FAILURE);
                 }
 
+                vmInit(&quarkVm);
+                quarkVm.heap.debug = heapDebug;
                 vmLoadProgramFromFile(&quarkVm, inputFilePath);
 
-                vmPushNativeFunc(&quarkVm, vmAllocate); // 0
-                vmPushNativeFunc(&quarkVm, vmFree);     // 1
-                vmPushNativeFunc(&quarkVm, vmPrintF64); // 2
-                vmPushNativeFunc(&quarkVm, vmPrintI64); // 3
-                vmPushNativeFunc(&quarkVm, vmPrintPtr); // 4
+                vmPushNatives(&quarkVm);
+
+                if (engine == ENGINE_COMPACT && quarkVm.compact.code == NULL)
+                {
+                    fprintf(stderr, "[\033[1;31mERROR\033[0m]: \"%s\" has no compact code (assemble it with quarki --compact).\n",
+                            inputFilePath);
+                    exit(EXIT_FAILURE);
+                }
+
+                VMVerification verification = {0};
+                if (verify && !vmVerifyProgram(&quarkVm, &verification)) return EXIT_FAILURE;
 
                 if (stepDebug == 1)
-                    for (int j = 0; limit != 0 && !quarkVm.halt && j < (int) quarkVm.programSize; ++j)
+                    while (limit != 0 && !quarkVm.halt)
                     {
-                        printf("Instruction: %s (%" PRId64 " | %lf | %p)\n",
-                               getInstructionName(quarkVm.program[j].type),
-                               quarkVm.program[j].value.asI64,
-                               quarkVm.program[j].value.asF64,
-                               quarkVm.program[j].value.asPtr);
+                        const int64_t ip = quarkVm.instructionPointer;
+                        if (ip >= 0 && ip < quarkVm.programSize)
+                            printf("Instruction: %s (%" PRId64 " | %lf | %p)\n",
+                                   getInstructionName(quarkVm.program[ip].type),
+                                   quarkVm.program[ip].value.asI64,
+                                   quarkVm.program[ip].value.asF64,
+                                   quarkVm.program[ip].value.asPtr);
 
-                        if (vmExecuteInstruction(&quarkVm) != EX_OK) return EXIT_FAILURE;
+                        if (vmExecuteProgram(&quarkVm, 1, 0) != EX_OK) return EXIT_FAILURE;
                         vmDumpStack(stdout, &quarkVm);
 
                         getchar();
@@ -61,9 +201,102 @@ int main(int argc, char **argv)
                 else
                 {
                     if (dump) vmDumpStack(stdout, &quarkVm);
-                    if (vmExecuteProgram(&quarkVm, limit, debug) != EX_OK) return EXIT_FAILURE;
+                    if (jit && VM_HAS_JIT && !debug && limit < 0 &&
+                        (vmUsesFibers(&quarkVm) || profile || maxInstructions > 0 || timeoutMs > 0 || stats))
+                    {
+                        const char *reason = vmUsesFibers(&quarkVm) ? "fibers" : profile ? "--profile"
+                                             : stats ? "--stats" : "--max-instructions or --timeout-ms";
+                        fprintf(stderr, "[\033[1;34mINFO\033[0m]: The JIT does not support %s, so the program runs on "
+                                        "the interpreter.\n", reason);
+                    }
+                    Exception exception;
+                    const double start = vmSeconds();
+                    if (vmUsesFibers(&quarkVm) && !debug && limit < 0)
+                    {
+                        VMScheduler scheduler = {0};
+                        scheduler.workerCount = workers;
+                        scheduler.slice = slice;
+                        scheduler.maxInstructions = maxInstructions;
+                        scheduler.timeout = (double) timeoutMs / 1e3;
+
+                        quarkVm.verified = verification.verified;
+                        exception = vmRunFibers(&quarkVm, &scheduler);
+
+                        if (stats)
+                        {
+                            fprintf(stderr, "[\033[1;34mINFO\033[0m]: Executed %" PRIu64 " instructions and %" PRIu64
+                                            " native calls in %.3f s.\n", quarkVm.instructionCount,
+                                    quarkVm.nativeCount, vmSeconds() - start);
+                            fprintf(stderr, "[\033[1;34mINFO\033[0m]: Ran %" PRId64 " fibers on %" PRId64 " workers "
+                                            "(%" PRIu64 " switches, %" PRIu64 " steals).\n", scheduler.fiberSize,
+                                    scheduler.workerCount, (uint64_t) scheduler.switches, (uint64_t) scheduler.steals);
+                        }
+                        vmSchedulerDestroy(&scheduler);
+                    } else if (profile && VM_HAS_COMPUTED_GOTO && !debug && limit < 0)
+                    {
+                        vmProfileCreate(&quarkVm);
+                        exception = verification.verified ? vmExecuteProgramProfiledUnchecked(&quarkVm)
+                                                          : vmExecuteProgramProfiled(&quarkVm);
+                    } else if ((maxInstructions > 0 || timeoutMs > 0 || stats) && !debug && limit < 0)
+                    {
+                        // Runs in slices, checking the limits between them.
+                        quarkVm.verified = verification.verified;
+                        do
+                        {
+                            uint64_t budget = slice;
+                            if (maxInstructions > 0 && maxInstructions - quarkVm.instructionCount < budget)
+                                budget = maxInstructions - quarkVm.instructionCount;
+
+                            exception = vmRun(&quarkVm, budget);
+                            if (exception != EX_OK || quarkVm.halt) break;
+
+                            if ((maxInstructions > 0 && quarkVm.instructionCount >= maxInstructions) ||
+                                (timeoutMs > 0 && (vmSeconds() - start) * 1e3 >= (double) timeoutMs))
+                            {
+                                exception = EX_LIMIT_EXCEEDED;
+                                vmReportException(&quarkVm, exception);
+                            }
+                        } while (exception == EX_OK);
+
+                        if (stats)
+                            fprintf(stderr, "[\033[1;34mINFO\033[0m]: Executed %" PRIu64 " instructions and %" PRIu64
+                                            " native calls in %.3f s.\n", quarkVm.instructionCount,
+                                    quarkVm.nativeCount, vmSeconds() - start);
+                    } else if (jit && !debug && limit < 0)
+                    {
+                        if (VM_HAS_JIT && !verification.verified)
+                            fprintf(stderr, "[\033[1;34mINFO\033[0m]: The program could not be verified, so it runs "
+                                            "on the interpreter instead of the JIT.\n");
+                        exception = vmExecuteJit(&quarkVm, &verification);
+                    }
+                    else if (engine == ENGINE_THREADED && !debug && limit < 0)
+                        exception = verification.verified ? vmExecuteProgramUnchecked(&quarkVm)
+                                                          : vmExecuteProgramThreaded(&quarkVm);
+                    else if (engine == ENGINE_COMPACT && !debug && limit < 0)
+                        exception = verification.verified ? vmExecuteCompactUnchecked(&quarkVm)
+                                                          : vmExecuteCompact(&quarkVm);
+                    else exception = vmExecuteProgram(&quarkVm, limit, debug);
+                    const double seconds = vmSeconds() - start;
+
+                    if (quarkVm.profile != NULL)
+                    {
+                        fflush(quarkVm.output);
+                        vmProfileReport(stderr, &quarkVm, seconds, 20);
+                        if (profileJsonPath != NULL) vmProfileWriteJson(profileJsonPath, &quarkVm, seconds);
+                        vmProfileDestroy(&quarkVm);
+                    } else if (profile)
+                        fprintf(stderr, "[\033[1;34mINFO\033[0m]: Profiling needs the threaded engine, which this "
+                                        "compiler does not support, and is disabled under --debug and --step.\n");
+
+                    if (heapStats) vmHeapReport(stderr, &quarkVm.heap);
+                    if ((heapStats || heapDebug) && quarkVm.halt && quarkVm.heap.liveBlocks > 0)
+                        fprintf(stderr, "[\033[1;34mINFO\033[0m]: Leaked %" PRIu64 " bytes in %" PRIu64 " blocks.\n",
+                                quarkVm.heap.liveBytes, quarkVm.heap.liveBlocks);
+
+                    vmFreeVerification(&verification);
+                    vmDestroy(&quarkVm);
 
-                    return EXIT_SUCCESS;
+                    return exception == EX_OK ? EXIT_SUCCESS : EXIT_FAILURE;
                 }
 
                 return EXIT_SUCCESS;
@@ -1,50 +1,218 @@
-#include "include/compiler.h"
+#include "include/optimizer.h"
+#include "include/linker.h"
 
 QuarkVM quarkVm = {0};
 VMTable table = {0};
+int fuse = 0, compact = 0, optimize = 0, useCache = 1, object = 0, printCacheStats = 0;
+char *cacheDirectory = NULL, *outputFilePath = NULL;
+const char *inputFilePath = NULL;
 
 int main(int argc, char **argv)
 {
     if (argc > 1)
-        if (strcmp(argv[1], "--file") == 0 || strcmp(argv[1], "-f") == 0)
+        for (int i = 1; i < argc; ++i)
         {
-            const char *inputFilePath = argv[2];
-            if (inputFilePath == NULL)
+            if (strcmp(argv[i], "--fuse") == 0 || strcmp(argv[i], "-F") == 0) fuse = 1;
+            else if (strcmp(argv[i], "--compact") == 0 || strcmp(argv[i], "-c") == 0) compact = 1;
+            else if (strcmp(argv[i], "-O0") == 0) optimize = 0;
+            else if (strcmp(argv[i], "-O1") == 0 || strcmp(argv[i], "-O") == 0) optimize = 1;
+            else if (strcmp(argv[i], "-O2") == 0) optimize = 2;
+            else if (strcmp(argv[i], "--no-cache") == 0) useCache = 0;
+            else if (strcmp(argv[i], "--object") == 0 || strcmp(argv[i], "-r") == 0) object = 1;
+            else if (strcmp(argv[i], "--output") == 0 || strcmp(argv[i], "-o") == 0)
             {
-                fprintf(stderr, "[\033[1;31mERROR\033[0m]: Missing input file\n");
-                printf("[\033[1;34mINFO\033[0m]: Usage: %s [--file | -f] <input_file.qas>\n\n", argv[0]);
-                exit(EXIT_FAILURE);
+                if (argv[i + 1] == NULL)
+                {
+                    fprintf(stderr, "[\033[1;31mERROR\033[0m]: Missing output file\n");
+                    exit(EXIT_FAILURE);
+                }
+
+                outputFilePath = argv[++i];
             }
+            else if (strcmp(argv[i], "--cache-dir") == 0)
+            {
+                if (argv[i + 1] == NULL || argv[i + 1][0] == '\0')
+                {
+                    fprintf(stderr, "[\033[1;31mERROR\033[0m]: Missing cache directory\n");
+                    exit(EXIT_FAILURE);
+                }
 
-            char *outputFilePath = malloc(strlen(inputFilePath) + 5);
+                cacheDirectory = argv[++i];
+            } else if (strcmp(argv[i], "--cache-stats") == 0) printCacheStats = 1;
+            else if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0)
+            {
+                printf("[\033[1;34mINFO\033[0m]: Usage: %s [options] [--file | -f] <input_file.qas>\n\n", argv[0]);
+                printf("[\033[1;34mINFO\033[0m]: Required:\n");
+                printf("[\033[1;34mINFO\033[0m]:   --file <file> | -f <file>: The file to compile (\"-\" for stdin)\n");
+                printf("[\033[1;34mINFO\033[0m]: Optional:\n");
+                printf("[\033[1;34mINFO\033[0m]:   --output <file> | -o <file>: The output file (default: the input file with "
+                       "a .qce extension; required with -f -)\n");
+                printf("[\033[1;34mINFO\033[0m]:   --fuse        | -F: Fuse common instruction sequences into superinstructions\n");
+                printf("[\033[1;34mINFO\033[0m]:   --compact     | -c: Use the compact variable-length encoding\n");
+                printf("[\033[1;34mINFO\033[0m]:   -O1           | -O: Fold constants and remove no-ops\n");
+                printf("[\033[1;34mINFO\033[0m]:   -O2: Also thread jumps and remove unreachable code and labels\n");
+                printf("[\033[1;34mINFO\033[0m]:   --object      | -r: Write a relocatable object (.qco) for quarkl instead "
+                       "of a program\n");
+                printf("[\033[1;34mINFO\033[0m]:   --no-cache: Always assemble, without reading or filling the compile cache\n");
+                printf("[\033[1;34mINFO\033[0m]:   --cache-dir <dir>: The compile cache directory (default: $QUARK_CACHE_DIR, "
+                       "else ~/.cache/quark)\n");
+                printf("[\033[1;34mINFO\033[0m]:   --cache-stats: Print the cache's size and hit rate and exit\n");
+                printf("[\033[1;34mINFO\033[0m]:   --help        | -h: Print this help message and exit\n");
 
-            if (outputFilePath == NULL)
+                exit(EXIT_SUCCESS);
+            } else if (strcmp(argv[i], "--file") == 0 || strcmp(argv[i], "-f") == 0)
             {
-                fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not allocate memory for output file\n");
+                inputFilePath = argv[++i];
+                if (inputFilePath == NULL)
+                {
+                    fprintf(stderr, "[\033[1;31mERROR\033[0m]: Missing input file\n");
+                    printf("[\033[1;34mINFO\033[0m]: Usage: %s [options] [--file | -f] <input_file.qas>\n\n", argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+            } else
+            {
+                fprintf(stderr, "[\033[1;31mERROR\033[0m]: Unknown argument: %s\n", argv[i]);
+                printf("[\033[1;34mINFO\033[0m]: Usage: %s [options] [--file | -f] <input_file.qas>\n\n", argv[0]);
+
                 exit(EXIT_FAILURE);
             }
+        }
+    else
+    {
+        printf("[\033[1;34mINFO\033[0m]: Usage: %s [options] [--file | -f] <input_file.qas>\n\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
 
-            strcpy(outputFilePath, inputFilePath);
+    // Options are all read first, so they apply wherever they appear.
+    if (printCacheStats)
+    {
+        const char *directory = cacheDirectory != NULL ? cacheDirectory : vmCacheDefaultDirectory();
+        if (directory == NULL)
+        {
+            fprintf(stderr, "[\033[1;31mERROR\033[0m]: No cache directory (set QUARK_CACHE_DIR or HOME)\n");
+            exit(EXIT_FAILURE);
+        }
 
-            char *dot = strrchr(outputFilePath, '.');
-            if (dot != NULL) *dot = '\0';
+        const VMCacheStats cacheStats = vmCacheStats(directory);
+        const uint64_t lookups = cacheStats.hits + cacheStats.misses;
+        printf("[\033[1;34mINFO\033[0m]: Cache \"%s\": %" PRIu64 " entries (%" PRIu64 " bytes), %" PRIu64
+               " hits, %" PRIu64 " misses (%.1f%% hit rate).\n",
+               directory, cacheStats.entries, cacheStats.bytes, cacheStats.hits, cacheStats.misses,
+               lookups > 0 ? 100.0 * (double) cacheStats.hits / (double) lookups : 0.0);
 
-            strcat(outputFilePath, ".qce");
-            vmParseSource(sv_readFile(inputFilePath), &quarkVm, &table, inputFilePath);
-            vmSaveProgramToFile(&quarkVm, outputFilePath);
+        exit(EXIT_SUCCESS);
+    }
 
-            printf("[\033[1;34mINFO\033[0m]: Program compiled to \"%s\".\n", outputFilePath);
-            return EXIT_SUCCESS;
-        } else
-        {
-            fprintf(stderr, "[\033[1;31mERROR\033[0m]: Unknown argument: %s\n", argv[1]);
-            printf("[\033[1;34mINFO\033[0m]: Usage: %s [--file | -f] <input_file.qas>\n\n", argv[0]);
+    if (inputFilePath == NULL)
+    {
+        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Missing input file\n");
+        printf("[\033[1;34mINFO\033[0m]: Usage: %s [options] [--file | -f] <input_file.qas>\n\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    const int fromStdin = strcmp(inputFilePath, "-") == 0;
+    if (object && (fuse || compact || optimize > 0))
+    {
+        fprintf(stderr, "[\033[1;31mERROR\033[0m]: --object cannot be combined with -F, -c or -O (pass them to "
+                        "quarkl)\n");
+        exit(EXIT_FAILURE);
+    }
 
+    if (fromStdin && outputFilePath == NULL)
+    {
+        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Reading from stdin needs an output file (-o <file>)\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (outputFilePath == NULL)
+    {
+        outputFilePath = malloc(strlen(inputFilePath) + 5);
+
+        if (outputFilePath == NULL)
+        {
+            fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not allocate memory for output file\n");
             exit(EXIT_FAILURE);
         }
-    else
+
+        strcpy(outputFilePath, inputFilePath);
+
+        char *dot = strrchr(outputFilePath, '.');
+        if (dot != NULL) *dot = '\0';
+
+        strcat(outputFilePath, object ? ".qco" : ".qce");
+    }
+
+    // Input from stdin can only be read once, so it is never looked up in the cache. Objects are
+    // kept up to date by quarkl instead.
+    VMCache cache = {0};
+    char key[VM_CACHE_KEY_SIZE + 1];
+    int cached = 0;
+
+    if (useCache && !object && !fromStdin && vmCacheKey(inputFilePath, fuse, compact, optimize, key))
+    {
+        if (cacheDirectory == NULL) cacheDirectory = vmCacheDefaultDirectory();
+        cached = cacheDirectory != NULL && vmCacheOpen(&cache, cacheDirectory, key);
+    }
+
+    if (cached && vmCacheFetch(&cache, outputFilePath))
+    {
+        vmCacheCount(cache.directory, 1, 0);
+        printf("[\033[1;34mINFO\033[0m]: Program compiled to \"%s\" (cached).\n", outputFilePath);
+
+        vmCacheClose(&cache);
+        return EXIT_SUCCESS;
+    }
+
+    SVReader reader = sv_openReader(inputFilePath);
+    vmParseSource(&reader, &quarkVm, &table, fromStdin ? "<stdin>" : inputFilePath);
+    sv_closeReader(&reader);
+
+    if (object)
     {
-        printf("[\033[1;34mINFO\033[0m]: Usage: %s [--file | -f] <input_file.qas>\n\n", argv[0]);
+        vmSaveObjectToFile(&quarkVm, &table, outputFilePath);
+        printf("[\033[1;34mINFO\033[0m]: Object compiled to \"%s\".\n", outputFilePath);
+        return EXIT_SUCCESS;
+    }
+
+    const Function *imported = vmFirstExtern(&table);
+    if (imported != NULL)
+    {
+        fprintf(stderr, "[\033[1;31mERROR\033[0m]: (In file \"%s\"): Label \"%.*s\" is imported on line %d; "
+                        "link the program with quarkl.\n", fromStdin ? "<stdin>" : inputFilePath,
+                (int) imported->function.count, imported->function.data, imported->line);
         exit(EXIT_FAILURE);
     }
+
+    // Don't cache the program under the old key if the file changed while it was read.
+    if (cached && (!vmCacheKey(inputFilePath, fuse, compact, optimize, key) || strcmp(key, cache.key) != 0))
+    {
+        vmCacheClose(&cache);
+        cached = 0;
+    }
+
+    if (optimize > 0)
+    {
+        const VMOptimization result = vmOptimizeProgram(&quarkVm, &table, optimize);
+        printf("[\033[1;34mINFO\033[0m]: Optimized %" PRId64 " instructions to %" PRId64 " (%.1f%% fewer): %" PRId64
+               " folded, %" PRId64 " jumps threaded, %" PRId64 " unreachable, %" PRId64 " labels removed.\n",
+               result.before, result.after,
+               result.before > 0 ? 100.0 * (double) (result.before - result.after) / (double) result.before : 0.0,
+               result.folded, result.threaded, result.unreachable, result.labels);
+    }
+
+    if (fuse)
+    {
+        const int64_t fused = vmFuseInstructions(&quarkVm, &table);
+        printf("[\033[1;34mINFO\033[0m]: Fused %" PRId64 " instructions.\n", fused);
+    }
+
+    if (cached)
+    {
+        vmCacheStore(&cache, &quarkVm, &table, compact, outputFilePath);
+        vmCacheCount(cache.directory, 0, 1);
+        vmCacheClose(&cache);
+    } else vmCacheSaveProgram(&quarkVm, &table, compact, outputFilePath);
+
+    printf("[\033[1;34mINFO\033[0m]: Program compiled to \"%s\".\n", outputFilePath);
+    return EXIT_SUCCESS;
 }
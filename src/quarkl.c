@@ -0,0 +1,111 @@
+#include "include/optimizer.h"
+#include "include/linker.h"
+
+QuarkVM quarkVm = {0};
+VMTable table = {0};
+int fuse = 0, compact = 0, optimize = 0, force = 0;
+int64_t workers = 0;
+const char *outputFilePath = NULL;
+
+int main(int argc, char **argv)
+{
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'; ++i)
+    {
+        if (strcmp(argv[i], "--fuse") == 0 || strcmp(argv[i], "-F") == 0) fuse = 1;
+        else if (strcmp(argv[i], "--compact") == 0 || strcmp(argv[i], "-c") == 0) compact = 1;
+        else if (strcmp(argv[i], "-O0") == 0) optimize = 0;
+        else if (strcmp(argv[i], "-O1") == 0 || strcmp(argv[i], "-O") == 0) optimize = 1;
+        else if (strcmp(argv[i], "-O2") == 0) optimize = 2;
+        else if (strcmp(argv[i], "--force") == 0) force = 1;
+        else if (strcmp(argv[i], "--output") == 0 || strcmp(argv[i], "-o") == 0)
+        {
+            if ((outputFilePath = argv[++i]) == NULL)
+            {
+                fprintf(stderr, "[\033[1;31mERROR\033[0m]: Missing output file\n");
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "--workers") == 0 || strcmp(argv[i], "-w") == 0)
+        {
+            const char *count = argv[++i];
+            if (count == NULL || (workers = strtoll(count, NULL, 10)) <= 0)
+            {
+                fprintf(stderr, "[\033[1;31mERROR\033[0m]: Expected a positive number of workers.\n");
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0)
+        {
+            printf("[\033[1;34mINFO\033[0m]: Usage: %s [options] --output <output.qce> <file>...\n\n", argv[0]);
+            printf("[\033[1;34mINFO\033[0m]: Links .qas sources and .qco objects into one program, which starts at the "
+                   "first instruction of the first file.\n");
+            printf("[\033[1;34mINFO\033[0m]: Each source is assembled to the .qco next to it, unless that is newer.\n");
+            printf("[\033[1;34mINFO\033[0m]: Required:\n");
+            printf("[\033[1;34mINFO\033[0m]:   --output <file> | -o <file>: The program to write\n");
+            printf("[\033[1;34mINFO\033[0m]: Optional:\n");
+            printf("[\033[1;34mINFO\033[0m]:   --workers <n>   | -w <n>: Threads assembling sources (default: one per "
+                   "processor)\n");
+            printf("[\033[1;34mINFO\033[0m]:   --force: Assemble every source, even if its object is up to date\n");
+            printf("[\033[1;34mINFO\033[0m]:   --fuse          | -F: Fuse common instruction sequences into "
+                   "superinstructions\n");
+            printf("[\033[1;34mINFO\033[0m]:   --compact       | -c: Use the compact variable-length encoding\n");
+            printf("[\033[1;34mINFO\033[0m]:   -O1             | -O: Fold constants and remove no-ops\n");
+            printf("[\033[1;34mINFO\033[0m]:   -O2: Also thread jumps and remove unreachable code and labels\n");
+            printf("[\033[1;34mINFO\033[0m]:   --help          | -h: Print this help message and exit\n");
+
+            exit(EXIT_SUCCESS);
+        } else
+        {
+            fprintf(stderr, "[\033[1;31mERROR\033[0m]: Unknown argument: %s\n", argv[i]);
+            printf("[\033[1;34mINFO\033[0m]: Usage: %s [options] --output <output.qce> <file>...\n\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (outputFilePath == NULL || i == argc)
+    {
+        fprintf(stderr, "[\033[1;31mERROR\033[0m]: %s\n",
+                outputFilePath == NULL ? "Missing output file" : "Missing input files");
+        printf("[\033[1;34mINFO\033[0m]: Usage: %s [options] --output <output.qce> <file>...\n\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    const int64_t objectCount = argc - i;
+    VMObject *objects = calloc(objectCount, sizeof(objects[0]));
+    if (objects == NULL)
+    {
+        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not allocate memory for %" PRId64 " files\n", objectCount);
+        exit(EXIT_FAILURE);
+    }
+
+    for (int64_t j = 0; j < objectCount; ++j) objects[j].path = argv[i + j];
+
+    const int64_t assembled = vmLoadObjects(objects, objectCount, workers > 0 ? workers : vmProcessorCount(), force);
+    vmLinkObjects(objects, objectCount, &quarkVm, &table);
+
+    for (int64_t j = 0; j < objectCount; ++j) vmFreeObject(&objects[j]);
+    free(objects);
+
+    printf("[\033[1;34mINFO\033[0m]: Linked %" PRId64 " files (%" PRId64 " assembled, %" PRId64 " up to date) into %" PRId64
+           " instructions.\n", objectCount, assembled, objectCount - assembled, quarkVm.programSize);
+
+    if (optimize > 0)
+    {
+        const VMOptimization result = vmOptimizeProgram(&quarkVm, &table, optimize);
+        printf("[\033[1;34mINFO\033[0m]: Optimized %" PRId64 " instructions to %" PRId64 " (%.1f%% fewer): %" PRId64
+               " folded, %" PRId64 " jumps threaded, %" PRId64 " unreachable, %" PRId64 " labels removed.\n",
+               result.before, result.after,
+               result.before > 0 ? 100.0 * (double) (result.before - result.after) / (double) result.before : 0.0,
+               result.folded, result.threaded, result.unreachable, result.labels);
+    }
+
+    if (fuse)
+    {
+        const int64_t fused = vmFuseInstructions(&quarkVm, &table);
+        printf("[\033[1;34mINFO\033[0m]: Fused %" PRId64 " instructions.\n", fused);
+    }
+
+    vmCacheSaveProgram(&quarkVm, &table, compact, outputFilePath);
+    printf("[\033[1;34mINFO\033[0m]: Program linked to \"%s\".\n", outputFilePath);
+
+    return EXIT_SUCCESS;
+}
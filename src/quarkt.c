@@ -0,0 +1,123 @@
+#include "include/translator.h"
+
+QuarkVM quarkVm = {0};
+const char *outputFilePath = NULL;
+
+int main(int argc, char **argv)
+{
+    if (argc > 1)
+        for (int i = 1; i < argc; ++i)
+        {
+            if (strcmp(argv[i], "--output") == 0 || strcmp(argv[i], "-o") == 0)
+            {
+                outputFilePath = argv[++i];
+                if (outputFilePath == NULL)
+                {
+                    fprintf(stderr, "[\033[1;31mERROR\033[0m]: Missing output file\n");
+                    printf("[\033[1;34mINFO\033[0m]: Usage: %s [options] [--file | -f] <input_file.qce>\n\n", argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+            } else if (strcmp(argv[i], "--plugin") == 0 || strcmp(argv[i], "-p") == 0)
+            {
+                if (argv[++i] == NULL)
+                {
+                    fprintf(stderr, "[\033[1;31mERROR\033[0m]: Missing plugin file\n");
+                    exit(EXIT_FAILURE);
+                }
+
+                vmLoadPlugin(argv[i]);
+            } else if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0)
+            {
+                printf("[\033[1;34mINFO\033[0m]: Usage: %s [options] [--file | -f] <input_file.qce>\n\n", argv[0]);
+                printf("[\033[1;34mINFO\033[0m]: Required:\n");
+                printf("[\033[1;34mINFO\033[0m]:   --file <file>   | -f <file>: The file to translate to C\n");
+                printf("[\033[1;34mINFO\033[0m]: Optional:\n");
+                printf("[\033[1;34mINFO\033[0m]:   --output <file> | -o <file>: The C file to write (default: the input file "
+                       "with a .c extension)\n");
+                printf("[\033[1;34mINFO\033[0m]:   --plugin <so>   | -p <so>: Load the natives of a plugin, which the "
+                       "translated program loads from the same path (before --file, may be repeated)\n");
+                printf("[\033[1;34mINFO\033[0m]:   --help          | -h: Print this help message and exit\n");
+
+                exit(EXIT_SUCCESS);
+            } else if (strcmp(argv[i], "--file") == 0 || strcmp(argv[i], "-f") == 0)
+            {
+                const char *inputFilePath = argv[++i];
+                if (inputFilePath == NULL)
+                {
+                    fprintf(stderr, "[\033[1;31mERROR\033[0m]: Missing input file\n");
+                    printf("[\033[1;34mINFO\033[0m]: Usage: %s [options] [--file | -f] <input_file.qce>\n\n", argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+
+                char *defaultOutputFilePath = NULL;
+                if (outputFilePath == NULL)
+                {
+                    defaultOutputFilePath = malloc(strlen(inputFilePath) + 3);
+                    if (defaultOutputFilePath == NULL)
+                    {
+                        fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not allocate memory for output file\n");
+                        exit(EXIT_FAILURE);
+                    }
+
+                    strcpy(defaultOutputFilePath, inputFilePath);
+
+                    char *dot = strrchr(defaultOutputFilePath, '.');
+                    if (dot != NULL) *dot = '\0';
+
+                    strcat(defaultOutputFilePath, ".c");
+                    outputFilePath = defaultOutputFilePath;
+                }
+
+                vmLoadProgramFromFile(&quarkVm, inputFilePath);
+                vmPushNatives(&quarkVm);
+
+                if (vmUsesFibers(&quarkVm))
+                {
+                    fprintf(stderr, "[\033[1;31mERROR\033[0m]: \"%s\" uses fibers, which translated programs do not "
+                                    "support.\n", inputFilePath);
+                    exit(EXIT_FAILURE);
+                }
+
+                VMVerification verification = {0};
+                if (!vmVerifyProgram(&quarkVm, &verification)) return EXIT_FAILURE;
+
+                FILE *file = fopen(outputFilePath, "w");
+                if (file == NULL)
+                {
+                    fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not open file \"%s\": %s\n", outputFilePath,
+                            strerror(errno));
+                    exit(EXIT_FAILURE);
+                }
+
+                vmTranslateProgram(file, &quarkVm, &verification, inputFilePath);
+                if (fclose(file) != 0)
+                {
+                    fprintf(stderr, "[\033[1;31mERROR\033[0m]: Could not write file \"%s\": %s\n", outputFilePath,
+                            strerror(errno));
+                    exit(EXIT_FAILURE);
+                }
+
+                printf("[\033[1;34mINFO\033[0m]: Program translated to \"%s\"%s.\n", outputFilePath,
+                       verification.verified ? "" : " (unverified, with stack checks)");
+
+                vmFreeVerification(&verification);
+                vmDestroy(&quarkVm);
+                free(defaultOutputFilePath);
+
+                return EXIT_SUCCESS;
+            } else
+            {
+                fprintf(stderr, "[\033[1;31mERROR\033[0m]: Unknown argument: %s\n", argv[i]);
+                printf("[\033[1;34mINFO\033[0m]: Usage: %s [options] [--file | -f] <input_file.qce>\n\n", argv[0]);
+
+                exit(EXIT_FAILURE);
+            }
+        }
+    else
+    {
+        printf("[\033[1;34mINFO\033[0m]: Usage: %s [options] [--file | -f] <input_file.qce>\n\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    return EXIT_SUCCESS;
+}
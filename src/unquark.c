@@ -37,8 +37,16 @@ int main(int argc, char **argv)
             }
 
             vmLoadProgramFromFile(&vm, inputFilePath);
+
+            StringView label = {0};
+            int64_t cursor = 0, labelAddress = -1;
+            int hasLabel = vmNextSymbol(&vm, &cursor, &label, &labelAddress);
+
             for (int64_t j = 0; j < vm.programSize; ++j)
             {
+                for (; hasLabel && labelAddress <= j; hasLabel = vmNextSymbol(&vm, &cursor, &label, &labelAddress))
+                    if (labelAddress == j) printf("%.*s:\n", (int) label.count, label.data);
+
                 !isRaw ? instructionWithOperand(vm.program[j].type)
                          ? printf("Op \033[1;34m%" PRId64 "\033[0m: %s (I64: %" PRId64 ", F64: %lf, PTR: %p)\n", j,
                                   getInstructionName(vm.program[j].type), vm.program[j].value.asI64,
@@ -49,6 +57,8 @@ int main(int argc, char **argv)
                                   vm.program[j].value.asI64, vm.program[j].value.asF64, vm.program[j].value.asPtr)
                          : printf("%s\n", getInstructionName(vm.program[j].type));
             }
+
+            vmDestroy(&vm);
         } else
         {
             fprintf(stderr, "[\033[1;31mERROR\033[0m]: Unknown option \"%s\"\n", argv[i]);
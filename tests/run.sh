@@ -0,0 +1,103 @@
+#!/usr/bin/env bash
+#
+# Regression tests. Each case assembles programs from tests/ into bin/tests, runs them and compares what they
+# print (stdout and stderr, with the colour codes removed) against the expected text.
+
+output=bin/tests
+failed=0
+
+mkdir -p "$output"
+
+# Keep the compile cache of the tests out of the user's.
+export QUARK_CACHE_DIR=$output/cache
+
+# Assembles tests/$1.qas into bin/tests/$1.qce; the other arguments are passed to quarki.
+assemble() {
+  local name=$1
+  shift
+  ./bin/quarki --no-cache "$@" -o "$output/$name.qce" -f "tests/$name.qas" >/dev/null || {
+    echo -e "\033[1;31mFAILED\033[0m $name (assembling)"
+    failed=1
+  }
+}
+
+# Runs "${@:3}" and checks that it prints $2. $1 names the case.
+expect() {
+  local name=$1 expected=$2 actual
+  shift 2
+  actual=$("$@" 2>&1 | sed 's/\x1b\[[0-9;]*m//g')
+
+  if [[ $actual == "$expected" ]]; then
+    echo -e "\033[1;32mOK\033[0m $name"
+  else
+    echo -e "\033[1;31mFAILED\033[0m $name"
+    diff <(echo "$expected") <(echo "$actual")
+    failed=1
+  fi
+}
+
+# A function that pops its return address must not pass the verifier and run without stack checks.
+assemble return-underflow
+expect return-underflow "[ERROR]: Error at Op 3 (iplus): Stack underflow" \
+  ./bin/quarkc -f $output/return-underflow.qce
+
+# A computed return address keeps a program off the JIT, which only knows the invoke return sites.
+assemble return-computed
+expect return-computed "2" ./bin/quarkc -f $output/return-computed.qce
+jitSkipped="[INFO]: The program could not be verified, so it runs on the interpreter instead of the JIT."$'\n'
+./bin/quarkc --help | grep -q "native code (not supported" && jitSkipped=""
+expect return-computed-jit "${jitSkipped}2" ./bin/quarkc --jit -f $output/return-computed.qce
+
+# Swapping the return address away and back keeps the function verified, so it runs on the JIT.
+assemble return-swap
+expect return-swap-jit "9" ./bin/quarkc --jit -f $output/return-swap.qce
+
+# Translates bin/tests/$1.qce to C and builds it as bin/tests/$1.
+translate() {
+  ./bin/quarkt -o "$output/$1.c" -f "$output/$1.qce" >/dev/null &&
+    ${CC:-cc} -O2 -Isrc/include -o "$output/$1" "$output/$1.c" -lm -pthread -ldl || {
+    echo -e "\033[1;31mFAILED\033[0m $1 (translating)"
+    failed=1
+  }
+}
+
+# --jit with a flag the JIT cannot honour says that it runs on the interpreter instead.
+jitIgnored="[INFO]: The JIT does not support --max-instructions or --timeout-ms, so the program runs on the interpreter."$'\n'
+[[ -z $jitSkipped ]] && jitIgnored=""
+expect jit-ignored "${jitIgnored}9" ./bin/quarkc --jit --max-instructions 1000 -f $output/return-swap.qce
+
+# quarkt keeps the same return sites as the JIT, so translated programs have to agree with quarkc as well.
+translate return-computed
+expect return-computed-aot "2" ./$output/return-computed
+translate return-swap
+expect return-swap-aot "9" ./$output/return-swap
+
+# Runs quarkc --batch with "$@", without the timing line at the end.
+batch() {
+  ./bin/quarkc "$@" | sed '$d'
+}
+
+# Files with the same code but different natives must not share an image in a batch.
+${CC:-cc} -O2 -shared -fPIC -Isrc/include -o $output/square.so examples/plugin/square.c -lm
+assemble batch-square
+assemble batch-hypot
+expect batch-natives "[INFO]: \"$output/batch-square.qce\": All OK
+16
+[INFO]: \"$output/batch-hypot.qce\": All OK
+5" batch --plugin ./$output/square.so --batch $output/batch-square.qce $output/batch-hypot.qce
+
+# Vector instructions may write to an input, but a partial overlap fails the same way on every SIMD level.
+assemble vector-overlap
+for level in scalar sse2 avx2; do
+  for flags in "" --jit; do
+    expect "vector-overlap $level${flags:+ $flags}" "[ERROR]: Error at Op 22 (vfplus): Illegal operation
+2.000000" ./bin/quarkc --simd $level $flags -f $output/vector-overlap.qce
+  done
+done
+
+# Options after -f still apply: -o names the output of a program read from stdin.
+rm -f $output/stdin.qce
+expect options-after-file "2" bash -c \
+  "./bin/quarki -f - -o $output/stdin.qce <tests/return-computed.qas >/dev/null && ./bin/quarkc -f $output/stdin.qce"
+
+exit $failed